@@ -13,16 +13,18 @@ function requestImage() {
 function transform() {
     let img_file = document.getElementById("input_file").files[0].name;
     let transform = document.getElementById("transform_select");
-    let spinbox = document.getElementById("spinbox");
-    let arg = 0;
-    if (spinbox) {
-        arg = document.getElementById("spinbox").value;
-        arg = parseFloat(arg);
+    let args = [];
+    for (let spinbox of document.querySelectorAll("#args input")) {
+        let arg = parseFloat(spinbox.value);
         if (transform.value == "rotate") {
             arg = arg * Math.PI / 180;
         }
+        args.push(arg);
     }
-    fetch("/" + img_file + "/transform/" + transform.value + "/" + arg)
+    if (args.length == 0) {
+        args.push(0);
+    }
+    fetch("/" + img_file + "/transform/" + transform.value + "/" + args.join("/"))
     .then(response => response.blob())
     .then(blob => {
         const imgUrl = URL.createObjectURL(blob);
@@ -43,14 +45,75 @@ document.getElementById("transform_select").addEventListener("change", function(
         input.value = 1;
         input.style.marginLeft = "10px";
         container.appendChild(input);
+    } else if (this.value == "resize") {
+        // width, then height (0 keeps the aspect ratio)
+        let input = document.createElement("input");
+        input.type = "number";
+        input.id = "spinbox";
+        input.min = 1;
+        input.max = 8192;
+        input.step = 1;
+        input.value = 256;
+        input.style.marginLeft = "10px";
+        container.appendChild(input);
+        let input2 = document.createElement("input");
+        input2.type = "number";
+        input2.id = "spinbox2";
+        input2.min = 0;
+        input2.max = 8192;
+        input2.step = 1;
+        input2.value = 0;
+        input2.style.marginLeft = "10px";
+        container.appendChild(input2);
     } else if (this.value == "blur") {
+        let input = document.createElement("input");
+        input.type = "number";
+        input.id = "spinbox";
+        input.min = 0.5;
+        input.max = 100;
+        input.step = 0.5;
+        input.value = 1;
+        input.style.marginLeft = "10px";
+        container.appendChild(input);
+    } else if (this.value == "canny") {
         let input = document.createElement("input");
         input.type = "number";
         input.id = "spinbox";
         input.min = 0;
         input.max = 10;
+        input.step = 0.1;
+        input.value = 1.4;
+        input.style.marginLeft = "10px";
+        container.appendChild(input);
+    } else if (["median", "erode", "dilate", "open", "close", "tophat", "blackhat", "morph_gradient"].includes(this.value)) {
+        let input = document.createElement("input");
+        input.type = "number";
+        input.id = "spinbox";
+        input.min = 1;
+        input.max = 15;
+        input.step = 1;
         input.value = 1;
         input.style.marginLeft = "10px";
         container.appendChild(input);
+    } else if (this.value == "bilateral") {
+        // sigma in space (pixels), then in range (fraction of the maxval)
+        let input = document.createElement("input");
+        input.type = "number";
+        input.id = "spinbox";
+        input.min = 1;
+        input.max = 50;
+        input.step = 0.5;
+        input.value = 8;
+        input.style.marginLeft = "10px";
+        container.appendChild(input);
+        let input2 = document.createElement("input");
+        input2.type = "number";
+        input2.id = "spinbox2";
+        input2.min = 0.01;
+        input2.max = 1;
+        input2.step = 0.01;
+        input2.value = 0.1;
+        input2.style.marginLeft = "10px";
+        container.appendChild(input2);
     }
 })
\ No newline at end of file
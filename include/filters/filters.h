@@ -3,25 +3,219 @@
 
 typedef struct Matrix Matrix;
 typedef struct Image Image;
+typedef struct ImageView ImageView;
 
-/// @brief Convolves an image with a kernel
+// values read outside the image by a filter
+typedef enum {
+    BORDER_ZERO,    // zeros (...00|abc|00...)
+    BORDER_CLAMP,   // nearest edge sample (...aa|abc|cc...)
+    BORDER_REFLECT, // mirror about the edge samples (...cb|abc|ba...)
+    BORDER_WRAP     // periodic image (...bc|abc|ab...)
+} BORDER_MODE;
+
+/// @brief Convolves an image with a kernel, directly, in two 1D passes when the kernel has rank 1,
+/// or through the Fourier domain for large kernels (whichever costs least)
 /// @param dest Filtered image (uninitialized)
 /// @param src Source image
 /// @param kernel Matrix filter
 /// @return bool if filtering ok
 extern bool filter(Image *dest, Image *src, Matrix *kernel);
 
-/// @brief Applie a gaussian filter to an image
+/// @brief Convolves a view with a kernel
+/// @note Only the pixels of the view are read, so filtering a region costs the region only
+/// @param dest Filtered image (uninitialized)
+/// @param src Source view
+/// @param kernel Matrix filter
+/// @return bool if filtering ok
+extern bool filter_view(Image *dest, const ImageView *src, Matrix *kernel);
+
+/// @brief Convolves an image with a kernel, reading outside the image according to a border mode
+/// @note filter() is filter_border() with BORDER_ZERO
+/// @param dest Filtered image (uninitialized)
+/// @param src Source image
+/// @param kernel Matrix filter
+/// @param border Border mode
+/// @return true if filtering ok
+extern bool filter_border(Image *dest, Image *src, Matrix *kernel, BORDER_MODE border);
+
+/// @brief Convolves a view with a kernel, reading outside the view according to a border mode
+/// @param dest Filtered image (uninitialized)
+/// @param src Source view
+/// @param kernel Matrix filter
+/// @param border Border mode
+/// @return true if filtering ok
+extern bool filter_border_view(Image *dest, const ImageView *src, Matrix *kernel, BORDER_MODE border);
+
+/// @brief Convolves an image with a kernel through the Fourier domain
+/// @note Same result as filter(), for a cost independent of the kernel size. filter() and
+/// filter_view() switch to it by themselves when it costs less than direct convolution.
+/// The spectra of the last kernels are cached for later images of the same size.
+/// @param dest Filtered image (uninitialized)
+/// @param src Source image
+/// @param kernel Matrix filter
+/// @return true if filtering ok
+extern bool fft_filter(Image *dest, Image *src, Matrix *kernel);
+
+/// @brief Convolves a view with a kernel through the Fourier domain
+/// @param dest Filtered image (uninitialized)
+/// @param src Source view
+/// @param kernel Matrix filter
+/// @return true if filtering ok
+extern bool fft_filter_view(Image *dest, const ImageView *src, Matrix *kernel);
+
+/// @brief Convolves the rows of a band from a window of source rows (out-of-core processing)
+/// @note The window must hold the kernel->height / 2 rows around the band (fewer at the
+/// image borders), rows outside the window being treated as outside the image
+/// @param dest Filtered band (allocated): its height is the number of rows to compute
+/// @param window Source rows
+/// @param kernel Matrix filter
+/// @param offset Row of the window matching the first row of dest
+/// @return true if filtering ok
+extern bool filter_band(Image *dest, const ImageView *window, Matrix *kernel, int offset);
+
+/// @brief Convolves an image with a separable kernel, the product of a column and a row kernel
+/// @note Same result as filter() with the kernel col_kernel x row_kernel, for
+/// width + height operations per sample instead of width * height
+/// @param dest Filtered image (uninitialized)
+/// @param src Source image
+/// @param row_kernel Horizontal kernel (1 x width)
+/// @param col_kernel Vertical kernel (height x 1)
+/// @return true if filtering ok
+extern bool separable_filter(Image *dest, Image *src, Matrix *row_kernel, Matrix *col_kernel);
+
+/// @brief Convolves a view with a separable kernel, the product of a column and a row kernel
+/// @param dest Filtered image (uninitialized)
+/// @param src Source view
+/// @param row_kernel Horizontal kernel (1 x width)
+/// @param col_kernel Vertical kernel (height x 1)
+/// @return true if filtering ok
+extern bool separable_filter_view(Image *dest, const ImageView *src, Matrix *row_kernel, Matrix *col_kernel);
+
+/// @brief Factors a kernel of rank 1 into a column kernel and a row kernel
+/// @note filter(), filter_view() and filter_band() factor their kernel automatically
+/// @param kernel Matrix filter
+/// @param row_kernel Horizontal factor (1 x width), allocated if the kernel has rank 1
+/// @param col_kernel Vertical factor (height x 1), allocated if the kernel has rank 1
+/// @return true if the kernel has rank 1, i.e. kernel = col_kernel x row_kernel
+extern bool factor_kernel(Matrix *kernel, Matrix *row_kernel, Matrix *col_kernel);
+
+/// @brief Creates a square gaussian kernel
+/// @param kernel_size Size of the kernel
+/// @param sigma Standard deviation of the gaussian function
+/// @return Gaussian kernel
+extern Matrix create_gaussian_kernel(unsigned int kernel_size, double sigma);
+
+/// @brief Implementations of the gaussian filter
+typedef enum {
+    GAUSSIAN_AUTO,  // recursive for large sigmas whose whole gaussian fits the kernel, convolution otherwise
+    GAUSSIAN_FIR,   // separable convolution with the truncated kernel
+    GAUSSIAN_IIR,   // recursive filter (Young - van Vliet), of constant cost whatever sigma (at least 0.5)
+    GAUSSIAN_PYRAMID // filter of a reduced pyramid level expanded back (pyramid_gaussian_filter_view), for large sigmas
+} GAUSSIAN_MODE;
+
+/// @brief Applies a gaussian filter to an image
+/// @note The recursive filter stands for the whole gaussian, with zero borders as the convolution:
+/// its fitting error leaves differences up to a few percent of the range at sharp edges
 /// @param dest Filtered image
 /// @param src Source image
-/// @param kernel_size Size of the gaussian kernel
+/// @param kernel_size Size of the gaussian kernel, 0 for 2 * ceil(3 * sigma) + 1
+/// @param sigma Standard deviation of the gaussian function
+/// @param mode Implementation
+/// @return true if filtering ok
+extern bool gaussian_filter(Image *dest, Image *src, unsigned int kernel_size, double sigma, GAUSSIAN_MODE mode);
+
+/// @brief Applies a gaussian filter to a view
+/// @param dest Filtered image
+/// @param src Source view
+/// @param kernel_size Size of the gaussian kernel, 0 for 2 * ceil(3 * sigma) + 1
 /// @param sigma Standard deviation of the gaussian function
+/// @param mode Implementation
+/// @return true if filtering ok
+extern bool gaussian_filter_view(Image *dest, const ImageView *src, unsigned int kernel_size, double sigma,
+                                 GAUSSIAN_MODE mode);
+
+/// @brief Computes the Sobel gradient of a view in a single pass
+/// @note Each 3x3 neighbourhood is read once for every output. Derivatives use the kernels of
+/// filter() (weights divided by 8, zero borders), the angle is atan2(y, x) in [-pi, pi].
+/// Results are DEPTH_F32 images of the size and layout of the source.
+/// @param grad_mag Magnitude of the gradient (uninitialized), or NULL
+/// @param grad_angle Angle of the gradient (uninitialized), or NULL
+/// @param grad_x Horizontal derivative (uninitialized), or NULL
+/// @param grad_y Vertical derivative (uninitialized), or NULL
+/// @param src Source view
 /// @return true if filtering ok
-extern bool gaussian_filter(Image *dest, Image *src, unsigned int kernel_size, double sigma);
+extern bool sobel_gradient(Image *grad_mag, Image *grad_angle, Image *grad_x, Image *grad_y, const ImageView *src);
 
 /// @brief Filters an image with the Sobel filters and returns magnitude and angle gradient images
 /// @param grad_mag Magnitude of the resulting gradient
-/// @param grad_angle Angle of the resulting gradient
+/// @param grad_angle Angle of the resulting gradient, atan2(y, x)
 /// @param src Original image
 /// @return true if filtering ok
-extern bool sobel_filter(Image *grad_mag, Image *grad_angle, Image *src);
\ No newline at end of file
+extern bool sobel_filter(Image *grad_mag, Image *grad_angle, Image *src);
+
+/// @brief Filters a view with the Sobel filters and returns magnitude and angle gradient images
+/// @param grad_mag Magnitude of the resulting gradient
+/// @param grad_angle Angle of the resulting gradient, atan2(y, x)
+/// @param src Original view
+/// @return true if filtering ok
+extern bool sobel_filter_view(Image *grad_mag, Image *grad_angle, const ImageView *src);
+
+/// @brief Computes the Sobel gradient of the rows of a band from a window of source rows
+/// @note The window must hold the row above and the row below the band (when they exist)
+/// @param grad_mag Magnitude of the gradient (allocated band)
+/// @param grad_angle Angle of the gradient (allocated band of the same size), or NULL
+/// @param window Source rows
+/// @param offset Row of the window matching the first row of the band
+/// @return true if filtering ok
+extern bool sobel_band(Image *grad_mag, Image *grad_angle, const ImageView *window, int offset);
+
+/// @brief Detects the edges of an image with the Canny detector
+/// @note Gaussian smoothing, Sobel gradient fused with non-maximum suppression, then hysteresis
+/// by union-find, each stage running over strips of rows in parallel. Borders repeat the edge
+/// samples. Multichannel images keep, at each pixel, the channel of strongest gradient.
+/// Thresholds apply to the gradient magnitude of sobel_gradient(), a step of the whole
+/// range giving 0.5.
+/// @param dest Edges, GRAY DEPTH_U8 image of 0 and 255 (uninitialized)
+/// @param src Source image
+/// @param sigma Standard deviation of the smoothing gaussian, 0 for no smoothing
+/// @param low Magnitude above which local maxima connected to strong ones are edges
+/// @param high Magnitude above which local maxima are edges
+/// @return true if detection ok
+extern bool canny_filter(Image *dest, Image *src, double sigma, double low, double high);
+
+/// @brief Detects the edges of a view with the Canny detector
+/// @param dest Edges, GRAY DEPTH_U8 image of 0 and 255 (uninitialized)
+/// @param src Source view
+/// @param sigma Standard deviation of the smoothing gaussian, 0 for no smoothing
+/// @param low Magnitude above which local maxima connected to strong ones are edges
+/// @param high Magnitude above which local maxima are edges
+/// @return true if detection ok
+extern bool canny_filter_view(Image *dest, const ImageView *src, double sigma, double low, double high);
+
+/// @brief Applies an edge-preserving bilateral filter to an image, through a bilateral grid
+/// @note Pixels are splatted into a grid sampling space and range (the mean of the channels)
+/// at a fraction of the sigmas, the grid is blurred by gaussians, then sliced by trilinear
+/// interpolation: the cost barely depends on sigma_space. Windows are clipped to the image.
+/// @param dest Filtered image (uninitialized)
+/// @param src Source image
+/// @param sigma_space Standard deviation of the spatial gaussian, in pixels
+/// @param sigma_range Standard deviation of the range gaussian, on normalized samples
+/// @return true if filtering ok
+extern bool bilateral_filter(Image *dest, Image *src, double sigma_space, double sigma_range);
+
+/// @brief Applies an edge-preserving bilateral filter to a view, through a bilateral grid
+/// @param dest Filtered image (uninitialized)
+/// @param src Source view
+/// @param sigma_space Standard deviation of the spatial gaussian, in pixels
+/// @param sigma_range Standard deviation of the range gaussian, on normalized samples
+/// @return true if filtering ok
+extern bool bilateral_filter_view(Image *dest, const ImageView *src, double sigma_space, double sigma_range);
+
+/// @brief Applies the bilateral filter by direct summation over the 3 sigma window, as a reference
+/// @note Cost grows with sigma_space^2: meant for checking bilateral_filter
+/// @param dest Filtered image (uninitialized)
+/// @param src Source image
+/// @param sigma_space Standard deviation of the spatial gaussian, in pixels
+/// @param sigma_range Standard deviation of the range gaussian, on normalized samples
+/// @return true if filtering ok
+extern bool bilateral_filter_reference(Image *dest, Image *src, double sigma_space, double sigma_range);
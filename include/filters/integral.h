@@ -0,0 +1,87 @@
+#pragma once
+#include <stdbool.h>
+#include "image/image.h"
+
+/// @brief Summed-area table of an image, giving the sum of any rectangle in constant time
+/// @note Entry (y, x) holds the sum of the samples above and left of pixel (x, y),
+/// so the first row and column are zeros: tables are (height + 1) x (width + 1) x channels,
+/// channels interleaved. Samples are normalized, as returned by read_image_row.
+typedef struct IntegralImage {
+    IMAGE_TYPE type;
+    unsigned int width;
+    unsigned int height;
+    unsigned int channels;
+    double *sum;        // sums of the samples
+    double *sum_sq;     // sums of the squared samples, NULL if not computed
+} IntegralImage;
+
+// local statistics over a square window
+typedef enum {
+    LOCAL_MEAN,
+    LOCAL_VARIANCE,
+    LOCAL_STD
+} LOCAL_STAT;
+
+/// @brief Computes the summed-area table of an image
+/// @param integral Summed-area table (uninitialized)
+/// @param src Source image, of any depth and layout
+/// @param squares true to also sum the squared samples (needed by the variance)
+/// @return true if computation ok
+extern bool integral_image(IntegralImage *integral, Image *src, bool squares);
+
+/// @brief Frees a summed-area table
+/// @param integral Summed-area table
+extern void free_integral_image(IntegralImage *integral);
+
+/// @brief Sums the samples of a rectangle, for each channel
+/// @param integral Summed-area table
+/// @param x0 First column
+/// @param y0 First row
+/// @param x1 Column past the last one (at most width)
+/// @param y1 Row past the last one (at most height)
+/// @param sums Sums of the channels
+extern void integral_sum(const IntegralImage *integral, unsigned int x0, unsigned int y0,
+                         unsigned int x1, unsigned int y1, double *sums);
+
+/// @brief Computes a statistic over the (2 * radius + 1)^2 window around each pixel
+/// @note Windows are clipped to the image, the statistic covering the pixels inside only.
+/// A table is computed once for any number of radii.
+/// @param dest Result (uninitialized), interleaved
+/// @param integral Summed-area table (with squares for the variance and the standard deviation)
+/// @param radius Radius of the window
+/// @param stat Statistic
+/// @param depth Depth of the result
+/// @return true if computation ok
+extern bool local_statistic(Image *dest, const IntegralImage *integral, unsigned int radius,
+                            LOCAL_STAT stat, PIXEL_DEPTH depth);
+
+/// @brief Averages the (2 * radius + 1)^2 window around each pixel, in constant time per pixel
+/// @param dest Filtered image (uninitialized), of the depth of the source
+/// @param src Source image
+/// @param radius Radius of the window
+/// @return true if filtering ok
+extern bool box_filter(Image *dest, Image *src, unsigned int radius);
+
+/// @brief Computes the variance of the (2 * radius + 1)^2 window around each pixel
+/// @param dest Local variance (uninitialized), DEPTH_F32
+/// @param src Source image
+/// @param radius Radius of the window
+/// @return true if computation ok
+extern bool local_variance(Image *dest, Image *src, unsigned int radius);
+
+/// @brief Computes the standard deviation of the (2 * radius + 1)^2 window around each pixel
+/// @param dest Local standard deviation (uninitialized), DEPTH_F32
+/// @param src Source image
+/// @param radius Radius of the window
+/// @return true if computation ok
+extern bool local_std(Image *dest, Image *src, unsigned int radius);
+
+/// @brief Approximates a gaussian filter by successive box filters, in constant time per pixel
+/// @note Box widths are chosen for the variance of the passes to add up to sigma^2.
+/// Unlike gaussian_filter, windows are clipped at the borders instead of reading zeros.
+/// @param dest Filtered image (uninitialized), of the depth of the source
+/// @param src Source image
+/// @param sigma Standard deviation of the gaussian function
+/// @param passes Number of box filters (3 stays within a few percent of the gaussian from sigma 3)
+/// @return true if filtering ok
+extern bool box_blur(Image *dest, Image *src, double sigma, unsigned int passes);
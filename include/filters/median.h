@@ -0,0 +1,21 @@
+#pragma once
+#include <stdbool.h>
+#include "image/image.h"
+
+/// @brief Replaces each sample by the median of the (2 * radius + 1)^2 window around it
+/// @note Channels are filtered independently, borders repeat the edge samples. Radii 1 and 2
+/// go through sorting networks; larger ones through sliding histograms (Perreau), whose cost
+/// per pixel does not depend on the radius. Strips of rows are filtered in parallel.
+/// DEPTH_U8 sources keep their samples and maxval; other depths are quantized to 8 bits.
+/// @param dest Filtered image (uninitialized), DEPTH_U8 of the layout of the source
+/// @param src Source image
+/// @param radius Radius of the window (at most 127)
+/// @return true if filtering ok
+extern bool median_filter(Image *dest, Image *src, unsigned int radius);
+
+/// @brief Replaces each sample of a view by the median of the (2 * radius + 1)^2 window around it
+/// @param dest Filtered image (uninitialized), DEPTH_U8 of the layout of the source
+/// @param src Source view
+/// @param radius Radius of the window (at most 127)
+/// @return true if filtering ok
+extern bool median_filter_view(Image *dest, const ImageView *src, unsigned int radius);
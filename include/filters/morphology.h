@@ -0,0 +1,37 @@
+#pragma once
+#include <stdbool.h>
+#include "image/image.h"
+
+/// @brief Morphological operations with a rectangular structuring element
+typedef enum {
+    MORPH_ERODE,    // minimum over the element
+    MORPH_DILATE,   // maximum over the element
+    MORPH_OPEN,     // erosion then dilation: removes bright details smaller than the element
+    MORPH_CLOSE,    // dilation then erosion: removes dark details smaller than the element
+    MORPH_TOPHAT,   // source minus its opening: the bright details only
+    MORPH_BLACKHAT, // closing minus the source: the dark details only
+    MORPH_GRADIENT  // dilation minus erosion: the outlines
+} MORPH_OP;
+
+/// @brief Applies a morphological operation with a (2 * radius_x + 1) x (2 * radius_y + 1) rectangle
+/// @note The rectangle is decomposed into a row then a column pass, each running the
+/// van Herk / Gil-Werman algorithm: 3 comparisons per sample whatever the radius.
+/// Channels are filtered independently and the element is clipped to the image.
+/// Sources whose samples are all 0 or maxval (masks) are filtered as packed bits, 64 samples per operation.
+/// @param dest Filtered image (uninitialized), of the depth and layout of the source
+/// @param src Source image
+/// @param op Operation
+/// @param radius_x Horizontal radius of the rectangle
+/// @param radius_y Vertical radius of the rectangle
+/// @return true if filtering ok
+extern bool morphology_filter(Image *dest, Image *src, MORPH_OP op, unsigned int radius_x, unsigned int radius_y);
+
+/// @brief Applies a morphological operation with a (2 * radius_x + 1) x (2 * radius_y + 1) rectangle to a view
+/// @param dest Filtered image (uninitialized), of the depth and layout of the source
+/// @param src Source view
+/// @param op Operation
+/// @param radius_x Horizontal radius of the rectangle
+/// @param radius_y Vertical radius of the rectangle
+/// @return true if filtering ok
+extern bool morphology_filter_view(Image *dest, const ImageView *src, MORPH_OP op,
+                                   unsigned int radius_x, unsigned int radius_y);
@@ -0,0 +1,101 @@
+#pragma once
+#include <stdbool.h>
+#include "image/image.h"
+#include "transform/geometry.h"
+
+/// @brief Images of decreasing sizes, each level halving the previous one
+/// @note Level i + 1 is (width + 1) / 2 x (height + 1) / 2 and its pixel (x, y) lies on
+/// pixel (2x, 2y) of level i. Gaussian levels keep the depth of the source; Laplacian
+/// levels are DEPTH_F32 differences, the last one holding the smallest gaussian level.
+typedef struct Pyramid {
+    unsigned int levels;
+    Image *images;
+} Pyramid;
+
+/// @brief Blurs a view with the 5-tap binomial kernel [1 4 6 4 1] / 16 and keeps every other pixel
+/// @note Both passes are fused: only the kept pixels are filtered, and each task keeps the
+/// five source rows it reads. Borders repeat the edge pixels.
+/// @param dest Reduced image (uninitialized), of the depth of the source
+/// @param src Source view
+/// @return true if reduction ok
+extern bool pyramid_down(Image *dest, const ImageView *src);
+
+/// @brief Doubles the size of a view, interpolating with the kernel of pyramid_down
+/// @param dest Expanded image (uninitialized), of the depth of the source
+/// @param src Source view
+/// @param width Width of the expanded image (2 * width or 2 * width - 1 of the source)
+/// @param height Height of the expanded image (2 * height or 2 * height - 1 of the source)
+/// @return true if expansion ok
+extern bool pyramid_up(Image *dest, const ImageView *src, int width, int height);
+
+/// @brief Builds the gaussian pyramid of a view
+/// @param pyramid Pyramid (uninitialized), its first level being a copy of the source
+/// @param src Source view
+/// @param levels Number of levels, 0 to go down to a single pixel
+/// @return true if building ok
+extern bool gaussian_pyramid(Pyramid *pyramid, const ImageView *src, unsigned int levels);
+
+/// @brief Adds the missing levels of a gaussian pyramid
+/// @param pyramid Gaussian pyramid
+/// @param levels Number of levels wanted, 0 to go down to a single pixel
+/// @return true if building ok
+extern bool extend_pyramid(Pyramid *pyramid, unsigned int levels);
+
+/// @brief Builds the Laplacian pyramid of a gaussian pyramid: each level minus the expansion of the next one
+/// @param laplacian Laplacian pyramid (uninitialized)
+/// @param gaussian Gaussian pyramid
+/// @return true if building ok
+extern bool laplacian_pyramid(Pyramid *laplacian, const Pyramid *gaussian);
+
+/// @brief Rebuilds an image from its Laplacian pyramid, expanding each level onto the previous one
+/// @param dest Rebuilt image (uninitialized)
+/// @param laplacian Laplacian pyramid
+/// @param depth Depth of the rebuilt image (of the default maxval)
+/// @return true if rebuilding ok
+extern bool collapse_pyramid(Image *dest, const Pyramid *laplacian, PIXEL_DEPTH depth);
+
+/// @brief Blends two images through their Laplacian pyramids, weighting each level by the gaussian pyramid of a mask
+/// @note Details of every scale cross the seam over their own width, hiding it
+/// @param dest Blended image (uninitialized), of the depth of the first image
+/// @param a First image
+/// @param b Second image, of the size and channels of the first one
+/// @param mask Weights of the first image, of its size and of 1 channel or as many as it has
+/// @param levels Number of levels, 0 to go down to a single pixel
+/// @return true if blending ok
+extern bool pyramid_blend(Image *dest, Image *a, Image *b, Image *mask, unsigned int levels);
+
+/// @brief Frees the levels of a pyramid
+/// @param pyramid Pyramid
+extern void free_pyramid(Pyramid *pyramid);
+
+/// @brief Resizes the first level of a gaussian pyramid, starting from the smallest level at least as large
+/// @note The pyramid must hold the levels down to the target size
+/// @param dest Resized image (uninitialized)
+/// @param pyramid Gaussian pyramid
+/// @param width Target width
+/// @param height Target height
+/// @param interp Interpolation technique
+/// @return true if resizing ok
+extern bool pyramid_resize(Image *dest, const Pyramid *pyramid, int width, int height, INTERP interp);
+
+/// @brief Number of pyramid levels a multi-scale gaussian filter goes through
+/// @param sigma Standard deviation of the gaussian function
+/// @return Number of levels, including the first one
+extern unsigned int pyramid_gaussian_levels(double sigma);
+
+/// @brief Applies a gaussian filter to the first level of a gaussian pyramid through a smaller level
+/// @note The level is blurred by the remaining sigma, then expanded back: reducing and
+/// expanding each add a variance of 1 pixel of the larger level. Borders repeat the edge pixels
+/// on the way, and follow the filter of the small level (zero borders).
+/// @param dest Filtered image (uninitialized), of the depth of the pyramid
+/// @param pyramid Gaussian pyramid
+/// @param sigma Standard deviation of the gaussian function
+/// @return true if filtering ok
+extern bool pyramid_gaussian_filter(Image *dest, const Pyramid *pyramid, double sigma);
+
+/// @brief Applies a gaussian filter to a view through a smaller pyramid level
+/// @param dest Filtered image (uninitialized), of the depth of the source
+/// @param src Source view
+/// @param sigma Standard deviation of the gaussian function
+/// @return true if filtering ok
+extern bool pyramid_gaussian_filter_view(Image *dest, const ImageView *src, double sigma);
@@ -0,0 +1,65 @@
+#pragma once
+#include <stdbool.h>
+#include "image/image.h"
+
+/// @brief Element-wise expression on the samples of images
+/// @note Nodes are built by the expr_* functions and owned by their parent: a node is
+/// used once, free_expr releasing a whole tree. The same image may appear in several
+/// leaves, its samples being read once per block.
+typedef struct Expr Expr;
+
+/// @brief Leaf reading the (normalized) samples of an image
+/// @param image Image
+/// @return Node, NULL if allocation failed
+extern Expr * expr_image(Image *image);
+
+/// @brief Leaf of constant value
+/// @param value Value
+/// @return Node, NULL if allocation failed
+extern Expr * expr_constant(double value);
+
+/// @brief a + b
+extern Expr * expr_add(Expr *a, Expr *b);
+
+/// @brief a - b
+extern Expr * expr_sub(Expr *a, Expr *b);
+
+/// @brief a * b
+extern Expr * expr_mul(Expr *a, Expr *b);
+
+/// @brief a / b, 0 where b is 0
+extern Expr * expr_div(Expr *a, Expr *b);
+
+/// @brief sqrt(a)
+extern Expr * expr_sqrt(Expr *a);
+
+/// @brief atan(a)
+extern Expr * expr_atan(Expr *a);
+
+/// @brief atan2(y, x)
+extern Expr * expr_atan2(Expr *y, Expr *x);
+
+/// @brief fct(a), for any function of a double
+/// @param a Operand
+/// @param fct Function
+/// @return Node, NULL if allocation failed
+extern Expr * expr_func(Expr *a, double (*fct)(double));
+
+/// @brief Evaluates an expression into a new image, in a single pass and without intermediate images
+/// @note The result has the size and layout of the first image of the expression. Images of
+/// the same layout are walked in storage order by blocks; mixed layouts are walked row by row.
+/// @param dest Result (uninitialized)
+/// @param expr Expression (holding at least one image of the same size as the others)
+/// @param depth Depth of the result
+/// @return true if evaluation ok
+extern bool eval_expr(Image *dest, Expr *expr, PIXEL_DEPTH depth);
+
+/// @brief Evaluates an expression into an allocated image of the size of its images
+/// @param dest Result (allocated)
+/// @param expr Expression
+/// @return true if evaluation ok
+extern bool eval_expr_into(Image *dest, Expr *expr);
+
+/// @brief Frees an expression tree
+/// @param expr Root node (NULL is ignored)
+extern void free_expr(Expr *expr);
@@ -1,5 +1,7 @@
 #pragma once
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
 // image types
 typedef enum {
@@ -8,57 +10,390 @@ typedef enum {
     HSV
 } IMAGE_TYPE;
 
+// pixel storage depth
+// Integer depths store raw samples, their value being sample / maxval.
+// Floating point depths store the value itself (normally within [0, 1]).
+typedef enum {
+    DEPTH_F64,
+    DEPTH_F32,
+    DEPTH_U8,
+    DEPTH_U16
+} PIXEL_DEPTH;
+
+// sample layout
+// Interleaved images store the channels of a pixel next to each other (RGBRGB...),
+// planar images store one full plane per channel (RR...GG...BB...).
+typedef enum {
+    LAYOUT_INTERLEAVED,
+    LAYOUT_PLANAR
+} IMAGE_LAYOUT;
+
 /// @brief Image structure
 typedef struct Image {
     // char *type;
     IMAGE_TYPE type;
+    PIXEL_DEPTH depth;
+    IMAGE_LAYOUT layout;
     unsigned int width;
     unsigned int height;
     unsigned int channels;
-    double *content;
+    unsigned int maxval; // sample value standing for 1.0 (integer depths only)
+    union {
+        double *content;
+        float *content_f32;
+        uint8_t *content_u8;
+        uint16_t *content_u16;
+        void *data;
+    };
+    void *mapping;       // private file mapping holding the samples (copy-on-write), NULL if allocated
+    size_t mapping_size;
 } Image;
 
+/// @brief Non-owning view on the samples of an image
+/// @note Strides are in bytes. A negative col_stride (row_stride) mirrors the view horizontally (vertically).
+typedef struct ImageView {
+    IMAGE_TYPE type;
+    PIXEL_DEPTH depth;
+    unsigned int width;
+    unsigned int height;
+    unsigned int channels;
+    unsigned int maxval;
+    unsigned char *origin; // first sample of pixel (0, 0)
+    ptrdiff_t row_stride;
+    ptrdiff_t col_stride;
+    ptrdiff_t channel_stride; // sample size if interleaved, plane size if planar
+} ImageView;
+
+/// @brief Size in bytes of a single sample
+/// @param depth Pixel depth
+/// @return Sample size
+extern size_t depth_size(PIXEL_DEPTH depth);
+
+/// @brief Returns the normalized value of a sample
+/// @param image 
+/// @param index Storage index of the sample (row * width * channels + col * channels + channel
+/// if interleaved, channel * width * height + row * width + col if planar)
+/// @return Sample value
+static inline double sample_get(const Image *image, size_t index)
+{
+    switch (image->depth) {
+    case DEPTH_U8: return image->content_u8[index] / (double)image->maxval;
+    case DEPTH_U16: return image->content_u16[index] / (double)image->maxval;
+    case DEPTH_F32: return image->content_f32[index];
+    case DEPTH_F64: [[fallthrough]];
+    default: return image->content[index];
+    }
+}
+
+/// @brief Sets the normalized value of a sample
+/// @note Integer depths are rounded and clamped to [0, 1]
+/// @param image 
+/// @param index Sample index
+/// @param value Sample value
+static inline void sample_set(Image *image, size_t index, double value)
+{
+    switch (image->depth) {
+    case DEPTH_U8: [[fallthrough]];
+    case DEPTH_U16: {
+        double v = value * image->maxval + 0.5;
+        v = v > 0 ? v : 0;
+        v = v < image->maxval ? v : image->maxval;
+        if (image->depth == DEPTH_U8) image->content_u8[index] = (uint8_t)v;
+        else image->content_u16[index] = (uint16_t)v;
+        break;
+    }
+    case DEPTH_F32: image->content_f32[index] = (float)value; break;
+    case DEPTH_F64: [[fallthrough]];
+    default: image->content[index] = value; break;
+    }
+}
+
+/// @brief Returns the normalized value of a sample of a view
+/// @param view 
+/// @param col 
+/// @param row 
+/// @param channel 
+/// @return Sample value
+static inline double view_sample_get(const ImageView *view, int col, int row, unsigned int channel)
+{
+    const unsigned char *p = view->origin + row * view->row_stride + col * view->col_stride
+                           + channel * view->channel_stride;
+    switch (view->depth) {
+    case DEPTH_U8: return *(const uint8_t *)p / (double)view->maxval;
+    case DEPTH_U16: return *(const uint16_t *)p / (double)view->maxval;
+    case DEPTH_F32: return *(const float *)p;
+    case DEPTH_F64: [[fallthrough]];
+    default: return *(const double *)p;
+    }
+}
+
+/// @brief Reads a row of the image as normalized doubles
+/// @param image 
+/// @param row Row index
+/// @param buffer Destination of width * channels values
+extern void read_image_row(const Image *image, unsigned int row, double *buffer);
+
+/// @brief Writes a row of normalized doubles into the image
+/// @note Integer depths are rounded and clamped to [0, 1]
+/// @param image 
+/// @param row Row index
+/// @param buffer Source of width * channels values
+extern void write_image_row(Image *image, unsigned int row, const double *buffer);
+
+/// @brief Reads a row of a view as normalized doubles
+/// @param view 
+/// @param row Row index
+/// @param buffer Destination of width * channels values
+extern void read_view_row(const ImageView *view, unsigned int row, double *buffer);
+
+/// @brief Writes a row of normalized doubles into a view
+/// @param view 
+/// @param row Row index
+/// @param buffer Source of width * channels values
+extern void write_view_row(const ImageView *view, unsigned int row, const double *buffer);
+
+/// @brief Reads consecutive samples in storage order as normalized doubles
+/// @note Element-wise kernels use it to run over contiguous memory whatever the layout
+/// @param image 
+/// @param offset Storage index of the first sample
+/// @param count Number of samples
+/// @param buffer Destination of count values
+extern void read_image_samples(const Image *image, size_t offset, size_t count, double *buffer);
+
+/// @brief Writes consecutive samples in storage order from normalized doubles
+/// @param image 
+/// @param offset Storage index of the first sample
+/// @param count Number of samples
+/// @param buffer Source of count values
+extern void write_image_samples(Image *image, size_t offset, size_t count, const double *buffer);
+
+/// @brief Returns a view on a whole image
+/// @param image 
+/// @return View
+extern ImageView image_view(Image *image);
+
+/// @brief Returns a single channel view on one channel of a view
+/// @note For planar images the result is a contiguous plane
+/// @param src Original view
+/// @param channel Channel index
+/// @return Channel view
+extern ImageView plane_view(const ImageView *src, unsigned int channel);
+
+/// @brief Restricts a view to a region of interest
+/// @param dest Cropped view
+/// @param src Original view
+/// @param col Left column of the region
+/// @param row Top row of the region
+/// @param width Region width
+/// @param height Region height
+/// @return true if the region lies inside the view
+extern bool crop_view(ImageView *dest, const ImageView *src, int col, int row, int width, int height);
+
+/// @brief Returns a horizontally mirrored view
+/// @param src Original view
+/// @return Mirrored view
+extern ImageView flip_view_horizontal(const ImageView *src);
+
+/// @brief Returns a vertically mirrored view
+/// @param src Original view
+/// @return Mirrored view
+extern ImageView flip_view_vertical(const ImageView *src);
+
+/// @brief Returns a transposed view: pixel (col, row) of the view is pixel (row, col) of the source
+/// @param src Original view
+/// @return Transposed view
+extern ImageView transpose_view(const ImageView *src);
+
+/// @brief Returns a view rotated by quarter turns, counterclockwise as rotate with a positive angle
+/// @note The last column of the source becomes the first row of a view turned once
+/// @param src Original view
+/// @param turns Number of quarter turns (negative ones turn clockwise)
+/// @return Rotated view
+extern ImageView rotate_view_quarter(const ImageView *src, int turns);
+
+/// @brief Returns a pointer to the pixel at row and col of a view
+/// @param view 
+/// @param col 
+/// @param row 
+/// @note Channels of the pixel are channel_stride bytes apart
+/// @return Pointer to pixel, NULL if not found
+extern void * view_pixel_at(const ImageView *view, int col, int row);
+
+/// @brief Copies the pixels of a view into a new contiguous interleaved image
+/// @param dest Image (uninitialized)
+/// @param src View
+/// @return true if copy ok
+extern bool materialize_view(Image *dest, const ImageView *src);
+
+/// @brief Crops an image
+/// @param dest Cropped image (uninitialized)
+/// @param src Original image
+/// @param col Left column of the region
+/// @param row Top row of the region
+/// @param width Region width
+/// @param height Region height
+/// @return true if crop ok
+extern bool crop_image(Image *dest, Image *src, int col, int row, int width, int height);
+
 /// @brief Printing for debug
 /// @param image 
 extern void print_image(Image *image);
 
-/// @brief Loads a PPM / PGM image
+/// @brief Loads a PPM / PGM (or PNG) image
+/// @note The image is stored as DEPTH_U8, or DEPTH_U16 when maxval is above 255.
+/// PNG files, recognized by their signature, go through load_png.
+/// Binary files are memory-mapped (see load_image_mmap): their samples can still be
+/// written in place, the pages being copied on their first write. ASCII files are parsed
+/// (see load_image_ascii).
 /// @param path Path to image
 /// @param image Image struct to store data
 /// @return true if loading is successful
 extern bool load_image(Image *image, const char *path);
 
+/// @brief Maps a binary PPM / PGM (P5 / P6) image without copying its samples
+/// @note 8-bit images point straight into a private mapping: samples written in place
+/// only copy the pages they touch, the file is never modified. Kernels widen the samples row by row when they need another
+/// depth. 16-bit images are byte-swapped into an allocated buffer.
+/// @param image Image struct to store data
+/// @param path Path to image
+/// @return true if loading is successful
+extern bool load_image_mmap(Image *image, const char *path);
+
+/// @brief Called while a PNG is decoded, each time a band of rows becomes final
+/// @param image Image being decoded
+/// @param rows Number of final rows (rows 0 to rows - 1)
+/// @param params Parameters given to load_png_rows
+/// @return false to stop decoding
+typedef bool (*png_rows_fct)(Image *image, unsigned int rows, void *params);
+
+/// @brief Loads a PNG image
+/// @note 8-bit and 16-bit gray, RGB, RGBA, palette and interlaced files are supported.
+/// Samples are decoded straight into the image as DEPTH_U8 or DEPTH_U16, alpha is dropped.
+/// @param image Image struct to store data
+/// @param path Path to image
+/// @return true if loading is successful
+extern bool load_png(Image *image, const char *path);
+
+/// @brief Loads a PNG image, calling back as bands of rows are decoded
+/// @note Lets a band operation start before the whole file is decoded. Interlaced
+/// rows become final during the last pass only, so their first call comes later.
+/// @param image Image struct to store data
+/// @param path Path to image
+/// @param band_rows Number of rows between two calls (0 for a single call at the end)
+/// @param callback Called with the number of final rows, or NULL
+/// @param params Parameters of the callback
+/// @return true if loading is successful (and no callback stopped it)
+extern bool load_png_rows(Image *image, const char *path, unsigned int band_rows, png_rows_fct callback, void *params);
+
+/// @brief Loads an ASCII PPM / PGM (P2 / P3) image
+/// @note Large payloads without comments are split in chunks decoded in parallel.
+/// Samples must not exceed maxval (at most 65535).
+/// @param image Image struct to store data
+/// @param path Path to image
+/// @param threads Number of decoding threads (0 for one per hardware thread, 1 for sequential)
+/// @return true if loading is successful
+extern bool load_image_ascii(Image *image, const char *path, unsigned int threads);
+
+/// @brief Converts a row of samples into bytes of a PGM/PPM/PNG payload
+/// @param view View on the image
+/// @param row Row index
+/// @param bytes Destination (width * channels samples of 1 byte, 2 big endian bytes if maxval is above 255)
+/// @param maxval Maxval of the destination samples
+/// @param buffer Temporary row of width * channels doubles
+extern void row_to_bytes(const ImageView *view, unsigned int row, unsigned char *bytes, unsigned int maxval, double *buffer);
+
 /// @brief Saves a PPM / PGM image
-/// @note Deduce the extension based on type
+/// @note Deduce the extension based on type. DEPTH_U16 images are saved with 16-bit samples.
 /// @param name Name of the image
 /// @param image Image struct
 /// @return true if save ok
 extern bool save_image(Image *image, const char *name);
 
+/// @brief Saves an ASCII PPM / PGM (P2 / P3) image
+/// @note Same extension and samples as save_image, written as decimal text
+/// @param name Name of the image
+/// @param image Image struct
+/// @return true if save ok
+extern bool save_image_ascii(Image *image, const char *name);
+
 /// @brief Allocates required memory given image properties
+/// @note Buffers come from the pool allocator (64-byte aligned, recycled by free_image)
 /// @param image Pointer to image
 /// @param type Image type (P2, P3, P5, P6)
 /// @param width 
 /// @param height 
 /// @param channels 
-extern void create_image(Image *image, IMAGE_TYPE type, int width, int height, int channels);
+/// @param depth Pixel depth
+extern void create_image(Image *image, IMAGE_TYPE type, int width, int height, int channels, PIXEL_DEPTH depth);
+
+/// @brief Allocates an image stored as one plane per channel
+/// @param image Pointer to image
+/// @param type Image type
+/// @param width 
+/// @param height 
+/// @param channels 
+/// @param depth Pixel depth
+extern void create_planar_image(Image *image, IMAGE_TYPE type, int width, int height, int channels, PIXEL_DEPTH depth);
+
+/// @brief Converts an interleaved image to planar layout
+/// @param dest Planar image (uninitialized)
+/// @param src Original image
+/// @return true if conversion ok
+extern bool deinterleave_image(Image *dest, Image *src);
+
+/// @brief Converts a planar image to interleaved layout
+/// @param dest Interleaved image (uninitialized)
+/// @param src Original image
+/// @return true if conversion ok
+extern bool interleave_image(Image *dest, Image *src);
 
-/// @brief Frees image data
+/// @brief Frees image data (or unmaps it)
 /// @param image  
 extern void free_image(Image *image);
 
+/// @brief PNG encoding settings (a negative value keeps the libpng default)
+typedef struct PngOptions {
+    int compression_level; // zlib level, from 0 (fastest) to 9 (smallest)
+    int strategy;          // zlib strategy (Z_DEFAULT_STRATEGY, Z_FILTERED, Z_HUFFMAN_ONLY, Z_RLE, Z_FIXED)
+    int filters;           // PNG row filters (PNG_FILTER_NONE, PNG_FILTER_SUB, ..., PNG_ALL_FILTERS)
+} PngOptions;
+
 /// @brief Converts an image to png and saves it
+/// @note DEPTH_U16 images are written as 16-bit PNG, other depths as 8-bit
 /// @param image Image struct
 /// @param png_file_path Resulting image file path
 /// @return true if conversion and save ok
 extern bool image_to_png(Image *image, const char *png_file_path);
 
+/// @brief Converts a view to png and saves it, without copying the pixels first
+/// @param view View
+/// @param png_file_path Resulting image file path
+/// @return true if conversion and save ok
+extern bool view_to_png(const ImageView *view, const char *png_file_path);
+
+/// @brief Encodes an image as png in memory
+/// @param image Image struct
+/// @param options Encoding settings (NULL for libpng defaults)
+/// @param png Encoded image, allocated with malloc (to be released with free)
+/// @param size Size of the encoded image
+/// @return true if encoding ok
+extern bool image_to_png_buffer(Image *image, const PngOptions *options, unsigned char **png, size_t *size);
+
+/// @brief Encodes a view as png in memory, without copying the pixels first
+/// @param view View on the image
+/// @param options Encoding settings (NULL for libpng defaults)
+/// @param png Encoded image, allocated with malloc (to be released with free)
+/// @param size Size of the encoded image
+/// @return true if encoding ok
+extern bool view_to_png_buffer(const ImageView *view, const PngOptions *options, unsigned char **png, size_t *size);
+
 /// @brief Returns a pointer to the pixel at row and col
 /// @param image 
 /// @param row 
 /// @param col 
-/// @return Pointer to pixel, NULL if not found
-extern double * pixel_at(Image *image, int col, int row);
+/// @note For planar images, this is the sample of the first channel
+/// @return Pointer to pixel (of the image depth), NULL if not found
+extern void * pixel_at(Image *image, int col, int row);
 
 /// @brief Does what you think it does
 /// @param dest Copy image (uninitialized)
@@ -66,7 +401,15 @@ extern double * pixel_at(Image *image, int col, int row);
 /// @return true if copy ok
 extern bool copy_image(Image *dest, Image *src);
 
+/// @brief Copies an image into another pixel depth
+/// @param dest Converted image (uninitialized)
+/// @param src Original image
+/// @param depth Target depth
+/// @return true if conversion ok
+extern bool convert_image_depth(Image *dest, Image *src, PIXEL_DEPTH depth);
+
 /// @brief Adds two images pixel-wise
+/// @note The result has the depth of I
 /// @param dest Result
 /// @param I Source image 1
 /// @param J Source image 2
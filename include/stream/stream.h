@@ -0,0 +1,118 @@
+#pragma once
+#include <stdbool.h>
+#include <stdio.h>
+#include "image/image.h"
+#include "transform/geometry.h"
+
+typedef struct Matrix Matrix;
+
+/// @brief Sequential reader of a binary PGM / PPM file, a band of rows at a time
+typedef struct ImageReader {
+    FILE *file;
+    IMAGE_TYPE type;
+    PIXEL_DEPTH depth;     // DEPTH_U8 up to maxval 255, DEPTH_U16 above
+    unsigned int width;
+    unsigned int height;
+    unsigned int channels;
+    unsigned int maxval;
+    unsigned int next_row; // next row to be read
+} ImageReader;
+
+/// @brief Sequential writer of a binary PGM / PPM file, a band of rows at a time
+typedef struct ImageWriter {
+    FILE *file;
+    IMAGE_TYPE type;
+    PIXEL_DEPTH depth;     // DEPTH_U8 or DEPTH_U16
+    unsigned int width;
+    unsigned int height;
+    unsigned int channels;
+    unsigned int maxval;
+    unsigned int next_row; // next row to be written
+} ImageWriter;
+
+/// @brief Opens a binary PGM (P5) or PPM (P6) file and reads its header
+/// @param reader Reader
+/// @param path Path of the file
+/// @return true if the file is a valid binary PGM / PPM
+extern bool open_image_reader(ImageReader *reader, const char *path);
+
+/// @brief Reads the next rows of the file into a band
+/// @param reader Reader
+/// @param band Band (allocated with the width, channels and depth of the reader), interleaved
+/// @param first Row of the band receiving the first row read
+/// @param count Number of rows to read
+/// @return Number of rows read (fewer than count at the end of the file)
+extern unsigned int read_image_rows(ImageReader *reader, Image *band, unsigned int first, unsigned int count);
+
+/// @brief Closes a reader
+/// @param reader Reader
+extern void close_image_reader(ImageReader *reader);
+
+/// @brief Creates a binary PGM / PPM file and writes its header
+/// @param writer Writer
+/// @param path Path of the file
+/// @param type GRAY or RGB
+/// @param width Width of the image
+/// @param height Height of the image
+/// @param depth DEPTH_U8 (maxval 255) or DEPTH_U16 (maxval 65535)
+/// @return true if the file was created
+extern bool open_image_writer(ImageWriter *writer, const char *path, IMAGE_TYPE type,
+                              unsigned int width, unsigned int height, PIXEL_DEPTH depth);
+
+/// @brief Appends rows of a band to the file
+/// @param writer Writer
+/// @param band Band of the width and channels of the writer, of any depth and layout
+/// @param first First row of the band to write
+/// @param count Number of rows to write
+/// @return true if writing ok
+extern bool write_image_rows(ImageWriter *writer, Image *band, unsigned int first, unsigned int count);
+
+/// @brief Closes a writer
+/// @param writer Writer
+/// @return true if every row of the image was written
+extern bool close_image_writer(ImageWriter *writer);
+
+/// @brief Convolves an image with a kernel, band by band
+/// @note Only band_rows + kernel->height - 1 source rows are resident at a time
+/// @param reader Source image
+/// @param writer Filtered image (opened with the size of the source)
+/// @param kernel Matrix filter
+/// @param band_rows Number of rows computed at once
+/// @return true if filtering ok
+extern bool stream_filter(ImageReader *reader, ImageWriter *writer, Matrix *kernel, unsigned int band_rows);
+
+/// @brief Applies a gaussian filter to an image, band by band
+/// @param reader Source image
+/// @param writer Filtered image (opened with the size of the source)
+/// @param kernel_size Size of the gaussian kernel
+/// @param sigma Standard deviation of the gaussian function
+/// @param band_rows Number of rows computed at once
+/// @return true if filtering ok
+extern bool stream_gaussian_filter(ImageReader *reader, ImageWriter *writer,
+                                   unsigned int kernel_size, double sigma, unsigned int band_rows);
+
+/// @brief Computes the magnitude of the Sobel gradient of an image, band by band
+/// @param reader Source image
+/// @param writer Gradient magnitude (opened with the size of the source)
+/// @param band_rows Number of rows computed at once
+/// @return true if filtering ok
+extern bool stream_sobel_filter(ImageReader *reader, ImageWriter *writer, unsigned int band_rows);
+
+/// @brief Converts the colours of an image, band by band
+/// @param reader Source image
+/// @param writer Converted image (opened with the size and type of the conversion result)
+/// @param convert Conversion of a whole image, e.g. rgb_to_gray or gray_to_rgb
+/// @param band_rows Number of rows converted at once
+/// @return true if conversion ok
+extern bool stream_convert_colors(ImageReader *reader, ImageWriter *writer,
+                                  bool (*convert)(Image *, Image *), unsigned int band_rows);
+
+/// @brief Resizes an image to the size of the writer, band by band
+/// @note Downscaling by a factor s keeps about s * band_rows source rows resident, plus the
+/// support of the filter for area, bicubic and Lanczos-3 resizes (up to 3 * s rows above and below)
+/// @param reader Source image
+/// @param writer Resized image (opened with the target size)
+/// @param interp Interpolation technique
+/// @param band_rows Number of rows computed at once
+/// @return true if resizing ok
+extern bool stream_resize(ImageReader *reader, ImageWriter *writer, INTERP interp, unsigned int band_rows);
@@ -1,12 +1,19 @@
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
 
 typedef struct Image Image;
+typedef struct ImageView ImageView;
 typedef struct Matrix Matrix;
 
+/// @note Area, bicubic and Lanczos-3 filters only resize: rotations, warps and remaps
+/// interpolate them bilinearly
 typedef enum {
     INTERP_NEAREST,
-    INTERP_BILINEAR
+    INTERP_BILINEAR,
+    INTERP_AREA,        // average of the covered source pixels
+    INTERP_BICUBIC,     // Keys cubic (a = -0.5), widened by the downscale factor
+    INTERP_LANCZOS3     // windowed sinc of 3 lobes, widened by the downscale factor
 } INTERP;
 
 /// @brief Flip the image horizontally
@@ -21,7 +28,28 @@ extern bool flip_horizontal(Image *dest, Image *src);
 /// @return true if transform ok
 extern bool flip_vertical(Image *dest, Image *src);
 
+/// @brief Transposes an image: pixel (col, row) becomes pixel (row, col)
+/// @note Flips, transposes and quarter turns copy the pixels by square tiles, so that
+/// the source lines read by a tile stay in cache whatever the direction
+/// @param dest Transposed image (uninitialized)
+/// @param src Original image
+/// @return true if transform ok
+extern bool transpose_image(Image *dest, Image *src);
+
+/// @brief Rotates an image by quarter turns, counterclockwise as rotate with a positive angle
+/// @param dest Rotated image (uninitialized)
+/// @param src Original image
+/// @param turns Number of quarter turns (negative ones turn clockwise)
+/// @return true if rotation ok
+extern bool rotate_quarter(Image *dest, Image *src, int turns);
+
 /// @brief Resizes an image to the desired size
+/// @note Resize, rotation and affine warps share one engine: source coordinates advance by
+/// fixed steps along each row, and the span of columns mapped inside the source is
+/// interpolated without bounds checks. Pixels mapped outside the source are zero.
+/// Area, bicubic and Lanczos-3 resizes are separable instead: each axis has a table of weights,
+/// computed once per source size, target size and filter, whose support grows with the
+/// downscale factor so that downscales do not alias. Borders repeat the edge pixels.
 /// @param dest Resized image
 /// @param src Original image
 /// @param width Target width
@@ -30,7 +58,59 @@ extern bool flip_vertical(Image *dest, Image *src);
 /// @return true if resizing ok
 extern bool resize(Image *dest, Image *src, int width, int height, INTERP interp);
 
-/// @brief Rotate an image
+/// @brief Resizes a view (e.g. a region of interest) to the desired size
+/// @param dest Resized image
+/// @param src Original view
+/// @param width Target width
+/// @param height Target height
+/// @param interp Interpolation technique
+/// @return true if resizing ok
+extern bool resize_view(Image *dest, const ImageView *src, int width, int height, INTERP interp);
+
+/// @brief Resizes a region of a view, given in source pixels, to the desired size
+/// @note The region may start between pixels and outgrow the view: area, bicubic and
+/// Lanczos-3 filters repeat the edge pixels there, other techniques give zero pixels
+/// @param dest Resized image
+/// @param src Original view
+/// @param x Left edge of the region
+/// @param y Top edge of the region
+/// @param region_width Width of the region
+/// @param region_height Height of the region
+/// @param width Target width
+/// @param height Target height
+/// @param interp Interpolation technique
+/// @return true if resizing ok
+extern bool resize_region_view(Image *dest, const ImageView *src, double x, double y,
+                               double region_width, double region_height, int width, int height, INTERP interp);
+
+/// @brief Resizes the rows of a band from a window of source rows (out-of-core processing)
+/// @note The window must hold every source row sampled by the band, as given by resize_source_rows
+/// @param dest Resized band (allocated with the target width)
+/// @param window Source rows
+/// @param window_row Source row matching the first row of the window
+/// @param src_height Height of the whole source image
+/// @param dest_row Resized row matching the first row of dest
+/// @param dest_height Height of the whole resized image
+/// @param interp Interpolation technique
+/// @return true if resizing ok
+extern bool resize_band(Image *dest, const ImageView *window, int window_row,
+                        int src_height, int dest_row, int dest_height, INTERP interp);
+
+/// @brief Gives the source rows sampled by a range of resized rows
+/// @param first First resized row
+/// @param last Last resized row
+/// @param src_height Height of the whole source image
+/// @param dest_height Height of the whole resized image
+/// @param interp Interpolation technique
+/// @param src_first First source row sampled
+/// @param src_last Last source row sampled
+extern void resize_source_rows(unsigned int first, unsigned int last, unsigned int src_height,
+                               unsigned int dest_height, INTERP interp,
+                               unsigned int *src_first, unsigned int *src_last);
+
+/// @brief Rotate an image about its center
+/// @note The rotated image is sized to hold the whole rotated source. Multiples of 90 degrees
+/// (within 1e-9 quarter turn) go through rotate_quarter: the pixels are moved, not interpolated.
 /// @param dest Rotated image
 /// @param src Original image
 /// @param angle Angle (radians)
@@ -57,9 +137,102 @@ extern Matrix create_affine_matrix(double sx, double sy,
 /// @brief Warps the image according to an affine transformation
 /// @param dest Warped image
 /// @param src Original image
-/// @param warp_matrix Affine transform matrix
+/// @param warp_matrix Affine transform matrix (3x3), applied to (row, col, 1)
 /// @param interp Interpolation
 /// @return true if warp ok
 extern bool warp_affine(Image *dest, Image *src, Matrix *warp_matrix, INTERP interp);
 
 
+
+/// @brief Coordinate maps: the source position sampled by each pixel of a remapped image
+/// @note Float maps hold any coordinates. Fixed-point maps pack the integer coordinates and
+/// REMAP_BITS bits of fraction of each, the interpolation weights: they are bound to a
+/// source size, out of which pixels are flagged once for all
+typedef struct RemapTable {
+    unsigned int width;         // size of the remapped image
+    unsigned int height;
+    INTERP interp;
+    float *map_x;               // float maps: source coordinates of each pixel (NULL if fixed-point)
+    float *map_y;
+    unsigned int src_width;     // fixed-point maps: size of the source
+    unsigned int src_height;
+    int16_t *map_xy;            // fixed-point maps: integer source coordinates (x, y), x = -1 out of the source
+    uint16_t *map_frac;         // fixed-point maps: fractions of x (low bits) and y, REMAP_BITS each
+} RemapTable;
+
+// Bits of the fractional part of fixed-point coordinates
+#define REMAP_BITS 8
+
+/// @brief Allocates float maps, to be filled with source coordinates
+/// @param table Remap table (uninitialized)
+/// @param width Width of the remapped image
+/// @param height Height of the remapped image
+/// @param interp Interpolation technique
+/// @return true if allocation ok
+extern bool create_remap_table(RemapTable *table, unsigned int width, unsigned int height, INTERP interp);
+
+/// @brief Converts float maps to fixed-point maps for a source size
+/// @param dest Fixed-point remap table (uninitialized)
+/// @param src Float remap table
+/// @param src_width Width of the sources to remap (at most 32767)
+/// @param src_height Height of the sources to remap (at most 32767)
+/// @return true if conversion ok
+extern bool fix_remap_table(RemapTable *dest, const RemapTable *src, unsigned int src_width, unsigned int src_height);
+
+/// @brief Builds the maps of a rotation about the center, sized as rotate
+/// @param table Remap table (uninitialized)
+/// @param src_width Width of the source
+/// @param src_height Height of the source
+/// @param angle Angle (radians)
+/// @param interp Interpolation technique
+/// @param fixed true for fixed-point maps, false for float maps
+/// @return true if building ok
+extern bool rotation_remap_table(RemapTable *table, unsigned int src_width, unsigned int src_height,
+                                 double angle, INTERP interp, bool fixed);
+
+/// @brief Builds the maps of an affine warp, sized as warp_affine
+/// @param table Remap table (uninitialized)
+/// @param src_width Width of the source
+/// @param src_height Height of the source
+/// @param warp_matrix Affine transform matrix (3x3), applied to (row, col, 1)
+/// @param interp Interpolation technique
+/// @param fixed true for fixed-point maps, false for float maps
+/// @return true if building ok
+extern bool affine_remap_table(RemapTable *table, unsigned int src_width, unsigned int src_height,
+                               Matrix *warp_matrix, INTERP interp, bool fixed);
+
+/// @brief Frees the maps of a remap table
+/// @param table Remap table
+extern void free_remap_table(RemapTable *table);
+
+/// @brief Remaps an image: each pixel is interpolated at the source position given by the maps
+/// @note Only the gather is left: no coordinate is computed. Pixels mapped out of the source are zero.
+/// @param dest Remapped image (uninitialized), of the size of the maps
+/// @param src Source image (of the size of the table for fixed-point maps)
+/// @param table Remap table
+/// @return true if remapping ok
+extern bool remap(Image *dest, Image *src, const RemapTable *table);
+
+/// @brief Remaps a view: each pixel is interpolated at the source position given by the maps
+/// @param dest Remapped image (uninitialized), of the size of the maps
+/// @param src Source view (of the size of the table for fixed-point maps)
+/// @param table Remap table
+/// @return true if remapping ok
+extern bool remap_view(Image *dest, const ImageView *src, const RemapTable *table);
+
+/// @brief Rotates an image through fixed-point maps, cached for later sources of the same size
+/// @note Maps are cached by transform, source size and destination size (least recently used first out)
+/// @param dest Rotated image
+/// @param src Original image
+/// @param angle Angle (radians)
+/// @param interp Interpolation technique
+/// @return true if rotation ok
+extern bool rotate_remap(Image *dest, Image *src, double angle, INTERP interp);
+
+/// @brief Warps an image through fixed-point maps, cached for later sources of the same size
+/// @param dest Warped image
+/// @param src Original image
+/// @param warp_matrix Affine transform matrix (3x3), applied to (row, col, 1)
+/// @param interp Interpolation technique
+/// @return true if warp ok
+extern bool warp_affine_remap(Image *dest, Image *src, Matrix *warp_matrix, INTERP interp);
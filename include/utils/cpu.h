@@ -0,0 +1,18 @@
+#pragma once
+#include <stdbool.h>
+
+/// @brief Tells whether the CPU supports SSE2 (double precision vectors)
+/// @return true if supported
+extern bool cpu_has_sse2(void);
+
+/// @brief Tells whether the CPU supports SSSE3 (byte shuffles)
+/// @return true if supported
+extern bool cpu_has_ssse3(void);
+
+/// @brief Tells whether the CPU supports AVX2 and FMA
+/// @return true if supported
+extern bool cpu_has_avx2(void);
+
+/// @brief Tells whether the CPU supports AVX-512 (foundation)
+/// @return true if supported
+extern bool cpu_has_avx512f(void);
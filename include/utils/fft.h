@@ -0,0 +1,40 @@
+#pragma once
+#include <stdbool.h>
+#include <complex.h>
+
+// Largest number of prime factors of a transform size
+#define FFT_MAX_FACTORS 32
+
+/// @brief Precomputed factors and twiddle factors of a transform size
+typedef struct FftPlan {
+    unsigned int size;
+    unsigned int n_factors;
+    unsigned int factors[FFT_MAX_FACTORS]; // radices, in the order of the stages
+    double complex *twiddles;              // twiddle factors of each stage, one stage after the other
+} FftPlan;
+
+/// @brief Returns the smallest transform size of the form 2^a 3^b 5^c at least n
+/// @note Such sizes only use the dedicated radix 2, 3, 4 and 5 butterflies
+/// @param n Minimal size
+/// @return Transform size
+extern unsigned int fft_size(unsigned int n);
+
+/// @brief Prepares the transforms of a given size
+/// @note Any size is accepted, prime factors above 5 using a generic (slower) butterfly
+/// @param plan Plan (uninitialized)
+/// @param size Number of samples
+/// @return true if preparation ok
+extern bool fft_plan(FftPlan *plan, unsigned int size);
+
+/// @brief Frees a plan
+/// @param plan Plan
+extern void free_fft_plan(FftPlan *plan);
+
+/// @brief Computes the discrete Fourier transform of a sequence, in place
+/// @note Self-sorting mixed radix (Stockham) algorithm. The inverse transform is not
+/// scaled: a forward then inverse transform multiplies the sequence by its size.
+/// @param plan Plan of the size of the sequence
+/// @param data Sequence (plan->size values)
+/// @param work Scratch space (plan->size values)
+/// @param inverse true for the inverse transform
+extern void fft(const FftPlan *plan, double complex *data, double complex *work, bool inverse);
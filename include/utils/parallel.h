@@ -0,0 +1,18 @@
+#pragma once
+
+/// @brief Task of a parallel loop
+/// @param task Index of the task
+/// @param params Parameters shared by every task
+typedef void (*parallel_fct)(unsigned int task, void *params);
+
+/// @brief Returns the number of hardware threads
+/// @return Number of threads (at least 1)
+extern unsigned int parallel_threads(void);
+
+/// @brief Runs tasks 0 to count - 1 over the hardware threads and waits for them
+/// @note Tasks are handed out one at a time, so they may be of uneven cost.
+/// The calling thread runs tasks as well.
+/// @param count Number of tasks
+/// @param fct Task
+/// @param params Parameters shared by every task
+extern void parallel_for(unsigned int count, parallel_fct fct, void *params);
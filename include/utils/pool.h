@@ -0,0 +1,48 @@
+#pragma once
+#include <stddef.h>
+
+typedef struct PoolBlock PoolBlock;
+
+/// @brief Scope collecting the buffers allocated by one thread between begin and end
+typedef struct PoolArena {
+    PoolBlock *blocks;
+    struct PoolArena *parent;
+} PoolArena;
+
+/// @brief Pool statistics
+typedef struct PoolStats {
+    size_t allocations;  // number of pool_alloc calls
+    size_t hits;         // allocations served from a cached buffer
+    double hit_rate;     // hits / allocations
+    size_t bytes_in_use; // bytes currently handed out
+    size_t peak_bytes;   // maximum of bytes_in_use
+    size_t bytes_cached; // bytes kept in the free lists
+} PoolStats;
+
+/// @brief Allocates a 64-byte aligned buffer, reusing a cached one of the same size class if any
+/// @param size Size in bytes
+/// @return Buffer, NULL if allocation failed
+extern void * pool_alloc(size_t size);
+
+/// @brief Gives a buffer back to the pool
+/// @param ptr Buffer from pool_alloc (NULL is ignored)
+extern void pool_free(void *ptr);
+
+/// @brief Opens an arena scope on the calling thread (scopes can be nested)
+/// @param arena Arena to initialize
+extern void pool_arena_begin(PoolArena *arena);
+
+/// @brief Closes an arena scope, freeing every buffer allocated in it and not freed yet
+/// @param arena Arena opened by pool_arena_begin
+extern void pool_arena_end(PoolArena *arena);
+
+/// @brief Detaches a buffer from its arena so that it outlives the scope
+/// @param ptr Buffer from pool_alloc
+extern void pool_persist(void *ptr);
+
+/// @brief Releases every cached buffer to the system
+extern void pool_trim(void);
+
+/// @brief Returns the pool statistics
+/// @param stats Statistics
+extern void pool_stats(PoolStats *stats);
@@ -0,0 +1,23 @@
+#pragma once
+#include <stddef.h>
+
+/// @brief Computes a weighted sum of sequences: out[k] = sum over t of weights[t] * terms[t][k]
+/// @note The vector unit is chosen at runtime (AVX-512, AVX2 with FMA, SSE2 or scalar code).
+/// Terms are summed in order, each output being kept in a register across the terms.
+/// @param out Result (count values, may not overlap the terms)
+/// @param terms Sequences (n_terms pointers to count values at least)
+/// @param weights Weights of the sequences
+/// @param n_terms Number of sequences
+/// @param count Number of values
+extern void weighted_sum(double *out, const double *const *terms, const double *weights,
+                         unsigned int n_terms, size_t count);
+
+/// @brief Converts vectors to polar coordinates: magnitude[k] = sqrt(x[k]^2 + y[k]^2), angle[k] = atan2(y[k], x[k])
+/// @note The vector variants evaluate atan with the rational approximation of Cephes, within a few
+/// ulps of the C library. The angle is in [-pi, pi], 0 where x and y are 0.
+/// @param magnitude Magnitudes (count values), or NULL
+/// @param angle Angles (count values), or NULL
+/// @param x First coordinates
+/// @param y Second coordinates
+/// @param count Number of vectors
+extern void polar_coordinates(double *magnitude, double *angle, const double *x, const double *y, size_t count);
@@ -1,54 +1,908 @@
 #include "filters/filters.h"
+#include "filters/pyramid.h"
 #include "utils/matrix.h"
 #include "image/image.h"
+#include "utils/fft.h"
+#include "utils/parallel.h"
+#include "utils/simd.h"
 #include <stdlib.h>
 #include <stdio.h>
 #include <math.h>
+#include <string.h>
+#include <limits.h>
+#include <complex.h>
+#include <pthread.h>
 
-bool filter(Image *dest, Image *src, Matrix *kernel)
+// Largest deviation from a rank 1 kernel, relative to the pivot, still factored
+#define RANK1_TOLERANCE 1e-12
+
+// Kernel spectra kept for later convolutions at the same transform size
+#define SPECTRUM_CACHE_ENTRIES 8
+#define SPECTRUM_CACHE_BYTES ((size_t)64 << 20)
+// Columns transformed together, gathered into contiguous sequences
+#define FFT_COLUMN_BLOCK 8
+// Cost of a transform point per log2 of the transform size, in multiply-adds of the direct convolution
+#define FFT_COST_FACTOR 60.0
+// Sigma from which GAUSSIAN_AUTO filters recursively: below, the separable kernel is cheaper
+#define GAUSSIAN_IIR_SIGMA 3.0
+// Smallest sigma of the recursive gaussian, the Young - van Vliet coefficients being fitted from there
+#define GAUSSIAN_IIR_MIN_SIGMA 0.5
+// Length of the free decay of the recursive gaussian, in sigmas, taken for the boundary state
+#define GAUSSIAN_IIR_TAIL 16
+// tan(pi / 8): gradients within 22.5 degrees of an axis are compared along that axis by Canny
+#define CANNY_TAN_22_5 0.41421356237309503
+// Cells of the bilateral grid per sigma, along the space and range axes
+#define BILATERAL_SAMPLING 2.0
+// Smallest spatial cell of the bilateral grid, in pixels: finer grids cost more than direct sums
+#define BILATERAL_MIN_CELL 2.0
+// Largest number of cells of the bilateral grid, coarser cells being taken above
+#define BILATERAL_MAX_CELLS ((size_t)1 << 24)
+
+/// @brief Kernel ready for convolution, its weights divided by the sum of their absolute values
+/// @note A rank 1 kernel keeps its two factors only, each normalized on its own:
+/// the product of the factors is then the normalized kernel
+typedef struct FilterKernel {
+    int width;
+    int height;
+    double *weights;    // height x width weights, NULL when separable
+    double *row;        // width weights of the horizontal pass (separable)
+    double *col;        // height weights of the vertical pass (separable)
+} FilterKernel;
+
+/// @brief Copies the coefficients of a matrix, divided by the sum of their absolute values
+/// @param weights Normalized coefficients, in row-major order
+/// @param matrix Coefficients
+static void normalize_weights(double *weights, Matrix *matrix)
 {
-    create_image(dest, src->type, src->width, src->height, src->channels);
-    if (!dest->content) {
-        perror("Error during image allocation.");
+    size_t count = (size_t)matrix->width * matrix->height;
+    double total_weight = 0;
+    for (size_t k = 0; k < count; ++k) {
+        total_weight += fabs(matrix->data[k]);
+    }
+    for (size_t k = 0; k < count; ++k) {
+        weights[k] = matrix->data[k] / total_weight;
+    }
+}
+
+/// @brief Prepares a separable kernel from its two factors
+/// @param kernel Kernel
+/// @param row_kernel Horizontal factor (1 x width)
+/// @param col_kernel Vertical factor (height x 1)
+/// @return true if preparation ok
+static bool init_separable_kernel(FilterKernel *kernel, Matrix *row_kernel, Matrix *col_kernel)
+{
+    if (row_kernel->height != 1 || col_kernel->width != 1) {
+        fprintf(stderr, "Separable kernels are a row (1 x n) and a column (n x 1), got %dx%d and %dx%d\n",
+                row_kernel->height, row_kernel->width, col_kernel->height, col_kernel->width);
+        return false;
+    }
+    kernel->width = row_kernel->width;
+    kernel->height = col_kernel->height;
+    kernel->weights = NULL;
+    kernel->row = malloc((kernel->width + kernel->height) * sizeof(double));
+    if (!kernel->row) {
+        perror("Error allocating filter kernel.");
         return false;
     }
+    kernel->col = kernel->row + kernel->width;
+    normalize_weights(kernel->row, row_kernel);
+    normalize_weights(kernel->col, col_kernel);
+    return true;
+}
 
-    double total_weight = 0;
-    for (int i = 0; i < kernel->height; i++) {
-        for (int j = 0; j < kernel->width; j++) {
-            total_weight += fabs(matrix_at(kernel, i, j));
-        }
-    }
-
-    for (int row = 0; row < src->height; ++row) {
-        for (int col = 0; col < src->width; ++col) {
-            double *pixel_dest = pixel_at(dest, col, row);
-            for (int i = 0; i < kernel->height; ++i) {
-                int row_i = row - (i - kernel->height / 2);
-                if (row_i < 0 || row_i >= src->height) continue;
-                for (int j = 0; j < kernel->width; ++j) {
-                    int col_j = col - (j - kernel->width / 2);
-                    if (col_j < 0 || col_j >= src->height) continue;
-                    double *pixel_src = pixel_at(src, col_j, row_i);
-                    for (int c = 0; c < src->channels; ++c) {
-                        *(pixel_dest+c) += *(pixel_src+c) * matrix_at(kernel, i, j) / total_weight;
-                    }
+/// @brief Prepares a kernel, factored into two 1D passes when it has rank 1
+/// @param kernel Kernel
+/// @param matrix Matrix filter
+/// @return true if preparation ok
+static bool init_kernel(FilterKernel *kernel, Matrix *matrix)
+{
+    Matrix row_kernel, col_kernel;
+    if (matrix->width > 1 && matrix->height > 1 && factor_kernel(matrix, &row_kernel, &col_kernel)) {
+        bool rc = init_separable_kernel(kernel, &row_kernel, &col_kernel);
+        free_matrix(&row_kernel);
+        free_matrix(&col_kernel);
+        return rc;
+    }
+    kernel->width = matrix->width;
+    kernel->height = matrix->height;
+    kernel->row = kernel->col = NULL;
+    kernel->weights = malloc((size_t)kernel->width * kernel->height * sizeof(double));
+    if (!kernel->weights) {
+        perror("Error allocating filter kernel.");
+        return false;
+    }
+    normalize_weights(kernel->weights, matrix);
+    return true;
+}
+
+/// @brief Frees the weights of a kernel
+/// @param kernel Kernel
+static void free_kernel(FilterKernel *kernel)
+{
+    free(kernel->weights);
+    free(kernel->row);
+}
+
+bool factor_kernel(Matrix *kernel, Matrix *row_kernel, Matrix *col_kernel)
+{
+    // a rank 1 kernel is the product of the column and the row of its largest coefficient
+    int width = kernel->width, height = kernel->height;
+    const double *data = kernel->data;
+    int pivot_i = 0, pivot_j = 0;
+    for (int i = 0; i < height; ++i) {
+        for (int j = 0; j < width; ++j) {
+            if (fabs(data[i * width + j]) > fabs(data[pivot_i * width + pivot_j])) {
+                pivot_i = i;
+                pivot_j = j;
+            }
+        }
+    }
+    double pivot = data[pivot_i * width + pivot_j];
+    if (pivot == 0) {
+        return false;
+    }
+    double tolerance = RANK1_TOLERANCE * fabs(pivot);
+    for (int i = 0; i < height; ++i) {
+        for (int j = 0; j < width; ++j) {
+            double product = data[i * width + pivot_j] * data[pivot_i * width + j] / pivot;
+            if (fabs(data[i * width + j] - product) > tolerance) {
+                return false;
+            }
+        }
+    }
+
+    *row_kernel = zero_matrix(1, width);
+    *col_kernel = zero_matrix(height, 1);
+    if (!row_kernel->data || !col_kernel->data) {
+        perror("Error allocating kernel factors.");
+        free_matrix(row_kernel);
+        free_matrix(col_kernel);
+        return false;
+    }
+    for (int j = 0; j < width; ++j) {
+        row_kernel->data[j] = data[pivot_i * width + j] / pivot;
+    }
+    for (int i = 0; i < height; ++i) {
+        col_kernel->data[i] = data[i * width + pivot_j];
+    }
+    return true;
+}
+
+/// @brief Maps a row or column index into [0, n) according to a border mode
+/// @param i Index
+/// @param n Number of rows or columns
+/// @param border Border mode
+/// @return Index inside, -1 for a zero
+static int border_index(int i, int n, BORDER_MODE border)
+{
+    if (i >= 0 && i < n) {
+        return i;
+    }
+    switch (border) {
+    case BORDER_CLAMP:
+        return i < 0 ? 0 : n - 1;
+    case BORDER_REFLECT: {
+        if (n == 1) return 0;
+        int period = 2 * (n - 1);
+        i %= period;
+        if (i < 0) i += period;
+        return i < n ? i : period - i;
+    }
+    case BORDER_WRAP:
+        i %= n;
+        return i < 0 ? i + n : i;
+    case BORDER_ZERO: [[fallthrough]];
+    default:
+        return -1;
+    }
+}
+
+/// @brief Reads a source row between halos of columns outside the image
+/// @param src Source view
+/// @param row Row to read
+/// @param padded Row with halos ((left + width + right) * channels values)
+/// @param left Number of columns before the row
+/// @param right Number of columns after the row
+/// @param border Border mode giving the halos
+static void read_padded_row(const ImageView *src, int row, double *padded, int left, int right, BORDER_MODE border)
+{
+    int width = src->width, channels = src->channels;
+    double *inside = padded + (size_t)left * channels;
+    read_view_row(src, row, inside);
+    for (int x = -left; x < width + right; x = x == -1 ? width : x + 1) {
+        double *pixel = inside + (ptrdiff_t)x * channels;
+        int col = border_index(x, width, border);
+        for (int c = 0; c < channels; ++c) {
+            pixel[c] = col < 0 ? 0 : inside[(size_t)col * channels + c];
+        }
+    }
+}
+
+/// @brief Convolves a view with a kernel, row by row, into another view of the same width
+/// @note Source rows are widened to double in a ring of kernel->height rows,
+/// so the source is never converted as a whole. Each row is read between halos
+/// given by the border mode, so that every output sample is the same weighted sum
+/// of kernel->height * kernel->width samples, without bound checks: the vector unit
+/// computes whole rows at once. A separable kernel filters each row horizontally as
+/// it enters the ring, leaving a single column of weights per output row.
+/// @param dest Filtered view
+/// @param src Source view
+/// @param kernel Prepared kernel
+/// @param offset Source row matching the first row of dest
+/// @param border Border mode
+/// @return true if filtering ok
+static bool convolve_view(const ImageView *dest, const ImageView *src, const FilterKernel *kernel, int offset,
+                          BORDER_MODE border)
+{
+    int kh = kernel->height, kw = kernel->width;
+    bool separable = kernel->weights == NULL;
+    int width = src->width, height = src->height, channels = src->channels;
+    // output column col reads columns col - left to col + right
+    int left = kw - 1 - kw / 2, right = kw / 2;
+    size_t row_size = (size_t)width * channels;
+    size_t padded_size = row_size + (size_t)(kw - 1) * channels;
+    size_t slot_size = separable ? row_size : padded_size;
+    size_t n_terms = separable ? (size_t)kh + kw : (size_t)kh * kw;
+    double *ring = malloc((kh * slot_size + row_size + padded_size + n_terms) * sizeof(double));
+    const double **terms = malloc(n_terms * sizeof(double *));
+    if (!ring || !terms) {
+        perror("Error allocating filter rows.");
+        free(ring);
+        free(terms);
+        return false;
+    }
+    double *acc = ring + kh * slot_size;
+    double *line = acc + row_size;
+    double *weights = line + padded_size;
+
+    // horizontal pass of a separable kernel: tap j reads column col + kw/2 - j
+    const double **row_terms = terms + kh;
+    for (int j = 0; j < kw && separable; ++j) {
+        row_terms[j] = line + (size_t)(kw - 1 - j) * channels;
+    }
+
+    // virtual rows, outside the source, are mapped by the border mode
+    int loaded = offset - (kh - 1 - kh / 2);
+    for (int dest_row = 0; dest_row < (int)dest->height; ++dest_row) {
+        int row = dest_row + offset;
+        // fetch the source rows entering the kernel window
+        while (loaded <= row + kh / 2) {
+            int source_row = border_index(loaded, height, border);
+            double *slot = ring + (size_t)(((loaded % kh) + kh) % kh) * slot_size;
+            if (source_row >= 0 && separable) {
+                read_padded_row(src, source_row, line, left, right, border);
+                weighted_sum(slot, row_terms, kernel->row, kw, row_size);
+            } else if (source_row >= 0) {
+                read_padded_row(src, source_row, slot, left, right, border);
+            }
+            ++loaded;
+        }
+
+        // rows reading zeros are left out of the sum
+        unsigned int n = 0;
+        for (int i = 0; i < kh; ++i) {
+            int row_i = row + kh / 2 - i;
+            if (border_index(row_i, height, border) < 0) continue;
+            const double *slot = ring + (size_t)(((row_i % kh) + kh) % kh) * slot_size;
+            if (separable) {
+                terms[n] = slot;
+                weights[n++] = kernel->col[i];
+                continue;
+            }
+            for (int j = 0; j < kw; ++j) {
+                terms[n] = slot + (size_t)(kw - 1 - j) * channels;
+                weights[n++] = kernel->weights[i * kw + j];
+            }
+        }
+        weighted_sum(acc, terms, weights, n, row_size);
+        write_view_row(dest, dest_row, acc);
+    }
+    free(ring);
+    free(terms);
+    return true;
+}
+
+/// @brief Convolves a window into a band, plane by plane for planar bands
+/// @param dest Filtered band (allocated)
+/// @param window Source rows
+/// @param kernel Prepared kernel
+/// @param offset Row of the window matching the first row of dest
+/// @param border Border mode
+/// @return true if filtering ok
+static bool convolve_band(Image *dest, const ImageView *window, const FilterKernel *kernel, int offset,
+                          BORDER_MODE border)
+{
+    bool rc = true;
+    ImageView dest_view = image_view(dest);
+    if (dest->layout == LAYOUT_PLANAR) {
+        for (unsigned int c = 0; c < window->channels && rc; ++c) {
+            ImageView src_plane = plane_view(window, c);
+            ImageView dest_plane = plane_view(&dest_view, c);
+            rc = convolve_view(&dest_plane, &src_plane, kernel, offset, border);
+        }
+    } else {
+        rc = convolve_view(&dest_view, window, kernel, offset, border);
+    }
+    return rc;
+}
+
+/// @brief State shared by the tasks of a convolution by strips of rows
+typedef struct ConvolutionStrips {
+    const ImageView *dest;
+    const ImageView *src;
+    const FilterKernel *kernel;
+    BORDER_MODE border;
+    unsigned int rows_per_task;
+    bool failed;
+} ConvolutionStrips;
+
+/// @brief Convolves a strip of rows, reading the halo rows around it from the source
+/// @param task Index of the task
+/// @param params Convolution
+static void convolve_strip(unsigned int task, void *params)
+{
+    ConvolutionStrips *conv = params;
+    unsigned int first = task * conv->rows_per_task;
+    unsigned int count = first + conv->rows_per_task < conv->dest->height ? conv->rows_per_task
+                                                                           : conv->dest->height - first;
+    ImageView strip;
+    crop_view(&strip, conv->dest, 0, first, conv->dest->width, count);
+    if (!convolve_view(&strip, conv->src, conv->kernel, first, conv->border)) {
+        conv->failed = true;
+    }
+}
+
+/// @brief Convolves a view into an image of its size, strips of rows running in parallel
+/// @param dest Filtered image (allocated), planar images being filtered plane by plane
+/// @param src Source view
+/// @param kernel Prepared kernel
+/// @param border Border mode
+/// @return true if filtering ok
+static bool convolve_parallel(Image *dest, const ImageView *src, const FilterKernel *kernel, BORDER_MODE border)
+{
+    unsigned int threads = parallel_threads();
+    unsigned int rows_per_task = (dest->height + 4 * threads - 1) / (4 * threads);
+    unsigned int tasks = rows_per_task ? (dest->height + rows_per_task - 1) / rows_per_task : 0;
+    ImageView dest_view = image_view(dest);
+    bool planar = dest->layout == LAYOUT_PLANAR;
+    bool rc = true;
+    for (unsigned int c = 0; c < (planar ? src->channels : 1) && rc; ++c) {
+        ImageView src_plane = planar ? plane_view(src, c) : *src;
+        ImageView dest_plane = planar ? plane_view(&dest_view, c) : dest_view;
+        ConvolutionStrips conv = {.dest = &dest_plane, .src = &src_plane, .kernel = kernel, .border = border,
+                                  .rows_per_task = rows_per_task};
+        parallel_for(tasks, convolve_strip, &conv);
+        rc = !conv.failed;
+    }
+    return rc;
+}
+
+bool filter_band(Image *dest, const ImageView *window, Matrix *kernel, int offset)
+{
+    FilterKernel prepared;
+    if (!init_kernel(&prepared, kernel)) {
+        return false;
+    }
+    bool rc = convolve_band(dest, window, &prepared, offset, BORDER_ZERO);
+    free_kernel(&prepared);
+    return rc;
+}
+
+/// @brief Spectrum of a kernel, padded to a transform size
+typedef struct KernelSpectrum {
+    int kernel_width;
+    int kernel_height;
+    unsigned int width;         // transform size
+    unsigned int height;
+    double *weights;            // normalized kernel weights, identifying the spectrum
+    double complex *spectrum;   // height x width, scaled by the inverse transform factor
+    unsigned int users;         // holders of the spectrum, the cache being one of them
+    unsigned long last_use;
+} KernelSpectrum;
+
+static KernelSpectrum *spectrum_cache[SPECTRUM_CACHE_ENTRIES];
+static unsigned long spectrum_clock;
+static pthread_mutex_t spectrum_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// @brief State shared by the tasks of a convolution by FFT
+typedef struct FftConvolution {
+    const ImageView *src;           // source rows (NULL for a kernel spectrum)
+    const ImageView *dest;
+    const KernelSpectrum *kernel;   // spectrum to multiply by (NULL for a kernel spectrum)
+    FftPlan row_plan;
+    FftPlan col_plan;
+    double complex *grids;          // one grid per pair of channels, a channel in each part
+    unsigned int pairs;
+    unsigned int width;             // transform size
+    unsigned int height;
+    unsigned int rows_per_task;
+    bool failed;                    // a task could not allocate its buffers
+} FftConvolution;
+
+/// @brief Returns the normalized weights of a kernel as a height x width table
+/// @param weights Table (kernel->width * kernel->height values)
+/// @param kernel Prepared kernel
+static void kernel_weights(double *weights, const FilterKernel *kernel)
+{
+    for (int i = 0; i < kernel->height; ++i) {
+        for (int j = 0; j < kernel->width; ++j) {
+            weights[i * kernel->width + j] = kernel->weights ? kernel->weights[i * kernel->width + j]
+                                                             : kernel->col[i] * kernel->row[j];
+        }
+    }
+}
+
+/// @brief Transforms source rows into the first rows of the grids (a channel in each part)
+/// @param task Index of the task
+/// @param params Convolution
+static void fft_source_rows(unsigned int task, void *params)
+{
+    FftConvolution *conv = params;
+    const ImageView *src = conv->src;
+    unsigned int channels = src->channels, width = conv->width;
+    double *row = malloc((size_t)src->width * channels * sizeof(double));
+    double complex *work = malloc(width * sizeof(double complex));
+    if (!row || !work) {
+        conv->failed = true;
+        free(row);
+        free(work);
+        return;
+    }
+    unsigned int first = task * conv->rows_per_task;
+    unsigned int last = first + conv->rows_per_task < src->height ? first + conv->rows_per_task : src->height;
+    for (unsigned int y = first; y < last; ++y) {
+        read_view_row(src, y, row);
+        for (unsigned int p = 0; p < conv->pairs; ++p) {
+            double complex *line = conv->grids + ((size_t)p * conv->height + y) * width;
+            unsigned int c = 2 * p;
+            for (unsigned int x = 0; x < src->width; ++x) {
+                const double *pixel = row + (size_t)x * channels;
+                line[x] = c + 1 < channels ? pixel[c] + I * pixel[c + 1] : pixel[c];
+            }
+            memset(line + src->width, 0, (width - src->width) * sizeof(double complex));
+            fft(&conv->row_plan, line, work, false);
+        }
+    }
+    free(row);
+    free(work);
+}
+
+/// @brief Transforms a block of columns of the grids, then multiplies them by the kernel
+/// spectrum and transforms them back (if there is a kernel)
+/// @note Columns are gathered into contiguous sequences, reading whole cache lines
+/// @param task Index of the task
+/// @param params Convolution
+static void fft_columns(unsigned int task, void *params)
+{
+    FftConvolution *conv = params;
+    unsigned int width = conv->width, height = conv->height;
+    unsigned int first = task * FFT_COLUMN_BLOCK;
+    unsigned int count = first + FFT_COLUMN_BLOCK < width ? FFT_COLUMN_BLOCK : width - first;
+    double complex *columns = malloc(((size_t)count + 1) * height * sizeof(double complex));
+    if (!columns) {
+        conv->failed = true;
+        return;
+    }
+    double complex *work = columns + (size_t)count * height;
+    for (unsigned int p = 0; p < conv->pairs; ++p) {
+        double complex *grid = conv->grids + (size_t)p * height * width;
+        for (unsigned int y = 0; y < height; ++y) {
+            for (unsigned int b = 0; b < count; ++b) {
+                columns[(size_t)b * height + y] = grid[(size_t)y * width + first + b];
+            }
+        }
+        for (unsigned int b = 0; b < count; ++b) {
+            double complex *column = columns + (size_t)b * height;
+            fft(&conv->col_plan, column, work, false);
+            if (conv->kernel) {
+                const double complex *spectrum = conv->kernel->spectrum + first + b;
+                for (unsigned int y = 0; y < height; ++y) {
+                    column[y] *= spectrum[(size_t)y * width];
                 }
+                fft(&conv->col_plan, column, work, true);
+            }
+        }
+        for (unsigned int y = 0; y < height; ++y) {
+            for (unsigned int b = 0; b < count; ++b) {
+                grid[(size_t)y * width + first + b] = columns[(size_t)b * height + y];
+            }
+        }
+    }
+    free(columns);
+}
+
+/// @brief Transforms back the grid rows of destination rows and writes them
+/// @param task Index of the task
+/// @param params Convolution
+static void fft_dest_rows(unsigned int task, void *params)
+{
+    FftConvolution *conv = params;
+    const ImageView *dest = conv->dest;
+    unsigned int channels = dest->channels, width = conv->width;
+    int row_offset = conv->kernel->kernel_height / 2, col_offset = conv->kernel->kernel_width / 2;
+    double *row = malloc((size_t)dest->width * channels * sizeof(double));
+    double complex *work = malloc(width * sizeof(double complex));
+    if (!row || !work) {
+        conv->failed = true;
+        free(row);
+        free(work);
+        return;
+    }
+    unsigned int first = task * conv->rows_per_task;
+    unsigned int last = first + conv->rows_per_task < dest->height ? first + conv->rows_per_task : dest->height;
+    for (unsigned int y = first; y < last; ++y) {
+        for (unsigned int p = 0; p < conv->pairs; ++p) {
+            // the convolution of the padded image is shifted by the kernel centre
+            double complex *line = conv->grids + ((size_t)p * conv->height + y + row_offset) * width;
+            fft(&conv->row_plan, line, work, true);
+            unsigned int c = 2 * p;
+            for (unsigned int x = 0; x < dest->width; ++x) {
+                double *pixel = row + (size_t)x * channels;
+                pixel[c] = creal(line[x + col_offset]);
+                if (c + 1 < channels) pixel[c + 1] = cimag(line[x + col_offset]);
+            }
+        }
+        write_view_row(dest, y, row);
+    }
+    free(row);
+    free(work);
+}
+
+/// @brief Frees a kernel spectrum
+/// @param spectrum Spectrum
+static void free_spectrum(KernelSpectrum *spectrum)
+{
+    free(spectrum->weights);
+    free(spectrum->spectrum);
+    free(spectrum);
+}
+
+/// @brief Computes the spectrum of a kernel
+/// @param conv Convolution (plans and transform size set)
+/// @param kernel Prepared kernel
+/// @param weights Normalized weights of the kernel (kept by the spectrum)
+/// @return Spectrum (one user), NULL if computation failed
+static KernelSpectrum * compute_spectrum(FftConvolution *conv, const FilterKernel *kernel, double *weights)
+{
+    unsigned int width = conv->width, height = conv->height;
+    KernelSpectrum *spectrum = malloc(sizeof(KernelSpectrum));
+    double complex *grid = calloc((size_t)width * height, sizeof(double complex));
+    double complex *work = malloc(width * sizeof(double complex));
+    if (!spectrum || !grid || !work) {
+        perror("Error allocating kernel spectrum.");
+        free(spectrum);
+        free(grid);
+        free(work);
+        return NULL;
+    }
+    // the inverse transform is not scaled: its factor is folded into the kernel
+    double scale = 1.0 / ((double)width * height);
+    for (int i = 0; i < kernel->height; ++i) {
+        double complex *line = grid + (size_t)i * width;
+        for (int j = 0; j < kernel->width; ++j) {
+            line[j] = weights[i * kernel->width + j] * scale;
+        }
+        fft(&conv->row_plan, line, work, false);
+    }
+    free(work);
+
+    FftConvolution kernel_conv = *conv;
+    kernel_conv.grids = grid;
+    kernel_conv.pairs = 1;
+    kernel_conv.kernel = NULL;
+    kernel_conv.failed = false;
+    parallel_for((width + FFT_COLUMN_BLOCK - 1) / FFT_COLUMN_BLOCK, fft_columns, &kernel_conv);
+    if (kernel_conv.failed) {
+        perror("Error allocating kernel spectrum.");
+        free(spectrum);
+        free(grid);
+        return NULL;
+    }
+
+    spectrum->kernel_width = kernel->width;
+    spectrum->kernel_height = kernel->height;
+    spectrum->width = width;
+    spectrum->height = height;
+    spectrum->weights = weights;
+    spectrum->spectrum = grid;
+    spectrum->users = 1;
+    return spectrum;
+}
+
+/// @brief Gives back a spectrum, freeing it once neither the cache nor any convolution holds it
+/// @param spectrum Spectrum
+static void release_spectrum(KernelSpectrum *spectrum)
+{
+    pthread_mutex_lock(&spectrum_lock);
+    bool unused = --spectrum->users == 0;
+    pthread_mutex_unlock(&spectrum_lock);
+    if (unused) {
+        free_spectrum(spectrum);
+    }
+}
+
+/// @brief Returns the spectrum of a kernel at a transform size, from the cache if possible
+/// @note Spectra are cached by kernel weights and transform size (least recently used first out)
+/// @param conv Convolution (plans and transform size set)
+/// @param kernel Prepared kernel
+/// @return Spectrum, to be released, NULL if computation failed
+static KernelSpectrum * acquire_spectrum(FftConvolution *conv, const FilterKernel *kernel)
+{
+    size_t n_weights = (size_t)kernel->width * kernel->height;
+    double *weights = malloc(n_weights * sizeof(double));
+    if (!weights) {
+        perror("Error allocating kernel spectrum.");
+        return NULL;
+    }
+    kernel_weights(weights, kernel);
+
+    pthread_mutex_lock(&spectrum_lock);
+    for (unsigned int k = 0; k < SPECTRUM_CACHE_ENTRIES; ++k) {
+        KernelSpectrum *cached = spectrum_cache[k];
+        if (cached && cached->width == conv->width && cached->height == conv->height
+            && cached->kernel_width == kernel->width && cached->kernel_height == kernel->height
+            && memcmp(cached->weights, weights, n_weights * sizeof(double)) == 0) {
+            ++cached->users;
+            cached->last_use = ++spectrum_clock;
+            pthread_mutex_unlock(&spectrum_lock);
+            free(weights);
+            return cached;
+        }
+    }
+    pthread_mutex_unlock(&spectrum_lock);
+
+    KernelSpectrum *spectrum = compute_spectrum(conv, kernel, weights);
+    if (!spectrum) {
+        free(weights);
+        return NULL;
+    }
+    size_t bytes = (size_t)conv->width * conv->height * sizeof(double complex);
+    if (bytes > SPECTRUM_CACHE_BYTES) {
+        return spectrum;
+    }
+
+    // make room by evicting the least recently used spectra
+    pthread_mutex_lock(&spectrum_lock);
+    KernelSpectrum *evicted[SPECTRUM_CACHE_ENTRIES];
+    unsigned int n_evicted = 0;
+    for (;;) {
+        size_t cached_bytes = 0;
+        int free_slot = -1, oldest = -1;
+        for (unsigned int k = 0; k < SPECTRUM_CACHE_ENTRIES; ++k) {
+            KernelSpectrum *cached = spectrum_cache[k];
+            if (!cached) {
+                free_slot = k;
+                continue;
+            }
+            cached_bytes += (size_t)cached->width * cached->height * sizeof(double complex);
+            if (oldest < 0 || cached->last_use < spectrum_cache[oldest]->last_use) {
+                oldest = k;
             }
         }
+        if (free_slot >= 0 && cached_bytes + bytes <= SPECTRUM_CACHE_BYTES) {
+            spectrum->users++;
+            spectrum->last_use = ++spectrum_clock;
+            spectrum_cache[free_slot] = spectrum;
+            break;
+        }
+        KernelSpectrum *victim = spectrum_cache[oldest];
+        spectrum_cache[oldest] = NULL;
+        if (--victim->users == 0) {
+            evicted[n_evicted++] = victim;
+        }
+    }
+    pthread_mutex_unlock(&spectrum_lock);
+    for (unsigned int k = 0; k < n_evicted; ++k) {
+        free_spectrum(evicted[k]);
+    }
+    return spectrum;
+}
+
+/// @brief Estimates the cost of a convolution by FFT, in multiply-adds of the direct
+/// convolution per sample
+/// @note Kernel spectra are assumed to be cached
+/// @param src Source view
+/// @param kernel Prepared kernel
+/// @return Cost per sample
+static double fft_convolution_cost(const ImageView *src, const FilterKernel *kernel)
+{
+    double width = fft_size(src->width + kernel->width - 1);
+    double height = fft_size(src->height + kernel->height - 1);
+    double pairs = (src->channels + 1) / 2;
+    // forward and inverse transforms of the source rows, of every column
+    double operations = pairs * (2 * src->height * width * log2(width) + 2 * width * height * log2(height));
+    return FFT_COST_FACTOR * operations / ((double)src->width * src->height * src->channels);
+}
+
+/// @brief Convolves a view with a kernel through the Fourier domain, into a view of the same size
+/// @note Two channels are transformed at once, as the real and imaginary parts of a
+/// complex image, the kernel being real. The padding leaves room for the kernel, so
+/// the circular convolution reads zeros outside the source as the direct one does.
+/// @param dest Filtered view
+/// @param src Source view
+/// @param kernel Prepared kernel
+/// @return true if filtering ok
+static bool fft_convolve_view(const ImageView *dest, const ImageView *src, const FilterKernel *kernel)
+{
+    FftConvolution conv = {.src = src, .dest = dest, .pairs = (src->channels + 1) / 2};
+    conv.width = fft_size(src->width + kernel->width - 1);
+    conv.height = fft_size(src->height + kernel->height - 1);
+    if (!fft_plan(&conv.row_plan, conv.width)) {
+        return false;
+    }
+    if (!fft_plan(&conv.col_plan, conv.height)) {
+        free_fft_plan(&conv.row_plan);
+        return false;
+    }
+    KernelSpectrum *spectrum = acquire_spectrum(&conv, kernel);
+    // rows below the source are zeros
+    conv.grids = calloc((size_t)conv.pairs * conv.width * conv.height, sizeof(double complex));
+    bool rc = spectrum && conv.grids;
+    if (!conv.grids) {
+        perror("Error allocating transform.");
+    }
+
+    if (rc) {
+        conv.kernel = spectrum;
+        unsigned int threads = parallel_threads();
+        conv.rows_per_task = (src->height + 4 * threads - 1) / (4 * threads);
+        parallel_for((src->height + conv.rows_per_task - 1) / conv.rows_per_task, fft_source_rows, &conv);
+        if (!conv.failed) {
+            parallel_for((conv.width + FFT_COLUMN_BLOCK - 1) / FFT_COLUMN_BLOCK, fft_columns, &conv);
+        }
+        if (!conv.failed) {
+            parallel_for((dest->height + conv.rows_per_task - 1) / conv.rows_per_task, fft_dest_rows, &conv);
+        }
+        if (conv.failed) {
+            perror("Error allocating transform rows.");
+            rc = false;
+        }
+    }
+
+    if (spectrum) {
+        release_spectrum(spectrum);
+    }
+    free(conv.grids);
+    free_fft_plan(&conv.row_plan);
+    free_fft_plan(&conv.col_plan);
+    return rc;
+}
+
+/// @brief Allocates the result of a filter, of the size and layout of the source
+/// @note Planar sources give planar results, each plane being filtered as a
+/// contiguous single channel image
+/// @param dest Filtered image (uninitialized)
+/// @param src Source view
+/// @param depth Depth of the filtered image
+/// @return true if allocation ok
+static bool create_filtered_image(Image *dest, const ImageView *src, PIXEL_DEPTH depth)
+{
+    bool planar = src->channels > 1 && src->channel_stride != (ptrdiff_t)depth_size(src->depth);
+    if (planar) {
+        create_planar_image(dest, src->type, src->width, src->height, src->channels, depth);
+    } else {
+        create_image(dest, src->type, src->width, src->height, src->channels, depth);
+    }
+    if (!dest->data) {
+        perror("Error during image allocation.");
+        return false;
+    }
+    if (depth == src->depth) {
+        dest->maxval = src->maxval;
     }
     return true;
 }
 
+/// @brief Convolves a view with a kernel into an image of the given depth
+/// @param dest Filtered image (uninitialized)
+/// @param src Source view
+/// @param kernel Prepared kernel
+/// @param depth Depth of the filtered image
+/// @param border Border mode
+/// @return true if filtering ok
+static bool filter_to_depth(Image *dest, const ImageView *src, const FilterKernel *kernel, PIXEL_DEPTH depth,
+                            BORDER_MODE border)
+{
+    if (!create_filtered_image(dest, src, depth)) {
+        return false;
+    }
+    // direct, separable or Fourier domain (zero borders only), whichever costs least
+    double direct_cost = kernel->weights ? (double)kernel->width * kernel->height : kernel->width + kernel->height;
+    bool rc;
+    if (border == BORDER_ZERO && fft_convolution_cost(src, kernel) < direct_cost) {
+        ImageView dest_view = image_view(dest);
+        rc = fft_convolve_view(&dest_view, src, kernel);
+    } else {
+        rc = convolve_parallel(dest, src, kernel, border);
+    }
+    if (!rc) {
+        free_image(dest);
+    }
+    return rc;
+}
+
+bool filter_border_view(Image *dest, const ImageView *src, Matrix *kernel, BORDER_MODE border)
+{
+    FilterKernel prepared;
+    if (!init_kernel(&prepared, kernel)) {
+        return false;
+    }
+    bool rc = filter_to_depth(dest, src, &prepared, src->depth, border);
+    free_kernel(&prepared);
+    return rc;
+}
+
+bool filter_border(Image *dest, Image *src, Matrix *kernel, BORDER_MODE border)
+{
+    ImageView view = image_view(src);
+    return filter_border_view(dest, &view, kernel, border);
+}
+
+bool filter_view(Image *dest, const ImageView *src, Matrix *kernel)
+{
+    return filter_border_view(dest, src, kernel, BORDER_ZERO);
+}
+
+bool filter(Image *dest, Image *src, Matrix *kernel)
+{
+    ImageView view = image_view(src);
+    return filter_view(dest, &view, kernel);
+}
+
+bool fft_filter_view(Image *dest, const ImageView *src, Matrix *kernel)
+{
+    FilterKernel prepared;
+    if (!init_kernel(&prepared, kernel)) {
+        return false;
+    }
+    bool rc = create_filtered_image(dest, src, src->depth);
+    if (rc) {
+        ImageView dest_view = image_view(dest);
+        rc = fft_convolve_view(&dest_view, src, &prepared);
+        if (!rc) {
+            free_image(dest);
+        }
+    }
+    free_kernel(&prepared);
+    return rc;
+}
+
+bool fft_filter(Image *dest, Image *src, Matrix *kernel)
+{
+    ImageView view = image_view(src);
+    return fft_filter_view(dest, &view, kernel);
+}
+
+bool separable_filter_view(Image *dest, const ImageView *src, Matrix *row_kernel, Matrix *col_kernel)
+{
+    FilterKernel prepared;
+    if (!init_separable_kernel(&prepared, row_kernel, col_kernel)) {
+        return false;
+    }
+    bool rc = filter_to_depth(dest, src, &prepared, src->depth, BORDER_ZERO);
+    free_kernel(&prepared);
+    return rc;
+}
+
+bool separable_filter(Image *dest, Image *src, Matrix *row_kernel, Matrix *col_kernel)
+{
+    ImageView view = image_view(src);
+    return separable_filter_view(dest, &view, row_kernel, col_kernel);
+}
+
+static inline double gaussian1D(double x, double sigma)
+{
+    return 1.0/sqrt(2*M_PI*sigma*sigma) * exp(-pow(x,2)/2.0/sigma/sigma);
+}
+
 static inline double gaussian2D(double x, double y, double sigma)
 {
     return 1.0/sqrt(2*M_PI*sigma*sigma) * exp(-(pow(x,2)+pow(y,2))/2.0/sigma/sigma);
 }
 
-static Matrix create_gaussian_kernel(unsigned int kernel_size, double sigma)
+Matrix create_gaussian_kernel(unsigned int kernel_size, double sigma)
 {
     Matrix kernel = zero_matrix(kernel_size, kernel_size);
-    double ux = (double)kernel_size/2, uy = (double)kernel_size/2;
     for (int i = 0; i < kernel_size; ++i) {
         for (int j = 0; j < kernel_size; ++j) {
             int x = i - kernel_size/2;
@@ -59,47 +913,1076 @@ static Matrix create_gaussian_kernel(unsigned int kernel_size, double sigma)
     return kernel;
 }
 
-bool gaussian_filter(Image *dest, Image *src, unsigned int kernel_size, double sigma)
+/// @brief Creates a 1D gaussian kernel
+/// @param height Height of the kernel (1 for a row kernel)
+/// @param width Width of the kernel (1 for a column kernel)
+/// @param sigma Standard deviation of the gaussian function
+/// @return Gaussian kernel
+static Matrix create_gaussian_vector(unsigned int height, unsigned int width, double sigma)
+{
+    Matrix kernel = zero_matrix(height, width);
+    unsigned int size = height * width;
+    for (int k = 0; k < size; ++k) {
+        kernel.data[k] = gaussian1D((double)(k - (int)size/2), sigma);
+    }
+    return kernel;
+}
+
+/// @brief Coefficients of the recursive gaussian filter (Young - van Vliet)
+/// @note Each 1D pass runs a causal then an anti-causal third order recursion:
+/// w[n] = b x[n] + a0 w[n-1] + a1 w[n-2] + a2 w[n-3], then
+/// y[n] = b w[n] + a0 y[n+1] + a1 y[n+2] + a2 y[n+3]
+typedef struct RecursiveGaussian {
+    double b;           // input gain, making the gain of each recursion 1
+    double a[3];        // feedback coefficients
+    double m[3][3];     // y[N], y[N+1], y[N+2] from w[N-1], w[N-2], w[N-3] (zero border)
+} RecursiveGaussian;
+
+/// @brief Computes the coefficients of the recursive gaussian filter
+/// @param gaussian Coefficients
+/// @param sigma Standard deviation of the gaussian function (at least GAUSSIAN_IIR_MIN_SIGMA)
+/// @return true if computation ok
+static bool init_recursive_gaussian(RecursiveGaussian *gaussian, double sigma)
+{
+    double q = sigma >= 2.5 ? 0.98711 * sigma - 0.96330 : 3.97156 - 4.14554 * sqrt(1 - 0.26891 * sigma);
+    double b0 = 1.57825 + 2.44413 * q + 1.4281 * q * q + 0.422205 * q * q * q;
+    double b1 = 2.44413 * q + 2.85619 * q * q + 1.26661 * q * q * q;
+    double b2 = -(1.4281 * q * q + 1.26661 * q * q * q);
+    double b3 = 0.422205 * q * q * q;
+    const double *a = gaussian->a;
+    gaussian->a[0] = b1 / b0;
+    gaussian->a[1] = b2 / b0;
+    gaussian->a[2] = b3 / b0;
+    gaussian->b = 1 - (a[0] + a[1] + a[2]);
+
+    // Beyond the last sample the input is zero, so the causal output decays freely
+    // and the anti-causal pass starts from the end of that decay. Both are linear in the
+    // last three causal outputs: running them over the tail for each unit state gives
+    // the boundary matrix of Triggs and Sdika, whatever the sign conventions.
+    size_t tail = (size_t)(GAUSSIAN_IIR_TAIL * sigma) + 64;
+    double *w = malloc(tail * sizeof(double));
+    if (!w) {
+        perror("Error allocating gaussian coefficients.");
+        return false;
+    }
+    for (int j = 0; j < 3; ++j) {
+        double s[3] = {0, 0, 0};
+        s[j] = 1;
+        for (size_t n = 0; n < tail; ++n) {
+            w[n] = a[0] * s[0] + a[1] * s[1] + a[2] * s[2];
+            s[2] = s[1];
+            s[1] = s[0];
+            s[0] = w[n];
+        }
+        double y[3] = {0, 0, 0};
+        for (size_t n = tail; n-- > 0;) {
+            double v = gaussian->b * w[n] + a[0] * y[0] + a[1] * y[1] + a[2] * y[2];
+            y[2] = y[1];
+            y[1] = y[0];
+            y[0] = v;
+            if (n < 3) gaussian->m[n][j] = v;
+        }
+    }
+    free(w);
+    return true;
+}
+
+/// @brief Filters a line of samples in place with the recursive gaussian
+/// @param data First sample
+/// @param count Number of samples
+/// @param stride Distance between two samples
+/// @param gaussian Coefficients
+static void recursive_gaussian_line(double *data, size_t count, size_t stride, const RecursiveGaussian *gaussian)
+{
+    const double b = gaussian->b, a0 = gaussian->a[0], a1 = gaussian->a[1], a2 = gaussian->a[2];
+    // causal pass, zeros before the first sample
+    double w1 = 0, w2 = 0, w3 = 0;
+    for (size_t n = 0; n < count; ++n) {
+        double w = b * data[n * stride] + a0 * w1 + a1 * w2 + a2 * w3;
+        data[n * stride] = w;
+        w3 = w2;
+        w2 = w1;
+        w1 = w;
+    }
+    // anti-causal pass, from the state left by the zeros after the last sample
+    const double (*m)[3] = gaussian->m;
+    double y1 = m[0][0] * w1 + m[0][1] * w2 + m[0][2] * w3;
+    double y2 = m[1][0] * w1 + m[1][1] * w2 + m[1][2] * w3;
+    double y3 = m[2][0] * w1 + m[2][1] * w2 + m[2][2] * w3;
+    for (size_t n = count; n-- > 0;) {
+        double y = b * data[n * stride] + a0 * y1 + a1 * y2 + a2 * y3;
+        data[n * stride] = y;
+        y3 = y2;
+        y2 = y1;
+        y1 = y;
+    }
+}
+
+/// @brief Filters the columns of rows in place with the recursive gaussian
+/// @note Whole rows are combined at each step, so memory is walked contiguously
+/// @param rows Rows, one after the other
+/// @param row_size Number of samples of a row
+/// @param height Number of rows
+/// @param tail Three rows of scratch space
+/// @param gaussian Coefficients
+static void recursive_gaussian_columns(double *rows, size_t row_size, unsigned int height, double *tail,
+                                       const RecursiveGaussian *gaussian)
+{
+    const double b = gaussian->b;
+    const double *a = gaussian->a;
+    // causal pass, zero rows above the first one
+    for (unsigned int r = 0; r < height; ++r) {
+        double *restrict row = rows + r * row_size;
+        for (size_t k = 0; k < row_size; ++k) row[k] *= b;
+        for (unsigned int i = 0; i < 3 && i < r; ++i) {
+            const double *restrict w = rows + (r - 1 - i) * row_size;
+            for (size_t k = 0; k < row_size; ++k) row[k] += a[i] * w[k];
+        }
+    }
+
+    // rows y[N], y[N+1], y[N+2] below the image, from the last three causal rows
+    for (unsigned int t = 0; t < 3; ++t) {
+        double *restrict out = tail + t * row_size;
+        for (size_t k = 0; k < row_size; ++k) out[k] = 0;
+        for (unsigned int j = 0; j < 3 && j < height; ++j) {
+            const double *restrict w = rows + (height - 1 - j) * row_size;
+            double weight = gaussian->m[t][j];
+            for (size_t k = 0; k < row_size; ++k) out[k] += weight * w[k];
+        }
+    }
+
+    // anti-causal pass
+    for (unsigned int r = height; r-- > 0;) {
+        double *restrict row = rows + r * row_size;
+        for (size_t k = 0; k < row_size; ++k) row[k] *= b;
+        for (unsigned int i = 0; i < 3; ++i) {
+            unsigned int next = r + 1 + i;
+            const double *restrict y = next < height ? rows + next * row_size : tail + (next - height) * row_size;
+            for (size_t k = 0; k < row_size; ++k) row[k] += a[i] * y[k];
+        }
+    }
+}
+
+/// @brief Filters a view with the recursive gaussian, into a view of the same size
+/// @note The view is widened to double as a whole, the vertical pass needing every row
+/// @param dest Filtered view
+/// @param src Source view
+/// @param gaussian Coefficients
+/// @return true if filtering ok
+static bool recursive_gaussian_view(const ImageView *dest, const ImageView *src, const RecursiveGaussian *gaussian)
+{
+    unsigned int height = src->height, channels = src->channels;
+    size_t row_size = (size_t)src->width * channels;
+    double *rows = malloc(((size_t)height + 3) * row_size * sizeof(double));
+    if (!rows) {
+        perror("Error allocating filter rows.");
+        return false;
+    }
+    for (unsigned int r = 0; r < height; ++r) {
+        double *row = rows + r * row_size;
+        read_view_row(src, r, row);
+        for (unsigned int c = 0; c < channels; ++c) {
+            recursive_gaussian_line(row + c, src->width, channels, gaussian);
+        }
+    }
+    recursive_gaussian_columns(rows, row_size, height, rows + height * row_size, gaussian);
+    for (unsigned int r = 0; r < height; ++r) {
+        write_view_row(dest, r, rows + r * row_size);
+    }
+    free(rows);
+    return true;
+}
+
+/// @brief Applies the recursive gaussian to a view
+/// @param dest Filtered image (uninitialized)
+/// @param src Source view
+/// @param sigma Standard deviation of the gaussian function
+/// @return true if filtering ok
+static bool recursive_gaussian_filter(Image *dest, const ImageView *src, double sigma)
+{
+    if (sigma < GAUSSIAN_IIR_MIN_SIGMA) {
+        fprintf(stderr, "The recursive gaussian needs a sigma of at least %g (got %g)\n", GAUSSIAN_IIR_MIN_SIGMA, sigma);
+        return false;
+    }
+    RecursiveGaussian gaussian;
+    if (!init_recursive_gaussian(&gaussian, sigma) || !create_filtered_image(dest, src, src->depth)) {
+        return false;
+    }
+
+    bool rc = true;
+    ImageView dest_view = image_view(dest);
+    if (dest->layout == LAYOUT_PLANAR) {
+        for (unsigned int c = 0; c < src->channels && rc; ++c) {
+            ImageView src_plane = plane_view(src, c);
+            ImageView dest_plane = plane_view(&dest_view, c);
+            rc = recursive_gaussian_view(&dest_plane, &src_plane, &gaussian);
+        }
+    } else {
+        rc = recursive_gaussian_view(&dest_view, src, &gaussian);
+    }
+    if (!rc) {
+        free_image(dest);
+    }
+    return rc;
+}
+
+bool gaussian_filter_view(Image *dest, const ImageView *src, unsigned int kernel_size, double sigma, GAUSSIAN_MODE mode)
 {
-    Matrix kernel = create_gaussian_kernel(kernel_size, sigma);
-    bool rc = filter(dest, src, &kernel);
-    free_matrix(&kernel);
+    if (!(sigma > 0)) {
+        fprintf(stderr, "Invalid gaussian sigma %g\n", sigma);
+        return false;
+    }
+    if (kernel_size == 0) {
+        kernel_size = 2 * (unsigned int)ceil(3 * sigma) + 1;
+    }
+    // the recursion costs the same whatever sigma, but stands for the whole gaussian:
+    // it replaces kernels long enough to hold it only
+    if (mode == GAUSSIAN_AUTO) {
+        bool whole = kernel_size >= 6 * sigma;
+        mode = sigma >= GAUSSIAN_IIR_SIGMA && whole ? GAUSSIAN_IIR : GAUSSIAN_FIR;
+    }
+    if (mode == GAUSSIAN_IIR) {
+        return recursive_gaussian_filter(dest, src, sigma);
+    }
+    if (mode == GAUSSIAN_PYRAMID) {
+        return pyramid_gaussian_filter_view(dest, src, sigma);
+    }
+
+    // the gaussian is the product of a row and a column gaussian
+    Matrix row_kernel = create_gaussian_vector(1, kernel_size, sigma);
+    Matrix col_kernel = create_gaussian_vector(kernel_size, 1, sigma);
+    bool rc = separable_filter_view(dest, src, &row_kernel, &col_kernel);
+    free_matrix(&row_kernel);
+    free_matrix(&col_kernel);
     return rc;
 }
 
-bool sobel_filter(Image *grad_mag, Image *grad_angle, Image *src)
+bool gaussian_filter(Image *dest, Image *src, unsigned int kernel_size, double sigma, GAUSSIAN_MODE mode)
+{
+    ImageView view = image_view(src);
+    return gaussian_filter_view(dest, &view, kernel_size, sigma, mode);
+}
+
+/// @brief State shared by the tasks of a Sobel gradient
+typedef struct SobelGradient {
+    const ImageView *src;       // source rows
+    const ImageView *outputs;   // magnitude, angle, x and y derivatives
+    bool wanted[4];             // outputs to compute
+    unsigned int height;        // rows of the outputs
+    int offset;                 // source row matching the first output row
+    unsigned int rows_per_task;
+    bool failed;                // a task could not allocate its buffers
+} SobelGradient;
+
+/// @brief Computes the Sobel derivatives of a row from the three rows around it
+/// @note The 3x3 kernels are the products of a [1 2 1] smoothing and a [1 0 -1] difference:
+/// vertical sums and differences are taken once per column, then combined along the row.
+/// Samples of a pixel are channels apart, so every channel is computed in the same sweep.
+/// @param gx Horizontal derivatives (width * channels values)
+/// @param gy Vertical derivatives
+/// @param up Row above, between single pixel zero halos ((width + 2) * channels values)
+/// @param mid Row
+/// @param down Row below
+/// @param sum Scratch row of the padded size
+/// @param diff Scratch row of the padded size
+/// @param row_size Number of samples of a row
+/// @param channels Number of channels
+static inline void sobel_derivatives(double *restrict gx, double *restrict gy, const double *restrict up,
+                                     const double *restrict mid, const double *restrict down,
+                                     double *restrict sum, double *restrict diff, size_t row_size, size_t channels)
+{
+    for (size_t k = 0; k < row_size + 2 * channels; ++k) {
+        sum[k] = up[k] + 2 * mid[k] + down[k];
+        diff[k] = down[k] - up[k];
+    }
+    // weights divided by the sum of their absolute values (8), as filter() does
+    for (size_t k = 0; k < row_size; ++k) {
+        gx[k] = 0.125 * (sum[k] - sum[k + 2 * channels]);
+        gy[k] = 0.125 * (diff[k] + 2 * diff[k + channels] + diff[k + 2 * channels]);
+    }
+}
+
+/// @brief Computes the Sobel gradient of a strip of rows
+/// @param task Index of the task
+/// @param params Gradient
+static void sobel_rows(unsigned int task, void *params)
+{
+    SobelGradient *grad = params;
+    const ImageView *src = grad->src;
+    size_t channels = src->channels;
+    size_t row_size = (size_t)src->width * channels;
+    size_t padded_size = row_size + 2 * channels;
+    // three source rows, the vertical sums and differences, then one row per output
+    double *buffer = malloc((5 * padded_size + 4 * row_size) * sizeof(double));
+    if (!buffer) {
+        grad->failed = true;
+        return;
+    }
+    double *sum = buffer + 3 * padded_size;
+    double *diff = sum + padded_size;
+    double *rows[4];
+    for (int i = 0; i < 4; ++i) {
+        rows[i] = diff + padded_size + i * row_size;
+    }
+
+    int first = task * grad->rows_per_task;
+    int last = first + grad->rows_per_task < grad->height ? first + grad->rows_per_task : grad->height;
+    int loaded = first + grad->offset - 1;
+    for (int dest_row = first; dest_row < last; ++dest_row) {
+        int row = dest_row + grad->offset;
+        // rows outside the source are zeros
+        while (loaded <= row + 1) {
+            double *slot = buffer + (size_t)(loaded + 1) % 3 * padded_size;
+            if (loaded >= 0 && loaded < (int)src->height) {
+                read_padded_row(src, loaded, slot, 1, 1, BORDER_ZERO);
+            } else {
+                memset(slot, 0, padded_size * sizeof(double));
+            }
+            ++loaded;
+        }
+        const double *up = buffer + (size_t)row % 3 * padded_size;
+        const double *mid = buffer + (size_t)(row + 1) % 3 * padded_size;
+        const double *down = buffer + (size_t)(row + 2) % 3 * padded_size;
+        // a single channel gets constant offsets
+        if (channels == 1) {
+            sobel_derivatives(rows[2], rows[3], up, mid, down, sum, diff, row_size, 1);
+        } else {
+            sobel_derivatives(rows[2], rows[3], up, mid, down, sum, diff, row_size, channels);
+        }
+        polar_coordinates(grad->wanted[0] ? rows[0] : NULL, grad->wanted[1] ? rows[1] : NULL,
+                          rows[2], rows[3], row_size);
+        for (int i = 0; i < 4; ++i) {
+            if (grad->wanted[i]) write_view_row(&grad->outputs[i], dest_row, rows[i]);
+        }
+    }
+    free(buffer);
+}
+
+/// @brief Computes the Sobel gradient of rows of a view, in parallel strips
+/// @param outputs Views of the magnitude, angle, x and y derivatives
+/// @param wanted Outputs to compute
+/// @param src Source view
+/// @param height Number of output rows
+/// @param offset Source row matching the first output row
+/// @return true if computation ok
+static bool sobel_view(const ImageView *outputs, const bool *wanted, const ImageView *src,
+                       unsigned int height, int offset)
+{
+    SobelGradient grad = {.src = src, .outputs = outputs, .height = height, .offset = offset};
+    for (int i = 0; i < 4; ++i) {
+        grad.wanted[i] = wanted[i];
+    }
+    unsigned int threads = parallel_threads();
+    grad.rows_per_task = (height + 4 * threads - 1) / (4 * threads);
+    if (height > 0) {
+        parallel_for((height + grad.rows_per_task - 1) / grad.rows_per_task, sobel_rows, &grad);
+    }
+    if (grad.failed) {
+        perror("Error allocating Sobel rows.");
+    }
+    return !grad.failed;
+}
+
+/// @brief Computes the Sobel gradient into allocated images, plane by plane for planar images
+/// @param images Magnitude, angle, x and y derivatives (NULL if not wanted), of the same size and layout
+/// @param src Source rows
+/// @param offset Source row matching the first row of the images
+/// @return true if computation ok
+static bool sobel_images(Image **images, const ImageView *src, int offset)
 {
-    Matrix sobel_x = create_matrix(3, 3, (double[3][3]){
-        {-1, 0, 1},
-        {-2, 0, 2},
-        {-1, 0, 1}
-    });
-    Matrix sobel_y = create_matrix(3, 3, (double[3][3]){
-        {1, 2, 1},
-        {0, 0, 0},
-        {-1, -2, -1}
-    });
-
-    Image Ix, Iy, Ix_sq, Iy_sq, dI_sq, I_div;
+    ImageView views[4];
+    bool wanted[4];
+    const Image *first = NULL;
+    for (int i = 0; i < 4; ++i) {
+        wanted[i] = images[i] != NULL;
+        if (wanted[i]) {
+            views[i] = image_view(images[i]);
+            if (!first) first = images[i];
+        }
+    }
+    if (!first) {
+        return true;
+    }
+    if (first->layout != LAYOUT_PLANAR) {
+        return sobel_view(views, wanted, src, first->height, offset);
+    }
     bool rc = true;
-    rc = filter(&Ix, src, &sobel_x) && rc;
-    rc = filter(&Iy, src, &sobel_y) && rc;
-    rc = multiply_images(&Ix_sq, &Ix, &Ix) && rc;
-    rc = multiply_images(&Iy_sq, &Iy, &Iy) && rc;
-    rc = add_images(&dI_sq, &Ix_sq, &Iy_sq) && rc;
-    rc = func_image(grad_mag, &dI_sq, &sqrt);
-
-    rc = divide_images(&I_div, &Iy, &Ix);
-    rc = func_image(grad_angle, &I_div, &atan);
-    
-    // free
-    free_image(&Ix);
-    free_image(&Iy);
-    free_image(&Ix_sq);
-    free_image(&Iy_sq);
-    free_image(&dI_sq);
-    free_matrix(&sobel_x);
-    free_matrix(&sobel_y);
+    for (unsigned int c = 0; c < src->channels && rc; ++c) {
+        ImageView planes[4];
+        for (int i = 0; i < 4; ++i) {
+            if (wanted[i]) planes[i] = plane_view(&views[i], c);
+        }
+        ImageView src_plane = plane_view(src, c);
+        rc = sobel_view(planes, wanted, &src_plane, first->height, offset);
+    }
+    return rc;
+}
+
+bool sobel_gradient(Image *grad_mag, Image *grad_angle, Image *grad_x, Image *grad_y, const ImageView *src)
+{
+    // derivatives are signed: keep them in floating point whatever the source depth
+    Image *images[4] = {grad_mag, grad_angle, grad_x, grad_y};
+    int created = 0;
+    while (created < 4 && (!images[created] || create_filtered_image(images[created], src, DEPTH_F32))) {
+        ++created;
+    }
+    bool rc = created == 4 && sobel_images(images, src, 0);
+    if (!rc) {
+        for (int i = 0; i < created; ++i) {
+            if (images[i]) free_image(images[i]);
+        }
+    }
+    return rc;
+}
+
+bool sobel_filter(Image *grad_mag, Image *grad_angle, Image *src)
+{
+    ImageView view = image_view(src);
+    return sobel_filter_view(grad_mag, grad_angle, &view);
+}
+
+bool sobel_filter_view(Image *grad_mag, Image *grad_angle, const ImageView *src)
+{
+    return sobel_gradient(grad_mag, grad_angle, NULL, NULL, src);
+}
+
+bool sobel_band(Image *grad_mag, Image *grad_angle, const ImageView *window, int offset)
+{
+    // the window brings the halo rows
+    Image *images[4] = {grad_mag, grad_angle, NULL, NULL};
+    return sobel_images(images, window, offset);
+}
+
+/// @brief Classes of the pixels of the Canny detector, after non-maximum suppression
+typedef enum {
+    CANNY_NONE,     // not a local maximum, or below the low threshold
+    CANNY_WEAK,     // local maximum between the thresholds, an edge if connected to a strong one
+    CANNY_STRONG    // local maximum above the high threshold (or component holding one, at its root)
+} CANNY_CLASS;
+
+/// @brief State shared by the tasks of the Canny detector
+typedef struct CannyEdges {
+    const ImageView *src;       // smoothed source
+    unsigned char *classes;     // CANNY_CLASS of every pixel, row after row
+    unsigned int *parent;       // union-find forest of the edge candidates
+    Image *dest;
+    double low;                 // squared thresholds
+    double high;
+    unsigned int rows_per_task;
+    bool failed;                // a task could not allocate its buffers
+} CannyEdges;
+
+/// @brief Computes the squared gradient magnitude of a row, with the derivatives giving it
+/// @note Multichannel sources keep, at each pixel, the channel of strongest gradient
+/// @param magnitude Squared magnitudes (width values), or NULL
+/// @param gx Horizontal derivatives, replaced by the ones of the kept channels (width * channels values)
+/// @param gy Vertical derivatives, likewise
+/// @param width Number of pixels
+/// @param channels Number of channels
+static void canny_magnitude(double *restrict magnitude, double *restrict gx, double *restrict gy,
+                            size_t width, size_t channels)
+{
+    if (channels == 1) {
+        for (size_t x = 0; x < width; ++x) {
+            magnitude[x] = gx[x] * gx[x] + gy[x] * gy[x];
+        }
+        return;
+    }
+    for (size_t x = 0; x < width; ++x) {
+        size_t best = x * channels;
+        double best_magnitude = gx[best] * gx[best] + gy[best] * gy[best];
+        for (size_t k = best + 1; k < (x + 1) * channels; ++k) {
+            double m = gx[k] * gx[k] + gy[k] * gy[k];
+            if (m > best_magnitude) {
+                best_magnitude = m;
+                best = k;
+            }
+        }
+        magnitude[x] = best_magnitude;
+        gx[x] = gx[best];
+        gy[x] = gy[best];
+    }
+}
+
+/// @brief Computes the gradient of a strip of rows and keeps its local maxima across the edges
+/// @note Gradient rows are computed once, in a ring of three around the row being thinned:
+/// a pixel is kept if its magnitude is not below both neighbours along the gradient direction,
+/// rounded to a multiple of 45 degrees. Magnitudes are compared squared.
+/// @param task Index of the task
+/// @param params Detector
+static void canny_gradient_rows(unsigned int task, void *params)
+{
+    CannyEdges *canny = params;
+    const ImageView *src = canny->src;
+    int width = src->width, height = src->height;
+    size_t channels = src->channels;
+    size_t row_size = (size_t)width * channels;
+    size_t padded_size = row_size + 2 * channels;
+    // three source rows, the vertical sums and differences, then three gradient rows
+    // (magnitudes between zero halos, derivatives)
+    size_t gradient_size = width + 2 + 2 * row_size;
+    double *buffer = malloc((5 * padded_size + 3 * gradient_size) * sizeof(double));
+    if (!buffer) {
+        canny->failed = true;
+        return;
+    }
+    double *sum = buffer + 3 * padded_size;
+    double *diff = sum + padded_size;
+    double *gradients = diff + padded_size;
+
+    int first = task * canny->rows_per_task;
+    int last = first + canny->rows_per_task < (unsigned int)height ? first + canny->rows_per_task : height;
+    int loaded = first - 2, computed = first - 1;
+    for (int row = first; row < last; ++row) {
+        // gradient rows up to the one below, from the source rows around each of them
+        for (; computed <= row + 1; ++computed) {
+            double *magnitude = gradients + (size_t)(computed + 1) % 3 * gradient_size;
+            double *gx = magnitude + width + 2, *gy = gx + row_size;
+            memset(magnitude, 0, (width + 2) * sizeof(double));
+            if (computed < 0 || computed >= height) continue;
+            // the edge samples are repeated: the image frame is no edge
+            for (; loaded <= computed + 1; ++loaded) {
+                double *slot = buffer + (size_t)(loaded + 2) % 3 * padded_size;
+                read_padded_row(src, border_index(loaded, height, BORDER_CLAMP), slot, 1, 1, BORDER_CLAMP);
+            }
+            const double *up = buffer + (size_t)(computed + 1) % 3 * padded_size;
+            const double *mid = buffer + (size_t)(computed + 2) % 3 * padded_size;
+            const double *down = buffer + (size_t)computed % 3 * padded_size;
+            if (channels == 1) {
+                sobel_derivatives(gx, gy, up, mid, down, sum, diff, row_size, 1);
+            } else {
+                sobel_derivatives(gx, gy, up, mid, down, sum, diff, row_size, channels);
+            }
+            canny_magnitude(magnitude + 1, gx, gy, width, channels);
+        }
+
+        // non-maximum suppression and double threshold
+        const double *above = gradients + (size_t)row % 3 * gradient_size + 1;
+        const double *center = gradients + (size_t)(row + 1) % 3 * gradient_size + 1;
+        const double *below = gradients + (size_t)(row + 2) % 3 * gradient_size + 1;
+        const double *gx = center + width + 1, *gy = gx + row_size;
+        unsigned char *classes = canny->classes + (size_t)row * width;
+        for (int x = 0; x < width; ++x) {
+            double m = center[x];
+            if (m <= canny->low) {
+                classes[x] = CANNY_NONE;
+                continue;
+            }
+            // gx is the derivative towards -x: opposite signs point along the main diagonal
+            double ax = fabs(gx[x]), ay = fabs(gy[x]);
+            double a, b;
+            if (ay <= CANNY_TAN_22_5 * ax) {
+                a = center[x - 1];
+                b = center[x + 1];
+            } else if (ax <= CANNY_TAN_22_5 * ay) {
+                a = above[x];
+                b = below[x];
+            } else if ((gx[x] < 0) != (gy[x] < 0)) {
+                a = above[x - 1];
+                b = below[x + 1];
+            } else {
+                a = above[x + 1];
+                b = below[x - 1];
+            }
+            classes[x] = m > a && m >= b ? (m > canny->high ? CANNY_STRONG : CANNY_WEAK) : CANNY_NONE;
+        }
+    }
+    free(buffer);
+}
+
+/// @brief Returns the root of the component of an edge candidate
+/// @param parent Union-find forest
+/// @param p Pixel
+/// @return Root pixel
+static inline unsigned int canny_root(const unsigned int *parent, unsigned int p)
+{
+    while (parent[p] != p) {
+        p = parent[p];
+    }
+    return p;
+}
+
+/// @brief Merges the components of two edge candidates, the merged one being strong if either is
+/// @note The smaller index becomes the root; paths are halved on the way up
+/// @param canny Detector
+/// @param p Pixel
+/// @param q Pixel
+static void canny_union(CannyEdges *canny, unsigned int p, unsigned int q)
+{
+    unsigned int *parent = canny->parent;
+    while (parent[p] != p) {
+        parent[p] = parent[parent[p]];
+        p = parent[p];
+    }
+    while (parent[q] != q) {
+        parent[q] = parent[parent[q]];
+        q = parent[q];
+    }
+    if (p == q) return;
+    unsigned int root = p < q ? p : q, child = p < q ? q : p;
+    parent[child] = root;
+    if (canny->classes[child] == CANNY_STRONG) {
+        canny->classes[root] = CANNY_STRONG;
+    }
+}
+
+/// @brief Joins a candidate pixel to the candidates among its neighbours of the row above
+/// @param canny Detector
+/// @param x Column
+/// @param y Row (at least 1)
+static void canny_union_above(CannyEdges *canny, int x, int y)
+{
+    int width = canny->src->width;
+    unsigned int p = (unsigned int)y * width + x;
+    for (int dx = -1; dx <= 1; ++dx) {
+        if (x + dx >= 0 && x + dx < width && canny->classes[p - width + dx] != CANNY_NONE) {
+            canny_union(canny, p, p - width + dx);
+        }
+    }
+}
+
+/// @brief Connects the edge candidates of a strip of rows (8-connectivity)
+/// @note Unions stay inside the strip, whose tasks thus share no pixel
+/// @param task Index of the task
+/// @param params Detector
+static void canny_components(unsigned int task, void *params)
+{
+    CannyEdges *canny = params;
+    int width = canny->src->width, height = canny->src->height;
+    int first = task * canny->rows_per_task;
+    int last = first + canny->rows_per_task < (unsigned int)height ? first + canny->rows_per_task : height;
+    for (int y = first; y < last; ++y) {
+        for (int x = 0; x < width; ++x) {
+            unsigned int p = (unsigned int)y * width + x;
+            if (canny->classes[p] == CANNY_NONE) continue;
+            canny->parent[p] = p;
+            if (x > 0 && canny->classes[p - 1] != CANNY_NONE) {
+                canny_union(canny, p, p - 1);
+            }
+            if (y > first) {
+                canny_union_above(canny, x, y);
+            }
+        }
+    }
+}
+
+/// @brief Writes the edges of a strip of rows: candidates whose component is strong
+/// @param task Index of the task
+/// @param params Detector
+static void canny_output_rows(unsigned int task, void *params)
+{
+    CannyEdges *canny = params;
+    size_t width = canny->src->width, height = canny->src->height;
+    size_t first = (size_t)task * canny->rows_per_task * width;
+    size_t last = first + (size_t)canny->rows_per_task * width;
+    if (last > width * height) last = width * height;
+    uint8_t *edges = canny->dest->content_u8;
+    for (size_t p = first; p < last; ++p) {
+        bool edge = canny->classes[p] != CANNY_NONE
+                    && canny->classes[canny_root(canny->parent, (unsigned int)p)] == CANNY_STRONG;
+        edges[p] = edge ? 255 : 0;
+    }
+}
+
+bool canny_filter_view(Image *dest, const ImageView *src, double sigma, double low, double high)
+{
+    if ((size_t)src->width * src->height > UINT_MAX) {
+        fprintf(stderr, "Image of %ux%u too large for the Canny detector\n", src->width, src->height);
+        return false;
+    }
+    // smoothing
+    Image smoothed = {0};
+    ImageView smoothed_view = *src;
+    if (sigma > 0) {
+        unsigned int kernel_size = 2 * (unsigned int)ceil(3 * sigma) + 1;
+        Matrix row_kernel = create_gaussian_vector(1, kernel_size, sigma);
+        Matrix col_kernel = create_gaussian_vector(kernel_size, 1, sigma);
+        FilterKernel kernel;
+        bool rc = init_separable_kernel(&kernel, &row_kernel, &col_kernel);
+        free_matrix(&row_kernel);
+        free_matrix(&col_kernel);
+        if (!rc) {
+            return false;
+        }
+        rc = create_filtered_image(&smoothed, src, DEPTH_F32);
+        if (rc && !convolve_parallel(&smoothed, src, &kernel, BORDER_CLAMP)) {
+            free_image(&smoothed);
+            rc = false;
+        }
+        free_kernel(&kernel);
+        if (!rc) {
+            return false;
+        }
+        smoothed_view = image_view(&smoothed);
+    }
+
+    size_t count = (size_t)src->width * src->height;
+    create_image(dest, GRAY, src->width, src->height, 1, DEPTH_U8);
+    CannyEdges canny = {.src = &smoothed_view, .dest = dest, .low = low * low, .high = high * high};
+    canny.classes = malloc(count);
+    canny.parent = malloc(count * sizeof(unsigned int));
+    bool rc = dest->data && canny.classes && canny.parent;
+    if (!rc) {
+        perror("Error allocating Canny edges.");
+    }
+
+    if (rc && count > 0) {
+        unsigned int threads = parallel_threads();
+        canny.rows_per_task = (src->height + 4 * threads - 1) / (4 * threads);
+        unsigned int tasks = (src->height + canny.rows_per_task - 1) / canny.rows_per_task;
+        // gradient and non-maximum suppression, fused
+        parallel_for(tasks, canny_gradient_rows, &canny);
+        rc = !canny.failed;
+        if (!rc) {
+            perror("Error allocating Canny rows.");
+        }
+        // hysteresis: components of the strips, joined across the strip borders, then kept if strong
+        if (rc) {
+            parallel_for(tasks, canny_components, &canny);
+            for (unsigned int task = 1; task < tasks; ++task) {
+                int y = task * canny.rows_per_task;
+                for (int x = 0; x < (int)src->width; ++x) {
+                    if (canny.classes[(size_t)y * src->width + x] != CANNY_NONE) {
+                        canny_union_above(&canny, x, y);
+                    }
+                }
+            }
+            parallel_for(tasks, canny_output_rows, &canny);
+        }
+    }
+
+    if (!rc && dest->data) {
+        free_image(dest);
+    }
+    free(canny.classes);
+    free(canny.parent);
+    if (smoothed.data) {
+        free_image(&smoothed);
+    }
+    return rc;
+}
+
+bool canny_filter(Image *dest, Image *src, double sigma, double low, double high)
+{
+    ImageView view = image_view(src);
+    return canny_filter_view(dest, &view, sigma, low, high);
+}
+
+/// @brief State shared by the tasks of a bilateral filter on a grid
+/// @note The grid samples space and range (the mean of the channels) by cells of
+/// space_cell pixels and range_cell values. Each cell holds the sums of the channels
+/// of the pixels splatted into it, followed by their number (homogeneous coordinates).
+typedef struct BilateralGrid {
+    const ImageView *src;
+    const ImageView *dest;
+    double *cells;                  // depth x height x width cells, row after row
+    double *blurred;                // cells of the same size, for the blur passes
+    unsigned int width;             // grid size
+    unsigned int height;
+    unsigned int depth;
+    unsigned int values;            // channels + 1
+    double space_cell;
+    double range_cell;
+    double range_min;
+    const FilterKernel *space_kernel;
+    unsigned int rows_per_task;
+    bool failed;                    // a task could not allocate its buffers
+} BilateralGrid;
+
+/// @brief Returns the range coordinate of a pixel: the mean of its channels
+static inline double bilateral_range(const double *pixel, unsigned int channels)
+{
+    double sum = 0;
+    for (unsigned int c = 0; c < channels; ++c) {
+        sum += pixel[c];
+    }
+    return sum / channels;
+}
+
+/// @brief Views rows of grid cells as an image of double samples, for the convolution
+/// @param cells First cell
+/// @param width Cells per row
+/// @param height Number of rows
+/// @param values Values per cell
+/// @return View
+static ImageView grid_view(double *cells, size_t width, unsigned int height, unsigned int values)
+{
+    ImageView view = {
+        .type = GRAY,
+        .depth = DEPTH_F64,
+        .width = (unsigned int)width,
+        .height = height,
+        .channels = values,
+        .maxval = 1,
+        .origin = (unsigned char *)cells,
+        .row_stride = (ptrdiff_t)(width * values * sizeof(double)),
+        .col_stride = (ptrdiff_t)(values * sizeof(double)),
+        .channel_stride = sizeof(double)
+    };
+    return view;
+}
+
+/// @brief Blurs a range slice of the grid along the space axes
+/// @param task Index of the slice
+/// @param params Grid
+static void bilateral_blur_slice(unsigned int task, void *params)
+{
+    BilateralGrid *grid = params;
+    size_t slice = (size_t)grid->width * grid->height * grid->values;
+    ImageView src = grid_view(grid->cells + task * slice, grid->width, grid->height, grid->values);
+    ImageView dest = grid_view(grid->blurred + task * slice, grid->width, grid->height, grid->values);
+    if (!convolve_view(&dest, &src, grid->space_kernel, 0, BORDER_ZERO)) {
+        grid->failed = true;
+    }
+}
+
+/// @brief Reads the filtered values of a strip of rows from the grid, by trilinear interpolation
+/// @param task Index of the task
+/// @param params Grid
+static void bilateral_slice_rows(unsigned int task, void *params)
+{
+    BilateralGrid *grid = params;
+    const ImageView *src = grid->src;
+    unsigned int channels = src->channels, values = grid->values;
+    size_t row_size = (size_t)src->width * channels;
+    double *rows = malloc((2 * row_size + 2 * values) * sizeof(double));
+    if (!rows) {
+        grid->failed = true;
+        return;
+    }
+    double *out = rows + row_size;
+    double *cell = out + row_size;
+    double *weighted = cell + values;
+    size_t line = (size_t)grid->width * values;
+    size_t slice = line * grid->height;
+
+    unsigned int first = task * grid->rows_per_task;
+    unsigned int last = first + grid->rows_per_task < src->height ? first + grid->rows_per_task : src->height;
+    for (unsigned int y = first; y < last; ++y) {
+        read_view_row(src, y, rows);
+        double fy = y / grid->space_cell;
+        unsigned int iy = (unsigned int)fy;
+        double ty = fy - iy;
+        for (unsigned int x = 0; x < src->width; ++x) {
+            const double *pixel = rows + (size_t)x * channels;
+            double fx = x / grid->space_cell;
+            double fz = (bilateral_range(pixel, channels) - grid->range_min) / grid->range_cell;
+            unsigned int ix = (unsigned int)fx, iz = (unsigned int)fz;
+            double tx = fx - ix, tz = fz - iz;
+            const double *corner = grid->cells + iz * slice + iy * line + (size_t)ix * values;
+            for (unsigned int v = 0; v < values; ++v) {
+                weighted[v] = 0;
+            }
+            for (int k = 0; k < 8; ++k) {
+                double w = (k & 1 ? tx : 1 - tx) * (k & 2 ? ty : 1 - ty) * (k & 4 ? tz : 1 - tz);
+                const double *c = corner + (k & 4 ? slice : 0) + (k & 2 ? line : 0) + (k & 1 ? values : 0);
+                for (unsigned int v = 0; v < values; ++v) {
+                    weighted[v] += w * c[v];
+                }
+            }
+            // a pixel always lies next to its own contribution, unless it vanished in the blur
+            double weight = weighted[channels];
+            for (unsigned int c = 0; c < channels; ++c) {
+                out[(size_t)x * channels + c] = weight > 0 ? weighted[c] / weight : pixel[c];
+            }
+        }
+        write_view_row(grid->dest, y, out);
+    }
+    free(rows);
+}
+
+/// @brief Applies a bilateral filter to a view through a bilateral grid
+/// @param dest Filtered view
+/// @param src Source view
+/// @param sigma_space Standard deviation of the spatial gaussian, in pixels
+/// @param sigma_range Standard deviation of the range gaussian
+/// @return true if filtering ok
+static bool bilateral_grid_view(const ImageView *dest, const ImageView *src, double sigma_space, double sigma_range)
+{
+    unsigned int channels = src->channels, values = channels + 1;
+    size_t row_size = (size_t)src->width * channels;
+    double *row = malloc(row_size * sizeof(double));
+    if (!row) {
+        perror("Error allocating bilateral grid.");
+        return false;
+    }
+    double range_min = INFINITY, range_max = -INFINITY;
+    for (unsigned int y = 0; y < src->height; ++y) {
+        read_view_row(src, y, row);
+        for (unsigned int x = 0; x < src->width; ++x) {
+            double g = bilateral_range(row + (size_t)x * channels, channels);
+            range_min = fmin(range_min, g);
+            range_max = fmax(range_max, g);
+        }
+    }
 
+    // cells of a fraction of the sigmas, coarser if the grid is too large
+    BilateralGrid grid = {.src = src, .dest = dest, .values = values, .range_min = range_min};
+    grid.space_cell = fmax(sigma_space / BILATERAL_SAMPLING, BILATERAL_MIN_CELL);
+    grid.range_cell = sigma_range / BILATERAL_SAMPLING;
+    for (;;) {
+        // one more cell on each axis for the interpolation
+        grid.width = (unsigned int)((src->width - 1) / grid.space_cell) + 2;
+        grid.height = (unsigned int)((src->height - 1) / grid.space_cell) + 2;
+        grid.depth = (unsigned int)((range_max - range_min) / grid.range_cell) + 2;
+        if ((size_t)grid.width * grid.height * grid.depth <= BILATERAL_MAX_CELLS) break;
+        grid.space_cell *= 1.25;
+        grid.range_cell *= 1.25;
+    }
+    size_t count = (size_t)grid.width * grid.height * grid.depth * values;
+    grid.cells = calloc(count, sizeof(double));
+    grid.blurred = malloc(count * sizeof(double));
+    if (!grid.cells || !grid.blurred) {
+        perror("Error allocating bilateral grid.");
+        free(grid.cells);
+        free(grid.blurred);
+        free(row);
+        return false;
+    }
+
+    // splat: each pixel into its nearest cell
+    size_t line = (size_t)grid.width * values, slice = line * grid.height;
+    for (unsigned int y = 0; y < src->height; ++y) {
+        read_view_row(src, y, row);
+        size_t iy = (size_t)(y / grid.space_cell + 0.5);
+        for (unsigned int x = 0; x < src->width; ++x) {
+            const double *pixel = row + (size_t)x * channels;
+            size_t ix = (size_t)(x / grid.space_cell + 0.5);
+            size_t iz = (size_t)((bilateral_range(pixel, channels) - range_min) / grid.range_cell + 0.5);
+            double *cell = grid.cells + iz * slice + iy * line + ix * values;
+            for (unsigned int c = 0; c < channels; ++c) {
+                cell[c] += pixel[c];
+            }
+            cell[channels] += 1;
+        }
+    }
+    free(row);
+
+    // blur: gaussians of the sigmas, in cells, along space (each slice) then range (whole grid)
+    double space_sigma = sigma_space / grid.space_cell, range_sigma = sigma_range / grid.range_cell;
+    unsigned int space_size = 2 * (unsigned int)ceil(3 * space_sigma) + 1;
+    unsigned int range_size = 2 * (unsigned int)ceil(3 * range_sigma) + 1;
+    Matrix row_kernel = create_gaussian_vector(1, space_size, space_sigma);
+    Matrix col_kernel = create_gaussian_vector(space_size, 1, space_sigma);
+    Matrix range_matrix = create_gaussian_vector(range_size, 1, range_sigma);
+    FilterKernel space_kernel, range_kernel;
+    bool rc = init_separable_kernel(&space_kernel, &row_kernel, &col_kernel);
+    if (rc && !init_kernel(&range_kernel, &range_matrix)) {
+        free_kernel(&space_kernel);
+        rc = false;
+    }
+    free_matrix(&row_kernel);
+    free_matrix(&col_kernel);
+    free_matrix(&range_matrix);
+
+    if (rc) {
+        grid.space_kernel = &space_kernel;
+        parallel_for(grid.depth, bilateral_blur_slice, &grid);
+        // rows of the range pass are whole slices
+        ImageView slices = grid_view(grid.blurred, (size_t)grid.width * grid.height, grid.depth, values);
+        ImageView blurred = grid_view(grid.cells, (size_t)grid.width * grid.height, grid.depth, values);
+        ConvolutionStrips conv = {.dest = &blurred, .src = &slices, .kernel = &range_kernel, .border = BORDER_ZERO};
+        unsigned int threads = parallel_threads();
+        conv.rows_per_task = (grid.depth + threads - 1) / threads;
+        if (!grid.failed) {
+            parallel_for((grid.depth + conv.rows_per_task - 1) / conv.rows_per_task, convolve_strip, &conv);
+        }
+        // slice
+        grid.rows_per_task = (src->height + 4 * threads - 1) / (4 * threads);
+        if (!grid.failed && !conv.failed && grid.rows_per_task > 0) {
+            parallel_for((src->height + grid.rows_per_task - 1) / grid.rows_per_task, bilateral_slice_rows, &grid);
+        }
+        rc = !grid.failed && !conv.failed;
+        if (!rc) {
+            perror("Error allocating bilateral rows.");
+        }
+        free_kernel(&space_kernel);
+        free_kernel(&range_kernel);
+    }
+    free(grid.cells);
+    free(grid.blurred);
     return rc;
-}
\ No newline at end of file
+}
+
+/// @brief Checks the sigmas of a bilateral filter
+/// @return true if both are positive
+static bool check_bilateral_sigmas(double sigma_space, double sigma_range)
+{
+    if (!(sigma_space > 0) || !(sigma_range > 0)) {
+        fprintf(stderr, "Invalid bilateral sigmas %g (space) and %g (range)\n", sigma_space, sigma_range);
+        return false;
+    }
+    return true;
+}
+
+bool bilateral_filter_view(Image *dest, const ImageView *src, double sigma_space, double sigma_range)
+{
+    if (!check_bilateral_sigmas(sigma_space, sigma_range) || !create_filtered_image(dest, src, src->depth)) {
+        return false;
+    }
+    ImageView dest_view = image_view(dest);
+    if (!bilateral_grid_view(&dest_view, src, sigma_space, sigma_range)) {
+        free_image(dest);
+        return false;
+    }
+    return true;
+}
+
+bool bilateral_filter(Image *dest, Image *src, double sigma_space, double sigma_range)
+{
+    ImageView view = image_view(src);
+    return bilateral_filter_view(dest, &view, sigma_space, sigma_range);
+}
+
+bool bilateral_filter_reference(Image *dest, Image *src, double sigma_space, double sigma_range)
+{
+    ImageView view = image_view(src);
+    if (!check_bilateral_sigmas(sigma_space, sigma_range) || !create_filtered_image(dest, &view, src->depth)) {
+        return false;
+    }
+    int width = src->width, height = src->height, channels = src->channels;
+    size_t row_size = (size_t)width * channels;
+    double *samples = malloc(((size_t)height + 1) * row_size * sizeof(double));
+    if (!samples) {
+        perror("Error allocating bilateral rows.");
+        free_image(dest);
+        return false;
+    }
+    double *out = samples + (size_t)height * row_size;
+    for (int y = 0; y < height; ++y) {
+        read_image_row(src, y, samples + (size_t)y * row_size);
+    }
+
+    // every pixel within 3 sigmas, the window being clipped to the image
+    int radius = (int)ceil(3 * sigma_space);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            const double *center = samples + (size_t)y * row_size + (size_t)x * channels;
+            double range = bilateral_range(center, channels);
+            double total = 0;
+            double *pixel_out = out + (size_t)x * channels;
+            for (int c = 0; c < channels; ++c) {
+                pixel_out[c] = 0;
+            }
+            for (int j = y - radius; j <= y + radius; ++j) {
+                for (int i = x - radius; i <= x + radius; ++i) {
+                    if (i < 0 || j < 0 || i >= width || j >= height) continue;
+                    const double *pixel = samples + (size_t)j * row_size + (size_t)i * channels;
+                    double d = bilateral_range(pixel, channels) - range;
+                    double w = exp(-((i - x) * (i - x) + (j - y) * (j - y)) / (2 * sigma_space * sigma_space)
+                                   - d * d / (2 * sigma_range * sigma_range));
+                    for (int c = 0; c < channels; ++c) {
+                        pixel_out[c] += w * pixel[c];
+                    }
+                    total += w;
+                }
+            }
+            for (int c = 0; c < channels; ++c) {
+                pixel_out[c] /= total;
+            }
+        }
+        write_image_row(dest, y, out);
+    }
+    free(samples);
+    return true;
+}
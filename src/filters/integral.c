@@ -0,0 +1,203 @@
+#include "filters/integral.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+
+bool integral_image(IntegralImage *integral, Image *src, bool squares)
+{
+    unsigned int width = src->width, height = src->height, channels = src->channels;
+    size_t row_size = (size_t)width * channels;
+    size_t stride = row_size + channels;
+    integral->type = src->type;
+    integral->width = width;
+    integral->height = height;
+    integral->channels = channels;
+    integral->sum = calloc((height + 1) * stride, sizeof(double));
+    integral->sum_sq = squares ? calloc((height + 1) * stride, sizeof(double)) : NULL;
+    double *row = malloc(row_size * sizeof(double));
+    if (!integral->sum || (squares && !integral->sum_sq) || !row) {
+        perror("Error allocating integral image.");
+        free_integral_image(integral);
+        free(row);
+        return false;
+    }
+
+    for (unsigned int y = 0; y < height; ++y) {
+        read_image_row(src, y, row);
+        // S(y + 1, x + 1) = S(y + 1, x) + S(y, x + 1) - S(y, x) + sample(y, x)
+        const double *above = integral->sum + y * stride;
+        double *current = integral->sum + (y + 1) * stride;
+        for (size_t i = 0; i < row_size; ++i) {
+            current[i + channels] = current[i] + above[i + channels] - above[i] + row[i];
+        }
+        if (squares) {
+            above = integral->sum_sq + y * stride;
+            current = integral->sum_sq + (y + 1) * stride;
+            for (size_t i = 0; i < row_size; ++i) {
+                current[i + channels] = current[i] + above[i + channels] - above[i] + row[i] * row[i];
+            }
+        }
+    }
+    free(row);
+    return true;
+}
+
+void free_integral_image(IntegralImage *integral)
+{
+    free(integral->sum);
+    free(integral->sum_sq);
+    integral->sum = NULL;
+    integral->sum_sq = NULL;
+}
+
+void integral_sum(const IntegralImage *integral, unsigned int x0, unsigned int y0,
+                  unsigned int x1, unsigned int y1, double *sums)
+{
+    unsigned int channels = integral->channels;
+    size_t stride = ((size_t)integral->width + 1) * channels;
+    const double *top = integral->sum + y0 * stride;
+    const double *bottom = integral->sum + y1 * stride;
+    for (unsigned int c = 0; c < channels; ++c) {
+        sums[c] = bottom[x1 * channels + c] - bottom[x0 * channels + c]
+                - top[x1 * channels + c] + top[x0 * channels + c];
+    }
+}
+
+/// @brief Computes a statistic over the windows of a row from the rows of a table bounding them
+/// @param out Statistic of the pixels of the row
+/// @param top Table row above the windows
+/// @param bottom Table row below the windows
+/// @param top_sq Table row of squares above the windows (variance and standard deviation only)
+/// @param bottom_sq Table row of squares below the windows
+/// @param width Width of the image
+/// @param channels Number of channels
+/// @param radius Radius of the windows
+/// @param rows Number of rows of the windows
+/// @param stat Statistic
+static void row_statistic(double *out, const double *top, const double *bottom,
+                          const double *top_sq, const double *bottom_sq,
+                          unsigned int width, unsigned int channels, unsigned int radius,
+                          unsigned int rows, LOCAL_STAT stat)
+{
+    for (unsigned int x = 0; x < width; ++x) {
+        size_t x0 = x > radius ? x - radius : 0;
+        size_t x1 = x + radius + 1 < width ? x + radius + 1 : width;
+        double count = (double)((x1 - x0) * rows);
+        size_t left = x0 * channels, right = x1 * channels;
+        for (unsigned int c = 0; c < channels; ++c) {
+            double mean = (bottom[right + c] - bottom[left + c] - top[right + c] + top[left + c]) / count;
+            double value = mean;
+            if (stat != LOCAL_MEAN) {
+                double mean_sq = (bottom_sq[right + c] - bottom_sq[left + c]
+                                - top_sq[right + c] + top_sq[left + c]) / count;
+                // rounding may leave a tiny negative variance on flat areas
+                double variance = mean_sq - mean * mean;
+                value = variance > 0 ? variance : 0;
+                if (stat == LOCAL_STD) value = sqrt(value);
+            }
+            out[(size_t)x * channels + c] = value;
+        }
+    }
+}
+
+bool local_statistic(Image *dest, const IntegralImage *integral, unsigned int radius,
+                     LOCAL_STAT stat, PIXEL_DEPTH depth)
+{
+    if (stat != LOCAL_MEAN && !integral->sum_sq) {
+        fprintf(stderr, "Local variance needs an integral image of the squared samples\n");
+        return false;
+    }
+    unsigned int width = integral->width, height = integral->height, channels = integral->channels;
+    create_image(dest, integral->type, width, height, channels, depth);
+    double *row = malloc((size_t)width * channels * sizeof(double));
+    if (!dest->data || !row) {
+        perror("Error during image allocation.");
+        free_image(dest);
+        free(row);
+        return false;
+    }
+
+    size_t stride = ((size_t)width + 1) * channels;
+    for (unsigned int y = 0; y < height; ++y) {
+        size_t y0 = y > radius ? y - radius : 0;
+        size_t y1 = y + radius + 1 < height ? y + radius + 1 : height;
+        const double *sum_sq = integral->sum_sq;
+        row_statistic(row, integral->sum + y0 * stride, integral->sum + y1 * stride,
+                      sum_sq ? sum_sq + y0 * stride : NULL, sum_sq ? sum_sq + y1 * stride : NULL,
+                      width, channels, radius, (unsigned int)(y1 - y0), stat);
+        write_image_row(dest, y, row);
+    }
+    free(row);
+    return true;
+}
+
+/// @brief Computes a local statistic of an image through its summed-area table
+/// @param dest Result (uninitialized)
+/// @param src Source image
+/// @param radius Radius of the window
+/// @param stat Statistic
+/// @param depth Depth of the result
+/// @return true if computation ok
+static bool image_statistic(Image *dest, Image *src, unsigned int radius, LOCAL_STAT stat, PIXEL_DEPTH depth)
+{
+    IntegralImage integral;
+    if (!integral_image(&integral, src, stat != LOCAL_MEAN)) {
+        return false;
+    }
+    bool rc = local_statistic(dest, &integral, radius, stat, depth);
+    free_integral_image(&integral);
+    if (rc && depth == src->depth) {
+        dest->maxval = src->maxval;
+    }
+    return rc;
+}
+
+bool box_filter(Image *dest, Image *src, unsigned int radius)
+{
+    return image_statistic(dest, src, radius, LOCAL_MEAN, src->depth);
+}
+
+bool local_variance(Image *dest, Image *src, unsigned int radius)
+{
+    return image_statistic(dest, src, radius, LOCAL_VARIANCE, DEPTH_F32);
+}
+
+bool local_std(Image *dest, Image *src, unsigned int radius)
+{
+    return image_statistic(dest, src, radius, LOCAL_STD, DEPTH_F32);
+}
+
+bool box_blur(Image *dest, Image *src, double sigma, unsigned int passes)
+{
+    if (!(sigma > 0) || passes == 0) {
+        fprintf(stderr, "Invalid box blur (sigma %g, %u passes)\n", sigma, passes);
+        return false;
+    }
+    // a box of odd width w has variance (w^2 - 1) / 12: the first passes use the
+    // width just below the ideal one, the others the next odd width, so that the
+    // variances add up to sigma^2 as closely as possible
+    double ideal = sqrt(12 * sigma * sigma / passes + 1);
+    int lower = (int)floor(ideal);
+    if (lower % 2 == 0) --lower;
+    int upper = lower + 2;
+    double n = passes;
+    int n_lower = (int)round((12 * sigma * sigma - n * lower * lower - 4 * n * lower - 3 * n) / (-4.0 * lower - 4));
+
+    // intermediate passes are kept in double, the last one returns to the source depth
+    Image current = *src, next = {0};
+    bool rc = true;
+    for (unsigned int pass = 0; pass < passes && rc; ++pass) {
+        unsigned int radius = (unsigned int)(((int)pass < n_lower ? lower : upper) - 1) / 2;
+        bool last = pass + 1 == passes;
+        rc = image_statistic(last ? dest : &next, &current, radius, LOCAL_MEAN,
+                             last ? src->depth : DEPTH_F64);
+        if (pass > 0) {
+            free_image(&current);
+        }
+        current = next;
+    }
+    if (rc) {
+        dest->maxval = src->maxval;
+    }
+    return rc;
+}
@@ -0,0 +1,384 @@
+#include "filters/median.h"
+#include "utils/parallel.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+
+// Largest radius: window counts are kept on 16 bits
+#define MEDIAN_MAX_RADIUS 127
+// Samples sorted together by the sorting networks, one vector operation per exchange
+#define MEDIAN_BLOCK 64
+// Bins of the coarse histograms, each standing for MEDIAN_COARSE bins of the fine ones
+#define MEDIAN_COARSE 16
+
+/// @brief State shared by the tasks of a median filter
+typedef struct MedianFilter {
+    const ImageView *src;
+    const ImageView *dest;      // DEPTH_U8 view of the size of the source
+    int radius;
+    unsigned int rows_per_task;
+    bool failed;                // a task could not allocate its buffers
+} MedianFilter;
+
+/// @brief Reads a row of a view as 8 bit samples
+/// @note DEPTH_U8 samples are copied as they are, other depths are quantized to 255 levels
+/// @param src Source view
+/// @param row Row to read
+/// @param samples Samples (width * channels values)
+/// @param scratch Scratch row of width * channels doubles (other depths only)
+static void read_u8_row(const ImageView *src, int row, uint8_t *samples, double *scratch)
+{
+    size_t channels = src->channels, row_size = (size_t)src->width * channels;
+    if (src->depth != DEPTH_U8) {
+        read_view_row(src, row, scratch);
+        for (size_t k = 0; k < row_size; ++k) {
+            double value = round(scratch[k] * 255);
+            samples[k] = value < 0 ? 0 : value > 255 ? 255 : (uint8_t)value;
+        }
+        return;
+    }
+    const unsigned char *line = src->origin + row * src->row_stride;
+    if (src->col_stride == (ptrdiff_t)channels && src->channel_stride == 1) {
+        memcpy(samples, line, row_size);
+        return;
+    }
+    for (size_t x = 0; x < src->width; ++x) {
+        for (size_t c = 0; c < channels; ++c) {
+            samples[x * channels + c] = line[(ptrdiff_t)x * src->col_stride + (ptrdiff_t)c * src->channel_stride];
+        }
+    }
+}
+
+/// @brief Writes 8 bit samples into a row of a DEPTH_U8 view
+/// @param dest View
+/// @param row Row to write
+/// @param samples Samples (width * channels values)
+static void write_u8_row(const ImageView *dest, int row, const uint8_t *samples)
+{
+    size_t channels = dest->channels, row_size = (size_t)dest->width * channels;
+    unsigned char *line = dest->origin + row * dest->row_stride;
+    if (dest->col_stride == (ptrdiff_t)channels && dest->channel_stride == 1) {
+        memcpy(line, samples, row_size);
+        return;
+    }
+    for (size_t x = 0; x < dest->width; ++x) {
+        for (size_t c = 0; c < channels; ++c) {
+            line[(ptrdiff_t)x * dest->col_stride + (ptrdiff_t)c * dest->channel_stride] = samples[x * channels + c];
+        }
+    }
+}
+
+/// @brief Clamps an index into [0, n)
+static inline int clamp_index(int i, int n)
+{
+    return i < 0 ? 0 : i >= n ? n - 1 : i;
+}
+
+/// @brief Orders two sequences of samples element-wise: a receives the minima, b the maxima
+static inline void sort_pair(uint8_t *restrict a, uint8_t *restrict b)
+{
+    for (int k = 0; k < MEDIAN_BLOCK; ++k) {
+        uint8_t low = a[k] < b[k] ? a[k] : b[k];
+        uint8_t high = a[k] < b[k] ? b[k] : a[k];
+        a[k] = low;
+        b[k] = high;
+    }
+}
+
+#define MEDIAN_SORT(i, j) sort_pair(v[i], v[j])
+
+/// @brief Moves the median of 9 sequences to v[4] (19 exchanges, Paeth)
+static void median_network_9(uint8_t (*v)[MEDIAN_BLOCK])
+{
+    MEDIAN_SORT(1, 2); MEDIAN_SORT(4, 5); MEDIAN_SORT(7, 8); MEDIAN_SORT(0, 1); MEDIAN_SORT(3, 4);
+    MEDIAN_SORT(6, 7); MEDIAN_SORT(1, 2); MEDIAN_SORT(4, 5); MEDIAN_SORT(7, 8); MEDIAN_SORT(0, 3);
+    MEDIAN_SORT(5, 8); MEDIAN_SORT(4, 7); MEDIAN_SORT(3, 6); MEDIAN_SORT(1, 4); MEDIAN_SORT(2, 5);
+    MEDIAN_SORT(4, 7); MEDIAN_SORT(4, 2); MEDIAN_SORT(6, 4); MEDIAN_SORT(4, 2);
+}
+
+/// @brief Moves the median of 25 sequences to v[12] (99 exchanges, Devillard)
+static void median_network_25(uint8_t (*v)[MEDIAN_BLOCK])
+{
+    MEDIAN_SORT(0, 1);   MEDIAN_SORT(3, 4);   MEDIAN_SORT(2, 4);   MEDIAN_SORT(2, 3);   MEDIAN_SORT(6, 7);
+    MEDIAN_SORT(5, 7);   MEDIAN_SORT(5, 6);   MEDIAN_SORT(9, 10);  MEDIAN_SORT(8, 10);  MEDIAN_SORT(8, 9);
+    MEDIAN_SORT(12, 13); MEDIAN_SORT(11, 13); MEDIAN_SORT(11, 12); MEDIAN_SORT(15, 16); MEDIAN_SORT(14, 16);
+    MEDIAN_SORT(14, 15); MEDIAN_SORT(18, 19); MEDIAN_SORT(17, 19); MEDIAN_SORT(17, 18); MEDIAN_SORT(21, 22);
+    MEDIAN_SORT(20, 22); MEDIAN_SORT(20, 21); MEDIAN_SORT(23, 24); MEDIAN_SORT(2, 5);   MEDIAN_SORT(3, 6);
+    MEDIAN_SORT(0, 6);   MEDIAN_SORT(0, 3);   MEDIAN_SORT(4, 7);   MEDIAN_SORT(1, 7);   MEDIAN_SORT(1, 4);
+    MEDIAN_SORT(11, 14); MEDIAN_SORT(8, 14);  MEDIAN_SORT(8, 11);  MEDIAN_SORT(12, 15); MEDIAN_SORT(9, 15);
+    MEDIAN_SORT(9, 12);  MEDIAN_SORT(13, 16); MEDIAN_SORT(10, 16); MEDIAN_SORT(10, 13); MEDIAN_SORT(20, 23);
+    MEDIAN_SORT(17, 23); MEDIAN_SORT(17, 20); MEDIAN_SORT(21, 24); MEDIAN_SORT(18, 24); MEDIAN_SORT(18, 21);
+    MEDIAN_SORT(19, 22); MEDIAN_SORT(8, 17);  MEDIAN_SORT(9, 18);  MEDIAN_SORT(0, 18);  MEDIAN_SORT(0, 9);
+    MEDIAN_SORT(10, 19); MEDIAN_SORT(1, 19);  MEDIAN_SORT(1, 10);  MEDIAN_SORT(11, 20); MEDIAN_SORT(2, 20);
+    MEDIAN_SORT(2, 11);  MEDIAN_SORT(12, 21); MEDIAN_SORT(3, 21);  MEDIAN_SORT(3, 12);  MEDIAN_SORT(13, 22);
+    MEDIAN_SORT(4, 22);  MEDIAN_SORT(4, 13);  MEDIAN_SORT(14, 23); MEDIAN_SORT(5, 23);  MEDIAN_SORT(5, 14);
+    MEDIAN_SORT(15, 24); MEDIAN_SORT(6, 24);  MEDIAN_SORT(6, 15);  MEDIAN_SORT(7, 16);  MEDIAN_SORT(7, 19);
+    MEDIAN_SORT(13, 21); MEDIAN_SORT(15, 23); MEDIAN_SORT(7, 13);  MEDIAN_SORT(7, 15);  MEDIAN_SORT(1, 9);
+    MEDIAN_SORT(3, 11);  MEDIAN_SORT(5, 17);  MEDIAN_SORT(11, 17); MEDIAN_SORT(9, 17);  MEDIAN_SORT(4, 10);
+    MEDIAN_SORT(6, 12);  MEDIAN_SORT(7, 14);  MEDIAN_SORT(4, 6);   MEDIAN_SORT(4, 7);   MEDIAN_SORT(12, 14);
+    MEDIAN_SORT(10, 14); MEDIAN_SORT(6, 7);   MEDIAN_SORT(10, 12); MEDIAN_SORT(6, 10);  MEDIAN_SORT(6, 17);
+    MEDIAN_SORT(12, 17); MEDIAN_SORT(7, 17);  MEDIAN_SORT(7, 10);  MEDIAN_SORT(12, 18); MEDIAN_SORT(7, 12);
+    MEDIAN_SORT(10, 18); MEDIAN_SORT(12, 20); MEDIAN_SORT(10, 20); MEDIAN_SORT(10, 12);
+}
+
+/// @brief Filters a strip of rows with a sorting network (radius 1 or 2)
+/// @note Rows are read between halos repeating the edge pixels, in a ring of 2 * radius + 1 rows.
+/// The window samples of MEDIAN_BLOCK consecutive samples are gathered into as many sequences,
+/// the network ordering them all at once; channels are sorted in the same sweep.
+/// @param task Index of the task
+/// @param params Median filter
+static void median_network_rows(unsigned int task, void *params)
+{
+    MedianFilter *median = params;
+    const ImageView *src = median->src;
+    int r = median->radius, n = 2 * r + 1;
+    int width = src->width, height = src->height, channels = src->channels;
+    size_t row_size = (size_t)width * channels;
+    size_t padded_size = row_size + 2 * (size_t)r * channels;
+    uint8_t *ring = malloc(n * padded_size + row_size);
+    double *scratch = src->depth == DEPTH_U8 ? NULL : malloc(row_size * sizeof(double));
+    uint8_t (*v)[MEDIAN_BLOCK] = calloc(n * n, MEDIAN_BLOCK);
+    if (!ring || !v || (src->depth != DEPTH_U8 && !scratch)) {
+        median->failed = true;
+        free(ring);
+        free(scratch);
+        free(v);
+        return;
+    }
+    uint8_t *out = ring + n * padded_size;
+
+    int first = task * median->rows_per_task;
+    int last = first + median->rows_per_task < (unsigned int)height ? first + median->rows_per_task : height;
+    int loaded = first - r;
+    for (int row = first; row < last; ++row) {
+        for (; loaded <= row + r; ++loaded) {
+            uint8_t *slot = ring + (size_t)((loaded % n + n) % n) * padded_size;
+            uint8_t *inside = slot + (size_t)r * channels;
+            read_u8_row(src, clamp_index(loaded, height), inside, scratch);
+            for (int i = 1; i <= r; ++i) {
+                memcpy(inside - (size_t)i * channels, inside, channels);
+                memcpy(inside + row_size + (size_t)(i - 1) * channels, inside + row_size - channels, channels);
+            }
+        }
+        for (size_t k = 0; k < row_size; k += MEDIAN_BLOCK) {
+            size_t count = row_size - k < MEDIAN_BLOCK ? row_size - k : MEDIAN_BLOCK;
+            for (int dy = 0; dy < n; ++dy) {
+                const uint8_t *slot = ring + (size_t)(((row - r + dy) % n + n) % n) * padded_size;
+                for (int dx = 0; dx < n; ++dx) {
+                    memcpy(v[dy * n + dx], slot + k + (size_t)dx * channels, count);
+                }
+            }
+            if (r == 1) {
+                median_network_9(v);
+            } else {
+                median_network_25(v);
+            }
+            memcpy(out + k, v[n * n / 2], count);
+        }
+        write_u8_row(median->dest, row, out);
+    }
+    free(ring);
+    free(scratch);
+    free(v);
+}
+
+/// @brief Adds (sign 1) or removes (sign -1) a row to the column histograms
+/// @param fine Fine histograms, 256 bins per sample of a row
+/// @param coarse Coarse histograms, MEDIAN_COARSE bins per sample of a row
+/// @param samples Row
+/// @param row_size Number of samples of the row
+/// @param sign 1 or -1
+static void update_columns(uint16_t *fine, uint16_t *coarse, const uint8_t *samples, size_t row_size, int sign)
+{
+    for (size_t k = 0; k < row_size; ++k) {
+        fine[k * 256 + samples[k]] += sign;
+        coarse[k * MEDIAN_COARSE + samples[k] / MEDIAN_COARSE] += sign;
+    }
+}
+
+/// @brief Adds (sign 1) or removes (sign -1) a histogram to another
+static inline void add_histogram(uint16_t *restrict dest, const uint16_t *restrict histogram, int count, int sign)
+{
+    for (int i = 0; i < count; ++i) {
+        dest[i] += sign * histogram[i];
+    }
+}
+
+/// @brief Filters a strip of rows with sliding histograms (Perreau), in constant time per sample
+/// @note Each sample of a row keeps the histogram of its column of the window, updated by one
+/// row in and one row out per output row. The window histogram slides along the row by one
+/// column in and one column out. Only its coarse bins are kept up to date: the fine bins of
+/// the coarse bin holding the median are brought to the current column when needed, from the
+/// columns passed since their last use (or rebuilt if the whole window was passed).
+/// @param task Index of the task
+/// @param params Median filter
+static void median_histogram_rows(unsigned int task, void *params)
+{
+    MedianFilter *median = params;
+    const ImageView *src = median->src;
+    int r = median->radius, n = 2 * r + 1;
+    int width = src->width, height = src->height, channels = src->channels;
+    size_t row_size = (size_t)width * channels;
+    uint16_t *fine = calloc(row_size * (256 + MEDIAN_COARSE), sizeof(uint16_t));
+    uint8_t *samples = malloc(2 * row_size);
+    double *scratch = src->depth == DEPTH_U8 ? NULL : malloc(row_size * sizeof(double));
+    if (!fine || !samples || (src->depth != DEPTH_U8 && !scratch)) {
+        median->failed = true;
+        free(fine);
+        free(samples);
+        free(scratch);
+        return;
+    }
+    uint16_t *coarse = fine + row_size * 256;
+    uint8_t *out = samples + row_size;
+
+    int first = task * median->rows_per_task;
+    int last = first + median->rows_per_task < (unsigned int)height ? first + median->rows_per_task : height;
+    for (int y = first - r; y < first + r; ++y) {
+        read_u8_row(src, clamp_index(y, height), samples, scratch);
+        update_columns(fine, coarse, samples, row_size, 1);
+    }
+    // rank of the median among the n * n samples of a window
+    int rank = n * n / 2;
+    for (int row = first; row < last; ++row) {
+        if (row > first) {
+            read_u8_row(src, clamp_index(row - r - 1, height), samples, scratch);
+            update_columns(fine, coarse, samples, row_size, -1);
+        }
+        read_u8_row(src, clamp_index(row + r, height), samples, scratch);
+        update_columns(fine, coarse, samples, row_size, 1);
+
+        for (int c = 0; c < channels; ++c) {
+            uint16_t window_coarse[MEDIAN_COARSE] = {0};
+            uint16_t window_fine[MEDIAN_COARSE][256 / MEDIAN_COARSE];
+            int synced[MEDIAN_COARSE];      // column of the fine bins, INT_MIN if never computed
+            for (int b = 0; b < MEDIAN_COARSE; ++b) {
+                synced[b] = INT_MIN;
+            }
+            for (int x = -r; x <= r; ++x) {
+                add_histogram(window_coarse, coarse + ((size_t)clamp_index(x, width) * channels + c) * MEDIAN_COARSE,
+                              MEDIAN_COARSE, 1);
+            }
+            for (int x = 0; x < width; ++x) {
+                if (x > 0) {
+                    size_t in = (size_t)clamp_index(x + r, width) * channels + c;
+                    size_t out_col = (size_t)clamp_index(x - r - 1, width) * channels + c;
+                    add_histogram(window_coarse, coarse + in * MEDIAN_COARSE, MEDIAN_COARSE, 1);
+                    add_histogram(window_coarse, coarse + out_col * MEDIAN_COARSE, MEDIAN_COARSE, -1);
+                }
+                int b = 0, below = 0;
+                while (below + window_coarse[b] <= rank) {
+                    below += window_coarse[b++];
+                }
+
+                uint16_t *bins = window_fine[b];
+                int segment = b * (256 / MEDIAN_COARSE);
+                if (synced[b] == INT_MIN || x - synced[b] >= n) {
+                    memset(bins, 0, sizeof(window_fine[b]));
+                    for (int j = x - r; j <= x + r; ++j) {
+                        size_t col = (size_t)clamp_index(j, width) * channels + c;
+                        add_histogram(bins, fine + col * 256 + segment, 256 / MEDIAN_COARSE, 1);
+                    }
+                } else {
+                    for (int j = synced[b] + 1; j <= x; ++j) {
+                        size_t in = (size_t)clamp_index(j + r, width) * channels + c;
+                        size_t out_col = (size_t)clamp_index(j - r - 1, width) * channels + c;
+                        add_histogram(bins, fine + in * 256 + segment, 256 / MEDIAN_COARSE, 1);
+                        add_histogram(bins, fine + out_col * 256 + segment, 256 / MEDIAN_COARSE, -1);
+                    }
+                }
+                synced[b] = x;
+
+                int i = 0;
+                while (below + bins[i] <= rank) {
+                    below += bins[i++];
+                }
+                out[(size_t)x * channels + c] = (uint8_t)(segment + i);
+            }
+        }
+        write_u8_row(median->dest, row, out);
+    }
+    free(fine);
+    free(samples);
+    free(scratch);
+}
+
+/// @brief Filters a view into a DEPTH_U8 view of its size, strips of rows running in parallel
+/// @param dest Filtered view
+/// @param src Source view
+/// @param radius Radius of the window
+/// @return true if filtering ok
+static bool median_view(const ImageView *dest, const ImageView *src, unsigned int radius)
+{
+    MedianFilter median = {.src = src, .dest = dest, .radius = radius};
+    unsigned int threads = parallel_threads();
+    median.rows_per_task = (src->height + 4 * threads - 1) / (4 * threads);
+    if (median.rows_per_task == 0) {
+        return true;
+    }
+    unsigned int tasks = (src->height + median.rows_per_task - 1) / median.rows_per_task;
+    parallel_for(tasks, radius <= 2 ? median_network_rows : median_histogram_rows, &median);
+    if (median.failed) {
+        perror("Error allocating median rows.");
+    }
+    return !median.failed;
+}
+
+bool median_filter_view(Image *dest, const ImageView *src, unsigned int radius)
+{
+    if (radius > MEDIAN_MAX_RADIUS) {
+        fprintf(stderr, "Median radius %u above the largest one (%d)\n", radius, MEDIAN_MAX_RADIUS);
+        return false;
+    }
+    bool planar = src->channels > 1 && src->channel_stride != (ptrdiff_t)depth_size(src->depth);
+    if (planar) {
+        create_planar_image(dest, src->type, src->width, src->height, src->channels, DEPTH_U8);
+    } else {
+        create_image(dest, src->type, src->width, src->height, src->channels, DEPTH_U8);
+    }
+    if (!dest->data) {
+        perror("Error during image allocation.");
+        return false;
+    }
+    if (src->depth == DEPTH_U8) {
+        dest->maxval = src->maxval;
+    }
+
+    ImageView dest_view = image_view(dest);
+    bool rc = true;
+    if (radius == 0) {
+        // the window is the sample itself
+        uint8_t *row = malloc((size_t)src->width * src->channels);
+        double *scratch = malloc((size_t)src->width * src->channels * sizeof(double));
+        rc = row && scratch;
+        for (unsigned int y = 0; y < src->height && rc; ++y) {
+            read_u8_row(src, y, row, scratch);
+            write_u8_row(&dest_view, y, row);
+        }
+        if (!rc) {
+            perror("Error allocating median rows.");
+        }
+        free(row);
+        free(scratch);
+    } else if (planar) {
+        for (unsigned int c = 0; c < src->channels && rc; ++c) {
+            ImageView src_plane = plane_view(src, c);
+            ImageView dest_plane = plane_view(&dest_view, c);
+            rc = median_view(&dest_plane, &src_plane, radius);
+        }
+    } else {
+        rc = median_view(&dest_view, src, radius);
+    }
+    if (!rc) {
+        free_image(dest);
+    }
+    return rc;
+}
+
+bool median_filter(Image *dest, Image *src, unsigned int radius)
+{
+    ImageView view = image_view(src);
+    return median_filter_view(dest, &view, radius);
+}
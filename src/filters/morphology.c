@@ -0,0 +1,474 @@
+#include "filters/morphology.h"
+#include "utils/parallel.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+// Samples of each row handled by a task of the column pass: the prefix and suffix
+// extrema of a strip of columns stay in cache
+#define MORPH_COLUMNS 128
+
+/// @brief Geometry of the samples filtered by a morphological operation
+typedef struct Morphology {
+    size_t row_size;            // samples of a row (width * channels)
+    unsigned int height;
+    unsigned int channels;      // distance between two samples of a channel along a row
+    unsigned int radius_x;
+    unsigned int radius_y;
+    bool binary;                // samples are 0 or 1, packed as bits
+    size_t words;               // words of a packed row
+} Morphology;
+
+/// @brief State shared by the tasks of an erosion or dilation pass on samples
+typedef struct ExtremumPass {
+    const Morphology *morph;
+    double *rows;               // rows filtered in place
+    bool dilate;
+    unsigned int rows_per_task;
+    bool failed;                // a task could not allocate its buffers
+} ExtremumPass;
+
+/// @brief Returns the minimum (erosion) or maximum (dilation) of two samples
+static inline double extremum(double a, double b, bool dilate)
+{
+    return dilate ? (a > b ? a : b) : (a < b ? a : b);
+}
+
+/// @brief Replaces each vector of a line by the extremum of the 2 * radius + 1 vectors around it (van Herk / Gil-Werman)
+/// @note The padded line is cut into blocks of the window size. Extrema of the prefixes (forward)
+/// and of the suffixes (backward) of each block make any window the extremum of a suffix and
+/// a prefix: 3 comparisons per sample whatever the radius. Vectors beyond the line are neutral.
+/// @param line First vector, filtered in place
+/// @param count Number of vectors
+/// @param stride Distance between two vectors, in samples
+/// @param len Number of samples of a vector (contiguous)
+/// @param radius Radius of the window
+/// @param dilate true for the maximum, false for the minimum
+/// @param g Prefix extrema, (count + 2 * radius) * len samples
+/// @param h Suffix extrema, (count + 2 * radius) * len samples
+static inline void van_herk_line(double *line, size_t count, size_t stride, size_t len, unsigned int radius,
+                                 bool dilate, double *restrict g, double *restrict h)
+{
+    size_t window = 2 * (size_t)radius + 1, padded = count + 2 * (size_t)radius;
+    double neutral = dilate ? -INFINITY : INFINITY;
+    for (size_t i = 0; i < padded; ++i) {
+        double *restrict gi = g + i * len, *restrict hi = h + i * len;
+        if (i < radius || i >= radius + count) {
+            for (size_t j = 0; j < len; ++j) gi[j] = hi[j] = neutral;
+        } else {
+            const double *in = line + (i - radius) * stride;
+            for (size_t j = 0; j < len; ++j) gi[j] = hi[j] = in[j];
+        }
+    }
+    for (size_t i = 1; i < padded; ++i) {
+        if (i % window == 0) continue;
+        double *restrict gi = g + i * len;
+        const double *restrict prev = gi - len;
+        for (size_t j = 0; j < len; ++j) gi[j] = extremum(prev[j], gi[j], dilate);
+    }
+    for (size_t i = padded - 1; i-- > 0;) {
+        if ((i + 1) % window == 0) continue;
+        double *restrict hi = h + i * len;
+        const double *restrict next = hi + len;
+        for (size_t j = 0; j < len; ++j) hi[j] = extremum(next[j], hi[j], dilate);
+    }
+    // the window of padded vectors [x, x + 2 * radius] is centered on vector x of the line
+    for (size_t x = 0; x < count; ++x) {
+        double *restrict out = line + x * stride;
+        const double *restrict suffix = h + x * len, *restrict prefix = g + (x + 2 * (size_t)radius) * len;
+        for (size_t j = 0; j < len; ++j) out[j] = extremum(suffix[j], prefix[j], dilate);
+    }
+}
+
+/// @brief Filters a strip of rows along the rows
+/// @param task Index of the strip
+/// @param params Pass (ExtremumPass)
+static void extremum_rows(unsigned int task, void *params)
+{
+    ExtremumPass *pass = params;
+    const Morphology *morph = pass->morph;
+    unsigned int first = task * pass->rows_per_task;
+    unsigned int last = first + pass->rows_per_task < morph->height ? first + pass->rows_per_task : morph->height;
+    size_t channels = morph->channels, count = morph->row_size / channels;
+    unsigned int radius = morph->radius_x;
+    double *g = malloc(2 * (count + 2 * (size_t)radius) * channels * sizeof(double));
+    if (!g) {
+        pass->failed = true;
+        return;
+    }
+    double *h = g + (count + 2 * (size_t)radius) * channels;
+    for (unsigned int y = first; y < last; ++y) {
+        double *row = pass->rows + y * morph->row_size;
+        // constant channels and operation let the inner loops unroll
+        if (channels == 1) {
+            if (pass->dilate) van_herk_line(row, count, 1, 1, radius, true, g, h);
+            else van_herk_line(row, count, 1, 1, radius, false, g, h);
+        } else if (pass->dilate) {
+            van_herk_line(row, count, channels, channels, radius, true, g, h);
+        } else {
+            van_herk_line(row, count, channels, channels, radius, false, g, h);
+        }
+    }
+    free(g);
+}
+
+/// @brief Filters a strip of MORPH_COLUMNS samples of each row along the columns
+/// @note Whole runs of samples are combined at each step, so memory is walked contiguously
+/// @param task Index of the strip
+/// @param params Pass (ExtremumPass)
+static void extremum_columns(unsigned int task, void *params)
+{
+    ExtremumPass *pass = params;
+    const Morphology *morph = pass->morph;
+    size_t first = (size_t)task * MORPH_COLUMNS;
+    size_t len = morph->row_size - first < MORPH_COLUMNS ? morph->row_size - first : MORPH_COLUMNS;
+    unsigned int radius = morph->radius_y;
+    double *g = malloc(2 * ((size_t)morph->height + 2 * (size_t)radius) * len * sizeof(double));
+    if (!g) {
+        pass->failed = true;
+        return;
+    }
+    double *h = g + ((size_t)morph->height + 2 * (size_t)radius) * len;
+    double *strip = pass->rows + first;
+    if (pass->dilate) van_herk_line(strip, morph->height, morph->row_size, len, radius, true, g, h);
+    else van_herk_line(strip, morph->height, morph->row_size, len, radius, false, g, h);
+    free(g);
+}
+
+/// @brief Erodes or dilates samples in place by the rectangle, rows then columns
+/// @param morph Geometry
+/// @param rows Samples, row after row
+/// @param dilate true for a dilation, false for an erosion
+/// @return true if filtering ok
+static bool extremum_pass(const Morphology *morph, double *rows, bool dilate)
+{
+    ExtremumPass pass = {.morph = morph, .rows = rows, .dilate = dilate};
+    unsigned int threads = parallel_threads();
+    if (morph->radius_x > 0) {
+        pass.rows_per_task = (morph->height + 4 * threads - 1) / (4 * threads);
+        parallel_for((morph->height + pass.rows_per_task - 1) / pass.rows_per_task, extremum_rows, &pass);
+    }
+    if (morph->radius_y > 0 && !pass.failed) {
+        parallel_for((morph->row_size + MORPH_COLUMNS - 1) / MORPH_COLUMNS, extremum_columns, &pass);
+    }
+    if (pass.failed) {
+        perror("Error allocating morphology rows.");
+    }
+    return !pass.failed;
+}
+
+/// @brief Combines two words of packed samples: AND for an erosion, OR for a dilation
+static inline uint64_t combine_bits(uint64_t a, uint64_t b, bool dilate)
+{
+    return dilate ? a | b : a & b;
+}
+
+/// @brief Returns the word of packed samples starting shift bits after word w
+/// @param bits Packed samples
+/// @param words Number of words
+/// @param w Word index
+/// @param shift Distance in bits
+/// @param fill Word standing for the samples beyond the last word
+static inline uint64_t shifted_word(const uint64_t *bits, size_t words, size_t w, size_t shift, uint64_t fill)
+{
+    size_t q = w + shift / 64;
+    unsigned int b = shift % 64;
+    uint64_t low = q < words ? bits[q] : fill;
+    if (b == 0) {
+        return low;
+    }
+    uint64_t high = q + 1 < words ? bits[q + 1] : fill;
+    return (low >> b) | (high << (64 - b));
+}
+
+/// @brief Erodes or dilates a packed row along the row
+/// @note The row is padded with neutral samples, then extrema over 1, 2, 4... samples are
+/// combined by shifting whole words: log2(2 * radius + 1) operations per 64 samples
+/// @param row Packed samples, filtered in place
+/// @param morph Geometry
+/// @param dilate true for a dilation, false for an erosion
+/// @param a Scratch, padded row (row_size + 2 * radius_x * channels bits)
+/// @param b Scratch, padded row
+static void binary_extremum_row(uint64_t *row, const Morphology *morph, bool dilate, uint64_t *a, uint64_t *b)
+{
+    size_t step = morph->channels, margin = (size_t)morph->radius_x * step;
+    size_t words = (morph->row_size + 2 * margin + 63) / 64;
+    uint64_t fill = dilate ? 0 : ~(uint64_t)0;
+
+    // neutral margins, then the samples from bit margin on
+    for (size_t w = 0; w < words; ++w) a[w] = fill;
+    for (size_t x = margin, end = margin + morph->row_size; x < end;) {
+        size_t bit = x % 64, n = end - x < 64 - bit ? end - x : 64 - bit;
+        uint64_t mask = n == 64 ? ~(uint64_t)0 : (((uint64_t)1 << n) - 1) << bit;
+        a[x / 64] &= ~mask;
+        x += n;
+    }
+    size_t tail = morph->row_size % 64;
+    for (size_t w = 0; w < morph->words; ++w) {
+        uint64_t v = row[w];
+        if (w + 1 == morph->words && tail) v &= ((uint64_t)1 << tail) - 1;
+        size_t pos = margin + 64 * w;
+        a[pos / 64] |= v << (pos % 64);
+        if (pos % 64 && pos / 64 + 1 < words) a[pos / 64 + 1] |= v >> (64 - pos % 64);
+    }
+
+    // extrema over span samples, then two overlapping spans cover the window
+    size_t window = 2 * (size_t)morph->radius_x + 1, span = 1;
+    while (2 * span <= window) {
+        for (size_t w = 0; w < words; ++w) b[w] = combine_bits(a[w], shifted_word(a, words, w, span * step, fill), dilate);
+        uint64_t *t = a;
+        a = b;
+        b = t;
+        span *= 2;
+    }
+    if (span < window) {
+        for (size_t w = 0; w < words; ++w) {
+            b[w] = combine_bits(a[w], shifted_word(a, words, w, (window - span) * step, fill), dilate);
+        }
+        a = b;
+    }
+    // the window starting at padded bit x is centered on sample x
+    memcpy(row, a, morph->words * sizeof(uint64_t));
+}
+
+/// @brief Erodes or dilates packed rows along the columns (van Herk / Gil-Werman on whole words)
+/// @param rows Packed rows, filtered in place
+/// @param morph Geometry
+/// @param dilate true for a dilation, false for an erosion
+/// @param g Prefix extrema, (height + 2 * radius_y) * words words
+/// @param h Suffix extrema, (height + 2 * radius_y) * words words
+static void binary_extremum_columns(uint64_t *rows, const Morphology *morph, bool dilate, uint64_t *g, uint64_t *h)
+{
+    size_t len = morph->words, count = morph->height, radius = morph->radius_y;
+    size_t window = 2 * radius + 1, padded = count + 2 * radius;
+    uint64_t neutral = dilate ? 0 : ~(uint64_t)0;
+    for (size_t i = 0; i < padded; ++i) {
+        uint64_t *gi = g + i * len, *hi = h + i * len;
+        if (i < radius || i >= radius + count) {
+            for (size_t j = 0; j < len; ++j) gi[j] = hi[j] = neutral;
+        } else {
+            memcpy(gi, rows + (i - radius) * len, len * sizeof(uint64_t));
+            memcpy(hi, gi, len * sizeof(uint64_t));
+        }
+    }
+    for (size_t i = 1; i < padded; ++i) {
+        if (i % window == 0) continue;
+        for (size_t j = 0; j < len; ++j) g[i * len + j] = combine_bits(g[(i - 1) * len + j], g[i * len + j], dilate);
+    }
+    for (size_t i = padded - 1; i-- > 0;) {
+        if ((i + 1) % window == 0) continue;
+        for (size_t j = 0; j < len; ++j) h[i * len + j] = combine_bits(h[(i + 1) * len + j], h[i * len + j], dilate);
+    }
+    for (size_t y = 0; y < count; ++y) {
+        for (size_t j = 0; j < len; ++j) {
+            rows[y * len + j] = combine_bits(h[y * len + j], g[(y + 2 * radius) * len + j], dilate);
+        }
+    }
+}
+
+/// @brief Erodes or dilates packed samples in place by the rectangle, rows then columns
+/// @param morph Geometry
+/// @param rows Packed rows
+/// @param dilate true for a dilation, false for an erosion
+/// @return true if filtering ok
+static bool binary_pass(const Morphology *morph, uint64_t *rows, bool dilate)
+{
+    size_t row_words = (morph->row_size + 2 * (size_t)morph->radius_x * morph->channels + 63) / 64;
+    size_t column_words = ((size_t)morph->height + 2 * (size_t)morph->radius_y) * morph->words;
+    uint64_t *scratch = malloc(2 * (row_words > column_words ? row_words : column_words) * sizeof(uint64_t));
+    if (!scratch) {
+        perror("Error allocating morphology rows.");
+        return false;
+    }
+    if (morph->radius_x > 0) {
+        for (unsigned int y = 0; y < morph->height; ++y) {
+            binary_extremum_row(rows + y * morph->words, morph, dilate, scratch, scratch + row_words);
+        }
+    }
+    if (morph->radius_y > 0) {
+        binary_extremum_columns(rows, morph, dilate, scratch, scratch + column_words);
+    }
+    free(scratch);
+    return true;
+}
+
+/// @brief Erodes or dilates samples in place, packed or not
+static bool morphology_pass(const Morphology *morph, void *data, bool dilate)
+{
+    return morph->binary ? binary_pass(morph, data, dilate) : extremum_pass(morph, data, dilate);
+}
+
+/// @brief Subtracts samples: dest = a - b (a AND NOT b when packed)
+static void morphology_difference(const Morphology *morph, void *dest, const void *a, const void *b)
+{
+    if (morph->binary) {
+        size_t count = morph->words * morph->height;
+        uint64_t *out = dest;
+        const uint64_t *x = a, *y = b;
+        for (size_t k = 0; k < count; ++k) out[k] = x[k] & ~y[k];
+    } else {
+        size_t count = morph->row_size * morph->height;
+        double *out = dest;
+        const double *x = a, *y = b;
+        for (size_t k = 0; k < count; ++k) out[k] = x[k] - y[k];
+    }
+}
+
+/// @brief Applies an operation to samples in place, packed or not
+/// @param morph Geometry
+/// @param data Samples
+/// @param size Size of the samples, in bytes
+/// @param op Operation
+/// @return true if filtering ok
+static bool morphology_apply(const Morphology *morph, void *data, size_t size, MORPH_OP op)
+{
+    switch (op) {
+    case MORPH_ERODE:
+        return morphology_pass(morph, data, false);
+    case MORPH_DILATE:
+        return morphology_pass(morph, data, true);
+    case MORPH_OPEN:
+        return morphology_pass(morph, data, false) && morphology_pass(morph, data, true);
+    case MORPH_CLOSE:
+        return morphology_pass(morph, data, true) && morphology_pass(morph, data, false);
+    default:
+        break;
+    }
+
+    // differences of two results, the second one computed on a copy
+    void *copy = malloc(size);
+    if (!copy) {
+        perror("Error allocating morphology rows.");
+        return false;
+    }
+    memcpy(copy, data, size);
+    bool rc;
+    if (op == MORPH_TOPHAT) {
+        rc = morphology_apply(morph, copy, size, MORPH_OPEN);
+        if (rc) morphology_difference(morph, data, data, copy);
+    } else if (op == MORPH_BLACKHAT) {
+        rc = morphology_apply(morph, copy, size, MORPH_CLOSE);
+        if (rc) morphology_difference(morph, data, copy, data);
+    } else {
+        rc = morphology_pass(morph, data, true) && morphology_pass(morph, copy, false);
+        if (rc) morphology_difference(morph, data, data, copy);
+    }
+    free(copy);
+    return rc;
+}
+
+/// @brief Applies an operation to a view, into a view of the same size
+/// @note The view is widened to double as a whole, the column pass needing every row.
+/// Views of 0 and 1 samples only are packed as bits before filtering.
+/// @param dest Filtered view
+/// @param src Source view
+/// @param op Operation
+/// @param radius_x Horizontal radius of the rectangle
+/// @param radius_y Vertical radius of the rectangle
+/// @return true if filtering ok
+static bool morphology_view(const ImageView *dest, const ImageView *src, MORPH_OP op,
+                            unsigned int radius_x, unsigned int radius_y)
+{
+    // beyond the size of the view, windows see whole lines anyway
+    Morphology morph = {
+        .row_size = (size_t)src->width * src->channels,
+        .height = src->height,
+        .channels = src->channels,
+        .radius_x = radius_x < src->width ? radius_x : src->width - 1,
+        .radius_y = radius_y < src->height ? radius_y : src->height - 1
+    };
+    size_t count = morph.row_size * morph.height;
+    double *rows = malloc(count * sizeof(double));
+    if (!rows) {
+        perror("Error allocating morphology rows.");
+        return false;
+    }
+    morph.binary = true;
+    for (unsigned int y = 0; y < morph.height; ++y) {
+        double *row = rows + y * morph.row_size;
+        read_view_row(src, y, row);
+        for (size_t k = 0; k < morph.row_size && morph.binary; ++k) {
+            morph.binary = row[k] == 0 || row[k] == 1;
+        }
+    }
+
+    bool rc;
+    if (morph.binary) {
+        morph.words = (morph.row_size + 63) / 64;
+        size_t size = morph.words * morph.height * sizeof(uint64_t);
+        uint64_t *bits = calloc(1, size);
+        rc = bits != NULL;
+        if (!rc) {
+            perror("Error allocating morphology rows.");
+        }
+        for (size_t y = 0; y < morph.height && rc; ++y) {
+            for (size_t k = 0; k < morph.row_size; ++k) {
+                if (rows[y * morph.row_size + k] != 0) bits[y * morph.words + k / 64] |= (uint64_t)1 << (k % 64);
+            }
+        }
+        rc = rc && morphology_apply(&morph, bits, size, op);
+        for (size_t y = 0; y < morph.height && rc; ++y) {
+            for (size_t k = 0; k < morph.row_size; ++k) {
+                rows[y * morph.row_size + k] = (bits[y * morph.words + k / 64] >> (k % 64)) & 1;
+            }
+        }
+        free(bits);
+    } else {
+        rc = morphology_apply(&morph, rows, count * sizeof(double), op);
+    }
+
+    for (unsigned int y = 0; y < morph.height && rc; ++y) {
+        write_view_row(dest, y, rows + y * morph.row_size);
+    }
+    free(rows);
+    return rc;
+}
+
+bool morphology_filter_view(Image *dest, const ImageView *src, MORPH_OP op, unsigned int radius_x, unsigned int radius_y)
+{
+    if (op < MORPH_ERODE || op > MORPH_GRADIENT) {
+        fprintf(stderr, "Unknown morphological operation %d\n", op);
+        return false;
+    }
+    bool planar = src->channels > 1 && src->channel_stride != (ptrdiff_t)depth_size(src->depth);
+    if (planar) {
+        create_planar_image(dest, src->type, src->width, src->height, src->channels, src->depth);
+    } else {
+        create_image(dest, src->type, src->width, src->height, src->channels, src->depth);
+    }
+    if (!dest->data) {
+        perror("Error during image allocation.");
+        return false;
+    }
+    dest->maxval = src->maxval;
+    if (src->width == 0 || src->height == 0) {
+        return true;
+    }
+    // the element is clipped to the image: larger radii cover the same pixels
+    radius_x = radius_x < src->width ? radius_x : src->width;
+    radius_y = radius_y < src->height ? radius_y : src->height;
+
+    ImageView dest_view = image_view(dest);
+    bool rc = true;
+    if (planar) {
+        for (unsigned int c = 0; c < src->channels && rc; ++c) {
+            ImageView src_plane = plane_view(src, c);
+            ImageView dest_plane = plane_view(&dest_view, c);
+            rc = morphology_view(&dest_plane, &src_plane, op, radius_x, radius_y);
+        }
+    } else {
+        rc = morphology_view(&dest_view, src, op, radius_x, radius_y);
+    }
+    if (!rc) {
+        free_image(dest);
+    }
+    return rc;
+}
+
+bool morphology_filter(Image *dest, Image *src, MORPH_OP op, unsigned int radius_x, unsigned int radius_y)
+{
+    ImageView view = image_view(src);
+    return morphology_filter_view(dest, &view, op, radius_x, radius_y);
+}
@@ -0,0 +1,548 @@
+#include "filters/pyramid.h"
+#include "filters/filters.h"
+#include "utils/parallel.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+// Smallest sigma left to the level filtered by a multi-scale gaussian filter, in pixels of the level:
+// below, the level is not smooth enough to be expanded without aliasing
+#define PYRAMID_MIN_SIGMA 1.0
+
+/// @brief State shared by the tasks of a reduction or an expansion
+typedef struct PyramidStep {
+    const ImageView *dest;
+    const ImageView *src;
+    const ImageView *add;       // view added to the expansion, NULL for none
+    double sign;                // sign of the expansion in the sum
+    unsigned int rows_per_task;
+    bool failed;                // a task could not allocate its rows
+} PyramidStep;
+
+/// @brief Returns a source row, reading it into a ring of rows if it is not there yet
+/// @note Rows beyond the view repeat the edge rows
+/// @param src Source view
+/// @param row Row index
+/// @param ring Rows read, size rows of width * channels samples
+/// @param tags Row held by each slot of the ring, -1 for none
+/// @param size Number of slots, at least the number of consecutive rows in use
+/// @return Samples of the row
+static const double * ring_row(const ImageView *src, int row, double *ring, int *tags, unsigned int size)
+{
+    row = row < 0 ? 0 : (row >= (int)src->height ? (int)src->height - 1 : row);
+    unsigned int slot = row % size;
+    double *samples = ring + (size_t)slot * src->width * src->channels;
+    if (tags[slot] != row) {
+        read_view_row(src, row, samples);
+        tags[slot] = row;
+    }
+    return samples;
+}
+
+/// @brief Reduces a strip of rows: column pass over the 5 source rows, then row pass on the kept pixels only
+/// @param task Index of the strip
+/// @param params Reduction (PyramidStep)
+static void down_rows(unsigned int task, void *params)
+{
+    PyramidStep *step = params;
+    const ImageView *src = step->src, *dest = step->dest;
+    unsigned int first = task * step->rows_per_task;
+    unsigned int last = first + step->rows_per_task < dest->height ? first + step->rows_per_task : dest->height;
+    unsigned int channels = src->channels;
+    int width = src->width;
+    size_t length = (size_t)width * channels;
+    double *ring = malloc((6 * length + (size_t)dest->width * channels) * sizeof(double));
+    if (!ring) {
+        step->failed = true;
+        return;
+    }
+    double *column = ring + 5 * length, *out = column + length;
+    int tags[5] = {-1, -1, -1, -1, -1};
+    for (unsigned int row = first; row < last; ++row) {
+        const double *r0 = ring_row(src, 2 * row - 2, ring, tags, 5);
+        const double *r1 = ring_row(src, 2 * row - 1, ring, tags, 5);
+        const double *r2 = ring_row(src, 2 * row, ring, tags, 5);
+        const double *r3 = ring_row(src, 2 * row + 1, ring, tags, 5);
+        const double *r4 = ring_row(src, 2 * row + 2, ring, tags, 5);
+        for (size_t i = 0; i < length; ++i) {
+            column[i] = (r0[i] + r4[i] + 4 * (r1[i] + r3[i]) + 6 * r2[i]) * (1.0 / 16);
+        }
+        for (unsigned int x = 0; x < dest->width; ++x) {
+            int center = 2 * x;
+            size_t c0, c1, c3, c4, c2 = (size_t)center * channels;
+            if (center >= 2 && center + 2 < width) {
+                c0 = c2 - 2 * channels, c1 = c2 - channels, c3 = c2 + channels, c4 = c2 + 2 * channels;
+            } else {
+                c0 = (size_t)(center - 2 < 0 ? 0 : center - 2) * channels;
+                c1 = (size_t)(center - 1 < 0 ? 0 : center - 1) * channels;
+                c3 = (size_t)(center + 1 < width ? center + 1 : width - 1) * channels;
+                c4 = (size_t)(center + 2 < width ? center + 2 : width - 1) * channels;
+            }
+            for (unsigned int c = 0; c < channels; ++c) {
+                out[x * channels + c] = (column[c0 + c] + column[c4 + c] + 4 * (column[c1 + c] + column[c3 + c])
+                                         + 6 * column[c2 + c]) * (1.0 / 16);
+            }
+        }
+        write_view_row(dest, row, out);
+    }
+    free(ring);
+}
+
+/// @brief Expands a strip of rows: even pixels weigh [1 6 1] / 8 around their source pixel,
+/// odd ones the mean of their two source neighbors
+/// @param task Index of the strip
+/// @param params Expansion (PyramidStep)
+static void up_rows(unsigned int task, void *params)
+{
+    PyramidStep *step = params;
+    const ImageView *src = step->src, *dest = step->dest;
+    unsigned int first = task * step->rows_per_task;
+    unsigned int last = first + step->rows_per_task < dest->height ? first + step->rows_per_task : dest->height;
+    unsigned int channels = src->channels;
+    int width = src->width;
+    size_t length = (size_t)width * channels, out_length = (size_t)dest->width * channels;
+    double *ring = malloc((4 * length + 2 * out_length) * sizeof(double));
+    if (!ring) {
+        step->failed = true;
+        return;
+    }
+    double *column = ring + 3 * length, *out = column + length, *added = out + out_length;
+    int tags[3] = {-1, -1, -1};
+    for (unsigned int row = first; row < last; ++row) {
+        int j = row / 2;
+        if (row % 2 == 0) {
+            const double *r0 = ring_row(src, j - 1, ring, tags, 3);
+            const double *r1 = ring_row(src, j, ring, tags, 3);
+            const double *r2 = ring_row(src, j + 1, ring, tags, 3);
+            for (size_t i = 0; i < length; ++i) {
+                column[i] = (r0[i] + r2[i] + 6 * r1[i]) * (1.0 / 8);
+            }
+        } else {
+            const double *r0 = ring_row(src, j, ring, tags, 3);
+            const double *r1 = ring_row(src, j + 1, ring, tags, 3);
+            for (size_t i = 0; i < length; ++i) {
+                column[i] = (r0[i] + r1[i]) * 0.5;
+            }
+        }
+        for (unsigned int x = 0; x < dest->width; ++x) {
+            int i = x / 2;
+            size_t c1 = (size_t)i * channels;
+            size_t c2 = (size_t)(i + 1 < width ? i + 1 : width - 1) * channels;
+            if (x % 2 == 0) {
+                size_t c0 = (size_t)(i > 0 ? i - 1 : 0) * channels;
+                for (unsigned int c = 0; c < channels; ++c) {
+                    out[x * channels + c] = (column[c0 + c] + column[c2 + c] + 6 * column[c1 + c]) * (1.0 / 8);
+                }
+            } else {
+                for (unsigned int c = 0; c < channels; ++c) {
+                    out[x * channels + c] = (column[c1 + c] + column[c2 + c]) * 0.5;
+                }
+            }
+        }
+        if (step->add) {
+            read_view_row(step->add, row, added);
+            for (size_t k = 0; k < out_length; ++k) {
+                out[k] = added[k] + step->sign * out[k];
+            }
+        }
+        write_view_row(dest, row, out);
+    }
+    free(ring);
+}
+
+/// @brief Runs a reduction or an expansion, strips of rows in parallel
+/// @param step Step, of views set
+/// @param rows Task filling a strip of rows
+/// @return true if the step ok
+static bool run_step(PyramidStep *step, void (*rows)(unsigned int, void *))
+{
+    unsigned int threads = parallel_threads();
+    step->rows_per_task = (step->dest->height + 4 * threads - 1) / (4 * threads);
+    if (step->rows_per_task == 0) {
+        return true;
+    }
+    parallel_for((step->dest->height + step->rows_per_task - 1) / step->rows_per_task, rows, step);
+    if (step->failed) {
+        perror("Error allocating pyramid rows.");
+    }
+    return !step->failed;
+}
+
+/// @brief Expands a view, optionally adding the expansion (or its opposite) to another view
+/// @param dest Expanded image (uninitialized)
+/// @param src Source view
+/// @param width Width of the expanded image
+/// @param height Height of the expanded image
+/// @param depth Depth of the expanded image
+/// @param add View of the size of the expanded image added to it, NULL for none
+/// @param sign Sign of the expansion in the sum
+/// @return true if expansion ok
+static bool expand_level(Image *dest, const ImageView *src, int width, int height, PIXEL_DEPTH depth,
+                         const ImageView *add, double sign)
+{
+    if (width < 1 || height < 1 || (unsigned int)width > 2 * src->width || (unsigned int)height > 2 * src->height
+        || (unsigned int)width + 1 < 2 * src->width || (unsigned int)height + 1 < 2 * src->height) {
+        fprintf(stderr, "Cannot expand a %ux%u image to %dx%d\n", src->width, src->height, width, height);
+        return false;
+    }
+    create_image(dest, src->type, width, height, src->channels, depth);
+    if (!dest->data) {
+        perror("Error during image allocation.");
+        return false;
+    }
+    if (depth == src->depth) {
+        dest->maxval = src->maxval;
+    }
+    ImageView dest_view = image_view(dest);
+    PyramidStep step = {.dest = &dest_view, .src = src, .add = add, .sign = sign};
+    if (!run_step(&step, up_rows)) {
+        free_image(dest);
+        return false;
+    }
+    return true;
+}
+
+bool pyramid_down(Image *dest, const ImageView *src)
+{
+    create_image(dest, src->type, (src->width + 1) / 2, (src->height + 1) / 2, src->channels, src->depth);
+    if (!dest->data) {
+        perror("Error during image allocation.");
+        return false;
+    }
+    dest->maxval = src->maxval;
+    ImageView dest_view = image_view(dest);
+    PyramidStep step = {.dest = &dest_view, .src = src};
+    if (!run_step(&step, down_rows)) {
+        free_image(dest);
+        return false;
+    }
+    return true;
+}
+
+bool pyramid_up(Image *dest, const ImageView *src, int width, int height)
+{
+    return expand_level(dest, src, width, height, src->depth, NULL, 1);
+}
+
+/// @brief Number of levels of a full pyramid, the last one being a single pixel
+/// @param width Width of the first level
+/// @param height Height of the first level
+/// @return Number of levels
+static unsigned int full_levels(unsigned int width, unsigned int height)
+{
+    unsigned int levels = 1;
+    while (width > 1 || height > 1) {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        ++levels;
+    }
+    return levels;
+}
+
+bool gaussian_pyramid(Pyramid *pyramid, const ImageView *src, unsigned int levels)
+{
+    pyramid->levels = 0;
+    pyramid->images = malloc(sizeof(Image));
+    if (!pyramid->images) {
+        perror("Error allocating pyramid.");
+        return false;
+    }
+    if (!materialize_view(&pyramid->images[0], src)) {
+        free(pyramid->images);
+        pyramid->images = NULL;
+        return false;
+    }
+    pyramid->levels = 1;
+    if (!extend_pyramid(pyramid, levels)) {
+        free_pyramid(pyramid);
+        return false;
+    }
+    return true;
+}
+
+bool extend_pyramid(Pyramid *pyramid, unsigned int levels)
+{
+    unsigned int full = full_levels(pyramid->images[0].width, pyramid->images[0].height);
+    if (levels == 0 || levels > full) {
+        levels = full;
+    }
+    if (levels <= pyramid->levels) {
+        return true;
+    }
+    Image *images = realloc(pyramid->images, levels * sizeof(Image));
+    if (!images) {
+        perror("Error allocating pyramid.");
+        return false;
+    }
+    pyramid->images = images;
+    while (pyramid->levels < levels) {
+        ImageView view = image_view(&images[pyramid->levels - 1]);
+        if (!pyramid_down(&images[pyramid->levels], &view)) {
+            return false;
+        }
+        ++pyramid->levels;
+    }
+    return true;
+}
+
+void free_pyramid(Pyramid *pyramid)
+{
+    for (unsigned int i = 0; i < pyramid->levels; ++i) {
+        free_image(&pyramid->images[i]);
+    }
+    free(pyramid->images);
+    pyramid->images = NULL;
+    pyramid->levels = 0;
+}
+
+bool laplacian_pyramid(Pyramid *laplacian, const Pyramid *gaussian)
+{
+    laplacian->levels = 0;
+    laplacian->images = malloc(gaussian->levels * sizeof(Image));
+    if (!laplacian->images) {
+        perror("Error allocating pyramid.");
+        return false;
+    }
+    unsigned int n = gaussian->levels;
+    for (unsigned int i = 0; i + 1 < n; ++i) {
+        // the level minus the expansion of the next one, in a single pass
+        ImageView level = image_view(&gaussian->images[i]);
+        ImageView next = image_view(&gaussian->images[i + 1]);
+        if (!expand_level(&laplacian->images[i], &next, level.width, level.height, DEPTH_F32, &level, -1)) {
+            free_pyramid(laplacian);
+            return false;
+        }
+        ++laplacian->levels;
+    }
+    if (!convert_image_depth(&laplacian->images[n - 1], &gaussian->images[n - 1], DEPTH_F32)) {
+        free_pyramid(laplacian);
+        return false;
+    }
+    ++laplacian->levels;
+    return true;
+}
+
+bool collapse_pyramid(Image *dest, const Pyramid *laplacian, PIXEL_DEPTH depth)
+{
+    unsigned int n = laplacian->levels;
+    if (n == 1) {
+        return convert_image_depth(dest, &laplacian->images[0], depth);
+    }
+    // each rebuilt level is the expansion of the next one plus its details
+    Image rebuilt = laplacian->images[n - 1];
+    for (int i = n - 2; i >= 0; --i) {
+        Image expanded;
+        ImageView next = image_view(&rebuilt);
+        ImageView details = image_view(&laplacian->images[i]);
+        bool rc = expand_level(&expanded, &next, details.width, details.height, i == 0 ? depth : DEPTH_F32,
+                               &details, 1);
+        if (i != (int)n - 2) {
+            free_image(&rebuilt);
+        }
+        if (!rc) {
+            return false;
+        }
+        rebuilt = expanded;
+    }
+    *dest = rebuilt;
+    return true;
+}
+
+/// @brief Weights the levels of a Laplacian pyramid by a mask, adding the other pyramid weighted by its complement
+/// @param a Laplacian pyramid of the first image, receiving the blend
+/// @param b Laplacian pyramid of the second image
+/// @param mask Gaussian pyramid of the mask
+/// @return true if blending ok
+static bool blend_levels(Pyramid *a, const Pyramid *b, const Pyramid *mask)
+{
+    for (unsigned int i = 0; i < a->levels; ++i) {
+        Image *level = &a->images[i];
+        unsigned int channels = level->channels, mask_channels = mask->images[i].channels;
+        size_t length = (size_t)level->width * channels;
+        double *row = malloc((2 * length + (size_t)level->width * mask_channels) * sizeof(double));
+        if (!row) {
+            perror("Error allocating blend rows.");
+            return false;
+        }
+        double *other = row + length, *weights = other + length;
+        for (unsigned int y = 0; y < level->height; ++y) {
+            read_image_row(level, y, row);
+            read_image_row(&b->images[i], y, other);
+            read_image_row(&mask->images[i], y, weights);
+            for (unsigned int x = 0; x < level->width; ++x) {
+                for (unsigned int c = 0; c < channels; ++c) {
+                    double w = weights[x * mask_channels + (mask_channels == 1 ? 0 : c)];
+                    size_t k = (size_t)x * channels + c;
+                    row[k] = w * row[k] + (1 - w) * other[k];
+                }
+            }
+            write_image_row(level, y, row);
+        }
+        free(row);
+    }
+    return true;
+}
+
+bool pyramid_blend(Image *dest, Image *a, Image *b, Image *mask, unsigned int levels)
+{
+    if (a->width != b->width || a->height != b->height || a->channels != b->channels
+        || a->width != mask->width || a->height != mask->height
+        || (mask->channels != 1 && mask->channels != a->channels)) {
+        fprintf(stderr, "Cannot blend %ux%u images of %u and %u channels with a %ux%u mask of %u channels\n",
+                a->width, a->height, a->channels, b->channels, mask->width, mask->height, mask->channels);
+        return false;
+    }
+    Pyramid gaussians[3], laplacians[2];
+    Image *sources[3] = {a, b, mask};
+    unsigned int built = 0, built_laplacians = 0;
+    bool rc = false;
+    for (; built < 3; ++built) {
+        ImageView view = image_view(sources[built]);
+        if (!gaussian_pyramid(&gaussians[built], &view, levels)) {
+            goto cleanup;
+        }
+    }
+    for (; built_laplacians < 2; ++built_laplacians) {
+        if (!laplacian_pyramid(&laplacians[built_laplacians], &gaussians[built_laplacians])) {
+            goto cleanup;
+        }
+    }
+    rc = blend_levels(&laplacians[0], &laplacians[1], &gaussians[2])
+         && collapse_pyramid(dest, &laplacians[0], a->depth);
+cleanup:
+    for (unsigned int i = 0; i < built; ++i) {
+        free_pyramid(&gaussians[i]);
+    }
+    for (unsigned int i = 0; i < built_laplacians; ++i) {
+        free_pyramid(&laplacians[i]);
+    }
+    return rc;
+}
+
+bool pyramid_resize(Image *dest, const Pyramid *pyramid, int width, int height, INTERP interp)
+{
+    unsigned int level = 0;
+    while (level + 1 < pyramid->levels && pyramid->images[level + 1].width >= (unsigned int)width
+           && pyramid->images[level + 1].height >= (unsigned int)height) {
+        ++level;
+    }
+    // pixel x of the level lies on pixel x * scale of the first one: shift the region of the
+    // separable filters, which sample pixel centers, by the matching fraction of a pixel
+    double scale = (double)(1u << level);
+    double offset = interp == INTERP_NEAREST || interp == INTERP_BILINEAR ? 0 : 0.5 - 0.5 / scale;
+    ImageView view = image_view(&pyramid->images[level]);
+    return resize_region_view(dest, &view, offset, offset, pyramid->images[0].width / scale,
+                              pyramid->images[0].height / scale, width, height, interp);
+}
+
+unsigned int pyramid_gaussian_levels(double sigma)
+{
+    // k reductions and expansions add a variance of 2 * (4^k - 1) / 3, the level filter 4^k * sigma_k^2
+    unsigned int levels = 1;
+    for (double scale = 4; (sigma * sigma - 2 * (scale - 1) / 3) / scale >= PYRAMID_MIN_SIGMA * PYRAMID_MIN_SIGMA;
+         scale *= 4) {
+        ++levels;
+    }
+    return levels;
+}
+
+/// @brief Filters a pyramid level and expands it back to the size of the first level
+/// @param dest Filtered image (uninitialized), of the depth of the first level
+/// @param level Pyramid level
+/// @param index Index of the level
+/// @param first First level of the pyramid
+/// @param sigma Standard deviation of the gaussian function on the first level
+/// @return true if filtering ok
+static bool filter_level(Image *dest, const ImageView *level, unsigned int index, const ImageView *first, double sigma)
+{
+    if (index == 0) {
+        return gaussian_filter_view(dest, first, 0, sigma, GAUSSIAN_AUTO);
+    }
+    double scale = (double)(1u << 2 * index);
+    double level_sigma = sqrt((sigma * sigma - 2 * (scale - 1) / 3) / scale);
+    // the small level is filtered and expanded in floats, then stored once at the depth of the source
+    Image samples, filtered;
+    create_image(&samples, level->type, level->width, level->height, level->channels, DEPTH_F32);
+    if (!samples.data) {
+        perror("Error during image allocation.");
+        return false;
+    }
+    ImageView samples_view = image_view(&samples);
+    double *row = malloc((size_t)level->width * level->channels * sizeof(double));
+    if (!row) {
+        perror("Error allocating pyramid rows.");
+        free_image(&samples);
+        return false;
+    }
+    for (unsigned int y = 0; y < level->height; ++y) {
+        read_view_row(level, y, row);
+        write_view_row(&samples_view, y, row);
+    }
+    free(row);
+    bool rc = gaussian_filter(&filtered, &samples, 0, level_sigma, GAUSSIAN_AUTO);
+    free_image(&samples);
+    if (!rc) {
+        return false;
+    }
+    for (int i = index - 1; i >= 0; --i) {
+        unsigned int width = first->width, height = first->height;
+        for (int k = 0; k < i; ++k) {
+            width = (width + 1) / 2;
+            height = (height + 1) / 2;
+        }
+        Image expanded;
+        ImageView view = image_view(&filtered);
+        rc = expand_level(&expanded, &view, width, height, i == 0 ? first->depth : DEPTH_F32, NULL, 1);
+        free_image(&filtered);
+        if (!rc) {
+            return false;
+        }
+        filtered = expanded;
+    }
+    filtered.maxval = first->maxval;
+    *dest = filtered;
+    return true;
+}
+
+bool pyramid_gaussian_filter(Image *dest, const Pyramid *pyramid, double sigma)
+{
+    unsigned int levels = pyramid_gaussian_levels(sigma);
+    if (levels > pyramid->levels) {
+        levels = pyramid->levels;
+    }
+    ImageView first = image_view(&pyramid->images[0]);
+    ImageView level = image_view(&pyramid->images[levels - 1]);
+    return filter_level(dest, &level, levels - 1, &first, sigma);
+}
+
+bool pyramid_gaussian_filter_view(Image *dest, const ImageView *src, double sigma)
+{
+    unsigned int levels = pyramid_gaussian_levels(sigma);
+    unsigned int full = full_levels(src->width, src->height);
+    if (levels > full) {
+        levels = full;
+    }
+    if (levels == 1) {
+        return filter_level(dest, src, 0, src, sigma);
+    }
+    // the levels in between are reduced and dropped on the way down
+    Image level;
+    if (!pyramid_down(&level, src)) {
+        return false;
+    }
+    for (unsigned int i = 2; i < levels; ++i) {
+        Image next;
+        ImageView view = image_view(&level);
+        bool rc = pyramid_down(&next, &view);
+        free_image(&level);
+        if (!rc) {
+            return false;
+        }
+        level = next;
+    }
+    ImageView view = image_view(&level);
+    bool rc = filter_level(dest, &view, levels - 1, src, sigma);
+    free_image(&level);
+    return rc;
+}
@@ -0,0 +1,276 @@
+#include "image/expression.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+// Samples evaluated at once when walking storage order: every node keeps a block
+// of values, small enough for the whole expression to stay in cache
+#define EXPR_BLOCK 1024
+
+typedef enum {
+    EXPR_IMAGE,
+    EXPR_CONSTANT,
+    EXPR_ADD,
+    EXPR_SUB,
+    EXPR_MUL,
+    EXPR_DIV,
+    EXPR_SQRT,
+    EXPR_ATAN,
+    EXPR_ATAN2,
+    EXPR_FUNC
+} EXPR_OP;
+
+struct Expr {
+    EXPR_OP op;
+    Expr *a;                // operands
+    Expr *b;
+    Image *image;           // EXPR_IMAGE
+    double value;           // EXPR_CONSTANT
+    double (*fct)(double);  // EXPR_FUNC
+    // evaluation state
+    double *values;         // values of the current block
+    Expr *source;           // leaf reading the same image first (itself if none)
+    bool direct;            // values point into the image (double samples in storage order)
+};
+
+/// @brief Allocates a node
+/// @param op Operation
+/// @param a First operand (NULL for leaves)
+/// @param b Second operand (NULL for leaves and unary operations)
+/// @param operands Number of operands of the operation
+/// @return Node, NULL if allocation failed or an operand is missing
+static Expr * new_expr(EXPR_OP op, Expr *a, Expr *b, int operands)
+{
+    Expr *expr = NULL;
+    if ((operands < 1 || a) && (operands < 2 || b)) {
+        expr = calloc(1, sizeof(Expr));
+    }
+    if (!expr) {
+        if (operands > 0) perror("Error building expression");
+        free_expr(a);
+        free_expr(b);
+        return NULL;
+    }
+    expr->op = op;
+    expr->a = a;
+    expr->b = b;
+    return expr;
+}
+
+Expr * expr_image(Image *image)
+{
+    Expr *expr = new_expr(EXPR_IMAGE, NULL, NULL, 0);
+    if (expr) expr->image = image;
+    return expr;
+}
+
+Expr * expr_constant(double value)
+{
+    Expr *expr = new_expr(EXPR_CONSTANT, NULL, NULL, 0);
+    if (expr) expr->value = value;
+    return expr;
+}
+
+Expr * expr_add(Expr *a, Expr *b) { return new_expr(EXPR_ADD, a, b, 2); }
+Expr * expr_sub(Expr *a, Expr *b) { return new_expr(EXPR_SUB, a, b, 2); }
+Expr * expr_mul(Expr *a, Expr *b) { return new_expr(EXPR_MUL, a, b, 2); }
+Expr * expr_div(Expr *a, Expr *b) { return new_expr(EXPR_DIV, a, b, 2); }
+Expr * expr_sqrt(Expr *a) { return new_expr(EXPR_SQRT, a, NULL, 1); }
+Expr * expr_atan(Expr *a) { return new_expr(EXPR_ATAN, a, NULL, 1); }
+Expr * expr_atan2(Expr *y, Expr *x) { return new_expr(EXPR_ATAN2, y, x, 2); }
+
+Expr * expr_func(Expr *a, double (*fct)(double))
+{
+    Expr *expr = new_expr(EXPR_FUNC, a, NULL, 1);
+    if (expr) expr->fct = fct;
+    return expr;
+}
+
+void free_expr(Expr *expr)
+{
+    if (!expr) return;
+    free_expr(expr->a);
+    free_expr(expr->b);
+    free(expr);
+}
+
+/// @brief Lists the nodes of an expression in evaluation order (operands first)
+/// @param expr Root node
+/// @param nodes Nodes (NULL to count them only)
+/// @param n Number of nodes
+static void flatten_expr(Expr *expr, Expr **nodes, size_t *n)
+{
+    if (!expr) return;
+    flatten_expr(expr->a, nodes, n);
+    flatten_expr(expr->b, nodes, n);
+    if (nodes) nodes[*n] = expr;
+    ++*n;
+}
+
+/// @brief Evaluates the operation nodes of a block, the leaves being read
+/// @param nodes Nodes in evaluation order
+/// @param n_nodes Number of nodes
+/// @param count Number of values of the block
+static void eval_block(Expr **nodes, size_t n_nodes, size_t count)
+{
+    for (size_t k = 0; k < n_nodes; ++k) {
+        Expr *e = nodes[k];
+        double *restrict out = e->values;
+        const double *restrict x = e->a ? e->a->values : NULL;
+        const double *restrict y = e->b ? e->b->values : NULL;
+        switch (e->op) {
+        case EXPR_ADD:
+            for (size_t i = 0; i < count; ++i) out[i] = x[i] + y[i];
+            break;
+        case EXPR_SUB:
+            for (size_t i = 0; i < count; ++i) out[i] = x[i] - y[i];
+            break;
+        case EXPR_MUL:
+            for (size_t i = 0; i < count; ++i) out[i] = x[i] * y[i];
+            break;
+        case EXPR_DIV:
+            for (size_t i = 0; i < count; ++i) out[i] = y[i] == 0.0 ? 0 : x[i] / y[i];
+            break;
+        case EXPR_SQRT:
+            for (size_t i = 0; i < count; ++i) out[i] = sqrt(x[i]);
+            break;
+        case EXPR_ATAN:
+            for (size_t i = 0; i < count; ++i) out[i] = atan(x[i]);
+            break;
+        case EXPR_ATAN2:
+            for (size_t i = 0; i < count; ++i) out[i] = atan2(x[i], y[i]);
+            break;
+        case EXPR_FUNC:
+            for (size_t i = 0; i < count; ++i) out[i] = e->fct(x[i]);
+            break;
+        case EXPR_IMAGE: [[fallthrough]];
+        case EXPR_CONSTANT: [[fallthrough]];
+        default:
+            break;
+        }
+    }
+}
+
+/// @brief Returns the first image of an expression
+/// @param expr Expression
+/// @return Image, NULL if the expression has none
+static Image * first_image(Expr *expr)
+{
+    if (!expr) return NULL;
+    if (expr->op == EXPR_IMAGE) return expr->image;
+    Image *image = first_image(expr->a);
+    return image ? image : first_image(expr->b);
+}
+
+bool eval_expr_into(Image *dest, Expr *expr)
+{
+    if (!expr) {
+        fprintf(stderr, "Cannot evaluate an incomplete expression\n");
+        return false;
+    }
+    size_t n_nodes = 0;
+    flatten_expr(expr, NULL, &n_nodes);
+    Expr **nodes = malloc(n_nodes * sizeof(Expr *));
+    if (!nodes) {
+        perror("Error evaluating expression");
+        return false;
+    }
+    n_nodes = 0;
+    flatten_expr(expr, nodes, &n_nodes);
+
+    // leaves must match the result; blocks follow storage order when every layout agrees
+    bool storage_order = true;
+    for (size_t k = 0; k < n_nodes; ++k) {
+        Image *image = nodes[k]->image;
+        if (nodes[k]->op != EXPR_IMAGE) continue;
+        if (image->width != dest->width || image->height != dest->height || image->channels != dest->channels) {
+            fprintf(stderr, "Cannot evaluate an expression on images of different sizes (%dx%dx%d and %dx%dx%d)\n",
+                    image->width, image->height, image->channels, dest->width, dest->height, dest->channels);
+            free(nodes);
+            return false;
+        }
+        storage_order = storage_order && image->layout == dest->layout;
+    }
+    size_t row_size = (size_t)dest->width * dest->channels;
+    size_t block = storage_order ? EXPR_BLOCK : row_size;
+
+    double *values = malloc(n_nodes * block * sizeof(double));
+    if (!values) {
+        perror("Error evaluating expression");
+        free(nodes);
+        return false;
+    }
+    for (size_t k = 0; k < n_nodes; ++k) {
+        Expr *e = nodes[k];
+        e->values = values + k * block;
+        e->source = e;
+        e->direct = false;
+        if (e->op == EXPR_CONSTANT) {
+            for (size_t i = 0; i < block; ++i) e->values[i] = e->value;
+        } else if (e->op == EXPR_IMAGE) {
+            for (size_t j = 0; j < k; ++j) {
+                if (nodes[j]->op == EXPR_IMAGE && nodes[j]->image == e->image) {
+                    e->source = nodes[j];
+                    break;
+                }
+            }
+            // double samples are used where they lie
+            e->direct = storage_order && e->image->depth == DEPTH_F64;
+        }
+    }
+
+    size_t total = storage_order ? row_size * dest->height : dest->height;
+    size_t step = storage_order ? EXPR_BLOCK : 1;
+    for (size_t offset = 0; offset < total; offset += step) {
+        size_t count = storage_order ? (total - offset < EXPR_BLOCK ? total - offset : EXPR_BLOCK) : row_size;
+        for (size_t k = 0; k < n_nodes; ++k) {
+            Expr *e = nodes[k];
+            if (e->op != EXPR_IMAGE) continue;
+            if (e->source != e) {
+                e->values = e->source->values;
+            } else if (e->direct) {
+                e->values = e->image->content + offset;
+            } else if (storage_order) {
+                read_image_samples(e->image, offset, count, e->values);
+            } else {
+                read_image_row(e->image, (unsigned int)offset, e->values);
+            }
+        }
+        eval_block(nodes, n_nodes, count);
+        if (storage_order) {
+            write_image_samples(dest, offset, count, expr->values);
+        } else {
+            write_image_row(dest, (unsigned int)offset, expr->values);
+        }
+    }
+
+    free(values);
+    free(nodes);
+    return true;
+}
+
+bool eval_expr(Image *dest, Expr *expr, PIXEL_DEPTH depth)
+{
+    Image *image = first_image(expr);
+    if (!image) {
+        fprintf(stderr, "Cannot evaluate an expression without image\n");
+        return false;
+    }
+    if (image->layout == LAYOUT_PLANAR) {
+        create_planar_image(dest, image->type, image->width, image->height, image->channels, depth);
+    } else {
+        create_image(dest, image->type, image->width, image->height, image->channels, depth);
+    }
+    if (!dest->data) {
+        perror("Error during image allocation");
+        return false;
+    }
+    if (depth == image->depth) {
+        dest->maxval = image->maxval;
+    }
+    if (!eval_expr_into(dest, expr)) {
+        free_image(dest);
+        return false;
+    }
+    return true;
+}
@@ -4,146 +4,584 @@
 #include <ctype.h>
 #include <string.h>
 #include "image/image.h"
+#include "image/expression.h"
+#include "utils/cpu.h"
+#include "utils/pool.h"
+#include "utils/parallel.h"
 #include <png.h>
 #include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
-/// @brief Reads the next line of a FILE and removed whitespaces before and after
-/// @param line 
-/// @param len 
-/// @param file 
-/// @return Number of characters read
-static ssize_t get_trimmed_line(char** line, size_t *len, FILE *file)
+/// @brief Header of a PNM file
+typedef struct PnmHeader {
+    int format; // 2, 3, 5 or 6 (P2, P3, P5, P6)
+    unsigned int width;
+    unsigned int height;
+    unsigned int maxval;
+    size_t payload; // offset of the first sample
+} PnmHeader;
+
+/// @brief Parses the header of a PNM file held in memory
+/// @param data File content
+/// @param size File size
+/// @param header Parsed header
+/// @return true if the header is valid
+static bool parse_pnm_header(const unsigned char *data, size_t size, PnmHeader *header)
+{
+    if (size < 2 || data[0] != 'P' || !strchr("2356", data[1])) {
+        return false;
+    }
+    header->format = data[1] - '0';
+    size_t pos = 2;
+    unsigned long values[3];
+    for (int k = 0; k < 3; ++k) {
+        // whitespaces and comments
+        while (pos < size && (isspace(data[pos]) || data[pos] == '#')) {
+            if (data[pos] == '#') {
+                while (pos < size && data[pos] != '\n') ++pos;
+            } else {
+                ++pos;
+            }
+        }
+        if (pos >= size || !isdigit(data[pos])) {
+            return false;
+        }
+        unsigned long value = 0;
+        while (pos < size && isdigit(data[pos]) && value <= UINT32_MAX) {
+            value = value * 10 + (data[pos++] - '0');
+        }
+        values[k] = value;
+    }
+    // a single whitespace separates the header from the samples
+    if (pos >= size || !isspace(data[pos])) {
+        return false;
+    }
+    header->width = values[0];
+    header->height = values[1];
+    header->maxval = values[2];
+    header->payload = pos + 1;
+    return values[0] > 0 && values[0] <= INT32_MAX && values[1] > 0 && values[1] <= INT32_MAX
+        && values[2] > 0 && values[2] <= 65535;
+}
+
+/// @brief Maps a whole file in memory, privately: writes go to copy-on-write pages, never to the file
+/// @param path Path to the file
+/// @param size Size of the file
+/// @return Mapping, NULL on error
+static unsigned char * map_file(const char *path, size_t *size)
 {
-    int read = getline(line, len, file);
-    if (read == -1) {
-        perror("Error reading file");
+    int fd = open(path, O_RDONLY);
+    struct stat sbuf;
+    if (fd == -1 || fstat(fd, &sbuf) != 0) {
+        perror("Could not open file");
+        if (fd != -1) close(fd);
+        return NULL;
+    }
+    *size = (size_t)sbuf.st_size;
+    unsigned char *map = *size ? mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("Could not map file");
+        return NULL;
+    }
+    return map;
+}
+
+/// @brief Maps a binary PNM file and wraps its samples
+/// @param image Image struct to store data
+/// @param path Path to image
+/// @return 1 if loaded, 0 on error, -1 if the file is an ASCII PNM
+static int map_pnm(Image *image, const char *path)
+{
+    size_t size;
+    unsigned char *map = map_file(path, &size);
+    if (!map) {
+        return 0;
+    }
+
+    PnmHeader header;
+    if (!parse_pnm_header(map, size, &header)) {
+        fprintf(stderr, "Invalid PNM header in %s\n", path);
+        munmap(map, size);
         return 0;
     }
+    if (header.format == 2 || header.format == 3) {
+        munmap(map, size);
+        return -1;
+    }
 
-    // trim left
-    char *start = *line, *end;
-    while (*start && isspace((unsigned char)*start)) {
-        start++;
+    unsigned int channels = header.format == 5 ? 1 : 3;
+    IMAGE_TYPE type = header.format == 5 ? GRAY : RGB;
+    size_t n = (size_t)header.width * header.height * channels;
+    size_t sample_bytes = header.maxval > 255 ? 2 : 1;
+    if (size - header.payload < n * sample_bytes) {
+        fprintf(stderr, "Truncated image data in %s\n", path);
+        munmap(map, size);
+        return 0;
     }
 
-    // trim right
-    end = start + strlen(*line) - 1;
-    while(end > start && isspace((unsigned char)*end)) {
-        *end = '\0';
-        end--;
+    if (sample_bytes == 1) {
+        // zero copy: the samples are the mapped bytes, pages being copied on their first write
+        madvise(map, size, MADV_SEQUENTIAL);
+        image->type = type;
+        image->depth = DEPTH_U8;
+        image->layout = LAYOUT_INTERLEAVED;
+        image->width = header.width;
+        image->height = header.height;
+        image->channels = channels;
+        image->maxval = header.maxval;
+        image->data = map + header.payload;
+        image->mapping = map;
+        image->mapping_size = size;
+        return 1;
     }
 
-    // finalization
-    if (start != *line) {
-        memmove(*line, start, end-start+2);
+    // big endian 16-bit samples have to be swapped into native ones
+    create_image(image, type, header.width, header.height, channels, DEPTH_U16);
+    if (!image->data) {
+        perror("Failed to allocate memory for image content");
+        munmap(map, size);
+        return 0;
     }
-    return read;
+    image->maxval = header.maxval;
+    const unsigned char *bytes = map + header.payload;
+    for (size_t i = 0; i < n; ++i) {
+        image->content_u16[i] = (uint16_t)(bytes[2*i] << 8 | bytes[2*i+1]);
+    }
+    munmap(map, size);
+    return 1;
 }
 
-/// @brief Frees the resources after or during the loading of an image
-/// @param line Current line of the read file
-/// @param file Image file
-/// @param properties Properties of the images, as read from the header of the image file
-static void free_load_resources(char *line, FILE *file, char *properties[3])
+bool load_image_mmap(Image *image, const char *path)
 {
-    free(line);
-    fclose(file);
-    for (unsigned j = 0; j<3; ++j) {
-        if (properties[j] != NULL) {
-            free(properties[j]);
-        }
+    int rc = map_pnm(image, path);
+    if (rc < 0) {
+        fprintf(stderr, "Cannot map %s: ASCII PNM files have to be parsed\n", path);
     }
+    return rc > 0;
 }
 
-/// @brief Reads the header of the PGM/PPM file
-/// @param line Pointer to line
-/// @param len Pointer to the allocated size of the line
-/// @param file File from which the header is read
-/// @param properties Properties of the image
-/// @return true if reading was successful
-bool read_header(char **line, size_t *len, FILE *file, char *properties[3])
+// Payloads above this size are decoded by several threads
+#define ASCII_PARALLEL_MIN (1 << 20)
+
+static inline bool is_digit(unsigned char c)
 {
-    ssize_t read;
-    unsigned int i = 0;
-    while (i<3) {
-        read = get_trimmed_line(line, len, file);
-        if (read == -1) {
-            perror("Error reading line");
-            return false;
-        }
-        if (*line[0] == '#') continue; // skip comments
+    return (unsigned char)(c - '0') < 10;
+}
 
-        properties[i] = strdup(*line);
-        if (properties[i] == NULL) {
-            perror("Memory allocation failed");
-            return false;
+static inline bool is_space(unsigned char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\v' || c == '\f';
+}
+
+/// @brief Decodes the samples of an ASCII PNM payload, without per-value library calls
+/// @param text First character
+/// @param end Character after the last one
+/// @param image Image receiving the samples (DEPTH_U8 or DEPTH_U16, maxval set)
+/// @param first Index of the first sample decoded
+/// @param count Maximum number of samples to decode
+/// @param decoded Number of samples decoded
+/// @return false if the text holds something else than samples and comments
+static bool decode_ascii_samples(const unsigned char *text, const unsigned char *end, Image *image,
+                                 size_t first, size_t count, size_t *decoded)
+{
+    const unsigned char *p = text;
+    unsigned int maxval = image->maxval;
+    size_t k = 0;
+    while (k < count) {
+        while (p < end && !is_digit(*p)) {
+            if (*p == '#') {
+                while (p < end && *p != '\n') ++p;
+            } else if (is_space(*p)) {
+                ++p;
+            } else {
+                *decoded = k;
+                return false;
+            }
+        }
+        if (p >= end) break;
+        unsigned int value = 0;
+        while (p < end && is_digit(*p)) {
+            value = value * 10 + (*p++ - '0');
+            if (value > maxval) {
+                *decoded = k;
+                return false;
+            }
+        }
+        if (image->depth == DEPTH_U8) {
+            image->content_u8[first + k] = (uint8_t)value;
+        } else {
+            image->content_u16[first + k] = (uint16_t)value;
         }
-        ++i;
+        ++k;
     }
+    *decoded = k;
     return true;
 }
 
+/// @brief Counts the samples of a chunk of ASCII payload (without comments)
+/// @param text First character
+/// @param end Character after the last one
+/// @return Number of samples
+static size_t count_ascii_samples(const unsigned char *text, const unsigned char *end)
+{
+    size_t count = 0;
+    bool in_value = false;
+    for (const unsigned char *p = text; p < end; ++p) {
+        bool digit = is_digit(*p);
+        count += digit && !in_value;
+        in_value = digit;
+    }
+    return count;
+}
+
+/// @brief ASCII payload split into chunks decoded by different threads
+typedef struct AsciiChunks {
+    const unsigned char **bounds; // chunk i spans bounds[i] to bounds[i+1]
+    size_t *first;                // index of the first sample of each chunk
+    Image *image;
+    size_t total;                 // number of samples of the image
+    bool *valid;
+} AsciiChunks;
+
+static void count_chunk(unsigned int task, void *params)
+{
+    AsciiChunks *chunks = params;
+    chunks->first[task + 1] = count_ascii_samples(chunks->bounds[task], chunks->bounds[task + 1]);
+}
+
+static void decode_chunk(unsigned int task, void *params)
+{
+    AsciiChunks *chunks = params;
+    size_t first = chunks->first[task];
+    size_t count = first < chunks->total ? chunks->total - first : 0;
+    size_t decoded;
+    chunks->valid[task] = decode_ascii_samples(chunks->bounds[task], chunks->bounds[task + 1],
+                                               chunks->image, first, count, &decoded);
+}
+
+/// @brief Decodes an ASCII payload with several threads
+/// @note Chunks end on whitespaces, so that no value is split. Each chunk is
+/// counted, then decoded at the offset given by the counts of the chunks before it.
+/// @param text First character of the payload
+/// @param end Character after the last one
+/// @param image Image receiving the samples
+/// @param threads Number of chunks
+/// @param decoded Number of samples decoded
+/// @return false if the payload holds something else than samples
+static bool decode_ascii_parallel(const unsigned char *text, const unsigned char *end, Image *image,
+                                  unsigned int threads, size_t *decoded)
+{
+    const unsigned char *bounds[threads + 1];
+    size_t first[threads + 1];
+    bool valid[threads];
+    bounds[0] = text;
+    for (unsigned int i = 1; i < threads; ++i) {
+        const unsigned char *p = text + (size_t)(end - text) * i / threads;
+        if (p < bounds[i-1]) p = bounds[i-1];
+        while (p < end && !is_space(*p)) ++p;
+        bounds[i] = p;
+    }
+    bounds[threads] = end;
+
+    AsciiChunks chunks = {.bounds = bounds, .first = first, .image = image,
+                          .total = (size_t)image->width * image->height * image->channels, .valid = valid};
+    first[0] = 0;
+    parallel_for(threads, count_chunk, &chunks);
+    for (unsigned int i = 1; i <= threads; ++i) {
+        first[i] += first[i-1];
+    }
+    parallel_for(threads, decode_chunk, &chunks);
+
+    *decoded = first[threads] < chunks.total ? first[threads] : chunks.total;
+    for (unsigned int i = 0; i < threads; ++i) {
+        if (!valid[i]) return false;
+    }
+    return true;
+}
+
+bool load_image_ascii(Image *image, const char *path, unsigned int threads)
+{
+    size_t size;
+    unsigned char *map = map_file(path, &size);
+    if (!map) {
+        return false;
+    }
+    PnmHeader header;
+    if (!parse_pnm_header(map, size, &header) || (header.format != 2 && header.format != 3)) {
+        fprintf(stderr, "Invalid ASCII PNM header in %s\n", path);
+        munmap(map, size);
+        return false;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    unsigned int channels = header.format == 2 ? 1 : 3;
+    IMAGE_TYPE type = header.format == 2 ? GRAY : RGB;
+    PIXEL_DEPTH depth = header.maxval > 255 ? DEPTH_U16 : DEPTH_U8;
+    create_image(image, type, header.width, header.height, channels, depth);
+    if (!image->data) {
+        perror("Failed to allocate memory for image content");
+        munmap(map, size);
+        return false;
+    }
+    image->maxval = header.maxval;
+
+    // the header parser stops on the whitespace after maxval
+    const unsigned char *text = map + header.payload - 1;
+    const unsigned char *end = map + size;
+    size_t n = (size_t)header.width * header.height * channels;
+    size_t decoded;
+    bool rc;
+    if (threads == 0) {
+        threads = parallel_threads();
+    }
+    // comments may hold digits: chunks cannot be counted without parsing them in order
+    if (threads > 1 && (size_t)(end - text) >= ASCII_PARALLEL_MIN && !memchr(text, '#', end - text)) {
+        rc = decode_ascii_parallel(text, end, image, threads, &decoded);
+    } else {
+        rc = decode_ascii_samples(text, end, image, 0, n, &decoded);
+    }
+    munmap(map, size);
+
+    if (!rc) {
+        fprintf(stderr, "Invalid sample in %s (after %zu samples, maxval %u)\n", path, decoded, header.maxval);
+        free_image(image);
+        return false;
+    }
+    if (decoded != n) {
+        fprintf(stderr, "Truncated image data (%zu samples out of %zu)\n", decoded, n);
+        memset((unsigned char *)image->data + decoded * depth_size(depth), 0, (n - decoded) * depth_size(depth));
+    }
+    return true;
+}
+
+/// @brief Tells whether a file starts with the PNG signature
+/// @param path Path to the file
+/// @return true for a PNG file
+static bool is_png_file(const char *path)
+{
+    unsigned char signature[8];
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    bool png = fread(signature, 1, sizeof(signature), file) == sizeof(signature)
+            && png_sig_cmp(signature, 0, sizeof(signature)) == 0;
+    fclose(file);
+    return png;
+}
+
 bool load_image(Image *image, const char *path)
 {
-    FILE *file;
-    file = fopen(path, "r");
-    if (file == NULL) {
+    if (is_png_file(path)) {
+        return load_png(image, path);
+    }
+    int rc = map_pnm(image, path);
+    if (rc < 0) {
+        return load_image_ascii(image, path, 0);
+    }
+    return rc > 0;
+}
+
+bool load_png(Image *image, const char *path)
+{
+    return load_png_rows(image, path, 0, NULL, NULL);
+}
+
+bool load_png_rows(Image *image, const char *path, unsigned int band_rows, png_rows_fct callback, void *params)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file) {
         perror("Could not open file");
         return false;
     }
 
-    // properties
-    char *line = NULL;
-    size_t len = 0;
-    char *properties[3] = {NULL, NULL, NULL};
-    if (!read_header(&line, &len, file, properties)) {
-        perror("Could not read file header");
-        free_load_resources(line, file, properties);
+    png_structp png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info_ptr = png_ptr ? png_create_info_struct(png_ptr) : NULL;
+    if (!info_ptr) {
+        perror("Error creating PNG read structs");
+        png_destroy_read_struct(&png_ptr, NULL, NULL);
+        fclose(file);
         return false;
     }
+    image->data = NULL;
+    image->mapping = NULL;
 
-    IMAGE_TYPE type;
-    int width, height, channels;
-    if (strcmp(properties[0], "P2") == 0 || strcmp(properties[0], "P5") == 0) {
-        channels = 1;
-        type = GRAY;
-    } else if (strcmp(properties[0], "P3") == 0 || strcmp(properties[0], "P6") == 0) {
-        channels = 3;
-        type = RGB;
-    } else {
-        perror("Unknown image type");
-        free_load_resources(line, file, properties);
+    // handle possible errors
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        fprintf(stderr, "Error decoding PNG %s\n", path);
+        png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+        fclose(file);
+        free_image(image);
         return false;
     }
 
-    // width and height
-    char *p;
-    p = strtok(properties[1], " ");
-    if (p) width = atoi(p);
-    p = strtok(NULL, " ");
-    if (p) height = atoi(p);
+    png_init_io(png_ptr, file);
+    png_read_info(png_ptr, info_ptr);
+    png_uint_32 width = png_get_image_width(png_ptr, info_ptr);
+    png_uint_32 height = png_get_image_height(png_ptr, info_ptr);
+    int bit_depth = png_get_bit_depth(png_ptr, info_ptr);
+    int color_type = png_get_color_type(png_ptr, info_ptr);
 
-    // create image
-    create_image(image, type, width, height, channels);
+    // samples are decoded as 8 or 16-bit gray or RGB: palettes and packed gray
+    // are expanded, alpha is dropped (images have no alpha channel), including
+    // the alpha a tRNS chunk adds when a palette is expanded
+    if (color_type == PNG_COLOR_TYPE_PALETTE) {
+        png_set_palette_to_rgb(png_ptr);
+    }
+    if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8) {
+        png_set_expand_gray_1_2_4_to_8(png_ptr);
+    }
+    if ((color_type & PNG_COLOR_MASK_ALPHA) || png_get_valid(png_ptr, info_ptr, PNG_INFO_tRNS)) {
+        png_set_strip_alpha(png_ptr);
+    }
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (bit_depth == 16) {
+        // PNG samples are big endian: swap them into native uint16_t
+        png_set_swap(png_ptr);
+    }
+#endif
+    int passes = png_set_interlace_handling(png_ptr);
+    png_read_update_info(png_ptr, info_ptr);
 
-    // read content
-    if (image->content == NULL) {
+    bool gray = !(png_get_color_type(png_ptr, info_ptr) & PNG_COLOR_MASK_COLOR);
+    PIXEL_DEPTH depth = png_get_bit_depth(png_ptr, info_ptr) == 16 ? DEPTH_U16 : DEPTH_U8;
+    create_image(image, gray ? GRAY : RGB, width, height, gray ? 1 : 3, depth);
+    if (!image->data) {
         perror("Failed to allocate memory for image content");
-        free_load_resources(line, file, properties);
-        return false;
+        png_error(png_ptr, "allocation failed");
+    }
+    size_t row_bytes = (size_t)width * image->channels * depth_size(depth);
+    if (png_get_rowbytes(png_ptr, info_ptr) != row_bytes) {
+        png_error(png_ptr, "unexpected row size");
     }
 
-    unsigned char *uchar_content = malloc(width * height * channels);
-    fread(uchar_content, 1, width * height * channels, file);
-    for (size_t i = 0; i<width*height*channels; ++i) {
-        image->content[i] = (float)uchar_content[i] / 255.0;
+    // rows are decoded in place; with interlacing they are final during the last pass only
+    unsigned char *rows = image->data;
+    if (band_rows == 0) {
+        band_rows = height;
+    }
+    for (int pass = 0; pass < passes; ++pass) {
+        bool last_pass = pass == passes - 1;
+        for (png_uint_32 row = 0; row < height; ++row) {
+            png_read_row(png_ptr, rows + row * row_bytes, NULL);
+            if (callback && last_pass && ((row + 1) % band_rows == 0 || row + 1 == height)
+                && !callback(image, row + 1, params)) {
+                png_error(png_ptr, "decoding stopped by the row callback");
+            }
+        }
     }
+    png_read_end(png_ptr, NULL);
 
-    free_load_resources(line, file, properties);
+    png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+    fclose(file);
     return true;
 }
 
-bool save_image(Image *image, const char *name)
+void row_to_bytes(const ImageView *view, unsigned int row, unsigned char *bytes, unsigned int maxval, double *buffer)
+{
+    size_t n = (size_t)view->width * view->channels;
+    const unsigned char *p = view->origin + (ptrdiff_t)row * view->row_stride;
+    unsigned int channels = view->channels;
+    ptrdiff_t step = view->col_stride;
+    ptrdiff_t cstep = view->channel_stride;
+    switch (view->depth) {
+    case DEPTH_U16:
+        for (unsigned int col = 0; col < view->width; ++col) {
+            const unsigned char *px = p + col * step;
+            for (unsigned int c = 0; c < channels; ++c) {
+                unsigned int v = *(const uint16_t *)(px + c * cstep);
+                if (maxval != view->maxval) v = (unsigned int)(((uint64_t)v * maxval + view->maxval/2) / view->maxval);
+                size_t i = (size_t)col * channels + c;
+                if (maxval > 255) {
+                    bytes[2*i] = (unsigned char)(v >> 8);
+                    bytes[2*i+1] = (unsigned char)(v & 0xFF);
+                } else {
+                    bytes[i] = (unsigned char)v;
+                }
+            }
+        }
+        break;
+    case DEPTH_U8:
+        if (maxval <= 255) {
+            if (maxval == view->maxval && step == (ptrdiff_t)channels && cstep == 1) {
+                memcpy(bytes, p, n);
+                break;
+            }
+            for (unsigned int col = 0; col < view->width; ++col) {
+                const uint8_t *px = p + col * step;
+                for (unsigned int c = 0; c < channels; ++c) {
+                    bytes[(size_t)col*channels+c] = (unsigned char)((px[c * cstep] * maxval + view->maxval/2) / view->maxval);
+                }
+            }
+            break;
+        }
+        [[fallthrough]];
+    default:
+        read_view_row(view, row, buffer);
+        for (size_t i = 0; i < n; ++i) {
+            double v = buffer[i] * maxval + 0.5;
+            v = v > 0 ? v : 0;
+            v = v < maxval ? v : maxval;
+            if (maxval > 255) {
+                bytes[2*i] = (unsigned char)((unsigned int)v >> 8);
+                bytes[2*i+1] = (unsigned char)((unsigned int)v & 0xFF);
+            } else {
+                bytes[i] = (unsigned char)v;
+            }
+        }
+        break;
+    }
+}
+
+// ASCII PNM lines should not exceed 70 characters
+#define ASCII_LINE_MAX 70
+
+/// @brief Formats the samples of a row as ASCII PNM lines
+/// @param text Destination (at least 6 characters per sample)
+/// @param bytes Samples, as given by row_to_bytes
+/// @param count Number of samples
+/// @param wide true for 2-byte samples
+/// @return Number of characters written
+static size_t format_ascii_row(char *text, const unsigned char *bytes, size_t count, bool wide)
+{
+    char *p = text, *line = text;
+    for (size_t i = 0; i < count; ++i) {
+        unsigned int value = wide ? (unsigned int)(bytes[2*i] << 8 | bytes[2*i+1]) : bytes[i];
+        char digits[5];
+        int n = 0;
+        do {
+            digits[n++] = (char)('0' + value % 10);
+            value /= 10;
+        } while (value);
+        if (p != line) {
+            if (p - line + 1 + n > ASCII_LINE_MAX) {
+                *p++ = '\n';
+                line = p;
+            } else {
+                *p++ = ' ';
+            }
+        }
+        while (n) *p++ = digits[--n];
+    }
+    *p++ = '\n';
+    return (size_t)(p - text);
+}
+
+/// @brief Saves a PPM / PGM image, binary or ASCII
+/// @param image Image struct
+/// @param name Name of the image (without extension)
+/// @param ascii true for P2 / P3 files, false for P5 / P6
+/// @return true if save ok
+static bool write_pnm(Image *image, const char *name, bool ascii)
 {
     // find correct extension based on type
     char *extension = (char*)malloc(5);
@@ -179,24 +617,42 @@ bool save_image(Image *image, const char *name)
         return false;
     }
     
-    // data
-    unsigned char *uchar_content = malloc(image->width * image->height * image->channels);
-    for (size_t i = 0; i<image->width * image->height * image->channels; ++i) {
-        uchar_content[i] = (unsigned char)(255 * image->content[i]);
+    // header
+    unsigned int maxval = 255;
+    if (image->depth == DEPTH_U8 || image->depth == DEPTH_U16) {
+        maxval = image->maxval;
     }
     switch (image->type) {
         case GRAY:
-            fprintf(file, "%s\n", "P5");
+            fprintf(file, "%s\n", ascii ? "P2" : "P5");
             break;
         case RGB: [[fallthrough]];
         default:
-            fprintf(file, "%s\n", "P6");
+            fprintf(file, "%s\n", ascii ? "P3" : "P6");
             break;
     }
     fprintf(file, "%d %d\n", image->width, image->height);
-    fprintf(file, "255\n");
-    fwrite(uchar_content, sizeof(unsigned char), image->width * image->height * image->channels, file);
-    free(uchar_content);
+    fprintf(file, "%u\n", maxval);
+
+    // data, row by row
+    size_t row_size = (size_t)image->width * image->channels;
+    size_t sample_bytes = maxval > 255 ? 2 : 1;
+    unsigned char *bytes = malloc(row_size * sample_bytes);
+    double *buffer = malloc(row_size * sizeof(double));
+    // up to 5 digits and a separator per sample, plus the final newline
+    char *text = ascii ? malloc(row_size * 6 + 1) : NULL;
+    ImageView view = image_view(image);
+    for (unsigned int row = 0; row < image->height; ++row) {
+        row_to_bytes(&view, row, bytes, maxval, buffer);
+        if (ascii) {
+            fwrite(text, 1, format_ascii_row(text, bytes, row_size, sample_bytes == 2), file);
+        } else {
+            fwrite(bytes, sample_bytes, row_size, file);
+        }
+    }
+    free(bytes);
+    free(buffer);
+    free(text);
 
     // clear
     free(extension);   
@@ -205,23 +661,566 @@ bool save_image(Image *image, const char *name)
     return true;
 }
 
-void create_image(Image *image, IMAGE_TYPE type, int width, int height, int channels)
+bool save_image(Image *image, const char *name)
+{
+    return write_pnm(image, name, false);
+}
+
+bool save_image_ascii(Image *image, const char *name)
+{
+    return write_pnm(image, name, true);
+}
+
+size_t depth_size(PIXEL_DEPTH depth)
+{
+    switch (depth) {
+    case DEPTH_U8: return sizeof(uint8_t);
+    case DEPTH_U16: return sizeof(uint16_t);
+    case DEPTH_F32: return sizeof(float);
+    case DEPTH_F64: [[fallthrough]];
+    default: return sizeof(double);
+    }
+}
+
+void create_image(Image *image, IMAGE_TYPE type, int width, int height, int channels, PIXEL_DEPTH depth)
 {
     image->type = type;
+    image->depth = depth;
+    image->layout = LAYOUT_INTERLEAVED;
     image->width = width;
     image->height = height;
     image->channels = channels;
-    image->content = (double *)malloc(width * height * channels * sizeof(double));
+    switch (depth) {
+    case DEPTH_U8: image->maxval = 255; break;
+    case DEPTH_U16: image->maxval = 65535; break;
+    default: image->maxval = 1; break;
+    }
+    image->mapping = NULL;
+    image->mapping_size = 0;
+    image->data = pool_alloc((size_t)width * height * channels * depth_size(depth));
+}
+
+void create_planar_image(Image *image, IMAGE_TYPE type, int width, int height, int channels, PIXEL_DEPTH depth)
+{
+    create_image(image, type, width, height, channels, depth);
+    image->layout = LAYOUT_PLANAR;
 }
 
 void free_image(Image *image)
 {
-    free(image->content);
-    image = NULL;
+    if (image->mapping) {
+        munmap(image->mapping, image->mapping_size);
+        image->mapping = NULL;
+        image->data = NULL;
+        return;
+    }
+    pool_free(image->data);
+    image->data = NULL;
+}
+
+void read_image_row(const Image *image, unsigned int row, double *buffer)
+{
+    ImageView view = image_view((Image *)image);
+    read_view_row(&view, row, buffer);
 }
 
-bool image_to_png(Image *image, const char *png_file_path)
+void write_image_row(Image *image, unsigned int row, const double *buffer)
+{
+    ImageView view = image_view(image);
+    write_view_row(&view, row, buffer);
+}
+
+// Widens the samples of a row of type T: a contiguous run when interleaved,
+// one sequential pass per plane otherwise
+#define READ_ROW(T, scale)                                                      \
+    do {                                                                        \
+        if (step == (ptrdiff_t)(channels * sizeof(T)) && cstep == sizeof(T)) {  \
+            const T *px = (const T *)p;                                         \
+            for (size_t i = 0; i < n; ++i) buffer[i] = px[i] * (scale);         \
+        } else {                                                                \
+            for (unsigned int c = 0; c < channels; ++c) {                       \
+                const unsigned char *plane = p + c * cstep;                     \
+                for (unsigned int col = 0; col < view->width; ++col) {          \
+                    buffer[(size_t)col*channels+c] = *(const T *)(plane + col * step) * (scale); \
+                }                                                               \
+            }                                                                   \
+        }                                                                       \
+    } while (0)
+
+void read_view_row(const ImageView *view, unsigned int row, double *buffer)
+{
+    size_t n = (size_t)view->width * view->channels;
+    const unsigned char *p = view->origin + (ptrdiff_t)row * view->row_stride;
+    unsigned int channels = view->channels;
+    ptrdiff_t step = view->col_stride;
+    ptrdiff_t cstep = view->channel_stride;
+    switch (view->depth) {
+    case DEPTH_U8: READ_ROW(uint8_t, 1.0 / view->maxval); break;
+    case DEPTH_U16: READ_ROW(uint16_t, 1.0 / view->maxval); break;
+    case DEPTH_F32: READ_ROW(float, 1.0); break;
+    case DEPTH_F64: [[fallthrough]];
+    default:
+        if (step == (ptrdiff_t)(channels * sizeof(double)) && cstep == sizeof(double)) {
+            memcpy(buffer, p, n * sizeof(double));
+        } else {
+            READ_ROW(double, 1.0);
+        }
+        break;
+    }
+}
+
+// Narrows a row into samples of type T, rounding and clamping integers
+#define WRITE_ROW(T, convert)                                                   \
+    do {                                                                        \
+        for (unsigned int c = 0; c < channels; ++c) {                           \
+            unsigned char *plane = p + c * cstep;                               \
+            for (unsigned int col = 0; col < view->width; ++col) {              \
+                double v = buffer[(size_t)col*channels+c];                      \
+                *(T *)(plane + col * step) = convert;                           \
+            }                                                                   \
+        }                                                                       \
+    } while (0)
+
+static inline double clamp_sample(double v, double maxval)
+{
+    v = v * maxval + 0.5;
+    v = v > 0 ? v : 0;
+    return v < maxval ? v : maxval;
+}
+
+void write_view_row(const ImageView *view, unsigned int row, const double *buffer)
+{
+    unsigned char *p = view->origin + (ptrdiff_t)row * view->row_stride;
+    unsigned int channels = view->channels;
+    ptrdiff_t step = view->col_stride;
+    ptrdiff_t cstep = view->channel_stride;
+    double maxval = view->maxval;
+    switch (view->depth) {
+    case DEPTH_U8: WRITE_ROW(uint8_t, (uint8_t)clamp_sample(v, maxval)); break;
+    case DEPTH_U16: WRITE_ROW(uint16_t, (uint16_t)clamp_sample(v, maxval)); break;
+    case DEPTH_F32: WRITE_ROW(float, (float)v); break;
+    case DEPTH_F64: [[fallthrough]];
+    default:
+        if (step == (ptrdiff_t)(channels * sizeof(double)) && cstep == sizeof(double)) {
+            memcpy(p, buffer, (size_t)view->width * channels * sizeof(double));
+        } else {
+            WRITE_ROW(double, v);
+        }
+        break;
+    }
+}
+
+void read_image_samples(const Image *image, size_t offset, size_t count, double *buffer)
+{
+    switch (image->depth) {
+    case DEPTH_U8: {
+        const uint8_t *src = image->content_u8 + offset;
+        double scale = 1.0 / image->maxval;
+        for (size_t i = 0; i < count; ++i) buffer[i] = src[i] * scale;
+        break;
+    }
+    case DEPTH_U16: {
+        const uint16_t *src = image->content_u16 + offset;
+        double scale = 1.0 / image->maxval;
+        for (size_t i = 0; i < count; ++i) buffer[i] = src[i] * scale;
+        break;
+    }
+    case DEPTH_F32: {
+        const float *src = image->content_f32 + offset;
+        for (size_t i = 0; i < count; ++i) buffer[i] = src[i];
+        break;
+    }
+    case DEPTH_F64: [[fallthrough]];
+    default:
+        memcpy(buffer, image->content + offset, count * sizeof(double));
+        break;
+    }
+}
+
+void write_image_samples(Image *image, size_t offset, size_t count, const double *buffer)
+{
+    double maxval = image->maxval;
+    switch (image->depth) {
+    case DEPTH_U8: {
+        uint8_t *dest = image->content_u8 + offset;
+        for (size_t i = 0; i < count; ++i) dest[i] = (uint8_t)clamp_sample(buffer[i], maxval);
+        break;
+    }
+    case DEPTH_U16: {
+        uint16_t *dest = image->content_u16 + offset;
+        for (size_t i = 0; i < count; ++i) dest[i] = (uint16_t)clamp_sample(buffer[i], maxval);
+        break;
+    }
+    case DEPTH_F32: {
+        float *dest = image->content_f32 + offset;
+        for (size_t i = 0; i < count; ++i) dest[i] = (float)buffer[i];
+        break;
+    }
+    case DEPTH_F64: [[fallthrough]];
+    default:
+        memcpy(image->content + offset, buffer, count * sizeof(double));
+        break;
+    }
+}
+
+ImageView image_view(Image *image)
+{
+    size_t size = depth_size(image->depth);
+    ImageView view = {
+        .type = image->type,
+        .depth = image->depth,
+        .width = image->width,
+        .height = image->height,
+        .channels = image->channels,
+        .maxval = image->maxval,
+        .origin = image->data
+    };
+    if (image->layout == LAYOUT_PLANAR) {
+        view.row_stride = (ptrdiff_t)((size_t)image->width * size);
+        view.col_stride = (ptrdiff_t)size;
+        view.channel_stride = (ptrdiff_t)((size_t)image->width * image->height * size);
+    } else {
+        view.row_stride = (ptrdiff_t)((size_t)image->width * image->channels * size);
+        view.col_stride = (ptrdiff_t)((size_t)image->channels * size);
+        view.channel_stride = (ptrdiff_t)size;
+    }
+    return view;
+}
+
+ImageView plane_view(const ImageView *src, unsigned int channel)
+{
+    ImageView view = *src;
+    view.origin = src->origin + (ptrdiff_t)channel * src->channel_stride;
+    view.channels = 1;
+    if (src->type != HSV) view.type = GRAY;
+    return view;
+}
+
+bool crop_view(ImageView *dest, const ImageView *src, int col, int row, int width, int height)
+{
+    if (col < 0 || row < 0 || width <= 0 || height <= 0
+        || col + width > src->width || row + height > src->height) {
+        fprintf(stderr, "Region out of bounds: %dx%d at (%d %d) (for width %d and height %d)\n", 
+                width, height, col, row, src->width, src->height);
+        return false;
+    }
+    *dest = *src;
+    dest->origin = src->origin + row * src->row_stride + col * src->col_stride;
+    dest->width = width;
+    dest->height = height;
+    return true;
+}
+
+ImageView flip_view_horizontal(const ImageView *src)
+{
+    ImageView view = *src;
+    view.origin = src->origin + (ptrdiff_t)(src->width - 1) * src->col_stride;
+    view.col_stride = -src->col_stride;
+    return view;
+}
+
+ImageView flip_view_vertical(const ImageView *src)
+{
+    ImageView view = *src;
+    view.origin = src->origin + (ptrdiff_t)(src->height - 1) * src->row_stride;
+    view.row_stride = -src->row_stride;
+    return view;
+}
+
+ImageView transpose_view(const ImageView *src)
+{
+    ImageView view = *src;
+    view.width = src->height;
+    view.height = src->width;
+    view.row_stride = src->col_stride;
+    view.col_stride = src->row_stride;
+    return view;
+}
+
+ImageView rotate_view_quarter(const ImageView *src, int turns)
+{
+    ImageView view = *src;
+    ptrdiff_t last_col = (ptrdiff_t)(src->width - 1) * src->col_stride;
+    ptrdiff_t last_row = (ptrdiff_t)(src->height - 1) * src->row_stride;
+    switch (((turns % 4) + 4) % 4) {
+    case 1:
+        // the last column becomes the first row
+        view = transpose_view(src);
+        view.origin = src->origin + last_col;
+        view.row_stride = -src->col_stride;
+        break;
+    case 2:
+        view.origin = src->origin + last_col + last_row;
+        view.col_stride = -src->col_stride;
+        view.row_stride = -src->row_stride;
+        break;
+    case 3:
+        // the last row becomes the first column
+        view = transpose_view(src);
+        view.origin = src->origin + last_row;
+        view.col_stride = -src->row_stride;
+        break;
+    default:
+        break;
+    }
+    return view;
+}
+
+void * view_pixel_at(const ImageView *view, int col, int row)
+{
+    if (row < 0 || row >= view->height || col < 0 || col >= view->width) {
+        fprintf(stderr, "Fetching pixel out of bounds: %d %d (for width %d and height %d)\n", col, row, view->width, view->height);
+        return NULL;
+    }
+    return view->origin + row * view->row_stride + col * view->col_stride;
+}
+
+// Side of the square tiles of materialize_view, in pixels: the source lines of a tile stay in cache
+#define COPY_TILE 64
+
+/// @brief Copies a tile of elements from a strided layout to another
+/// @note Called with a constant size, each copy is a single move
+static inline void copy_tile(unsigned char *out, ptrdiff_t out_row_stride, ptrdiff_t out_col_stride,
+                             const unsigned char *in, ptrdiff_t row_stride, ptrdiff_t col_stride,
+                             unsigned int rows, unsigned int cols, size_t size)
 {
+    for (unsigned int row = 0; row < rows; ++row) {
+        unsigned char *o = out + row * out_row_stride;
+        const unsigned char *i = in + row * row_stride;
+        for (unsigned int col = 0; col < cols; ++col) {
+            memcpy(o + col * out_col_stride, i + col * col_stride, size);
+        }
+    }
+}
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/// @brief Transposes 8 x 8 bytes held by 8 words (byte j of word i is element (i, j))
+/// @note Off-diagonal blocks are swapped, then each block is transposed the same way:
+/// 4 x 4, 2 x 2 then single bytes
+static inline void transpose_bytes_8x8(uint64_t w[8])
+{
+    for (int i = 0; i < 4; ++i) {
+        uint64_t a = w[i], b = w[i + 4];
+        w[i] = (a & 0x00000000FFFFFFFFull) | (b << 32);
+        w[i + 4] = (a >> 32) | (b & 0xFFFFFFFF00000000ull);
+    }
+    for (int i = 0; i < 8; i += (i % 4 == 1) ? 3 : 1) {
+        uint64_t a = w[i], b = w[i + 2];
+        w[i] = (a & 0x0000FFFF0000FFFFull) | ((b << 16) & 0xFFFF0000FFFF0000ull);
+        w[i + 2] = ((a >> 16) & 0x0000FFFF0000FFFFull) | (b & 0xFFFF0000FFFF0000ull);
+    }
+    for (int i = 0; i < 8; i += 2) {
+        uint64_t a = w[i], b = w[i + 1];
+        w[i] = (a & 0x00FF00FF00FF00FFull) | ((b << 8) & 0xFF00FF00FF00FF00ull);
+        w[i + 1] = ((a >> 8) & 0x00FF00FF00FF00FFull) | (b & 0xFF00FF00FF00FF00ull);
+    }
+}
+
+/// @brief Copies a tile of bytes into contiguous rows, 8 x 8 bytes at a time
+/// @note Transposed tiles (row_stride of 1 byte, possibly reversed) go through word
+/// transposes, mirrored rows (col_stride of -1) through byte swaps; edges are copied
+/// byte by byte
+/// @return true if the tile was copied
+static bool copy_tile_bytes(unsigned char *out, ptrdiff_t out_row_stride,
+                            const unsigned char *in, ptrdiff_t row_stride, ptrdiff_t col_stride,
+                            unsigned int rows, unsigned int cols)
+{
+    unsigned int rows8 = rows & ~7u, cols8 = cols & ~7u;
+    if (row_stride == 1 || row_stride == -1) {
+        for (unsigned int r = 0; r < rows8; r += 8) {
+            for (unsigned int c = 0; c < cols8; c += 8) {
+                // word k: output rows r to r + 7 of output column c + k
+                uint64_t w[8];
+                for (int k = 0; k < 8; ++k) {
+                    const unsigned char *p = in + (ptrdiff_t)r * row_stride + (ptrdiff_t)(c + k) * col_stride;
+                    if (row_stride == 1) {
+                        memcpy(&w[k], p, 8);
+                    } else {
+                        memcpy(&w[k], p - 7, 8);
+                        w[k] = __builtin_bswap64(w[k]);
+                    }
+                }
+                transpose_bytes_8x8(w);
+                for (int k = 0; k < 8; ++k) {
+                    memcpy(out + (ptrdiff_t)(r + k) * out_row_stride + c, &w[k], 8);
+                }
+            }
+        }
+    } else if (col_stride == -1) {
+        for (unsigned int r = 0; r < rows8; ++r) {
+            for (unsigned int c = 0; c < cols8; c += 8) {
+                uint64_t w;
+                memcpy(&w, in + (ptrdiff_t)r * row_stride - c - 7, 8);
+                w = __builtin_bswap64(w);
+                memcpy(out + (ptrdiff_t)r * out_row_stride + c, &w, 8);
+            }
+        }
+    } else {
+        return false;
+    }
+    // edges
+    copy_tile(out + cols8, out_row_stride, 1, in + (ptrdiff_t)cols8 * col_stride, row_stride, col_stride,
+              rows8, cols - cols8, 1);
+    copy_tile(out + (ptrdiff_t)rows8 * out_row_stride, out_row_stride, 1, in + (ptrdiff_t)rows8 * row_stride,
+              row_stride, col_stride, rows - rows8, cols, 1);
+    return true;
+}
+#endif
+
+/// @brief Copies a tile of elements, specialized on the usual pixel and sample sizes
+static void copy_tile_sized(unsigned char *out, ptrdiff_t out_row_stride, ptrdiff_t out_col_stride,
+                            const unsigned char *in, ptrdiff_t row_stride, ptrdiff_t col_stride,
+                            unsigned int rows, unsigned int cols, size_t size)
+{
+    switch (size) {
+    case 1:
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        if (out_col_stride == 1 && copy_tile_bytes(out, out_row_stride, in, row_stride, col_stride, rows, cols)) {
+            break;
+        }
+#endif
+        copy_tile(out, out_row_stride, out_col_stride, in, row_stride, col_stride, rows, cols, 1);
+        break;
+    case 2: copy_tile(out, out_row_stride, out_col_stride, in, row_stride, col_stride, rows, cols, 2); break;
+    case 3: copy_tile(out, out_row_stride, out_col_stride, in, row_stride, col_stride, rows, cols, 3); break;
+    case 4: copy_tile(out, out_row_stride, out_col_stride, in, row_stride, col_stride, rows, cols, 4); break;
+    case 6: copy_tile(out, out_row_stride, out_col_stride, in, row_stride, col_stride, rows, cols, 6); break;
+    case 8: copy_tile(out, out_row_stride, out_col_stride, in, row_stride, col_stride, rows, cols, 8); break;
+    case 12: copy_tile(out, out_row_stride, out_col_stride, in, row_stride, col_stride, rows, cols, 12); break;
+    case 16: copy_tile(out, out_row_stride, out_col_stride, in, row_stride, col_stride, rows, cols, 16); break;
+    case 24: copy_tile(out, out_row_stride, out_col_stride, in, row_stride, col_stride, rows, cols, 24); break;
+    default: copy_tile(out, out_row_stride, out_col_stride, in, row_stride, col_stride, rows, cols, size); break;
+    }
+}
+
+/// @brief State shared by the tasks of a tiled copy
+typedef struct TiledCopy {
+    const ImageView *src;
+    unsigned char *out;         // contiguous interleaved pixels
+    unsigned int tile_rows_per_task;
+} TiledCopy;
+
+/// @brief Copies the tiles of a band of tile rows
+/// @param task Index of the band
+/// @param params Copy (TiledCopy)
+static void copy_tiles(unsigned int task, void *params)
+{
+    TiledCopy *copy = params;
+    const ImageView *src = copy->src;
+    size_t sample_size = depth_size(src->depth);
+    size_t pixel_size = src->channels * sample_size;
+    ptrdiff_t row_size = (ptrdiff_t)(src->width * pixel_size);
+    bool interleaved = src->channel_stride == (ptrdiff_t)sample_size;
+    unsigned int first = task * copy->tile_rows_per_task * COPY_TILE;
+    unsigned int last = first + copy->tile_rows_per_task * COPY_TILE;
+    last = last < src->height ? last : src->height;
+    for (unsigned int y = first; y < last; y += COPY_TILE) {
+        unsigned int rows = last - y < COPY_TILE ? last - y : COPY_TILE;
+        for (unsigned int x = 0; x < src->width; x += COPY_TILE) {
+            unsigned int cols = src->width - x < COPY_TILE ? src->width - x : COPY_TILE;
+            unsigned char *out = copy->out + (ptrdiff_t)y * row_size + x * pixel_size;
+            const unsigned char *in = src->origin + (ptrdiff_t)y * src->row_stride + (ptrdiff_t)x * src->col_stride;
+            if (interleaved) {
+                copy_tile_sized(out, row_size, pixel_size, in, src->row_stride, src->col_stride, rows, cols, pixel_size);
+                continue;
+            }
+            for (unsigned int c = 0; c < src->channels; ++c) {
+                copy_tile_sized(out + c * sample_size, row_size, pixel_size, in + c * src->channel_stride,
+                                src->row_stride, src->col_stride, rows, cols, sample_size);
+            }
+        }
+    }
+}
+
+bool materialize_view(Image *dest, const ImageView *src)
+{
+    create_image(dest, src->type, src->width, src->height, src->channels, src->depth);
+    if (!dest->data) {
+        perror("Error during image allocation");
+        return false;
+    }
+    dest->maxval = src->maxval;
+    size_t sample_size = depth_size(src->depth);
+    size_t pixel_size = src->channels * sample_size;
+    size_t row_size = src->width * pixel_size;
+    if (src->channel_stride == (ptrdiff_t)sample_size && src->col_stride == (ptrdiff_t)pixel_size) {
+        unsigned char *out = dest->data;
+        for (unsigned int row = 0; row < src->height; ++row, out += row_size) {
+            memcpy(out, src->origin + (ptrdiff_t)row * src->row_stride, row_size);
+        }
+        return true;
+    }
+    // other views (mirrored, transposed, planar) are copied by square tiles, bands of tiles in parallel
+    TiledCopy copy = {.src = src, .out = dest->data};
+    unsigned int tile_rows = (src->height + COPY_TILE - 1) / COPY_TILE;
+    unsigned int threads = parallel_threads();
+    copy.tile_rows_per_task = (tile_rows + 4 * threads - 1) / (4 * threads);
+    if (copy.tile_rows_per_task > 0) {
+        parallel_for((tile_rows + copy.tile_rows_per_task - 1) / copy.tile_rows_per_task, copy_tiles, &copy);
+    }
+    return true;
+}
+
+bool crop_image(Image *dest, Image *src, int col, int row, int width, int height)
+{
+    ImageView view = image_view(src), roi;
+    if (!crop_view(&roi, &view, col, row, width, height)) {
+        return false;
+    }
+    return materialize_view(dest, &roi);
+}
+
+/// @brief Growable memory buffer receiving an encoded PNG
+typedef struct PngBuffer {
+    unsigned char *data;
+    size_t size;
+    size_t capacity;
+} PngBuffer;
+
+/// @brief libpng write function appending to a PngBuffer
+static void write_png_buffer(png_structp png_ptr, png_bytep data, png_size_t length)
+{
+    PngBuffer *out = png_get_io_ptr(png_ptr);
+    if (out->size + length > out->capacity) {
+        size_t capacity = out->capacity ? out->capacity : 4096;
+        while (capacity < out->size + length) capacity *= 2;
+        unsigned char *grown = realloc(out->data, capacity);
+        if (!grown) {
+            png_error(png_ptr, "Error growing PNG buffer");
+        }
+        out->data = grown;
+        out->capacity = capacity;
+    }
+    memcpy(out->data + out->size, data, length);
+    out->size += length;
+}
+
+static void flush_png_buffer(png_structp png_ptr)
+{
+    (void)png_ptr;
+}
+
+/// @brief Encodes a view as PNG, into a file or a memory buffer
+/// @param view View on the image
+/// @param options Encoding settings (NULL for libpng defaults)
+/// @param file Destination file, or NULL
+/// @param out Destination buffer when file is NULL
+/// @return true if encoding ok
+static bool encode_png(const ImageView *view, const PngOptions *options, FILE *file, PngBuffer *out)
+{
+    int color_type;
+    switch (view->type) {
+    case GRAY:
+        color_type = PNG_COLOR_TYPE_GRAY;
+        break;
+    case RGB:
+        color_type = PNG_COLOR_TYPE_RGB;
+        break;
+    default:
+        fprintf(stderr, "Image type not recognized\n");
+        return false;
+    }
+
     // initialize png struct
     png_structp png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png_ptr) {
@@ -233,190 +1232,392 @@ bool image_to_png(Image *image, const char *png_file_path)
     png_infop info_ptr = png_create_info_struct(png_ptr);
     if (!info_ptr) {
         perror("Error creating PNG info struct");
+        png_destroy_write_struct(&png_ptr, NULL);
         return false;
     }
 
+    // rows (8-bit rows are written in place when possible)
+    int bit_depth = view->depth == DEPTH_U16 ? 16 : 8;
+    size_t row_size = (size_t)view->width * view->channels;
+    unsigned int maxval = bit_depth == 16 ? 65535 : 255;
+    bool in_place = view->depth == DEPTH_U8 && view->maxval == 255 && view->col_stride == (ptrdiff_t)view->channels;
+    png_bytep row_data = (png_bytep)malloc(row_size * bit_depth / 8);
+    double *buffer = in_place ? NULL : malloc(row_size * sizeof(double));
+
     // handle possible errors
     if (setjmp(png_jmpbuf(png_ptr))) {
         perror("Error creating PNG");
         png_destroy_write_struct(&png_ptr, &info_ptr);
+        free(buffer);
+        free(row_data);
         return false;
     }
 
-    // png file
-    FILE *png = fopen(png_file_path, "wb");
-    if (!png) {
-        perror("Error opening PNG file for writing");
-        return false;
+    // init I/O
+    if (file) {
+        png_init_io(png_ptr, file);
+    } else {
+        png_set_write_fn(png_ptr, out, write_png_buffer, flush_png_buffer);
     }
 
-    // init I/O
-    png_init_io(png_ptr, png);
+    // compression settings
+    if (options && options->compression_level >= 0) {
+        png_set_compression_level(png_ptr, options->compression_level);
+    }
+    if (options && options->strategy >= 0) {
+        png_set_compression_strategy(png_ptr, options->strategy);
+    }
+    if (options && options->filters >= 0) {
+        png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, options->filters);
+    }
 
     // set image info
-    int color_type;
-    switch (image->type) {
-    case GRAY:
-        color_type = PNG_COLOR_TYPE_GRAY;
-        break;
-    case RGB:
-        color_type = PNG_COLOR_TYPE_RGB;
-        break;
-    default:
-        perror("Image type not recognized");
-        break;
-    }
-    png_set_IHDR(png_ptr, info_ptr, image->width, image->height, 8, 
+    png_set_IHDR(png_ptr, info_ptr, view->width, view->height, bit_depth, 
                  color_type, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
                  PNG_FILTER_TYPE_DEFAULT);
     png_write_info(png_ptr, info_ptr);
 
-    // write image data (convert in uchar first)
-    unsigned char *uchar_content = malloc(image->width * image->height * image->channels);
-    for (size_t i = 0; i<image->width * image->height * image->channels; ++i) {
-        uchar_content[i] = (unsigned char)(255 * image->content[i]);
-    }
-    png_bytep row_data = (png_bytep)malloc(image->channels * image->width);
-    for (int row = 0; row < image->height; ++row) {
-        memcpy(row_data, uchar_content + row * image->width * image->channels, image->channels * image->width);
-        png_write_row(png_ptr, row_data);
+    // write image data
+    for (int row = 0; row < view->height; ++row) {
+        if (in_place) {
+            png_write_row(png_ptr, view->origin + row * view->row_stride);
+        } else {
+            row_to_bytes(view, row, row_data, maxval, buffer);
+            png_write_row(png_ptr, row_data);
+        }
     }
     png_write_end(png_ptr, info_ptr);
 
     // clear
-    free(uchar_content);
+    free(buffer);
     free(row_data);
     png_destroy_write_struct(&png_ptr, &info_ptr);
+    return true;
+}
+
+bool image_to_png(Image *image, const char *png_file_path)
+{
+    ImageView view = image_view(image);
+    return view_to_png(&view, png_file_path);
+}
+
+bool view_to_png(const ImageView *view, const char *png_file_path)
+{
+    FILE *png = fopen(png_file_path, "wb");
+    if (!png) {
+        perror("Error opening PNG file for writing");
+        return false;
+    }
+    bool rc = encode_png(view, NULL, png, NULL);
     fclose(png);
+    return rc;
+}
+
+bool image_to_png_buffer(Image *image, const PngOptions *options, unsigned char **png, size_t *size)
+{
+    ImageView view = image_view(image);
+    return view_to_png_buffer(&view, options, png, size);
+}
 
+bool view_to_png_buffer(const ImageView *view, const PngOptions *options, unsigned char **png, size_t *size)
+{
+    // start from a quarter of the raw size: most images compress at least that much
+    PngBuffer out = {.data = NULL, .size = 0, .capacity = 0};
+    size_t hint = (size_t)view->width * view->height * view->channels * (view->depth == DEPTH_U16 ? 2 : 1) / 4;
+    out.data = malloc(hint + 4096);
+    out.capacity = out.data ? hint + 4096 : 0;
+    if (!encode_png(view, options, NULL, &out)) {
+        free(out.data);
+        return false;
+    }
+    *png = out.data;
+    *size = out.size;
     return true;
 }
 
 void print_image(Image *image)
 {
-    printf("%d, %d, %d, %d\n", image->type, image->width, image->height, image->channels);
+    printf("%d, %d, %d, %d, %d\n", image->type, image->depth, image->width, image->height, image->channels);
     for (int col = 0; col<2; ++col) {
         for (int row = 0; row<2; ++row) {
-            double * pixel = pixel_at(image, col, row);
-            double r = *pixel, g = *(pixel+1), b = *(pixel+2);
-            printf("(%f %f %f) ", r, g, b);
+            ImageView view = image_view(image);
+            printf("(");
+            for (int c = 0; c < image->channels; ++c) {
+                printf(c ? " %f" : "%f", view_sample_get(&view, col, row, c));
+            }
+            printf(") ");
         }
         printf("\n");
     }
     printf("\n");
 }
 
-double * pixel_at(Image *image, int col, int row)
+void * pixel_at(Image *image, int col, int row)
 {
     if (row < 0 || row >= image->height || col < 0 || col >= image->width) {
         fprintf(stderr, "Fetching pixel out of bounds: %d %d (for width %d and height %d)\n", col, row, image->width, image->height);
         return NULL;
     }
-    double *pixel = image->content + row * image->width * image->channels
-                                   + col * image->channels;
+    size_t index = image->layout == LAYOUT_PLANAR
+                 ? (size_t)row * image->width + col
+                 : ((size_t)row * image->width + col) * image->channels;
+    unsigned char *pixel = (unsigned char *)image->data + index * depth_size(image->depth);
     return pixel;
 }
 
 bool copy_image(Image *dest, Image *src)
 {
-    create_image(dest, src->type, src->width, src->height, src->channels);
-    if (!dest->content) {
+    create_image(dest, src->type, src->width, src->height, src->channels, src->depth);
+    if (!dest->data) {
         perror("Error during image allocation");
         return false;
     }
-    size_t size = src->width * src->height * src->channels * sizeof(double);
-    if (!memcpy(dest->content, src->content, size)) {
+    dest->maxval = src->maxval;
+    dest->layout = src->layout;
+    size_t size = (size_t)src->width * src->height * src->channels * depth_size(src->depth);
+    if (!memcpy(dest->data, src->data, size)) {
         perror("Error copying image content");
         return false;
     }
     return true;
 }
 
-bool add_images(Image *dest, Image *I, Image *J)
+// number of samples processed at once by element-wise operations
+#define SAMPLE_CHUNK 4096
+
+bool convert_image_depth(Image *dest, Image *src, PIXEL_DEPTH depth)
 {
-    if (I->width != J->width || I->height != J->height || I->channels != J->channels) {
-        fprintf(stderr, "Cannot multiply images of different sizes (%dx%dx%d and %dx%dx%d)", 
-                I->width, I->height, I->channels, J->width, J->height, J->channels);
-        return false;
+    if (src->depth == depth) {
+        return copy_image(dest, src);
     }
-    create_image(dest, I->type, I->width, I->height, I->channels);
-    if (!dest->content) {
+    create_image(dest, src->type, src->width, src->height, src->channels, depth);
+    if (!dest->data) {
         perror("Error during image allocation");
         return false;
     }
-    for (int i = 0; i < I->height; ++i) {
-        for (int j = 0; j < I->width; ++j) {
-            for (int c = 0; c < I->channels; ++c) {
-                *(pixel_at(dest, j, i)+c) = *(pixel_at(I, j, i)+c) + *(pixel_at(J, j, i)+c);
-            }
-        }
+    dest->layout = src->layout;
+    double buffer[SAMPLE_CHUNK];
+    size_t total = (size_t)src->width * src->height * src->channels;
+    for (size_t offset = 0; offset < total; offset += SAMPLE_CHUNK) {
+        size_t count = total - offset < SAMPLE_CHUNK ? total - offset : SAMPLE_CHUNK;
+        read_image_samples(src, offset, count, buffer);
+        write_image_samples(dest, offset, count, buffer);
     }
     return true;
 }
 
+/// @brief Pixel-wise operation between two images
+bool add_images(Image *dest, Image *I, Image *J)
+{
+    Expr *expr = expr_add(expr_image(I), expr_image(J));
+    bool rc = eval_expr(dest, expr, I->depth);
+    free_expr(expr);
+    return rc;
+}
+
 bool multiply_images(Image *dest, Image *I, Image *J)
 {
-    if (I->width != J->width || I->height != J->height || I->channels != J->channels) {
-        fprintf(stderr, "Cannot multiply images of different sizes (%dx%dx%d and %dx%dx%d)", 
-                I->width, I->height, I->channels, J->width, J->height, J->channels);
-        return false;
+    Expr *expr = expr_mul(expr_image(I), expr_image(J));
+    bool rc = eval_expr(dest, expr, I->depth);
+    free_expr(expr);
+    return rc;
+}
+
+bool divide_images(Image *dest, Image *I, Image *J)
+{
+    Expr *expr = expr_div(expr_image(I), expr_image(J));
+    bool rc = eval_expr(dest, expr, I->depth);
+    free_expr(expr);
+    return rc;
+}
+
+bool func_image(Image *dest, Image *src, void *fct)
+{
+    Expr *expr = expr_func(expr_image(src), (double (*)(double))fct);
+    bool rc = eval_expr(dest, expr, src->depth);
+    free_expr(expr);
+    return rc;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/// @brief SSSE3 shuffle masks between 48 interleaved RGB bytes and 16 bytes per channel
+/// @param masks Mask of channel ch for the 16 bytes block blk, at masks[ch][blk]
+static void rgb_shuffle_masks(__m128i masks[3][3], bool interleave)
+{
+    uint8_t lanes[16];
+    for (int ch = 0; ch < 3; ++ch) {
+        for (int blk = 0; blk < 3; ++blk) {
+            for (int i = 0; i < 16; ++i) {
+                if (interleave) {
+                    // byte i of output block blk is channel (16*blk+i)%3 of pixel (16*blk+i)/3
+                    int k = 16 * blk + i;
+                    lanes[i] = k % 3 == ch ? (uint8_t)(k / 3) : 0x80;
+                } else {
+                    // pixel i of channel ch is byte 3*i+ch of the input
+                    int k = 3 * i + ch;
+                    lanes[i] = k / 16 == blk ? (uint8_t)(k % 16) : 0x80;
+                }
+            }
+            masks[ch][blk] = _mm_loadu_si128((const __m128i *)lanes);
+        }
     }
-    create_image(dest, I->type, I->width, I->height, I->channels);
-    if (!dest->content) {
-        perror("Error during image allocation");
-        return false;
+}
+
+__attribute__((target("ssse3")))
+static size_t deinterleave3_u8_ssse3(uint8_t *r, uint8_t *g, uint8_t *b, const uint8_t *src, size_t n)
+{
+    __m128i m[3][3];
+    rgb_shuffle_masks(m, false);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i x0 = _mm_loadu_si128((const __m128i *)(src + 3 * i));
+        __m128i x1 = _mm_loadu_si128((const __m128i *)(src + 3 * i + 16));
+        __m128i x2 = _mm_loadu_si128((const __m128i *)(src + 3 * i + 32));
+        uint8_t *planes[3] = {r, g, b};
+        for (int ch = 0; ch < 3; ++ch) {
+            __m128i v = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(x0, m[ch][0]),
+                                                  _mm_shuffle_epi8(x1, m[ch][1])),
+                                     _mm_shuffle_epi8(x2, m[ch][2]));
+            _mm_storeu_si128((__m128i *)(planes[ch] + i), v);
+        }
     }
-    for (int i = 0; i < I->height; ++i) {
-        for (int j = 0; j < I->width; ++j) {
-            for (int c = 0; c < I->channels; ++c) {
-                *(pixel_at(dest, j, i)+c) = *(pixel_at(I, j, i)+c) * *(pixel_at(J, j, i)+c);
-            }
+    return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t interleave3_u8_ssse3(uint8_t *dest, const uint8_t *r, const uint8_t *g, const uint8_t *b, size_t n)
+{
+    __m128i m[3][3];
+    rgb_shuffle_masks(m, true);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i vr = _mm_loadu_si128((const __m128i *)(r + i));
+        __m128i vg = _mm_loadu_si128((const __m128i *)(g + i));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+        for (int blk = 0; blk < 3; ++blk) {
+            __m128i v = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(vr, m[0][blk]),
+                                                  _mm_shuffle_epi8(vg, m[1][blk])),
+                                     _mm_shuffle_epi8(vb, m[2][blk]));
+            _mm_storeu_si128((__m128i *)(dest + 3 * i + 16 * blk), v);
         }
     }
-    return true;
+    return i;
 }
+#endif
 
-bool divide_images(Image *dest, Image *I, Image *J)
+/// @brief Splits interleaved RGB bytes into three planes with the vector unit
+/// @return Number of pixels converted, the remaining tail being left to the caller
+static size_t deinterleave3_u8(uint8_t *r, uint8_t *g, uint8_t *b, const uint8_t *src, size_t n)
 {
-    if (I->width != J->width || I->height != J->height || I->channels != J->channels) {
-        fprintf(stderr, "Cannot divide images of different sizes (%dx%dx%d and %dx%dx%d)", 
-                I->width, I->height, I->channels, J->width, J->height, J->channels);
-        return false;
+#if defined(__x86_64__) || defined(__i386__)
+    return cpu_has_ssse3() ? deinterleave3_u8_ssse3(r, g, b, src, n) : 0;
+#elif defined(__ARM_NEON)
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16x3_t px = vld3q_u8(src + 3 * i);
+        vst1q_u8(r + i, px.val[0]);
+        vst1q_u8(g + i, px.val[1]);
+        vst1q_u8(b + i, px.val[2]);
+    }
+    return i;
+#else
+    return 0;
+#endif
+}
+
+/// @brief Merges three planes of bytes into interleaved RGB with the vector unit
+/// @return Number of pixels converted, the remaining tail being left to the caller
+static size_t interleave3_u8(uint8_t *dest, const uint8_t *r, const uint8_t *g, const uint8_t *b, size_t n)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return cpu_has_ssse3() ? interleave3_u8_ssse3(dest, r, g, b, n) : 0;
+#elif defined(__ARM_NEON)
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16x3_t px = {{vld1q_u8(r + i), vld1q_u8(g + i), vld1q_u8(b + i)}};
+        vst3q_u8(dest + 3 * i, px);
+    }
+    return i;
+#else
+    return 0;
+#endif
+}
+
+// Scatters the channels of interleaved samples of type T into planes
+#define DEINTERLEAVE(T)                                                         \
+    do {                                                                        \
+        const T *in = (const T *)src->data;                                     \
+        T *out = (T *)dest->data;                                               \
+        for (unsigned int c = 0; c < channels; ++c) {                           \
+            T *plane = out + c * n;                                             \
+            for (size_t i = start; i < n; ++i) plane[i] = in[i * channels + c]; \
+        }                                                                       \
+    } while (0)
+
+// Gathers planes of samples of type T into interleaved pixels
+#define INTERLEAVE(T)                                                           \
+    do {                                                                        \
+        const T *in = (const T *)src->data;                                     \
+        T *out = (T *)dest->data;                                               \
+        for (unsigned int c = 0; c < channels; ++c) {                           \
+            const T *plane = in + c * n;                                        \
+            for (size_t i = start; i < n; ++i) out[i * channels + c] = plane[i]; \
+        }                                                                       \
+    } while (0)
+
+bool deinterleave_image(Image *dest, Image *src)
+{
+    if (src->layout == LAYOUT_PLANAR) {
+        return copy_image(dest, src);
     }
-    create_image(dest, I->type, I->width, I->height, I->channels);
-    if (!dest->content) {
+    create_planar_image(dest, src->type, src->width, src->height, src->channels, src->depth);
+    if (!dest->data) {
         perror("Error during image allocation");
         return false;
     }
-    for (int i = 0; i < I->height; ++i) {
-        for (int j = 0; j < I->width; ++j) {
-            for (int c = 0; c < I->channels; ++c) {
-                if (*(pixel_at(J, j, i)+c) == 0.0) {
-                    *(pixel_at(dest, j, i)+c) = 0;
-                } else {
-                    *(pixel_at(dest, j, i)+c) = *(pixel_at(I, j, i)+c) / *(pixel_at(J, j, i)+c);
-                }
-            }
-        }
+    dest->maxval = src->maxval;
+    size_t n = (size_t)src->width * src->height;
+    unsigned int channels = src->channels;
+    size_t start = 0;
+    if (src->depth == DEPTH_U8 && channels == 3) {
+        // vector kernel for the bulk of the pixels, scalar loop for the tail
+        start = deinterleave3_u8(dest->content_u8, dest->content_u8 + n, dest->content_u8 + 2 * n,
+                                 src->content_u8, n);
+    }
+    switch (src->depth) {
+    case DEPTH_U8: DEINTERLEAVE(uint8_t); break;
+    case DEPTH_U16: DEINTERLEAVE(uint16_t); break;
+    case DEPTH_F32: DEINTERLEAVE(float); break;
+    case DEPTH_F64: [[fallthrough]];
+    default: DEINTERLEAVE(double); break;
     }
     return true;
 }
 
-bool func_image(Image *dest, Image *src, void *fct)
+bool interleave_image(Image *dest, Image *src)
 {
-    typedef double (*F)(double);
-    F fct_ = (F)fct; 
-    create_image(dest, src->type, src->width, src->height, src->channels);
-    if (!dest->content) {
+    if (src->layout == LAYOUT_INTERLEAVED) {
+        return copy_image(dest, src);
+    }
+    create_image(dest, src->type, src->width, src->height, src->channels, src->depth);
+    if (!dest->data) {
         perror("Error during image allocation");
         return false;
     }
-    for (int i = 0; i < src->height; ++i) {
-        for (int j = 0; j < src->width; ++j) {
-            for (int c = 0; c < src->channels; ++c) {
-                *(pixel_at(dest, j, i)+c) = fct_((*(pixel_at(src, j, i)+c)));
-            }
-        }
+    dest->maxval = src->maxval;
+    size_t n = (size_t)src->width * src->height;
+    unsigned int channels = src->channels;
+    size_t start = 0;
+    if (src->depth == DEPTH_U8 && channels == 3) {
+        start = interleave3_u8(dest->content_u8, src->content_u8, src->content_u8 + n,
+                               src->content_u8 + 2 * n, n);
+    }
+    switch (src->depth) {
+    case DEPTH_U8: INTERLEAVE(uint8_t); break;
+    case DEPTH_U16: INTERLEAVE(uint16_t); break;
+    case DEPTH_F32: INTERLEAVE(float); break;
+    case DEPTH_F64: [[fallthrough]];
+    default: INTERLEAVE(double); break;
     }
     return true;
 }
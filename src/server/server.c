@@ -7,12 +7,19 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <stdarg.h>
+#include <limits.h>
 #include "server/server.h"
 #include "image/image.h"
 #include "transform/colors.h"
 #include "transform/geometry.h"
 #include "filters/filters.h"
+#include "filters/median.h"
+#include "filters/morphology.h"
+#include "filters/pyramid.h"
+#include "utils/pool.h"
 #include <math.h>
+#include <png.h>
+#include <zlib.h>
 
 // paths
 static const char * const IMAGES_PATH = "../images/";
@@ -26,17 +33,31 @@ static const char * const MIME_PNG = "image/png";
 // connection type for response
 static const char * const FROM_BUFFER = "from_buffer";
 static const char * const FROM_FD = "from_fd";
-// defaults and temporary
+// defaults
 static const char * const ERROR_PAGE = "<html><body>An internal server error has occurred!</body></html>";
-static const char * const TEMP_LOADED_IMG = "loaded_img.png";
 
 /// @brief defines a generic transform type
 typedef bool (*transform_fct)(Image *, Image *, double);
 
-// struct of a transform, with key, function and num of extra arguments
+/// @brief defines a transform taking several arguments (missing ones are 0)
+typedef bool (*transform_args_fct)(Image *, Image *, const double *);
+
+// maximum number of extra arguments read from the url
+#define TRANSFORM_MAX_ARGS 4
+
+/// @brief defines a transform reading the gaussian pyramid of the source (first level: the source)
+typedef bool (*pyramid_transform_fct)(Image *, Pyramid *, const double *);
+
+/// @brief defines a transform that only builds a view on the source (no pixel copied)
+typedef ImageView (*view_transform_fct)(const ImageView *, double);
+
+// struct of a transform, with key, function (or view function) and num of extra arguments
 typedef struct Transform {
     const char * const key;
     transform_fct func;
+    view_transform_fct view_func;
+    transform_args_fct args_func;
+    pyramid_transform_fct pyramid_func;
 } Transform;
 
 /// Some wrapper to call functions with more arguments
@@ -44,41 +65,106 @@ static bool rotate_wrapper(Image *dest, Image *src, double angle) {
     return rotate(dest, src, angle, INTERP_BILINEAR);
 }
 
-static bool gaussian_wrapper(Image *dest, Image *src, double sigma) {
-    return gaussian_filter(dest, src, 19, sigma);
+static bool gaussian_wrapper(Image *dest, Pyramid *pyramid, const double *args) {
+    // large sigmas filter a cached smaller level, expanded back; small ones the source itself
+    return pyramid_gaussian_filter(dest, pyramid, args[0]);
+}
+
+static bool resize_wrapper(Image *dest, Pyramid *pyramid, const double *args) {
+    // width then height, a missing height keeping the aspect ratio
+    // the sizes are checked before being converted: nan or out of range ones are undefined as int
+    const Image *src = &pyramid->images[0];
+    double width = trunc(args[0]);
+    double height = args[1] > 0 || isnan(args[1]) ? trunc(args[1]) : round(width * src->height / src->width);
+    if (!isfinite(width) || !isfinite(height) || width < 1 || height < 1 || width > INT_MAX || height > INT_MAX) {
+        fprintf(stderr, "Invalid resize to %gx%g\n", width, height);
+        return false;
+    }
+    return pyramid_resize(dest, pyramid, (int)width, (int)height, INTERP_BICUBIC);
 }
 
 static bool sobel_wrapper(Image *dest, Image *src, double arg) {
-    Image dummy;
-    bool rc = sobel_filter(dest, &dummy, src);
-    free_image(&dummy);
-    return rc;
+    // the magnitude only: no angle is computed
+    ImageView view = image_view(src);
+    return sobel_gradient(dest, NULL, NULL, NULL, &view);
+}
+
+static bool canny_wrapper(Image *dest, Image *src, double sigma) {
+    // thresholds on the gradient magnitude, a step of the whole range giving 0.5
+    return canny_filter(dest, src, sigma, 0.02, 0.05);
+}
+
+/// @brief Converts a radius read from an URL, negative ones giving 0
+/// @param radius Radius
+/// @param r Converted radius
+/// @return false if the radius is not finite or does not fit
+static bool radius_arg(double radius, unsigned int *r) {
+    if (!isfinite(radius) || radius > UINT_MAX) {
+        fprintf(stderr, "Invalid radius %g\n", radius);
+        return false;
+    }
+    *r = radius > 0 ? (unsigned int)radius : 0;
+    return true;
+}
+
+static bool median_wrapper(Image *dest, Image *src, double radius) {
+    unsigned int r;
+    return radius_arg(radius, &r) && median_filter(dest, src, r);
+}
+
+static bool bilateral_wrapper(Image *dest, Image *src, const double *args) {
+    // sigmas in space (pixels) then in range (fraction of the maxval)
+    return bilateral_filter(dest, src, args[0], args[1]);
 }
 
+// morphology with a square of the given radius
+#define MORPHOLOGY_WRAPPER(name, op) \
+    static bool name(Image *dest, Image *src, double radius) { \
+        unsigned int r; \
+        return radius_arg(radius, &r) && morphology_filter(dest, src, op, r, r); \
+    }
+MORPHOLOGY_WRAPPER(erode_wrapper, MORPH_ERODE)
+MORPHOLOGY_WRAPPER(dilate_wrapper, MORPH_DILATE)
+MORPHOLOGY_WRAPPER(open_wrapper, MORPH_OPEN)
+MORPHOLOGY_WRAPPER(close_wrapper, MORPH_CLOSE)
+MORPHOLOGY_WRAPPER(tophat_wrapper, MORPH_TOPHAT)
+MORPHOLOGY_WRAPPER(blackhat_wrapper, MORPH_BLACKHAT)
+MORPHOLOGY_WRAPPER(morph_gradient_wrapper, MORPH_GRADIENT)
+
 // array of transforms
 static Transform transforms[] = {
     {.key = "rgb2gray", .func = (transform_fct)rgb_to_gray},
     {.key = "gray2rgb", .func = (transform_fct)gray_to_rgb},
-    {.key = "flip_hor", .func = (transform_fct)flip_horizontal},
-    {.key = "flip_ver", .func = (transform_fct)flip_vertical},
+    {.key = "flip_hor", .view_func = (view_transform_fct)flip_view_horizontal},
+    {.key = "flip_ver", .view_func = (view_transform_fct)flip_view_vertical},
     {.key = "rotate", .func = (transform_fct)rotate_wrapper},
-    {.key = "blur", .func = (transform_fct)gaussian_wrapper},
-    {.key = "edges", .func = (transform_fct)sobel_wrapper}
+    {.key = "blur", .pyramid_func = gaussian_wrapper},
+    {.key = "resize", .pyramid_func = resize_wrapper},
+    {.key = "edges", .func = (transform_fct)sobel_wrapper},
+    {.key = "canny", .func = (transform_fct)canny_wrapper},
+    {.key = "median", .func = (transform_fct)median_wrapper},
+    {.key = "bilateral", .args_func = bilateral_wrapper},
+    {.key = "erode", .func = (transform_fct)erode_wrapper},
+    {.key = "dilate", .func = (transform_fct)dilate_wrapper},
+    {.key = "open", .func = (transform_fct)open_wrapper},
+    {.key = "close", .func = (transform_fct)close_wrapper},
+    {.key = "tophat", .func = (transform_fct)tophat_wrapper},
+    {.key = "blackhat", .func = (transform_fct)blackhat_wrapper},
+    {.key = "morph_gradient", .func = (transform_fct)morph_gradient_wrapper}
 };
 
 /// @brief Retrieves the transform given its key
 /// @param key Transform key
-/// @return Pointer to function
-static transform_fct * find_transform(const char * const key)
+/// @return Pointer to transform
+static Transform * find_transform(const char * const key)
 {
-    transform_fct *fct = NULL;
     if (sizeof(transforms) == 0) {
         return NULL;
     }
     size_t n = sizeof(transforms) / sizeof(transforms[0]);
     for (int i = 0; i < n; ++i) {
         if (strcmp(transforms[i].key, key) == 0) {
-            return &transforms[i].func;
+            return &transforms[i];
         }
     }
     fprintf(stderr, "Could not find transform of key %s\n", key);
@@ -129,6 +215,86 @@ create_response(struct MHD_Connection *connection,
     return ret;
 }
 
+// named values of the PNG encoding query arguments
+typedef struct NamedValue {
+    const char * const name;
+    int value;
+} NamedValue;
+
+static const NamedValue PNG_STRATEGIES[] = {
+    {"default", Z_DEFAULT_STRATEGY},
+    {"filtered", Z_FILTERED},
+    {"huffman", Z_HUFFMAN_ONLY},
+    {"rle", Z_RLE},
+    {"fixed", Z_FIXED}
+};
+
+static const NamedValue PNG_FILTERS[] = {
+    {"none", PNG_FILTER_NONE},
+    {"sub", PNG_FILTER_SUB},
+    {"up", PNG_FILTER_UP},
+    {"avg", PNG_FILTER_AVG},
+    {"paeth", PNG_FILTER_PAETH},
+    {"all", PNG_ALL_FILTERS}
+};
+
+/// @brief Looks a name up in a table of named values
+/// @param values Table
+/// @param n Number of entries
+/// @param name Name (NULL if absent)
+/// @return Matching value, -1 if not found
+static int find_named_value(const NamedValue *values, size_t n, const char *name)
+{
+    if (name == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (strcmp(values[i].name, name) == 0) {
+            return values[i].value;
+        }
+    }
+    fprintf(stderr, "Unknown PNG setting %s\n", name);
+    return -1;
+}
+
+/// @brief Reads the PNG encoding settings of a request: ?level=0..9&strategy=rle&filter=sub
+/// @note Absent or invalid settings keep the libpng defaults
+/// @param connection Connection
+/// @param options Encoding settings
+static void png_options_from_request(struct MHD_Connection *connection, PngOptions *options)
+{
+    const char *level = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "level");
+    const char *strategy = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "strategy");
+    const char *filter = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "filter");
+    options->compression_level = -1;
+    if (level && level[0] >= '0' && level[0] <= '9' && level[1] == '\0') {
+        options->compression_level = level[0] - '0';
+    }
+    options->strategy = find_named_value(PNG_STRATEGIES, sizeof(PNG_STRATEGIES) / sizeof(PNG_STRATEGIES[0]), strategy);
+    options->filters = find_named_value(PNG_FILTERS, sizeof(PNG_FILTERS) / sizeof(PNG_FILTERS[0]), filter);
+}
+
+/// @brief Answers with a view encoded as PNG in memory
+/// @param connection Connection
+/// @param view View to encode
+/// @return MHD result
+static
+enum MHD_Result
+answer_with_png(struct MHD_Connection *connection, const ImageView *view)
+{
+    PngOptions options;
+    png_options_from_request(connection, &options);
+    unsigned char *png;
+    size_t size;
+    if (!view_to_png_buffer(view, &options, &png, &size)) {
+        perror("An error occurred during PNG conversion");
+        return MHD_NO;
+    }
+    // the buffer is plain malloc memory, released by the daemon once sent
+    return create_response(connection, MIME_PNG, MHD_HTTP_OK, FROM_BUFFER,
+                           3, size, (void *)png, MHD_RESPMEM_MUST_FREE);
+}
+
 static
 enum MHD_Result
 answer_to_root(struct MHD_Connection *connection)
@@ -180,43 +346,169 @@ answer_to_script(struct MHD_Connection *connection)
     return ret;
 }
 
+// decoded images kept for later requests, and their total size (an image larger than it is still kept alone)
+#define IMAGE_CACHE_ENTRIES 8
+#define IMAGE_CACHE_BYTES ((size_t)256 << 20)
+
+/// @brief Decoded image kept between requests, with the levels of its gaussian pyramid built so far
+/// @note Requests are answered by the single polling thread of the daemon: the cache needs no lock
+typedef struct CachedImage {
+    char *path;                 // NULL for a free slot
+    time_t mtime;               // modification time of the file when decoded
+    off_t size;                 // size of the file when decoded
+    Pyramid pyramid;            // first level: the decoded image
+    unsigned long last_use;
+} CachedImage;
+
+static CachedImage image_cache[IMAGE_CACHE_ENTRIES];
+static unsigned long image_clock;
+
+/// @brief Size of the levels of a pyramid, in bytes
+static size_t pyramid_bytes(const Pyramid *pyramid)
+{
+    size_t bytes = 0;
+    for (unsigned int i = 0; i < pyramid->levels; ++i) {
+        const Image *level = &pyramid->images[i];
+        bytes += (size_t)level->width * level->height * level->channels * depth_size(level->depth);
+    }
+    return bytes;
+}
+
+/// @brief Detaches the levels of a pyramid from the arena of the request, so that they stay cached
+/// @param pyramid Pyramid
+/// @param first First level to detach
+static void persist_pyramid(Pyramid *pyramid, unsigned int first)
+{
+    for (unsigned int i = first; i < pyramid->levels; ++i) {
+        pool_persist(pyramid->images[i].data);
+    }
+}
+
+/// @brief Frees a cached image and its slot
+static void evict_image(CachedImage *cached)
+{
+    free_pyramid(&cached->pyramid);
+    free(cached->path);
+    cached->path = NULL;
+}
+
+/// @brief Evicts the least recently used images until the cache can take more bytes
+/// @param bytes Bytes to be added to the cache
+/// @param keep Cached image never evicted (the one being served), NULL if none
+/// @param need_slot Whether a free slot is needed as well
+/// @return Index of a free slot, -1 if there is none
+static int trim_image_cache(size_t bytes, const CachedImage *keep, bool need_slot)
+{
+    for (;;) {
+        size_t cached_bytes = 0;
+        int free_slot = -1, oldest = -1;
+        for (unsigned int k = 0; k < IMAGE_CACHE_ENTRIES; ++k) {
+            CachedImage *cached = &image_cache[k];
+            if (!cached->path) {
+                free_slot = k;
+                continue;
+            }
+            cached_bytes += pyramid_bytes(&cached->pyramid);
+            if (cached != keep && (oldest < 0 || cached->last_use < image_cache[oldest].last_use)) {
+                oldest = k;
+            }
+        }
+        bool fits = cached_bytes + bytes <= IMAGE_CACHE_BYTES || oldest < 0;
+        if (fits && (free_slot >= 0 || !need_slot)) {
+            return free_slot;
+        }
+        evict_image(&image_cache[oldest]);
+    }
+}
+
+/// @brief Returns a decoded image, from the cache if the file did not change since
+/// @note Images are cached by path (least recently used first out)
+/// @param path Path of the image file
+/// @return Cached image, valid until the next acquisition, NULL if loading failed
+static CachedImage * acquire_image(const char *path)
+{
+    struct stat sbuf;
+    if (stat(path, &sbuf) != 0) {
+        perror("Could not find image");
+        return NULL;
+    }
+    for (unsigned int k = 0; k < IMAGE_CACHE_ENTRIES; ++k) {
+        CachedImage *cached = &image_cache[k];
+        if (cached->path && strcmp(cached->path, path) == 0) {
+            if (cached->mtime == sbuf.st_mtime && cached->size == sbuf.st_size) {
+                cached->last_use = ++image_clock;
+                return cached;
+            }
+            evict_image(cached);
+        }
+    }
+
+    // the decoded samples are copied out of the arena (and of any file mapping)
+    Image decoded;
+    if (!load_image(&decoded, path)) {
+        perror("Could not properly load image");
+        return NULL;
+    }
+    Pyramid pyramid;
+    ImageView view = image_view(&decoded);
+    bool built = gaussian_pyramid(&pyramid, &view, 1);
+    free_image(&decoded);
+    if (!built) {
+        return NULL;
+    }
+    persist_pyramid(&pyramid, 0);
+
+    // make room by evicting the least recently used images
+    int slot = trim_image_cache(pyramid_bytes(&pyramid), NULL, true);
+    char *cached_path = strdup(path);
+    if (!cached_path) {
+        perror("Failed to allocate memory for cached image path");
+        free_pyramid(&pyramid);
+        return NULL;
+    }
+    CachedImage *cached = &image_cache[slot];
+    cached->path = cached_path;
+    cached->mtime = sbuf.st_mtime;
+    cached->size = sbuf.st_size;
+    cached->pyramid = pyramid;
+    cached->last_use = ++image_clock;
+    return cached;
+}
+
+/// @brief Builds the missing levels of the pyramid of a cached image, down to a single pixel
+/// @param cached Cached image
+/// @return true if building ok
+static bool complete_pyramid(CachedImage *cached)
+{
+    unsigned int levels = cached->pyramid.levels;
+    bool built = extend_pyramid(&cached->pyramid, 0);
+    persist_pyramid(&cached->pyramid, levels);
+    // the new levels count against the budget as well
+    trim_image_cache(0, cached, false);
+    return built;
+}
+
 static
 enum MHD_Result
 answer_to_image(struct MHD_Connection *connection, const char *url)
 {
     struct MHD_Response *response;
-    int fd, ret;
-    struct stat sbuf;
     
     // build image path from received url
     char *img_name = strrchr(url, '/');
     img_name++;
-    char *relative_path = (char*)malloc(strlen(IMAGES_PATH));
+    char *relative_path = (char*)malloc(strlen(IMAGES_PATH)+strlen(img_name)+1);
     strcpy(relative_path, IMAGES_PATH);
     strcat(relative_path, img_name);
 
-    Image image;
-    if (!load_image(&image, relative_path)) {
-        perror("Could not properly load image");
+    CachedImage *cached = acquire_image(relative_path);
+    free(relative_path);
+    if (!cached) {
         return MHD_NO;
     }
     // we actually have to perform a conversion since HTML is not happy with PPM/PGM
-    if (!image_to_png(&image, TEMP_LOADED_IMG)) {
-        perror("An error occurred during PNG conversion");
-        return MHD_NO;
-    }
-    free_image(&image);
-    
-    if (-1 == (fd = open(TEMP_LOADED_IMG, O_RDONLY)) || (0 != fstat(fd, &sbuf))) {
-        // error accessing file
-        if (fd != -1) {
-            close(fd);
-        }
-        ret = create_response(connection, MIME_TEXT, MHD_HTTP_INTERNAL_SERVER_ERROR, FROM_BUFFER, 
-                              3, strlen(ERROR_PAGE), (void*)ERROR_PAGE, MHD_RESPMEM_PERSISTENT);
-    }
-    ret = create_response(connection, MIME_PNG, MHD_HTTP_OK, FROM_FD, 3, sbuf.st_size, fd, 0);
-    return ret;
+    ImageView view = image_view(&cached->pyramid.images[0]);
+    return answer_with_png(connection, &view);
 }
 
 static
@@ -224,35 +516,36 @@ enum MHD_Result
 answer_to_transform(struct MHD_Connection *connection, const char *url)
 {
     struct MHD_Response *response;
-    int fd, ret;
-    struct stat sbuf;
+    int ret;
 
     // parse url
     char *transform_key;
-    bool has_arg = false;
-    double arg;
+    double args[TRANSFORM_MAX_ARGS] = {0};
     char *url_ = strdup(url);
     char *token = strtok(url_, "/");
     char *image_name = strdup(token);
-    char *image_path = (char*)malloc(strlen(IMAGES_PATH)+strlen(image_name));
+    char *image_path = (char*)malloc(strlen(IMAGES_PATH)+strlen(image_name)+1);
     strcpy(image_path, IMAGES_PATH);
     strcat(image_path, image_name);
     int i = 1;
     while (token) {
         token = strtok(NULL, "/");
+        int n = i - 3;
         switch (i++) {
             case 2: 
                 transform_key = strdup(token); 
                 break;
-            case 3: 
-                arg = atof(token); 
-                has_arg = true ; 
+            default:
+                // extra arguments, one per token
+                if (token && n >= 0 && n < TRANSFORM_MAX_ARGS) {
+                    args[n] = atof(token);
+                }
                 break;
-            default: break;
         }
     }
+    double arg = args[0];
 
-    transform_fct *transform = find_transform(transform_key);
+    Transform *transform = find_transform(transform_key);
     if (transform == NULL) {
         perror("Unknown transform key");
         free(url_);
@@ -262,10 +555,9 @@ answer_to_transform(struct MHD_Connection *connection, const char *url)
         return MHD_NO;
     }
 
-    // source
-    Image original_image;
-    if (!load_image(&original_image, image_path)) {
-        perror("Could not properly load image");
+    // source, decoded once for all the requests on it
+    CachedImage *cached = acquire_image(image_path);
+    if (!cached || (transform->pyramid_func && !complete_pyramid(cached))) {
         free(url_);
         free(image_name);
         free(image_path);
@@ -273,14 +565,33 @@ answer_to_transform(struct MHD_Connection *connection, const char *url)
         return MHD_NO;
     }
 
+    // view transforms are encoded straight from the source pixels
+    Image *original_image = &cached->pyramid.images[0];
+    if (transform->view_func) {
+        ImageView original_view = image_view(original_image);
+        ImageView transformed_view = transform->view_func(&original_view, arg);
+        free(url_);
+        free(image_name);
+        free(image_path);
+        free(transform_key);
+        return answer_with_png(connection, &transformed_view);
+    }
+
     // dest
     Image transformed_image;
-    if (!(*transform)(&transformed_image, &original_image, arg)) {
+    bool transformed;
+    if (transform->pyramid_func) {
+        transformed = transform->pyramid_func(&transformed_image, &cached->pyramid, args);
+    } else if (transform->args_func) {
+        transformed = transform->args_func(&transformed_image, original_image, args);
+    } else {
+        transformed = transform->func(&transformed_image, original_image, arg);
+    }
+    if (!transformed) {
         free(url_);
         free(image_name);
         free(image_path);
         free(transform_key);
-        free_image(&original_image);
         printf("NO\n");
         return MHD_NO;
     }
@@ -292,25 +603,27 @@ answer_to_transform(struct MHD_Connection *connection, const char *url)
     free(transform_key);
 
     // we actually have to perform a conversion since HTML is not happy with PPM/PGM
-    if (!image_to_png(&transformed_image, TEMP_LOADED_IMG)) {
-        perror("An error occurred during PNG conversion");
-        return MHD_NO;
-    }
-    free_image(&original_image);
+    ImageView transformed_view = image_view(&transformed_image);
+    ret = answer_with_png(connection, &transformed_view);
     free_image(&transformed_image);
-    
-    if (-1 == (fd = open(TEMP_LOADED_IMG, O_RDONLY)) || (0 != fstat(fd, &sbuf))) {
-        // error accessing file
-        if (fd != -1) {
-            close(fd);
-        }
-        ret = create_response(connection, MIME_TEXT, MHD_HTTP_INTERNAL_SERVER_ERROR, FROM_BUFFER, 
-                              3, strlen(ERROR_PAGE), (void*)ERROR_PAGE, MHD_RESPMEM_PERSISTENT);
-    }
-    ret = create_response(connection, MIME_PNG, MHD_HTTP_OK, FROM_FD, 3, sbuf.st_size, fd, 0);
     return ret;
 }
 
+static
+enum MHD_Result
+answer_to_stats(struct MHD_Connection *connection)
+{
+    PoolStats stats;
+    pool_stats(&stats);
+    char *buffer = (char*)malloc(256);
+    int len = snprintf(buffer, 256, 
+                       "allocations: %zu\nhits: %zu\nhit rate: %.3f\nbytes in use: %zu\npeak bytes: %zu\nbytes cached: %zu\n",
+                       stats.allocations, stats.hits, stats.hit_rate, 
+                       stats.bytes_in_use, stats.peak_bytes, stats.bytes_cached);
+    return create_response(connection, MIME_TEXT, MHD_HTTP_OK, FROM_BUFFER, 
+                           3, (size_t)len, buffer, MHD_RESPMEM_MUST_FREE);
+}
+
 static
 enum MHD_Result
 answer_to_unknown(struct MHD_Connection *connection)
@@ -339,14 +652,22 @@ answer_to_connection(void *cls,
         (void) con_cls;
 
         int ret;
+        // every image buffer allocated while answering goes back to the pool with the arena
+        PoolArena arena;
         if (strcmp(url, "/") == 0) {
             ret = answer_to_root(connection);
         } else if (strcmp(url, "/scripts.js") == 0) {
             ret = answer_to_script(connection);
+        } else if (strcmp(url, "/stats") == 0) {
+            ret = answer_to_stats(connection);
         } else if (strstr(url, "image") != NULL) {
+            pool_arena_begin(&arena);
             ret = answer_to_image(connection, url);
+            pool_arena_end(&arena);
         } else if (strstr(url, "transform") != NULL) {
+            pool_arena_begin(&arena);
             ret = answer_to_transform(connection, url);
+            pool_arena_end(&arena);
         } else {
             ret = answer_to_unknown(connection);
         }
@@ -0,0 +1,464 @@
+#include "stream/stream.h"
+#include "filters/filters.h"
+#include "utils/matrix.h"
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+
+/// @brief Reads the next value of a PNM header, skipping whitespaces and comments
+/// @param file File positioned in the header
+/// @param value Parsed value
+/// @return true if a value followed by a whitespace was read
+static bool read_header_value(FILE *file, unsigned long *value)
+{
+    int ch = getc(file);
+    while (ch != EOF && (isspace(ch) || ch == '#')) {
+        if (ch == '#') {
+            while (ch != EOF && ch != '\n') ch = getc(file);
+        } else {
+            ch = getc(file);
+        }
+    }
+    if (ch == EOF || !isdigit(ch)) {
+        return false;
+    }
+    *value = 0;
+    while (ch != EOF && isdigit(ch) && *value <= UINT32_MAX) {
+        *value = *value * 10 + (ch - '0');
+        ch = getc(file);
+    }
+    // after maxval, this single whitespace separates the header from the samples
+    return ch != EOF && isspace(ch);
+}
+
+bool open_image_reader(ImageReader *reader, const char *path)
+{
+    reader->file = fopen(path, "rb");
+    if (!reader->file) {
+        perror("Error opening image file");
+        return false;
+    }
+
+    char magic[2];
+    unsigned long values[3];
+    bool valid = fread(magic, 1, 2, reader->file) == 2 && magic[0] == 'P' && (magic[1] == '5' || magic[1] == '6');
+    for (int k = 0; k < 3 && valid; ++k) {
+        valid = read_header_value(reader->file, &values[k]);
+    }
+    valid = valid && values[0] > 0 && values[0] <= INT32_MAX && values[1] > 0 && values[1] <= INT32_MAX
+                  && values[2] > 0 && values[2] <= 65535;
+    if (!valid) {
+        fprintf(stderr, "Not a binary PGM / PPM file: %s\n", path);
+        fclose(reader->file);
+        reader->file = NULL;
+        return false;
+    }
+
+    reader->type = magic[1] == '5' ? GRAY : RGB;
+    reader->channels = magic[1] == '5' ? 1 : 3;
+    reader->width = values[0];
+    reader->height = values[1];
+    reader->maxval = values[2];
+    reader->depth = reader->maxval > 255 ? DEPTH_U16 : DEPTH_U8;
+    reader->next_row = 0;
+    return true;
+}
+
+unsigned int read_image_rows(ImageReader *reader, Image *band, unsigned int first, unsigned int count)
+{
+    if (count > reader->height - reader->next_row) {
+        count = reader->height - reader->next_row;
+    }
+    size_t row_samples = (size_t)reader->width * reader->channels;
+    size_t sample_size = depth_size(reader->depth);
+    unsigned char *rows = (unsigned char *)band->data + (size_t)first * row_samples * sample_size;
+    size_t n = row_samples * count;
+    size_t read = fread(rows, sample_size, n, reader->file);
+    if (reader->depth == DEPTH_U16) {
+        // samples are big endian in the file
+        uint16_t *samples = (uint16_t *)rows;
+        for (size_t i = 0; i < read; ++i) {
+            samples[i] = (uint16_t)(rows[2*i] << 8 | rows[2*i+1]);
+        }
+    }
+    unsigned int rows_read = (unsigned int)(read / row_samples);
+    reader->next_row += rows_read;
+    if (read != n) {
+        fprintf(stderr, "Truncated image data (%u rows out of %u)\n", reader->next_row, reader->height);
+    }
+    return rows_read;
+}
+
+void close_image_reader(ImageReader *reader)
+{
+    if (reader->file) {
+        fclose(reader->file);
+        reader->file = NULL;
+    }
+}
+
+bool open_image_writer(ImageWriter *writer, const char *path, IMAGE_TYPE type,
+                       unsigned int width, unsigned int height, PIXEL_DEPTH depth)
+{
+    if (type != GRAY && type != RGB) {
+        fprintf(stderr, "Only gray and RGB images can be written as PGM / PPM\n");
+        return false;
+    }
+    if (depth != DEPTH_U8 && depth != DEPTH_U16) {
+        fprintf(stderr, "PGM / PPM samples are 8-bit or 16-bit\n");
+        return false;
+    }
+    writer->file = fopen(path, "wb");
+    if (!writer->file) {
+        perror("Could not open file");
+        return false;
+    }
+    writer->type = type;
+    writer->depth = depth;
+    writer->width = width;
+    writer->height = height;
+    writer->channels = type == GRAY ? 1 : 3;
+    writer->maxval = depth == DEPTH_U16 ? 65535 : 255;
+    writer->next_row = 0;
+    fprintf(writer->file, "%s\n", type == GRAY ? "P5" : "P6");
+    fprintf(writer->file, "%u %u\n", width, height);
+    fprintf(writer->file, "%u\n", writer->maxval);
+    return true;
+}
+
+bool write_image_rows(ImageWriter *writer, Image *band, unsigned int first, unsigned int count)
+{
+    if (band->width != writer->width || band->channels != writer->channels) {
+        fprintf(stderr, "Band of %ux%u samples written to a %ux%u image\n",
+                band->width, band->channels, writer->width, writer->channels);
+        return false;
+    }
+    if (count > writer->height - writer->next_row) {
+        fprintf(stderr, "Too many rows written (%u rows out of %u)\n", writer->next_row + count, writer->height);
+        return false;
+    }
+    size_t row_samples = (size_t)writer->width * writer->channels;
+    size_t sample_bytes = writer->maxval > 255 ? 2 : 1;
+    unsigned char *bytes = malloc(row_samples * sample_bytes);
+    double *buffer = malloc(row_samples * sizeof(double));
+    bool rc = bytes && buffer;
+    if (!rc) {
+        perror("Error allocating row buffer.");
+    }
+    ImageView view = image_view(band);
+    for (unsigned int row = first; rc && row < first + count; ++row) {
+        row_to_bytes(&view, row, bytes, writer->maxval, buffer);
+        rc = fwrite(bytes, sample_bytes, row_samples, writer->file) == row_samples;
+    }
+    if (rc) {
+        writer->next_row += count;
+    } else {
+        perror("Error writing image rows");
+    }
+    free(bytes);
+    free(buffer);
+    return rc;
+}
+
+bool close_image_writer(ImageWriter *writer)
+{
+    if (!writer->file) {
+        return false;
+    }
+    bool rc = writer->next_row == writer->height;
+    if (!rc) {
+        fprintf(stderr, "Image closed after %u rows out of %u\n", writer->next_row, writer->height);
+    }
+    rc = fclose(writer->file) == 0 && rc;
+    writer->file = NULL;
+    return rc;
+}
+
+/// @brief Source rows resident while streaming
+typedef struct BandWindow {
+    Image rows;            // capacity rows of the source
+    unsigned int capacity;
+    unsigned int first;    // source row held in the first row of rows
+    unsigned int count;    // number of rows held
+} BandWindow;
+
+/// @brief Source rows needed by a band of output rows
+/// @param first First output row
+/// @param last Last output row
+/// @param src_first First source row needed
+/// @param src_last Last source row needed
+/// @param params Parameters of the operation
+typedef void (*band_rows_fct)(unsigned int first, unsigned int last,
+                              unsigned int *src_first, unsigned int *src_last, const void *params);
+
+/// @brief Computes a band of output rows
+/// @param band Output band
+/// @param window Source rows
+/// @param window_row Source row matching the first row of the window
+/// @param band_row Output row matching the first row of the band
+/// @param params Parameters of the operation
+/// @return true if computation ok
+typedef bool (*band_fct)(Image *band, const ImageView *window,
+                         unsigned int window_row, unsigned int band_row, const void *params);
+
+/// @brief Moves the window down the source so that it holds rows first to last
+/// @note The reader always stands right after the last row held
+/// @param window Window
+/// @param reader Source
+/// @param first First source row needed
+/// @param last Last source row needed
+/// @return true if the rows were read
+static bool slide_window(BandWindow *window, ImageReader *reader, unsigned int first, unsigned int last)
+{
+    size_t row_bytes = (size_t)reader->width * reader->channels * depth_size(reader->depth);
+    unsigned char *rows = window->rows.data;
+    unsigned int drop = first > window->first ? first - window->first : 0;
+    if (drop >= window->count) {
+        // none of the rows held is needed anymore: skip the ones in between
+        while (reader->next_row < first) {
+            if (read_image_rows(reader, &window->rows, 0, 1) != 1) {
+                return false;
+            }
+        }
+        window->first = first;
+        window->count = 0;
+    } else if (drop > 0) {
+        memmove(rows, rows + drop * row_bytes, (window->count - drop) * row_bytes);
+        window->first += drop;
+        window->count -= drop;
+    }
+
+    unsigned int needed = last + 1 - window->first;
+    if (needed > window->capacity) {
+        fprintf(stderr, "Band of %u rows does not fit a window of %u rows\n", needed, window->capacity);
+        return false;
+    }
+    if (needed > window->count) {
+        unsigned int missing = needed - window->count;
+        if (read_image_rows(reader, &window->rows, window->count, missing) != missing) {
+            return false;
+        }
+        window->count = needed;
+    }
+    return true;
+}
+
+/// @brief Streams an image through a band operation
+/// @note Memory holds one output band and the largest window of source rows a band
+/// needs, whatever the height of the image
+/// @param reader Source image
+/// @param writer Result image
+/// @param band_rows Number of output rows computed at once
+/// @param rows_needed Source rows needed by a band
+/// @param compute Band operation
+/// @param params Parameters of the operation
+/// @return true if streaming ok
+static bool stream_bands(ImageReader *reader, ImageWriter *writer, unsigned int band_rows,
+                         band_rows_fct rows_needed, band_fct compute, const void *params)
+{
+    if (band_rows == 0) {
+        band_rows = 1;
+    }
+    if (band_rows > writer->height) {
+        band_rows = writer->height;
+    }
+
+    // the window fits the band needing the most source rows
+    BandWindow window = {.capacity = 0, .first = 0, .count = 0};
+    for (unsigned int row = 0; row < writer->height; row += band_rows) {
+        unsigned int last = row + band_rows < writer->height ? row + band_rows - 1 : writer->height - 1;
+        unsigned int src_first, src_last;
+        rows_needed(row, last, &src_first, &src_last, params);
+        if (src_last - src_first + 1 > window.capacity) {
+            window.capacity = src_last - src_first + 1;
+        }
+    }
+
+    // bands keep the depth of the source, write_image_rows narrows them to the writer
+    Image band;
+    create_image(&window.rows, reader->type, reader->width, window.capacity, reader->channels, reader->depth);
+    create_image(&band, writer->type, writer->width, band_rows, writer->channels, reader->depth);
+    bool rc = window.rows.data && band.data;
+    if (!rc) {
+        perror("Error during band allocation.");
+    }
+    window.rows.maxval = reader->maxval;
+    band.maxval = reader->maxval;
+
+    for (unsigned int row = 0; rc && row < writer->height; row += band_rows) {
+        unsigned int last = row + band_rows < writer->height ? row + band_rows - 1 : writer->height - 1;
+        unsigned int src_first, src_last;
+        rows_needed(row, last, &src_first, &src_last, params);
+        rc = slide_window(&window, reader, src_first, src_last);
+        if (!rc) break;
+
+        ImageView view = image_view(&window.rows);
+        view.height = window.count;
+        band.height = last - row + 1;
+        rc = compute(&band, &view, window.first, row, params)
+          && write_image_rows(writer, &band, 0, band.height);
+    }
+
+    free_image(&window.rows);
+    free_image(&band);
+    return rc;
+}
+
+/// @brief Parameters of a streamed convolution
+typedef struct HaloParams {
+    unsigned int halo;   // rows needed above and below each output row
+    unsigned int height; // height of the source
+    Matrix *kernel;
+} HaloParams;
+
+static void halo_rows(unsigned int first, unsigned int last,
+                      unsigned int *src_first, unsigned int *src_last, const void *params)
+{
+    const HaloParams *p = params;
+    *src_first = first > p->halo ? first - p->halo : 0;
+    *src_last = last + p->halo < p->height ? last + p->halo : p->height - 1;
+}
+
+static bool filter_rows(Image *band, const ImageView *window,
+                        unsigned int window_row, unsigned int band_row, const void *params)
+{
+    const HaloParams *p = params;
+    return filter_band(band, window, p->kernel, (int)(band_row - window_row));
+}
+
+static bool sobel_rows(Image *band, const ImageView *window,
+                       unsigned int window_row, unsigned int band_row, const void *params)
+{
+    return sobel_band(band, NULL, window, (int)(band_row - window_row));
+}
+
+/// @brief Checks that a result has the size of the source
+/// @param reader Source
+/// @param writer Result
+/// @return true if sizes match
+static bool same_size(const ImageReader *reader, const ImageWriter *writer)
+{
+    if (reader->width != writer->width || reader->height != writer->height) {
+        fprintf(stderr, "Result of %ux%u for a source of %ux%u\n",
+                writer->width, writer->height, reader->width, reader->height);
+        return false;
+    }
+    return true;
+}
+
+bool stream_filter(ImageReader *reader, ImageWriter *writer, Matrix *kernel, unsigned int band_rows)
+{
+    if (!same_size(reader, writer)) {
+        return false;
+    }
+    HaloParams params = {.halo = kernel->height / 2, .height = reader->height, .kernel = kernel};
+    return stream_bands(reader, writer, band_rows, halo_rows, filter_rows, &params);
+}
+
+bool stream_gaussian_filter(ImageReader *reader, ImageWriter *writer,
+                            unsigned int kernel_size, double sigma, unsigned int band_rows)
+{
+    Matrix kernel = create_gaussian_kernel(kernel_size, sigma);
+    bool rc = stream_filter(reader, writer, &kernel, band_rows);
+    free_matrix(&kernel);
+    return rc;
+}
+
+bool stream_sobel_filter(ImageReader *reader, ImageWriter *writer, unsigned int band_rows)
+{
+    if (!same_size(reader, writer)) {
+        return false;
+    }
+    HaloParams params = {.halo = 1, .height = reader->height, .kernel = NULL};
+    return stream_bands(reader, writer, band_rows, halo_rows, sobel_rows, &params);
+}
+
+static bool convert_rows(Image *band, const ImageView *window,
+                         unsigned int window_row, unsigned int band_row, const void *params)
+{
+    bool (*convert)(Image *, Image *) = *(bool (* const *)(Image *, Image *))params;
+
+    // the window holds exactly the rows of the band
+    Image rows = {
+        .type = window->type,
+        .depth = window->depth,
+        .layout = LAYOUT_INTERLEAVED,
+        .width = window->width,
+        .height = window->height,
+        .channels = window->channels,
+        .maxval = window->maxval,
+        .data = window->origin,
+        .mapping = NULL,
+        .mapping_size = 0
+    };
+    Image converted;
+    if (!convert(&converted, &rows)) {
+        return false;
+    }
+    bool rc = converted.channels == band->channels;
+    if (rc) {
+        size_t row_size = (size_t)band->width * band->channels;
+        double *buffer = malloc(row_size * sizeof(double));
+        rc = buffer != NULL;
+        for (unsigned int row = 0; rc && row < band->height; ++row) {
+            read_image_row(&converted, row, buffer);
+            write_image_row(band, row, buffer);
+        }
+        free(buffer);
+    } else {
+        fprintf(stderr, "Conversion to %u channels written to a %u channels image\n",
+                converted.channels, band->channels);
+    }
+    free_image(&converted);
+    return rc;
+}
+
+static void same_rows(unsigned int first, unsigned int last,
+                      unsigned int *src_first, unsigned int *src_last, const void *params)
+{
+    *src_first = first;
+    *src_last = last;
+}
+
+bool stream_convert_colors(ImageReader *reader, ImageWriter *writer,
+                           bool (*convert)(Image *, Image *), unsigned int band_rows)
+{
+    if (!same_size(reader, writer)) {
+        return false;
+    }
+    return stream_bands(reader, writer, band_rows, same_rows, convert_rows, &convert);
+}
+
+/// @brief Parameters of a streamed resize
+typedef struct ResizeParams {
+    unsigned int src_height;
+    unsigned int dest_height;
+    INTERP interp;
+} ResizeParams;
+
+static void resize_rows(unsigned int first, unsigned int last,
+                        unsigned int *src_first, unsigned int *src_last, const void *params)
+{
+    const ResizeParams *p = params;
+    resize_source_rows(first, last, p->src_height, p->dest_height, p->interp, src_first, src_last);
+}
+
+static bool resize_band_rows(Image *band, const ImageView *window,
+                             unsigned int window_row, unsigned int band_row, const void *params)
+{
+    const ResizeParams *p = params;
+    return resize_band(band, window, (int)window_row, (int)p->src_height,
+                       (int)band_row, (int)p->dest_height, p->interp);
+}
+
+bool stream_resize(ImageReader *reader, ImageWriter *writer, INTERP interp, unsigned int band_rows)
+{
+    if (reader->channels != writer->channels) {
+        fprintf(stderr, "Resized image of %u channels for a source of %u channels\n",
+                writer->channels, reader->channels);
+        return false;
+    }
+    ResizeParams params = {.src_height = reader->height, .dest_height = writer->height, .interp = interp};
+    return stream_bands(reader, writer, band_rows, resize_rows, resize_band_rows, &params);
+}
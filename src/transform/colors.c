@@ -1,5 +1,6 @@
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include "image/image.h"
 #include "transform/colors.h"
 #include <math.h>
@@ -11,17 +12,48 @@ bool rgb_to_gray(Image *dest, Image *src)
         return false;
     }
     
-    create_image(dest, GRAY, src->width, src->height, 1);
-    if (!dest->content) {
+    create_image(dest, GRAY, src->width, src->height, 1, src->depth);
+    if (!dest->data) {
         perror("Error during image allocation.");
         return false;
     }
-
-    for (int col = 0; col<src->width; ++col) {
-        for (int row = 0; row<src->height; ++row) {
-            int pixel_pos = row * src->channels + col * src->channels * src->height;
-            dest->content[row+col*src->height] = (src->content[pixel_pos] + src->content[pixel_pos+1] + src->content[pixel_pos+2])/3.0;
+    dest->maxval = src->maxval;
+
+    // narrow depths are averaged directly on the stored samples; planar
+    // images read three contiguous planes, interleaved ones three-sample strides
+    size_t n = (size_t)src->width * src->height;
+    size_t plane = src->layout == LAYOUT_PLANAR ? n : 1;
+    size_t step = src->layout == LAYOUT_PLANAR ? 1 : 3;
+    switch (src->depth) {
+    case DEPTH_U8: {
+        const uint8_t *r = src->content_u8, *g = r + plane, *b = g + plane;
+        for (size_t i = 0; i < n; ++i) {
+            dest->content_u8[i] = (uint8_t)((r[i*step] + g[i*step] + b[i*step] + 1) / 3);
+        }
+        break;
+    }
+    case DEPTH_U16: {
+        const uint16_t *r = src->content_u16, *g = r + plane, *b = g + plane;
+        for (size_t i = 0; i < n; ++i) {
+            dest->content_u16[i] = (uint16_t)((r[i*step] + g[i*step] + b[i*step] + 1) / 3);
         }
+        break;
+    }
+    case DEPTH_F32: {
+        const float *r = src->content_f32, *g = r + plane, *b = g + plane;
+        for (size_t i = 0; i < n; ++i) {
+            dest->content_f32[i] = (r[i*step] + g[i*step] + b[i*step]) / 3.0f;
+        }
+        break;
+    }
+    case DEPTH_F64: [[fallthrough]];
+    default: {
+        const double *r = src->content, *g = r + plane, *b = g + plane;
+        for (size_t i = 0; i < n; ++i) {
+            dest->content[i] = (r[i*step] + g[i*step] + b[i*step]) / 3.0;
+        }
+        break;
+    }
     }
     return true;
 }
@@ -33,19 +65,21 @@ bool gray_to_rgb(Image *dest, Image *src)
         return false;
     }
     
-    create_image(dest, RGB, src->width, src->height, 3);
-    if (!dest->content) {
+    create_image(dest, RGB, src->width, src->height, 3, src->depth);
+    if (!dest->data) {
         perror("Error during image allocation.");
         return false;
     }
-
-    for (int col = 0; col<dest->width; ++col) {
-        for (int row = 0; row<dest->height; ++row) {
-            int pixel_pos = row*dest->channels + col*dest->channels*src->height;
-            double value = src->content[row+col*dest->height];
-            dest->content[pixel_pos] = value;
-            dest->content[pixel_pos+1] = value;
-            dest->content[pixel_pos+2] = value;
+    dest->maxval = src->maxval;
+
+    // replicate each sample, whatever its size
+    size_t n = (size_t)src->width * src->height;
+    size_t size = depth_size(src->depth);
+    const unsigned char *in = src->data;
+    unsigned char *out = dest->data;
+    for (size_t i = 0; i < n; ++i) {
+        for (int c = 0; c < 3; ++c) {
+            memcpy(out + (3 * i + c) * size, in + i * size, size);
         }
     }
     return true;
@@ -85,32 +119,51 @@ static void rgb_to_hsv_pixel(double *dest, double *src)
     *(dest+2) = v;
 }
 
-bool rgb_to_hsv(Image *dest, Image *src)
+/// @brief Converts an image between colour spaces row by row, keeping its layout
+/// @param dest Converted image (uninitialized)
+/// @param src Original image
+/// @param type Type of the converted image
+/// @param convert_pixel Conversion of a single (three samples) pixel
+/// @return true if conversion ok
+static bool convert_colors(Image *dest, Image *src, IMAGE_TYPE type, void (*convert_pixel)(double *, double *))
 {
-    if (src->type != RGB) {
-        perror("Error during RGB to HSV conversion: original image is not a valid RGB image");
-        return false;
+    // hue is in degrees: HSV images (and the RGB images made from them) are stored as doubles
+    if (src->layout == LAYOUT_PLANAR) {
+        create_planar_image(dest, type, src->width, src->height, src->channels, DEPTH_F64);
+    } else {
+        create_image(dest, type, src->width, src->height, src->channels, DEPTH_F64);
     }
-
-    create_image(dest, HSV, src->width, src->height, src->channels);
     if (!dest->content) {
         perror("Error during image allocation.");
         return false;
     }
 
-    bool ok = true;
-    for (int col = 0; col<src->width; ++col) {
-        for (int row = 0; row<src->height; ++row) {
-            double * src_pixel = pixel_at(src, col, row);
-            double * dest_pixel = pixel_at(dest, col, row);
-            if (!src_pixel || !dest_pixel) {
-                ok = false;
-                continue;
-            }
-            rgb_to_hsv_pixel(dest_pixel, src_pixel);
+    size_t row_size = (size_t)src->width * src->channels;
+    double *buffer = malloc(2 * row_size * sizeof(double));
+    if (!buffer) {
+        perror("Error allocating row buffer.");
+        free_image(dest);
+        return false;
+    }
+    double *converted = buffer + row_size;
+    for (int row = 0; row<src->height; ++row) {
+        read_image_row(src, row, buffer);
+        for (int col = 0; col<src->width; ++col) {
+            convert_pixel(converted + (size_t)col * 3, buffer + (size_t)col * 3);
         }
+        write_image_row(dest, row, converted);
+    }
+    free(buffer);
+    return true;
+}
+
+bool rgb_to_hsv(Image *dest, Image *src)
+{
+    if (src->type != RGB) {
+        perror("Error during RGB to HSV conversion: original image is not a valid RGB image");
+        return false;
     }
-    return ok;
+    return convert_colors(dest, src, HSV, rgb_to_hsv_pixel);
 }
 
 static void hsv_to_rgb_pixel(double *dest, double *src)
@@ -145,26 +198,7 @@ bool hsv_to_rgb(Image *dest, Image *src)
         perror("Error during HSV to RGB conversion: original image is not a valid HSV image");
         return false;
     }
-
-    create_image(dest, RGB, src->width, src->height, src->channels);
-    if (!dest->content) {
-        perror("Error during image allocation.");
-        return false;
-    }
-
-    bool ok = true;
-    for (int col = 0; col<src->width; ++col) {
-        for (int row = 0; row<src->height; ++row) {
-            double *src_pixel = pixel_at(src, col, row);
-            double *dest_pixel = pixel_at(dest, col, row);
-            if (!src_pixel || !dest_pixel) {
-                ok = false;
-                continue;
-            }
-            hsv_to_rgb_pixel(dest_pixel, src_pixel);
-        }
-    }
-    return ok;
+    return convert_colors(dest, src, RGB, hsv_to_rgb_pixel);
 }
 
 void shift_hue(Image *src, int shift)
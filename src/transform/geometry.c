@@ -4,146 +4,808 @@
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
+#include <pthread.h>
+#include <limits.h>
 #include "utils/matrix.h"
+#include "utils/parallel.h"
 
-/// @brief Nearest neighbors interpolation of a pixel
-/// @param pixel_dest Pixel to interpolate
-/// @param src Source image
-/// @param col 
-/// @param row 
-static void nearest_neighbors_interpolation(double *pixel_dest, Image *src, int col, int row)
+// Fixed-point maps kept for later sources of the same size, and their total size
+#define REMAP_CACHE_ENTRIES 8
+#define REMAP_CACHE_BYTES ((size_t)64 << 20)
+// Steps of the fractional part of fixed-point coordinates
+#define REMAP_SIZE (1 << REMAP_BITS)
+// Angles closer than this (in quarter turns) to a multiple of 90 degrees rotate by permuting the pixels
+#define QUARTER_TURN_TOLERANCE 1e-9
+// Weight tables of separable resizes kept for later resizes of the same sizes
+#define RESAMPLE_CACHE_ENTRIES 16
+
+/// @brief Affine map from the pixels of a destination to source coordinates
+/// @note Pixel (col, row) samples the source at x = (row + first_row) * dx_row + x0 + col * dx_col
+/// (and likewise for y): along a row, coordinates advance by fixed steps
+typedef struct WarpMap {
+    double x0, y0;          // source coordinates of pixel (0, -first_row)
+    double dx_col, dy_col;  // step along a destination row
+    double dx_row, dy_row;  // step along a destination column
+    int first_row;          // destination row matching the first row of the view
+} WarpMap;
+
+/// @brief State shared by the tasks of a warp
+typedef struct Warp {
+    const ImageView *dest;
+    const ImageView *src;
+    const WarpMap *map;
+    INTERP interp;
+    unsigned int rows_per_task;
+    bool failed;            // a task could not allocate its row
+} Warp;
+
+/// @brief Tells whether source coordinates can be interpolated
+/// @note Nearest neighbors truncate the coordinates, bilinear interpolation needs both neighbors
+static inline bool warp_inside(unsigned int width, unsigned int height, double x, double y, INTERP interp)
 {
-    if (col >= 0 && col < src->width && row >= 0 && row < src->height) {
-        memcpy(pixel_dest, pixel_at(src, col, row), src->channels * sizeof(double));
+    if (interp == INTERP_NEAREST) {
+        return x > -1 && x < width && y > -1 && y < height;
     }
+    return x >= 0 && x <= width - 1.0 && y >= 0 && y <= height - 1.0;
 }
 
-/// @brief Bilinear interpolation of a pixel
-/// @param pixel_dest Pixel to interpolate
-/// @param src Source image
-/// @param col Floating point col coordinate
-/// @param row Floating point row coordinate
-static void bilinear_interpolation(double *pixel_dest, Image *src, double col, double row)
-{
-    // neighbors
-    int col0 = (int)floor(col);
-    int col1 = (int)ceil(col);
-    int row0 = (int)floor(row);
-    int row1 = (int)ceil(row);
-    if (col0 < 0 || col1 >= src->width || row0 < 0 || row1 >= src->height) {
+/// @brief Restricts a span of columns to those whose coordinate lies in [low, high]
+/// @param base Coordinate of column 0
+/// @param step Coordinate step between two columns
+/// @param low Lowest coordinate
+/// @param high Highest coordinate
+/// @param first First column of the span, updated
+/// @param last Column after the span, updated
+static void clip_span(double base, double step, double low, double high, double *first, double *last)
+{
+    if (step == 0) {
+        if (base < low || base > high) *last = *first;
         return;
     }
-    // deltas
-    double dcol = col - col0;
-    double drow = row - row0;
-    // horizontal interpolation
-    double *pixel_top = (double *)malloc(src->channels * sizeof(double));
-    for (int c = 0; c < src->channels; ++c) {
-        *(pixel_top+c) = *(pixel_at(src, col0, row0)+c) * (1-dcol) + *(pixel_at(src, col1, row0)+c) * dcol;
+    double a = (low - base) / step, b = (high - base) / step;
+    *first = fmax(*first, ceil(fmin(a, b)));
+    *last = fmin(*last, floor(fmax(a, b)) + 1);
+}
+
+/// @brief Returns the normalized value of a sample
+/// @param p Sample
+/// @param depth Depth of the samples
+/// @param maxval Maximum value of the samples
+/// @param lut Normalized values of the DEPTH_U8 samples
+static inline double warp_fetch(const unsigned char *p, PIXEL_DEPTH depth, double maxval, const double *lut)
+{
+    switch (depth) {
+    case DEPTH_U8: return lut[*p];
+    case DEPTH_U16: return *(const uint16_t *)p / maxval;
+    case DEPTH_F32: return *(const float *)p;
+    case DEPTH_F64: [[fallthrough]];
+    default: return *(const double *)p;
     }
-    double *pixel_bottom = (double *)malloc(src->channels * sizeof(double));
-    for (int c = 0; c < src->channels; ++c) {
-        *(pixel_bottom+c) = *(pixel_at(src, col0, row1)+c) * (1-dcol) + *(pixel_at(src, col1, row1)+c) * dcol;
+}
+
+/// @brief Interpolates a pixel from its four neighbors, every one lying in the source
+/// @param pixel Normalized samples of the pixel
+/// @param src Source view
+/// @param x0 Column of the top left neighbor
+/// @param y0 Row of the top left neighbor
+/// @param dx Weight of the right neighbors
+/// @param dy Weight of the bottom neighbors
+/// @param depth Depth of the source (constant in callers, for the fetches to be specialized)
+/// @param lut Normalized values of the DEPTH_U8 samples
+static inline void bilinear_pixel(double *pixel, const ImageView *src, int x0, int y0, double dx, double dy,
+                                  PIXEL_DEPTH depth, const double *lut)
+{
+    // on the last column or row, the second neighbor has a zero weight
+    ptrdiff_t right = x0 + 1 < (int)src->width ? src->col_stride : 0;
+    ptrdiff_t down = y0 + 1 < (int)src->height ? src->row_stride : 0;
+    double maxval = src->maxval;
+    const unsigned char *p = src->origin + y0 * src->row_stride + x0 * src->col_stride;
+    for (unsigned int c = 0; c < src->channels; ++c, p += src->channel_stride) {
+        double top = warp_fetch(p, depth, maxval, lut) * (1 - dx) + warp_fetch(p + right, depth, maxval, lut) * dx;
+        double bottom = warp_fetch(p + down, depth, maxval, lut) * (1 - dx)
+                      + warp_fetch(p + down + right, depth, maxval, lut) * dx;
+        pixel[c] = (1 - dy) * top + dy * bottom;
     }
-    // vertical interpolation
-    for (int c = 0; c < src->channels; ++c) {
-        *(pixel_dest+c) = (1-drow) * *(pixel_top+c) + drow * *(pixel_bottom+c);
+}
+
+/// @brief Interpolates a span of a row bilinearly, every neighbor lying in the source
+/// @param out Row of normalized samples
+/// @param src Source view
+/// @param map Map from destination pixels to source coordinates
+/// @param x_row Source x coordinate of column 0
+/// @param y_row Source y coordinate of column 0
+/// @param col0 First column of the span
+/// @param col1 Column after the span
+/// @param depth Depth of the source (constant in callers, for the fetches to be specialized)
+/// @param lut Normalized values of the DEPTH_U8 samples
+static inline void warp_bilinear_span(double *out, const ImageView *src, const WarpMap *map, double x_row, double y_row,
+                                      int col0, int col1, PIXEL_DEPTH depth, const double *lut)
+{
+    for (int col = col0; col < col1; ++col) {
+        double x = x_row + col * map->dx_col;
+        double y = y_row + col * map->dy_col;
+        int x0 = (int)x, y0 = (int)y;
+        bilinear_pixel(out + (size_t)col * src->channels, src, x0, y0, x - x0, y - y0, depth, lut);
     }
 }
 
-bool flip_horizontal(Image *dest, Image *src)
+/// @brief Copies a source pixel into a destination pixel, samples as they are
+/// @param pixel_dest Destination pixel
+/// @param dest Destination view
+/// @param src Source view
+/// @param x Source column
+/// @param y Source row
+static inline void copy_pixel(unsigned char *pixel_dest, const ImageView *dest, const ImageView *src, int x, int y)
 {
-    create_image(dest, src->type, src->width, src->height, src->channels);
-    if (!dest->content) {
-        perror("Error during image allocation.");
-        return false;
+    size_t sample_size = depth_size(src->depth);
+    const unsigned char *pixel = src->origin + y * src->row_stride + x * src->col_stride;
+    if (src->channel_stride == (ptrdiff_t)sample_size && dest->channel_stride == (ptrdiff_t)sample_size) {
+        memcpy(pixel_dest, pixel, src->channels * sample_size);
+        return;
+    }
+    for (unsigned int c = 0; c < src->channels; ++c) {
+        memcpy(pixel_dest + c * dest->channel_stride, pixel + c * src->channel_stride, sample_size);
     }
-    for (int col = 0; col < src->width; ++col) {
-        for (int row = 0; row < src->height; ++row) {
-            memcpy(pixel_at(dest, dest->width - col - 1, row), pixel_at(src, col, row), src->channels * sizeof(double));
+}
+
+/// @brief Copies the nearest source pixels into a span of a row
+/// @param dest Destination view
+/// @param row Destination row
+/// @param src Source view
+/// @param map Map from destination pixels to source coordinates
+/// @param x_row Source x coordinate of column 0
+/// @param y_row Source y coordinate of column 0
+/// @param col0 First column of the span
+/// @param col1 Column after the span
+static void warp_nearest_span(const ImageView *dest, unsigned int row, const ImageView *src, const WarpMap *map,
+                              double x_row, double y_row, int col0, int col1)
+{
+    unsigned char *line = dest->origin + (ptrdiff_t)row * dest->row_stride;
+    for (int col = col0; col < col1; ++col) {
+        int x = (int)(x_row + col * map->dx_col);
+        int y = (int)(y_row + col * map->dy_col);
+        copy_pixel(line + col * dest->col_stride, dest, src, x, y);
+    }
+}
+
+/// @brief Zeroes a pixel of a view
+/// @param pixel_dest Pixel
+/// @param dest View
+static inline void zero_pixel(unsigned char *pixel_dest, const ImageView *dest)
+{
+    size_t sample_size = depth_size(dest->depth);
+    for (unsigned int c = 0; c < dest->channels; ++c) {
+        memset(pixel_dest + c * dest->channel_stride, 0, sample_size);
+    }
+}
+
+/// @brief Zeroes the pixels of a row of a view out of a span
+/// @param dest View
+/// @param row Row
+/// @param col0 First column of the span
+/// @param col1 Column after the span
+static void warp_clear(const ImageView *dest, unsigned int row, int col0, int col1)
+{
+    unsigned char *line = dest->origin + (ptrdiff_t)row * dest->row_stride;
+    const int ranges[2][2] = {{0, col0}, {col1, dest->width}};
+    for (int r = 0; r < 2; ++r) {
+        for (int col = ranges[r][0]; col < ranges[r][1]; ++col) {
+            zero_pixel(line + col * dest->col_stride, dest);
         }
     }
-    return true;
 }
 
-bool flip_vertical(Image *dest, Image *src)
+/// @brief Warps a strip of rows: the span of columns inside the source is found first,
+/// then interpolated without bounds checks, the other pixels being zeroed
+/// @param task Index of the strip
+/// @param params Warp (Warp)
+static void warp_rows(unsigned int task, void *params)
+{
+    Warp *warp = params;
+    const ImageView *src = warp->src, *dest = warp->dest;
+    const WarpMap *map = warp->map;
+    INTERP interp = warp->interp;
+    unsigned int first = task * warp->rows_per_task;
+    unsigned int last = first + warp->rows_per_task < dest->height ? first + warp->rows_per_task : dest->height;
+    unsigned int channels = src->channels;
+    int width = dest->width;
+    double *out = NULL;
+    if (interp != INTERP_NEAREST) {
+        out = malloc((size_t)width * channels * sizeof(double));
+        if (!out) {
+            warp->failed = true;
+            return;
+        }
+    }
+    double lut[256];
+    if (src->depth == DEPTH_U8) {
+        for (int v = 0; v < 256; ++v) lut[v] = v / (double)src->maxval;
+    }
+    // nearest neighbors keep coordinates in (-1, size), bilinear in [0, size - 1]
+    double margin = interp == INTERP_NEAREST ? 1 : 0;
+    for (unsigned int row = first; row < last; ++row) {
+        double x_row = ((double)row + map->first_row) * map->dx_row + map->x0;
+        double y_row = ((double)row + map->first_row) * map->dy_row + map->y0;
+        double begin = 0, end = width;
+        clip_span(x_row, map->dx_col, -margin, src->width - 1.0 + margin, &begin, &end);
+        clip_span(y_row, map->dy_col, -margin, src->height - 1.0 + margin, &begin, &end);
+        int col0 = begin < end ? (int)begin : 0, col1 = begin < end ? (int)end : 0;
+        // the bounds were rounded: settle them on the exact test
+        while (col0 < col1 && !warp_inside(src->width, src->height, x_row + col0 * map->dx_col, y_row + col0 * map->dy_col, interp)) ++col0;
+        while (col1 > col0 && !warp_inside(src->width, src->height, x_row + (col1 - 1) * map->dx_col, y_row + (col1 - 1) * map->dy_col, interp)) --col1;
+        while (col0 > 0 && warp_inside(src->width, src->height, x_row + (col0 - 1) * map->dx_col, y_row + (col0 - 1) * map->dy_col, interp)) --col0;
+        while (col1 < width && warp_inside(src->width, src->height, x_row + col1 * map->dx_col, y_row + col1 * map->dy_col, interp)) ++col1;
+
+        if (interp == INTERP_NEAREST) {
+            // samples are copied as they are
+            warp_clear(dest, row, col0, col1);
+            warp_nearest_span(dest, row, src, map, x_row, y_row, col0, col1);
+            continue;
+        }
+        memset(out, 0, (size_t)col0 * channels * sizeof(double));
+        memset(out + (size_t)col1 * channels, 0, (size_t)(width - col1) * channels * sizeof(double));
+        if (src->depth == DEPTH_U8) {
+            warp_bilinear_span(out, src, map, x_row, y_row, col0, col1, DEPTH_U8, lut);
+        } else {
+            warp_bilinear_span(out, src, map, x_row, y_row, col0, col1, src->depth, lut);
+        }
+        write_view_row(dest, row, out);
+    }
+    free(out);
+}
+
+/// @brief Warps a view into a view, strips of rows running in parallel
+/// @param dest Warped view
+/// @param src Source view
+/// @param map Map from destination pixels to source coordinates
+/// @param interp Interpolation technique
+/// @return true if warp ok
+static bool warp_view(const ImageView *dest, const ImageView *src, const WarpMap *map, INTERP interp)
+{
+    Warp warp = {.dest = dest, .src = src, .map = map, .interp = interp};
+    unsigned int threads = parallel_threads();
+    warp.rows_per_task = (dest->height + 4 * threads - 1) / (4 * threads);
+    if (warp.rows_per_task == 0) {
+        return true;
+    }
+    parallel_for((dest->height + warp.rows_per_task - 1) / warp.rows_per_task, warp_rows, &warp);
+    if (warp.failed) {
+        perror("Error allocating warp rows.");
+    }
+    return !warp.failed;
+}
+
+/// @brief Allocates a warped image and fills it from a view
+/// @param dest Warped image (uninitialized)
+/// @param src Source view
+/// @param width Width of the warped image
+/// @param height Height of the warped image
+/// @param map Map from destination pixels to source coordinates
+/// @param interp Interpolation technique
+/// @return true if warp ok
+static bool warp_image(Image *dest, const ImageView *src, int width, int height, const WarpMap *map, INTERP interp)
 {
-    create_image(dest, src->type, src->width, src->height, src->channels);
-    if (!dest->content) {
+    create_image(dest, src->type, width, height, src->channels, src->depth);
+    if (!dest->data) {
         perror("Error during image allocation.");
         return false;
     }
-    for (int col = 0; col < src->width; ++col) {
-        memcpy(dest->content + col * dest->height * dest->channels,
-            src->content + (src->width - col - 1) * src->height * src->channels,
-            src->height * src->channels * sizeof(double));
+    dest->maxval = src->maxval;
+    ImageView dest_view = image_view(dest);
+    if (!warp_view(&dest_view, src, map, interp)) {
+        free_image(dest);
+        return false;
+    }
+    return true;
+}
+
+/// @brief Weights resampling a line of samples into a line of another length
+/// @note Resampled sample i is the sum over t < taps of weights[i * taps + t] * source[first[i] + t]
+typedef struct ResampleTable {
+    unsigned int src_size;
+    unsigned int dest_size;
+    double start;               // source position of the start of the first resampled sample
+    double span;                // source length covered by the resampled line
+    INTERP interp;
+    unsigned int taps;          // weights of each resampled sample
+    unsigned int *first;        // first source sample of each resampled sample
+    double *weights;            // weights of each resampled sample, of sum 1
+    unsigned int users;         // holders of the table, the cache being one of them
+    unsigned long last_use;
+} ResampleTable;
+
+static ResampleTable *resample_cache[RESAMPLE_CACHE_ENTRIES];
+static unsigned long resample_clock;
+static pthread_mutex_t resample_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// @brief Value of a resampling kernel
+/// @param interp Filter (bicubic or Lanczos-3)
+/// @param x Distance to the resampled position, in source samples
+static double resample_kernel(INTERP interp, double x)
+{
+    x = fabs(x);
+    if (interp == INTERP_BICUBIC) {
+        if (x < 1) return (1.5 * x - 2.5) * x * x + 1;
+        if (x < 2) return ((-0.5 * x + 2.5) * x - 4) * x + 2;
+        return 0;
+    }
+    if (x < 1e-9) return 1;
+    if (x >= 3) return 0;
+    return 3 * sin(M_PI * x) * sin(M_PI * x / 3) / (M_PI * M_PI * x * x);
+}
+
+/// @brief Computes the weights resampling a line
+/// @note Sample i covers source positions [start + i * scale, start + (i + 1) * scale), with
+/// scale = span / dest_size. Downscales stretch the kernel by the scale, so that each source
+/// sample contributes; positions before or after the line weigh on the edge samples.
+/// @param src_size Length of the source line
+/// @param dest_size Length of the resampled line
+/// @param start Source position of the start of the first resampled sample
+/// @param span Source length covered by the resampled line
+/// @param interp Filter
+/// @return Table, NULL if allocation failed
+static ResampleTable * create_resample_table(unsigned int src_size, unsigned int dest_size,
+                                             double start, double span, INTERP interp)
+{
+    double scale = span / dest_size;
+    double stretch = scale > 1 ? scale : 1;
+    double support = (interp == INTERP_BICUBIC ? 2 : 3) * stretch;
+    unsigned int taps = interp == INTERP_AREA ? (unsigned int)ceil(scale) + 1 : (unsigned int)ceil(2 * support) + 1;
+    if (taps > src_size) {
+        taps = src_size;
+    }
+    ResampleTable *table = malloc(sizeof(ResampleTable));
+    if (!table) {
+        return NULL;
+    }
+    *table = (ResampleTable){.src_size = src_size, .dest_size = dest_size, .start = start, .span = span,
+                             .interp = interp, .taps = taps};
+    table->first = malloc(dest_size * sizeof(unsigned int));
+    table->weights = calloc((size_t)dest_size * taps, sizeof(double));
+    if (!table->first || !table->weights) {
+        free(table->first);
+        free(table->weights);
+        free(table);
+        return NULL;
+    }
+    for (unsigned int i = 0; i < dest_size; ++i) {
+        int low, high;
+        double begin = start + i * scale, center = begin + 0.5 * scale - 0.5;
+        if (interp == INTERP_AREA) {
+            low = (int)floor(begin);
+            high = (int)ceil(begin + scale) - 1;
+        } else {
+            low = (int)ceil(center - support);
+            high = (int)floor(center + support);
+        }
+        // the window of taps samples holds every contribution once clamped to the line
+        int first = low < 0 ? 0 : low;
+        if (first > (int)(src_size - taps)) {
+            first = src_size - taps;
+        }
+        table->first[i] = first;
+        double *weights = table->weights + (size_t)i * taps;
+        double sum = 0;
+        for (int j = low; j <= high; ++j) {
+            double weight;
+            if (interp == INTERP_AREA) {
+                // overlap of source pixel j with the pixel covered by sample i
+                weight = fmin(j + 1, begin + scale) - fmax(j, begin);
+            } else {
+                weight = resample_kernel(interp, (j - center) / stretch);
+            }
+            int k = j < 0 ? 0 : (j >= (int)src_size ? (int)src_size - 1 : j);
+            weights[k - first] += weight;
+            sum += weight;
+        }
+        for (unsigned int t = 0; sum != 0 && t < taps; ++t) {
+            weights[t] /= sum;
         }
-        return true;
     }
-    
-    bool resize(Image *dest, Image *src, int width, int height, INTERP interp)
-    {
-        create_image(dest, src->type, width, height, src->channels);
-        if (!dest->content) {
-            perror("Error during image allocation.");
-            return false;
-        }
-        
-        for (int col = 0; col < width; ++col) {
-            for (int row = 0; row < height; ++row) {
-                double *pixel = pixel_at(dest, col, row);
-                double col_src = col*(double)src->width/width;
-                double row_src = row*(double)src->height/height;
-                switch (interp) {
-                    case INTERP_NEAREST: {
-                        nearest_neighbors_interpolation(pixel, src, (int)col_src, (int)row_src);
-                        break;
-                    }
-                    case INTERP_BILINEAR: {
-                        bilinear_interpolation(pixel, src, col_src, row_src);
-                        break;
-                    }
+    return table;
+}
+
+/// @brief Gives back a table, freeing it once neither the cache nor any resize holds it
+/// @param table Cached table
+static void release_resample_table(ResampleTable *table)
+{
+    pthread_mutex_lock(&resample_lock);
+    bool unused = --table->users == 0;
+    pthread_mutex_unlock(&resample_lock);
+    if (unused) {
+        free(table->first);
+        free(table->weights);
+        free(table);
+    }
+}
+
+/// @brief Returns the weights resampling a line, from the cache if possible
+/// @note Tables are cached by source length, resampled line and filter (least recently used first out)
+/// @param src_size Length of the source line
+/// @param dest_size Length of the resampled line
+/// @param start Source position of the start of the first resampled sample
+/// @param span Source length covered by the resampled line
+/// @param interp Filter
+/// @return Table, to be released, NULL if allocation failed
+static ResampleTable * acquire_resample_table(unsigned int src_size, unsigned int dest_size,
+                                              double start, double span, INTERP interp)
+{
+    pthread_mutex_lock(&resample_lock);
+    for (unsigned int k = 0; k < RESAMPLE_CACHE_ENTRIES; ++k) {
+        ResampleTable *cached = resample_cache[k];
+        if (cached && cached->src_size == src_size && cached->dest_size == dest_size
+            && cached->start == start && cached->span == span && cached->interp == interp) {
+            ++cached->users;
+            cached->last_use = ++resample_clock;
+            pthread_mutex_unlock(&resample_lock);
+            return cached;
+        }
+    }
+    pthread_mutex_unlock(&resample_lock);
+
+    ResampleTable *table = create_resample_table(src_size, dest_size, start, span, interp);
+    if (!table) {
+        perror("Error allocating resampling weights.");
+        return NULL;
+    }
+    table->users = 2;
+    pthread_mutex_lock(&resample_lock);
+    table->last_use = ++resample_clock;
+    int slot = 0;
+    for (unsigned int k = 0; k < RESAMPLE_CACHE_ENTRIES; ++k) {
+        if (!resample_cache[k]) {
+            slot = k;
+            break;
+        }
+        if (resample_cache[k]->last_use < resample_cache[slot]->last_use) {
+            slot = k;
+        }
+    }
+    ResampleTable *evicted = resample_cache[slot];
+    resample_cache[slot] = table;
+    pthread_mutex_unlock(&resample_lock);
+    if (evicted) {
+        release_resample_table(evicted);
+    }
+    return table;
+}
+
+/// @brief State shared by the tasks of a separable resize
+typedef struct Resample {
+    const ImageView *dest;
+    const ImageView *src;           // window of source rows
+    const ResampleTable *cols;
+    const ResampleTable *rows;
+    int first_row;                  // source row matching the first resampled row of lines
+    int window_row;                 // source row matching the first row of src
+    int dest_row;                   // resized row matching the first row of dest
+    unsigned int n_lines;
+    double *lines;                  // source rows resampled horizontally
+    unsigned int rows_per_task;
+    bool failed;                    // a task could not allocate its row
+} Resample;
+
+/// @brief Resamples a line of pixels
+/// @note Gray and RGB pixels keep their sums in independent chains
+/// @param line Resampled pixels
+/// @param row Source pixels
+/// @param table Weights
+/// @param channels Channels of the pixels
+static void resample_line(double *line, const double *row, const ResampleTable *table, unsigned int channels)
+{
+    unsigned int taps = table->taps;
+    for (unsigned int i = 0; i < table->dest_size; ++i) {
+        const double *weights = table->weights + (size_t)i * taps;
+        const double *in = row + (size_t)table->first[i] * channels;
+        if (channels == 1) {
+            double sum0 = 0, sum1 = 0;
+            unsigned int t = 0;
+            for (; t + 1 < taps; t += 2) {
+                sum0 += weights[t] * in[t];
+                sum1 += weights[t + 1] * in[t + 1];
+            }
+            if (t < taps) {
+                sum0 += weights[t] * in[t];
+            }
+            line[i] = sum0 + sum1;
+        } else if (channels == 3) {
+            double sum0 = 0, sum1 = 0, sum2 = 0;
+            for (unsigned int t = 0; t < taps; ++t) {
+                sum0 += weights[t] * in[3 * t];
+                sum1 += weights[t] * in[3 * t + 1];
+                sum2 += weights[t] * in[3 * t + 2];
+            }
+            line[3 * i] = sum0;
+            line[3 * i + 1] = sum1;
+            line[3 * i + 2] = sum2;
+        } else {
+            for (unsigned int c = 0; c < channels; ++c) {
+                double sum = 0;
+                for (unsigned int t = 0; t < taps; ++t) {
+                    sum += weights[t] * in[t * channels + c];
                 }
+                line[i * channels + c] = sum;
             }
         }
+    }
+}
+
+/// @brief Resamples a strip of source rows horizontally
+/// @param task Index of the strip
+/// @param params Resize (Resample)
+static void resample_columns(unsigned int task, void *params)
+{
+    Resample *resample = params;
+    const ResampleTable *cols = resample->cols;
+    unsigned int first = task * resample->rows_per_task;
+    unsigned int last = first + resample->rows_per_task < resample->n_lines ? first + resample->rows_per_task : resample->n_lines;
+    unsigned int channels = resample->src->channels;
+    size_t line_size = (size_t)cols->dest_size * channels;
+    double *row = malloc((size_t)resample->src->width * channels * sizeof(double));
+    if (!row) {
+        resample->failed = true;
+        return;
+    }
+    for (unsigned int r = first; r < last; ++r) {
+        read_view_row(resample->src, resample->first_row - resample->window_row + r, row);
+        resample_line(resample->lines + r * line_size, row, cols, channels);
+    }
+    free(row);
+}
+
+/// @brief Resamples a strip of resized rows vertically, combining whole lines
+/// @param task Index of the strip
+/// @param params Resize (Resample)
+static void resample_rows(unsigned int task, void *params)
+{
+    Resample *resample = params;
+    const ResampleTable *rows = resample->rows;
+    unsigned int first = task * resample->rows_per_task;
+    unsigned int last = first + resample->rows_per_task < resample->dest->height ? first + resample->rows_per_task : resample->dest->height;
+    size_t line_size = (size_t)resample->cols->dest_size * resample->src->channels;
+    double *out = malloc(line_size * sizeof(double));
+    if (!out) {
+        resample->failed = true;
+        return;
+    }
+    for (unsigned int row = first; row < last; ++row) {
+        unsigned int i = resample->dest_row + row;
+        const double *weights = rows->weights + (size_t)i * rows->taps;
+        const double *lines = resample->lines + (rows->first[i] - resample->first_row) * line_size;
+        for (size_t k = 0; k < line_size; ++k) {
+            out[k] = weights[0] * lines[k];
+        }
+        for (unsigned int t = 1; t < rows->taps; ++t) {
+            const double *line = lines + t * line_size;
+            double weight = weights[t];
+            for (size_t k = 0; k < line_size; ++k) {
+                out[k] += weight * line[k];
+            }
+        }
+        write_view_row(resample->dest, row, out);
+    }
+    free(out);
+}
+
+/// @brief Resizes rows of a view with a separable filter: rows first, then columns
+/// @param dest Resized view
+/// @param window Source rows
+/// @param window_row Source row matching the first row of the window
+/// @param src_height Height of the whole source
+/// @param dest_row Resized row matching the first row of dest
+/// @param dest_height Height of the whole resized image
+/// @param region Source region covered by the resized image: x, y, width and height (pixels)
+/// @param interp Filter
+/// @return true if resizing ok
+static bool resample_view(const ImageView *dest, const ImageView *window, int window_row,
+                          unsigned int src_height, int dest_row, unsigned int dest_height,
+                          const double region[4], INTERP interp)
+{
+    if (dest->height == 0) {
         return true;
     }
-    
-bool rotate(Image *dest, Image *src, double angle, INTERP interp)
+    ResampleTable *cols = acquire_resample_table(window->width, dest->width, region[0], region[2], interp);
+    ResampleTable *rows = acquire_resample_table(src_height, dest_height, region[1], region[3], interp);
+    if (!cols || !rows) {
+        if (cols) release_resample_table(cols);
+        if (rows) release_resample_table(rows);
+        return false;
+    }
+    Resample resample = {.dest = dest, .src = window, .cols = cols, .rows = rows,
+                         .window_row = window_row, .dest_row = dest_row};
+    // only the source rows weighing on the resized rows are resampled horizontally
+    resample.first_row = rows->first[dest_row];
+    int end_row = rows->first[dest_row + dest->height - 1] + rows->taps;
+    resample.n_lines = end_row - resample.first_row;
+    bool rc = false;
+    if (resample.first_row < window_row || end_row > window_row + (int)window->height) {
+        fprintf(stderr, "Source rows %d to %d are outside the window of rows %d to %d\n",
+                resample.first_row, end_row - 1, window_row, window_row + (int)window->height - 1);
+        goto release;
+    }
+    resample.lines = malloc((size_t)resample.n_lines * dest->width * window->channels * sizeof(double));
+    if (!resample.lines) {
+        perror("Error allocating resampled rows.");
+        goto release;
+    }
+    unsigned int threads = parallel_threads();
+    resample.rows_per_task = (resample.n_lines + 4 * threads - 1) / (4 * threads);
+    parallel_for((resample.n_lines + resample.rows_per_task - 1) / resample.rows_per_task, resample_columns, &resample);
+    if (!resample.failed) {
+        resample.rows_per_task = (dest->height + 4 * threads - 1) / (4 * threads);
+        parallel_for((dest->height + resample.rows_per_task - 1) / resample.rows_per_task, resample_rows, &resample);
+    }
+    if (resample.failed) {
+        perror("Error allocating resampled rows.");
+    }
+    rc = !resample.failed;
+    free(resample.lines);
+release:
+    release_resample_table(cols);
+    release_resample_table(rows);
+    return rc;
+}
+
+bool flip_horizontal(Image *dest, Image *src)
+{
+    // a mirrored view read row by row: each pixel is copied once, in memory order
+    ImageView view = image_view(src);
+    ImageView flipped = flip_view_horizontal(&view);
+    return materialize_view(dest, &flipped);
+}
+
+bool flip_vertical(Image *dest, Image *src)
+{
+    ImageView view = image_view(src);
+    ImageView flipped = flip_view_vertical(&view);
+    return materialize_view(dest, &flipped);
+}
+
+bool transpose_image(Image *dest, Image *src)
+{
+    ImageView view = image_view(src);
+    ImageView transposed = transpose_view(&view);
+    return materialize_view(dest, &transposed);
+}
+
+bool rotate_quarter(Image *dest, Image *src, int turns)
 {
-    int width = (int)(src->width * cos(angle) + src->height * sin(angle));
-    int height = (int)(src->width * sin(angle) + src->height * cos(angle));
-        
-    create_image(dest, src->type, width, height, src->channels);
-    if (!dest->content) {
+    ImageView view = image_view(src);
+    ImageView rotated = rotate_view_quarter(&view, turns);
+    return materialize_view(dest, &rotated);
+}
+
+bool resize(Image *dest, Image *src, int width, int height, INTERP interp)
+{
+    ImageView view = image_view(src);
+    return resize_view(dest, &view, width, height, interp);
+}
+
+bool resize_view(Image *dest, const ImageView *src, int width, int height, INTERP interp)
+{
+    return resize_region_view(dest, src, 0, 0, src->width, src->height, width, height, interp);
+}
+
+bool resize_region_view(Image *dest, const ImageView *src, double x, double y,
+                        double region_width, double region_height, int width, int height, INTERP interp)
+{
+    if (interp == INTERP_NEAREST || interp == INTERP_BILINEAR) {
+        WarpMap map = {
+            .x0 = x,
+            .y0 = y,
+            .dx_col = region_width / width,
+            .dy_row = region_height / height
+        };
+        return warp_image(dest, src, width, height, &map, interp);
+    }
+    create_image(dest, src->type, width, height, src->channels, src->depth);
+    if (!dest->data) {
         perror("Error during image allocation.");
-         return false;
-    }
-        
-    double cx = (double)src->width / 2;
-    double cy = (double)src->height / 2;
-    double dest_cx = width / 2;
-    double dest_cy = height / 2;
-        
-    for (int col = 0; col < width; ++col) {
-        for (int row = 0; row < height; ++row) {
-            double *pixel = pixel_at(dest, col, row);
-            double col_src = (col-dest_cx)*cos(-angle) + (row-dest_cy)*sin(-angle) + cx;
-            double row_src = -(col-dest_cx)*sin(-angle) + (row-dest_cy)*cos(-angle) + cy;
-            switch (interp) {
-                case INTERP_NEAREST: {
-                    nearest_neighbors_interpolation(pixel, src, (int)col_src, (int)row_src);
-                    break;
-                }
-                case INTERP_BILINEAR: {
-                    bilinear_interpolation(pixel, src, col_src, row_src);
-                    break;
-                }
-            }
+        return false;
+    }
+    dest->maxval = src->maxval;
+    ImageView dest_view = image_view(dest);
+    double region[4] = {x, y, region_width, region_height};
+    if (!resample_view(&dest_view, src, 0, src->height, 0, height, region, interp)) {
+        free_image(dest);
+        return false;
+    }
+    return true;
+}
+
+bool resize_band(Image *dest, const ImageView *window, int window_row,
+                 int src_height, int dest_row, int dest_height, INTERP interp)
+{
+    ImageView dest_view = image_view(dest);
+    if (interp != INTERP_NEAREST && interp != INTERP_BILINEAR) {
+        double region[4] = {0, 0, window->width, src_height};
+        return resample_view(&dest_view, window, window_row, src_height, dest_row, dest_height, region, interp);
+    }
+    // rows of the band sample (dest_row + row) * scale, shifted into the window
+    WarpMap map = {
+        .y0 = -window_row,
+        .dx_col = (double)window->width / dest->width,
+        .dy_row = (double)src_height / dest_height,
+        .first_row = dest_row
+    };
+    return warp_view(&dest_view, window, &map, interp);
+}
+
+void resize_source_rows(unsigned int first, unsigned int last, unsigned int src_height,
+                        unsigned int dest_height, INTERP interp,
+                        unsigned int *src_first, unsigned int *src_last)
+{
+    if (interp != INTERP_NEAREST && interp != INTERP_BILINEAR) {
+        ResampleTable *rows = acquire_resample_table(src_height, dest_height, 0, src_height, interp);
+        if (rows) {
+            *src_first = rows->first[first];
+            *src_last = rows->first[last] + rows->taps - 1;
+            release_resample_table(rows);
+            return;
         }
+        // without weights, the whole source is needed
+        *src_first = 0;
+        *src_last = src_height - 1;
+        return;
+    }
+    double scale = (double)src_height / dest_height;
+    *src_first = (unsigned int)(first * scale);
+    // bilinear interpolation reads the row below the sample as well
+    unsigned int bottom = (unsigned int)ceil(last * scale);
+    *src_last = bottom < src_height ? bottom : src_height - 1;
+    if (*src_first > *src_last) {
+        *src_first = *src_last;
+    }
+}
+
+/// @brief Computes the map of a rotation about the centers, and the size holding the whole rotated source
+/// @param map Map from rotated pixels to source coordinates
+/// @param width Width of the rotated image
+/// @param height Height of the rotated image
+/// @param src_width Width of the source
+/// @param src_height Height of the source
+/// @param angle Angle (radians)
+/// @return false if the angle is not finite
+static bool rotation_map(WarpMap *map, int *width, int *height,
+                         unsigned int src_width, unsigned int src_height, double angle)
+{
+    if (!isfinite(angle)) {
+        fprintf(stderr, "Invalid rotation angle %g\n", angle);
+        return false;
     }
+    double cos_a = cos(angle), sin_a = sin(angle);
+    *width = (int)(src_width * fabs(cos_a) + src_height * fabs(sin_a));
+    *height = (int)(src_width * fabs(sin_a) + src_height * fabs(cos_a));
+    double cx = (double)src_width / 2;
+    double cy = (double)src_height / 2;
+    double dest_cx = *width / 2;
+    double dest_cy = *height / 2;
+
+    // inverse rotation about the centers
+    *map = (WarpMap){
+        .x0 = cx - dest_cx * cos_a + dest_cy * sin_a,
+        .y0 = cy - dest_cx * sin_a - dest_cy * cos_a,
+        .dx_col = cos_a, .dy_col = sin_a,
+        .dx_row = -sin_a, .dy_row = cos_a
+    };
     return true;
 }
+
+bool rotate(Image *dest, Image *src, double angle, INTERP interp)
+{
+    // quarter turns only move pixels: no sampling, and the source fits exactly
+    double turns = round(angle / M_PI_2);
+    if (fabs(angle / M_PI_2 - turns) < QUARTER_TURN_TOLERANCE && fabs(turns) < INT_MAX) {
+        return rotate_quarter(dest, src, (int)fmod(turns, 4));
+    }
+    WarpMap map;
+    int width, height;
+    if (!rotation_map(&map, &width, &height, src->width, src->height, angle)) {
+        return false;
+    }
+    ImageView view = image_view(src);
+    return warp_image(dest, &view, width, height, &map, interp);
+}
     
 Matrix create_affine_matrix(double sx, double sy, 
                             double angle, double cx, double cy,
@@ -158,88 +820,530 @@ Matrix create_affine_matrix(double sx, double sy,
 }
 
 /// @brief Warps the corners of an image according to an affine matrix
-/// @param img Image
-/// @param warp_matrix Affine matrix
+/// @param src_width Width of the image
+/// @param src_height Height of the image
+/// @param warp_matrix Affine matrix, applied to (row, col, 1)
 /// @param min_x Resulting minimum x coordinate after warping
 /// @param min_y Resulting minimum y coordinate after warping
 /// @param max_x Resulting maximum x coordinate after warping
 /// @param max_y Resulting maximum y coordinate after warping
-static void warp_corners(Image *img, Matrix *warp_matrix, 
+static void warp_corners(unsigned int src_width, unsigned int src_height, Matrix *warp_matrix, 
                          double *min_x, double *min_y, 
                          double *max_x, double *max_y)
 {
-    Matrix top_left = create_matrix(3, 1, (double[3][1]){{0.0}, {0.0}, {1.0}});
-    Matrix top_right = create_matrix(3, 1, (double[3][1]){{0.0}, {(double)img->width}, {1.0}});
-    Matrix bottom_left = create_matrix(3, 1, (double[3][1]){{(double)img->height}, {0.0}, {1.0}});
-    Matrix bottom_right = create_matrix(3, 1, (double[3][1]){{(double)img->height}, {(double)img->width}, {1.0}});
-
-    Matrix new_top_left = matmul(warp_matrix, &top_left);
-    Matrix new_top_right = matmul(warp_matrix, &top_right);
-    Matrix new_bottom_left = matmul(warp_matrix, &bottom_left);
-    Matrix new_bottom_right = matmul(warp_matrix, &bottom_right);
-
-    *min_x = fmin(matrix_at(&new_top_left, 1, 0), 
-                        fmin(matrix_at(&new_top_right, 1, 0), 
-                             fmin(matrix_at(&new_bottom_left, 1, 0), 
-                                  matrix_at(&new_bottom_right, 1, 0))));
-    *max_x = fmax(matrix_at(&new_top_left, 1, 0), 
-                        fmax(matrix_at(&new_top_right, 1, 0), 
-                             fmax(matrix_at(&new_bottom_left, 1, 0), 
-                                  matrix_at(&new_bottom_right, 1, 0))));
-    *min_y = fmin(matrix_at(&new_top_left, 0, 0), 
-                        fmin(matrix_at(&new_top_right, 0, 0), 
-                             fmin(matrix_at(&new_bottom_left, 0, 0), 
-                                  matrix_at(&new_bottom_right, 0, 0))));
-    *max_y = fmax(matrix_at(&new_top_left, 0, 0), 
-                        fmax(matrix_at(&new_top_right, 0, 0), 
-                             fmax(matrix_at(&new_bottom_left, 0, 0), 
-                                  matrix_at(&new_bottom_right, 0, 0))));
+    const double corners[4][2] = {
+        {0.0, 0.0}, {0.0, src_width}, {src_height, 0.0}, {src_height, src_width}
+    };
+    *min_x = *min_y = INFINITY;
+    *max_x = *max_y = -INFINITY;
+    for (int i = 0; i < 4; ++i) {
+        double row = corners[i][0], col = corners[i][1];
+        double y = matrix_at(warp_matrix, 0, 0) * row + matrix_at(warp_matrix, 0, 1) * col + matrix_at(warp_matrix, 0, 2);
+        double x = matrix_at(warp_matrix, 1, 0) * row + matrix_at(warp_matrix, 1, 1) * col + matrix_at(warp_matrix, 1, 2);
+        *min_x = fmin(*min_x, x);
+        *max_x = fmax(*max_x, x);
+        *min_y = fmin(*min_y, y);
+        *max_y = fmax(*max_y, y);
+    }
 }
 
-bool warp_affine(Image *dest, Image *src, Matrix *warp_matrix, INTERP interp)
+/// @brief Computes the map of an affine warp, and the size holding the whole warped source
+/// @param map Map from warped pixels to source coordinates
+/// @param width Width of the warped image
+/// @param height Height of the warped image
+/// @param src_width Width of the source
+/// @param src_height Height of the source
+/// @param warp_matrix Affine matrix (3x3), applied to (row, col, 1)
+/// @return true if the matrix can be inverted
+static bool affine_map(WarpMap *map, int *width, int *height,
+                       unsigned int src_width, unsigned int src_height, Matrix *warp_matrix)
 {
-    if (warp_matrix->width != warp_matrix->height) {
-        fprintf(stderr, "Affine matrix is not a square matrix: (%dx%d)\n", warp_matrix->height, warp_matrix->width);
+    if (warp_matrix->width != 3 || warp_matrix->height != 3) {
+        fprintf(stderr, "Affine matrix is not a 3x3 matrix: (%dx%d)\n", warp_matrix->height, warp_matrix->width);
         return false;
     }
 
     // get min and max values for size and displacement
     double min_x, min_y, max_x, max_y;
-    warp_corners(src, warp_matrix, &min_x, &min_y, &max_x, &max_y); 
-    int width = (int)ceil(max_x - min_x);
-    int height = (int)ceil(max_y - min_y);
-    create_image(dest, src->type, width, height, src->channels);
-    if (!dest->content) {
-        perror("Error during image allocation.");
+    warp_corners(src_width, src_height, warp_matrix, &min_x, &min_y, &max_x, &max_y); 
+    *width = (int)ceil(max_x - min_x);
+    *height = (int)ceil(max_y - min_y);
+
+    // the inverse matrix maps (row + min_y, col + min_x, 1) to the source (row, col, 1)
+    Matrix inv = inverse(warp_matrix);
+    if (inv.width == 0) {
+        return false;
+    }
+    double m[2][3];
+    for (int i = 0; i < 2; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            m[i][j] = matrix_at(&inv, i, j);
+        }
+    }
+    free_matrix(&inv);
+    *map = (WarpMap){
+        .x0 = m[1][0] * min_y + m[1][1] * min_x + m[1][2],
+        .y0 = m[0][0] * min_y + m[0][1] * min_x + m[0][2],
+        .dx_col = m[1][1], .dy_col = m[0][1],
+        .dx_row = m[1][0], .dy_row = m[0][0]
+    };
+    return true;
+}
+
+bool warp_affine(Image *dest, Image *src, Matrix *warp_matrix, INTERP interp)
+{
+    WarpMap map;
+    int width, height;
+    if (!affine_map(&map, &width, &height, src->width, src->height, warp_matrix)) {
+        return false;
+    }
+    ImageView view = image_view(src);
+    return warp_image(dest, &view, width, height, &map, interp);
+}
+
+bool create_remap_table(RemapTable *table, unsigned int width, unsigned int height, INTERP interp)
+{
+    size_t count = (size_t)width * height;
+    *table = (RemapTable){.width = width, .height = height, .interp = interp};
+    table->map_x = calloc(count ? count : 1, sizeof(float));
+    table->map_y = calloc(count ? count : 1, sizeof(float));
+    if (!table->map_x || !table->map_y) {
+        perror("Error allocating remap table.");
+        free_remap_table(table);
+        return false;
+    }
+    return true;
+}
+
+/// @brief Allocates fixed-point maps
+/// @param table Remap table (uninitialized)
+/// @param width Width of the remapped image
+/// @param height Height of the remapped image
+/// @param interp Interpolation technique
+/// @param src_width Width of the sources to remap
+/// @param src_height Height of the sources to remap
+/// @return true if allocation ok
+static bool create_fixed_remap_table(RemapTable *table, unsigned int width, unsigned int height, INTERP interp,
+                                     unsigned int src_width, unsigned int src_height)
+{
+    *table = (RemapTable){.width = width, .height = height, .interp = interp,
+                          .src_width = src_width, .src_height = src_height};
+    if (src_width > INT16_MAX || src_height > INT16_MAX) {
+        fprintf(stderr, "Sources of %ux%u are too large for fixed-point maps\n", src_width, src_height);
+        return false;
+    }
+    size_t count = (size_t)width * height;
+    table->map_xy = malloc((count ? count : 1) * 2 * sizeof(int16_t));
+    table->map_frac = malloc((count ? count : 1) * sizeof(uint16_t));
+    if (!table->map_xy || !table->map_frac) {
+        perror("Error allocating remap table.");
+        free_remap_table(table);
+        return false;
+    }
+    return true;
+}
+
+/// @brief Packs a source position into fixed-point maps
+/// @param xy Integer coordinates, x = -1 out of the source
+/// @param frac Fractions of the coordinates
+/// @param table Fixed-point remap table
+/// @param x Source x coordinate
+/// @param y Source y coordinate
+static inline void fix_position(int16_t *xy, uint16_t *frac, const RemapTable *table, double x, double y)
+{
+    *frac = 0;
+    if (!warp_inside(table->src_width, table->src_height, x, y, table->interp)) {
+        xy[0] = -1;
+        xy[1] = 0;
+    } else if (table->interp == INTERP_NEAREST) {
+        xy[0] = (int16_t)x;
+        xy[1] = (int16_t)y;
+    } else {
+        // rounded to the closest step: a fraction of one step moves to the next neighbor
+        long fx = lround(x * REMAP_SIZE), fy = lround(y * REMAP_SIZE);
+        xy[0] = (int16_t)(fx >> REMAP_BITS);
+        xy[1] = (int16_t)(fy >> REMAP_BITS);
+        *frac = (uint16_t)((fx & (REMAP_SIZE - 1)) | (fy & (REMAP_SIZE - 1)) << REMAP_BITS);
+    }
+}
+
+bool fix_remap_table(RemapTable *dest, const RemapTable *src, unsigned int src_width, unsigned int src_height)
+{
+    if (!src->map_x) {
+        fprintf(stderr, "Remap table has no float maps to convert\n");
+        return false;
+    }
+    if (!create_fixed_remap_table(dest, src->width, src->height, src->interp, src_width, src_height)) {
         return false;
     }
-        
-    Matrix inv_warp_matrix = inverse(warp_matrix);
-    for (int col = 0; col < width; ++col) {
-        for (int row = 0; row < height; ++row) {
-            double *pixel = pixel_at(dest, col, row);
-            Matrix pos = create_matrix(3, 1, (double[3][1]){
-                {row + min_y},
-                {col + min_x},
-                {1.0}});
-            Matrix new_pos = matmul(&inv_warp_matrix, &pos);
-            double row_src = matrix_at(&new_pos, 0, 0);
-            double col_src = matrix_at(&new_pos, 1, 0);
-
-            switch (interp) {
-                case INTERP_NEAREST: {
-                    nearest_neighbors_interpolation(pixel, src, (int)col_src, (int)row_src);
-                    break;
+    size_t count = (size_t)src->width * src->height;
+    for (size_t i = 0; i < count; ++i) {
+        fix_position(dest->map_xy + 2 * i, dest->map_frac + i, dest, src->map_x[i], src->map_y[i]);
+    }
+    return true;
+}
+
+/// @brief Fills maps from an affine map
+/// @param table Remap table (allocated)
+/// @param map Map from destination pixels to source coordinates
+static void fill_remap_table(RemapTable *table, const WarpMap *map)
+{
+    for (unsigned int row = 0; row < table->height; ++row) {
+        double x_row = ((double)row + map->first_row) * map->dx_row + map->x0;
+        double y_row = ((double)row + map->first_row) * map->dy_row + map->y0;
+        size_t i = (size_t)row * table->width;
+        for (unsigned int col = 0; col < table->width; ++col, ++i) {
+            double x = x_row + col * map->dx_col;
+            double y = y_row + col * map->dy_col;
+            if (table->map_xy) {
+                fix_position(table->map_xy + 2 * i, table->map_frac + i, table, x, y);
+            } else {
+                table->map_x[i] = (float)x;
+                table->map_y[i] = (float)y;
+            }
+        }
+    }
+}
+
+/// @brief Allocates the maps of an affine map and fills them
+/// @param table Remap table (uninitialized)
+/// @param map Map from destination pixels to source coordinates
+/// @param width Width of the remapped image
+/// @param height Height of the remapped image
+/// @param src_width Width of the source
+/// @param src_height Height of the source
+/// @param interp Interpolation technique
+/// @param fixed true for fixed-point maps, false for float maps
+/// @return true if building ok
+static bool build_remap_table(RemapTable *table, const WarpMap *map, int width, int height,
+                              unsigned int src_width, unsigned int src_height, INTERP interp, bool fixed)
+{
+    bool rc = fixed ? create_fixed_remap_table(table, width, height, interp, src_width, src_height)
+                    : create_remap_table(table, width, height, interp);
+    if (rc) {
+        fill_remap_table(table, map);
+    }
+    return rc;
+}
+
+bool rotation_remap_table(RemapTable *table, unsigned int src_width, unsigned int src_height,
+                          double angle, INTERP interp, bool fixed)
+{
+    WarpMap map;
+    int width, height;
+    if (!rotation_map(&map, &width, &height, src_width, src_height, angle)) {
+        return false;
+    }
+    return build_remap_table(table, &map, width, height, src_width, src_height, interp, fixed);
+}
+
+bool affine_remap_table(RemapTable *table, unsigned int src_width, unsigned int src_height,
+                        Matrix *warp_matrix, INTERP interp, bool fixed)
+{
+    WarpMap map;
+    int width, height;
+    if (!affine_map(&map, &width, &height, src_width, src_height, warp_matrix)) {
+        return false;
+    }
+    return build_remap_table(table, &map, width, height, src_width, src_height, interp, fixed);
+}
+
+void free_remap_table(RemapTable *table)
+{
+    free(table->map_x);
+    free(table->map_y);
+    free(table->map_xy);
+    free(table->map_frac);
+    table->map_x = table->map_y = NULL;
+    table->map_xy = NULL;
+    table->map_frac = NULL;
+}
+
+/// @brief State shared by the tasks of a remap
+typedef struct Remap {
+    const ImageView *dest;
+    const ImageView *src;
+    const RemapTable *table;
+    unsigned int rows_per_task;
+    bool failed;            // a task could not allocate its row
+} Remap;
+
+/// @brief Interpolates a row of a remapped image bilinearly
+/// @param out Row of normalized samples
+/// @param src Source view
+/// @param table Remap table
+/// @param row Row
+/// @param depth Depth of the source (constant in callers, for the fetches to be specialized)
+/// @param lut Normalized values of the DEPTH_U8 samples
+static inline void remap_bilinear_row(double *out, const ImageView *src, const RemapTable *table, unsigned int row,
+                                      PIXEL_DEPTH depth, const double *lut)
+{
+    unsigned int channels = src->channels;
+    size_t i = (size_t)row * table->width;
+    for (unsigned int col = 0; col < table->width; ++col, ++i) {
+        double *pixel = out + (size_t)col * channels;
+        if (table->map_xy) {
+            const int16_t *xy = table->map_xy + 2 * i;
+            if (xy[0] < 0) {
+                for (unsigned int c = 0; c < channels; ++c) pixel[c] = 0;
+                continue;
+            }
+            unsigned int frac = table->map_frac[i];
+            double dx = (double)(frac & (REMAP_SIZE - 1)) / REMAP_SIZE;
+            double dy = (double)(frac >> REMAP_BITS) / REMAP_SIZE;
+            bilinear_pixel(pixel, src, xy[0], xy[1], dx, dy, depth, lut);
+            continue;
+        }
+        double x = table->map_x[i], y = table->map_y[i];
+        if (!warp_inside(src->width, src->height, x, y, INTERP_BILINEAR)) {
+            for (unsigned int c = 0; c < channels; ++c) pixel[c] = 0;
+            continue;
+        }
+        int x0 = (int)x, y0 = (int)y;
+        bilinear_pixel(pixel, src, x0, y0, x - x0, y - y0, depth, lut);
+    }
+}
+
+/// @brief Remaps a strip of rows
+/// @param task Index of the strip
+/// @param params Remap (Remap)
+static void remap_rows(unsigned int task, void *params)
+{
+    Remap *remap = params;
+    const ImageView *src = remap->src, *dest = remap->dest;
+    const RemapTable *table = remap->table;
+    unsigned int first = task * remap->rows_per_task;
+    unsigned int last = first + remap->rows_per_task < dest->height ? first + remap->rows_per_task : dest->height;
+
+    if (table->interp == INTERP_NEAREST) {
+        // samples are copied as they are
+        for (unsigned int row = first; row < last; ++row) {
+            unsigned char *line = dest->origin + (ptrdiff_t)row * dest->row_stride;
+            size_t i = (size_t)row * table->width;
+            for (unsigned int col = 0; col < table->width; ++col, ++i) {
+                int x = -1, y = 0;
+                if (table->map_xy) {
+                    x = table->map_xy[2 * i];
+                    y = table->map_xy[2 * i + 1];
+                } else if (warp_inside(src->width, src->height, table->map_x[i], table->map_y[i], INTERP_NEAREST)) {
+                    x = (int)table->map_x[i];
+                    y = (int)table->map_y[i];
                 }
-                case INTERP_BILINEAR: {
-                    bilinear_interpolation(pixel, src, col_src, row_src);
-                    break;
+                if (x >= 0) {
+                    copy_pixel(line + col * dest->col_stride, dest, src, x, y);
+                } else {
+                    zero_pixel(line + col * dest->col_stride, dest);
                 }
             }
-            free_matrix(&pos);
-            free_matrix(&new_pos);
         }
+        return;
+    }
+
+    double *out = malloc((size_t)dest->width * src->channels * sizeof(double));
+    if (!out) {
+        remap->failed = true;
+        return;
+    }
+    double lut[256];
+    if (src->depth == DEPTH_U8) {
+        for (int v = 0; v < 256; ++v) lut[v] = v / (double)src->maxval;
+    }
+    for (unsigned int row = first; row < last; ++row) {
+        if (src->depth == DEPTH_U8) {
+            remap_bilinear_row(out, src, table, row, DEPTH_U8, lut);
+        } else {
+            remap_bilinear_row(out, src, table, row, src->depth, lut);
+        }
+        write_view_row(dest, row, out);
+    }
+    free(out);
+}
+
+bool remap_view(Image *dest, const ImageView *src, const RemapTable *table)
+{
+    if (table->map_xy && (src->width != table->src_width || src->height != table->src_height)) {
+        fprintf(stderr, "Fixed-point maps built for %ux%u sources cannot remap a %ux%u source\n",
+                table->src_width, table->src_height, src->width, src->height);
+        return false;
+    }
+    create_image(dest, src->type, table->width, table->height, src->channels, src->depth);
+    if (!dest->data) {
+        perror("Error during image allocation.");
+        return false;
+    }
+    dest->maxval = src->maxval;
+
+    ImageView dest_view = image_view(dest);
+    Remap remap = {.dest = &dest_view, .src = src, .table = table};
+    unsigned int threads = parallel_threads();
+    remap.rows_per_task = (table->height + 4 * threads - 1) / (4 * threads);
+    if (remap.rows_per_task > 0) {
+        parallel_for((table->height + remap.rows_per_task - 1) / remap.rows_per_task, remap_rows, &remap);
+    }
+    if (remap.failed) {
+        perror("Error allocating remap rows.");
+        free_image(dest);
+        return false;
     }
-    free_matrix(&inv_warp_matrix);
     return true;
 }
+
+bool remap(Image *dest, Image *src, const RemapTable *table)
+{
+    ImageView view = image_view(src);
+    return remap_view(dest, &view, table);
+}
+
+/// @brief Fixed-point maps of an affine map, for a source size
+typedef struct CachedRemap {
+    WarpMap map;                // transform, identifying the maps with the sizes of the table
+    RemapTable table;
+    unsigned int users;         // holders of the maps, the cache being one of them
+    unsigned long last_use;
+} CachedRemap;
+
+static CachedRemap *remap_cache[REMAP_CACHE_ENTRIES];
+static unsigned long remap_clock;
+static pthread_mutex_t remap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/// @brief Size of fixed-point maps, in bytes
+static size_t remap_table_bytes(const RemapTable *table)
+{
+    return (size_t)table->width * table->height * (2 * sizeof(int16_t) + sizeof(uint16_t));
+}
+
+/// @brief Gives back maps, freeing them once neither the cache nor any remap holds them
+/// @param remap Cached maps
+static void release_remap(CachedRemap *remap)
+{
+    pthread_mutex_lock(&remap_lock);
+    bool unused = --remap->users == 0;
+    pthread_mutex_unlock(&remap_lock);
+    if (unused) {
+        free_remap_table(&remap->table);
+        free(remap);
+    }
+}
+
+/// @brief Returns the fixed-point maps of an affine map, from the cache if possible
+/// @note Maps are cached by transform, source size and destination size (least recently used first out)
+/// @param map Map from destination pixels to source coordinates
+/// @param width Width of the remapped image
+/// @param height Height of the remapped image
+/// @param src_width Width of the source
+/// @param src_height Height of the source
+/// @param interp Interpolation technique
+/// @return Maps, to be released, NULL if building failed
+static CachedRemap * acquire_remap(const WarpMap *map, int width, int height,
+                                   unsigned int src_width, unsigned int src_height, INTERP interp)
+{
+    pthread_mutex_lock(&remap_lock);
+    for (unsigned int k = 0; k < REMAP_CACHE_ENTRIES; ++k) {
+        CachedRemap *cached = remap_cache[k];
+        if (cached && cached->table.width == (unsigned int)width && cached->table.height == (unsigned int)height
+            && cached->table.src_width == src_width && cached->table.src_height == src_height
+            && cached->table.interp == interp
+            && cached->map.x0 == map->x0 && cached->map.y0 == map->y0
+            && cached->map.dx_col == map->dx_col && cached->map.dy_col == map->dy_col
+            && cached->map.dx_row == map->dx_row && cached->map.dy_row == map->dy_row) {
+            ++cached->users;
+            cached->last_use = ++remap_clock;
+            pthread_mutex_unlock(&remap_lock);
+            return cached;
+        }
+    }
+    pthread_mutex_unlock(&remap_lock);
+
+    CachedRemap *remap = malloc(sizeof(CachedRemap));
+    if (!remap) {
+        perror("Error allocating remap table.");
+        return NULL;
+    }
+    remap->map = *map;
+    remap->users = 1;
+    if (!build_remap_table(&remap->table, map, width, height, src_width, src_height, interp, true)) {
+        free(remap);
+        return NULL;
+    }
+    size_t bytes = remap_table_bytes(&remap->table);
+    if (bytes > REMAP_CACHE_BYTES) {
+        return remap;
+    }
+
+    // make room by evicting the least recently used maps
+    pthread_mutex_lock(&remap_lock);
+    CachedRemap *evicted[REMAP_CACHE_ENTRIES];
+    unsigned int n_evicted = 0;
+    for (;;) {
+        size_t cached_bytes = 0;
+        int free_slot = -1, oldest = -1;
+        for (unsigned int k = 0; k < REMAP_CACHE_ENTRIES; ++k) {
+            CachedRemap *cached = remap_cache[k];
+            if (!cached) {
+                free_slot = k;
+                continue;
+            }
+            cached_bytes += remap_table_bytes(&cached->table);
+            if (oldest < 0 || cached->last_use < remap_cache[oldest]->last_use) {
+                oldest = k;
+            }
+        }
+        if (free_slot >= 0 && cached_bytes + bytes <= REMAP_CACHE_BYTES) {
+            remap->users++;
+            remap->last_use = ++remap_clock;
+            remap_cache[free_slot] = remap;
+            break;
+        }
+        CachedRemap *victim = remap_cache[oldest];
+        remap_cache[oldest] = NULL;
+        if (--victim->users == 0) {
+            evicted[n_evicted++] = victim;
+        }
+    }
+    pthread_mutex_unlock(&remap_lock);
+    for (unsigned int k = 0; k < n_evicted; ++k) {
+        free_remap_table(&evicted[k]->table);
+        free(evicted[k]);
+    }
+    return remap;
+}
+
+/// @brief Warps an image through the cached fixed-point maps of an affine map
+/// @param dest Warped image (uninitialized)
+/// @param src Source image
+/// @param map Map from destination pixels to source coordinates
+/// @param width Width of the warped image
+/// @param height Height of the warped image
+/// @param interp Interpolation technique
+/// @return true if warp ok
+static bool remap_cached(Image *dest, Image *src, const WarpMap *map, int width, int height, INTERP interp)
+{
+    CachedRemap *remap = acquire_remap(map, width, height, src->width, src->height, interp);
+    if (!remap) {
+        return false;
+    }
+    ImageView view = image_view(src);
+    bool rc = remap_view(dest, &view, &remap->table);
+    release_remap(remap);
+    return rc;
+}
+
+bool rotate_remap(Image *dest, Image *src, double angle, INTERP interp)
+{
+    WarpMap map;
+    int width, height;
+    if (!rotation_map(&map, &width, &height, src->width, src->height, angle)) {
+        return false;
+    }
+    return remap_cached(dest, src, &map, width, height, interp);
+}
+
+bool warp_affine_remap(Image *dest, Image *src, Matrix *warp_matrix, INTERP interp)
+{
+    WarpMap map;
+    int width, height;
+    if (!affine_map(&map, &width, &height, src->width, src->height, warp_matrix)) {
+        return false;
+    }
+    return remap_cached(dest, src, &map, width, height, interp);
+}
@@ -0,0 +1,49 @@
+#include "utils/cpu.h"
+
+// Features are queried at runtime so that a single binary runs everywhere,
+// kernels compiled for an extension only being called when it is present.
+#if defined(__x86_64__) || defined(__i386__)
+
+bool cpu_has_sse2(void)
+{
+    return __builtin_cpu_supports("sse2");
+}
+
+bool cpu_has_ssse3(void)
+{
+    return __builtin_cpu_supports("ssse3");
+}
+
+bool cpu_has_avx2(void)
+{
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}
+
+bool cpu_has_avx512f(void)
+{
+    return __builtin_cpu_supports("avx512f");
+}
+
+#else
+
+bool cpu_has_sse2(void)
+{
+    return false;
+}
+
+bool cpu_has_ssse3(void)
+{
+    return false;
+}
+
+bool cpu_has_avx2(void)
+{
+    return false;
+}
+
+bool cpu_has_avx512f(void)
+{
+    return false;
+}
+
+#endif
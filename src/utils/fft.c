@@ -0,0 +1,173 @@
+#include "utils/fft.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+unsigned int fft_size(unsigned int n)
+{
+    for (unsigned int size = n > 1 ? n : 1;; ++size) {
+        unsigned int m = size;
+        while (m % 2 == 0) m /= 2;
+        while (m % 3 == 0) m /= 3;
+        while (m % 5 == 0) m /= 5;
+        if (m == 1) return size;
+    }
+}
+
+bool fft_plan(FftPlan *plan, unsigned int size)
+{
+    plan->size = size;
+    plan->n_factors = 0;
+    plan->twiddles = NULL;
+    if (size == 0) {
+        fprintf(stderr, "Invalid transform size 0\n");
+        return false;
+    }
+
+    // radix 4 first (fewest stages), then the remaining primes
+    unsigned int m = size;
+    while (m % 4 == 0) {
+        plan->factors[plan->n_factors++] = 4;
+        m /= 4;
+    }
+    for (unsigned int p = 2; m > 1; ++p) {
+        while (m % p == 0) {
+            plan->factors[plan->n_factors++] = p;
+            m /= p;
+        }
+    }
+
+    // stage of length n and radix p: w[q * p + t] = exp(-2 i pi q t / n), q < n / p
+    size_t total = 0;
+    for (unsigned int f = 0, n = size; f < plan->n_factors; n /= plan->factors[f++]) {
+        total += n;
+    }
+    plan->twiddles = malloc((total ? total : 1) * sizeof(double complex));
+    if (!plan->twiddles) {
+        perror("Error allocating transform plan.");
+        return false;
+    }
+    double complex *w = plan->twiddles;
+    for (unsigned int f = 0, n = size; f < plan->n_factors; n /= plan->factors[f++]) {
+        unsigned int p = plan->factors[f];
+        for (unsigned int q = 0; q < n / p; ++q) {
+            for (unsigned int t = 0; t < p; ++t) {
+                double angle = -2 * M_PI * (double)((size_t)q * t % n) / n;
+                *w++ = cos(angle) + I * sin(angle);
+            }
+        }
+    }
+    return true;
+}
+
+void free_fft_plan(FftPlan *plan)
+{
+    free(plan->twiddles);
+    plan->twiddles = NULL;
+}
+
+/// @brief Computes the transform of p values, in place
+/// @param a Values
+/// @param p Radix
+static void butterfly(double complex *a, unsigned int p)
+{
+    switch (p) {
+    case 2: {
+        double complex t = a[1];
+        a[1] = a[0] - t;
+        a[0] = a[0] + t;
+        break;
+    }
+    case 3: {
+        const double s = 0.86602540378443864676; // sin(2 pi / 3)
+        double complex t1 = a[1] + a[2];
+        double complex m1 = a[0] - 0.5 * t1;
+        double complex m2 = -I * s * (a[1] - a[2]);
+        a[0] = a[0] + t1;
+        a[1] = m1 + m2;
+        a[2] = m1 - m2;
+        break;
+    }
+    case 4: {
+        double complex t0 = a[0] + a[2], t1 = a[0] - a[2];
+        double complex t2 = a[1] + a[3], t3 = -I * (a[1] - a[3]);
+        a[0] = t0 + t2;
+        a[1] = t1 + t3;
+        a[2] = t0 - t2;
+        a[3] = t1 - t3;
+        break;
+    }
+    case 5: {
+        const double c1 = 0.30901699437494742410, c2 = -0.80901699437494742410; // cos(2 pi / 5), cos(4 pi / 5)
+        const double s1 = 0.95105651629515357212, s2 = 0.58778525229247312917; // sin(2 pi / 5), sin(4 pi / 5)
+        double complex t1 = a[1] + a[4], t2 = a[2] + a[3];
+        double complex t3 = a[1] - a[4], t4 = a[2] - a[3];
+        double complex m1 = a[0] + c1 * t1 + c2 * t2, m2 = a[0] + c2 * t1 + c1 * t2;
+        double complex n1 = -I * (s1 * t3 + s2 * t4), n2 = -I * (s2 * t3 - s1 * t4);
+        a[0] = a[0] + t1 + t2;
+        a[1] = m1 + n1;
+        a[4] = m1 - n1;
+        a[2] = m2 + n2;
+        a[3] = m2 - n2;
+        break;
+    }
+    default: {
+        // any other prime: direct transform
+        double complex b[p];
+        for (unsigned int t = 0; t < p; ++t) {
+            b[t] = 0;
+            for (unsigned int k = 0; k < p; ++k) {
+                double angle = -2 * M_PI * (double)((t * k) % p) / p;
+                b[t] += a[k] * (cos(angle) + I * sin(angle));
+            }
+        }
+        memcpy(a, b, p * sizeof(double complex));
+        break;
+    }
+    }
+}
+
+void fft(const FftPlan *plan, double complex *data, double complex *work, bool inverse)
+{
+    unsigned int size = plan->size;
+    // the inverse transform is the conjugate of the transform of the conjugate
+    if (inverse) {
+        for (unsigned int k = 0; k < size; ++k) data[k] = conj(data[k]);
+    }
+
+    // decimation in frequency: a stage of length n splits x into p interleaved
+    // sequences of length m = n / p, s being the number of sequences already split
+    double complex *x = data, *y = work;
+    const double complex *w = plan->twiddles;
+    unsigned int n = size, s = 1;
+    for (unsigned int f = 0; f < plan->n_factors; ++f) {
+        unsigned int p = plan->factors[f], m = n / p;
+        double complex a[p];
+        for (unsigned int q = 0; q < m; ++q) {
+            const double complex *wq = w + (size_t)q * p;
+            for (unsigned int r = 0; r < s; ++r) {
+                for (unsigned int k = 0; k < p; ++k) {
+                    a[k] = x[r + (size_t)s * (q + (size_t)m * k)];
+                }
+                butterfly(a, p);
+                for (unsigned int t = 0; t < p; ++t) {
+                    y[r + (size_t)s * ((size_t)p * q + t)] = a[t] * wq[t];
+                }
+            }
+        }
+        w += n;
+        n = m;
+        s *= p;
+        double complex *swap = x;
+        x = y;
+        y = swap;
+    }
+    if (x != data) {
+        memcpy(data, x, size * sizeof(double complex));
+    }
+
+    if (inverse) {
+        for (unsigned int k = 0; k < size; ++k) data[k] = conj(data[k]);
+    }
+}
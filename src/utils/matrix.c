@@ -102,6 +102,7 @@ double determinant(Matrix *mat)
         for (int i = 0; i < mat->height; ++i) {
             Matrix submat = submatrix(mat, i, 0);
             det_value += pow(-1, i) * matrix_at(mat, i, 0) * determinant(&submat);
+            free_matrix(&submat);
         }
     }
     return det_value;
@@ -114,6 +115,7 @@ Matrix comatrix(Matrix *mat)
         for (int j = 0; j < mat->height; ++j) {
             Matrix submat = submatrix(mat, i, j);
             set_matrix_at(&comat, i, j, pow(-1, i+j) * determinant(&submat));
+            free_matrix(&submat);
         }
     }
     return comat;
@@ -151,6 +153,8 @@ Matrix inverse(Matrix *mat)
             set_matrix_at(&inverse, i, j, matrix_at(&t_comat, i, j) / det);
         }
     }
+    free_matrix(&comat);
+    free_matrix(&t_comat);
     return inverse;
 }
 
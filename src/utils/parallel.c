@@ -0,0 +1,50 @@
+#include "utils/parallel.h"
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+
+/// @brief Shared state of a parallel loop
+typedef struct ParallelLoop {
+    atomic_uint next; // next task to hand out
+    unsigned int count;
+    parallel_fct fct;
+    void *params;
+} ParallelLoop;
+
+/// @brief Runs tasks until none is left
+/// @param arg Parallel loop
+/// @return NULL
+static void * run_tasks(void *arg)
+{
+    ParallelLoop *loop = arg;
+    for (unsigned int task = atomic_fetch_add(&loop->next, 1); task < loop->count;
+         task = atomic_fetch_add(&loop->next, 1)) {
+        loop->fct(task, loop->params);
+    }
+    return NULL;
+}
+
+unsigned int parallel_threads(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned int)n : 1;
+}
+
+void parallel_for(unsigned int count, parallel_fct fct, void *params)
+{
+    ParallelLoop loop = {.count = count, .fct = fct, .params = params};
+    atomic_init(&loop.next, 0);
+
+    unsigned int threads = parallel_threads();
+    if (threads > count) threads = count;
+    pthread_t workers[threads > 1 ? threads - 1 : 1];
+    unsigned int started = 0;
+    while (started + 1 < threads && pthread_create(&workers[started], NULL, run_tasks, &loop) == 0) {
+        ++started;
+    }
+    // the calling thread takes its share (all of it if no thread could start)
+    run_tasks(&loop);
+    for (unsigned int i = 0; i < started; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+}
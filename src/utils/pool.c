@@ -0,0 +1,193 @@
+#include "utils/pool.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+
+// Size classes: four steps per power of two, from 4 KiB to 2 GiB. Bigger
+// buffers are not cached. Every buffer is preceded by a 64 bytes header, so
+// that the returned pointer keeps the 64 bytes alignment.
+#define POOL_ALIGNMENT 64
+#define POOL_MIN_SHIFT 12
+#define POOL_MAX_SHIFT 31
+#define POOL_STEPS 4
+#define POOL_CLASSES ((POOL_MAX_SHIFT - POOL_MIN_SHIFT) * POOL_STEPS + 1)
+#define POOL_MAX_CACHED ((size_t)256 << 20)
+
+struct PoolBlock {
+    PoolBlock *next;  // free list, or arena list while allocated
+    PoolBlock *prev;  // arena list
+    PoolArena *arena; // owning arena, if any
+    size_t size;      // usable size
+    int size_class;   // -1 if not cached
+};
+_Static_assert(sizeof(PoolBlock) <= POOL_ALIGNMENT, "pool header must fit the alignment");
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static PoolBlock *free_lists[POOL_CLASSES];
+static PoolStats stats;
+static _Thread_local PoolArena *current_arena = NULL;
+
+/// @brief Finds the size class of a request
+/// @param size Requested size
+/// @param class_size Size actually allocated for the class
+/// @return Class index, -1 if too big to be cached
+static int size_class(size_t size, size_t *class_size)
+{
+    if (size <= (size_t)1 << POOL_MIN_SHIFT) {
+        *class_size = (size_t)1 << POOL_MIN_SHIFT;
+        return 0;
+    }
+    int shift = 63 - __builtin_clzll((unsigned long long)(size - 1));
+    if (shift >= POOL_MAX_SHIFT) {
+        *class_size = (size + POOL_ALIGNMENT - 1) / POOL_ALIGNMENT * POOL_ALIGNMENT;
+        return -1;
+    }
+    size_t base = (size_t)1 << shift;
+    size_t step = base / POOL_STEPS;
+    size_t q = (size - base + step - 1) / step;
+    *class_size = base + q * step;
+    return (shift - POOL_MIN_SHIFT) * POOL_STEPS + (int)q;
+}
+
+static inline PoolBlock * block_of(void *ptr)
+{
+    return (PoolBlock *)((unsigned char *)ptr - POOL_ALIGNMENT);
+}
+
+static inline void * data_of(PoolBlock *block)
+{
+    return (unsigned char *)block + POOL_ALIGNMENT;
+}
+
+/// @brief Removes an allocated block from its arena (pool mutex held)
+static void unlink_block(PoolBlock *block)
+{
+    if (!block->arena) return;
+    if (block->prev) block->prev->next = block->next;
+    else block->arena->blocks = block->next;
+    if (block->next) block->next->prev = block->prev;
+    block->arena = NULL;
+    block->next = block->prev = NULL;
+}
+
+/// @brief Caches or releases a block which is no longer in use (pool mutex held)
+static void release_block(PoolBlock *block)
+{
+    stats.bytes_in_use -= block->size;
+    if (block->size_class >= 0 && stats.bytes_cached + block->size <= POOL_MAX_CACHED) {
+        block->next = free_lists[block->size_class];
+        free_lists[block->size_class] = block;
+        stats.bytes_cached += block->size;
+    } else {
+        free(block);
+    }
+}
+
+void * pool_alloc(size_t size)
+{
+    size_t class_size;
+    int cls = size_class(size, &class_size);
+
+    pthread_mutex_lock(&pool_mutex);
+    ++stats.allocations;
+    PoolBlock *block = NULL;
+    if (cls >= 0 && free_lists[cls]) {
+        block = free_lists[cls];
+        free_lists[cls] = block->next;
+        stats.bytes_cached -= block->size;
+        ++stats.hits;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+
+    if (!block) {
+        block = aligned_alloc(POOL_ALIGNMENT, POOL_ALIGNMENT + class_size);
+        if (!block) {
+            perror("Error allocating pool buffer");
+            return NULL;
+        }
+        block->size = class_size;
+        block->size_class = cls;
+    }
+
+    pthread_mutex_lock(&pool_mutex);
+    stats.bytes_in_use += block->size;
+    if (stats.bytes_in_use > stats.peak_bytes) {
+        stats.peak_bytes = stats.bytes_in_use;
+    }
+    block->arena = current_arena;
+    block->prev = NULL;
+    block->next = NULL;
+    if (current_arena) {
+        block->next = current_arena->blocks;
+        if (block->next) block->next->prev = block;
+        current_arena->blocks = block;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return data_of(block);
+}
+
+void pool_free(void *ptr)
+{
+    if (!ptr) return;
+    PoolBlock *block = block_of(ptr);
+    pthread_mutex_lock(&pool_mutex);
+    unlink_block(block);
+    release_block(block);
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+void pool_arena_begin(PoolArena *arena)
+{
+    arena->blocks = NULL;
+    arena->parent = current_arena;
+    current_arena = arena;
+}
+
+void pool_arena_end(PoolArena *arena)
+{
+    pthread_mutex_lock(&pool_mutex);
+    PoolBlock *block = arena->blocks;
+    while (block) {
+        PoolBlock *next = block->next;
+        block->arena = NULL;
+        release_block(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+    pthread_mutex_unlock(&pool_mutex);
+    if (current_arena == arena) {
+        current_arena = arena->parent;
+    }
+}
+
+void pool_persist(void *ptr)
+{
+    if (!ptr) return;
+    pthread_mutex_lock(&pool_mutex);
+    unlink_block(block_of(ptr));
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+void pool_trim(void)
+{
+    pthread_mutex_lock(&pool_mutex);
+    for (int cls = 0; cls < POOL_CLASSES; ++cls) {
+        while (free_lists[cls]) {
+            PoolBlock *block = free_lists[cls];
+            free_lists[cls] = block->next;
+            stats.bytes_cached -= block->size;
+            free(block);
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+}
+
+void pool_stats(PoolStats *result)
+{
+    pthread_mutex_lock(&pool_mutex);
+    *result = stats;
+    pthread_mutex_unlock(&pool_mutex);
+    result->hit_rate = result->allocations ? (double)result->hits / result->allocations : 0;
+}
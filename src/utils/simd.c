@@ -0,0 +1,290 @@
+#include "utils/simd.h"
+#include "utils/cpu.h"
+#include <math.h>
+#include <float.h>
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Rational approximation of atan over [-0.66, 0.66] (Cephes): atan(t) = t + t z P(z) / Q(z), z = t^2
+#define ATAN_P0 -8.750608600031904122785e-1
+#define ATAN_P1 -1.615753718733365076637e1
+#define ATAN_P2 -7.500855792314704667340e1
+#define ATAN_P3 -1.228866684490136173410e2
+#define ATAN_P4 -6.485021904942025371773e1
+#define ATAN_Q0 2.485846490142306297962e1
+#define ATAN_Q1 1.650270098316988542046e2
+#define ATAN_Q2 4.328810604912902668951e2
+#define ATAN_Q3 4.853903996359136964868e2
+#define ATAN_Q4 1.945506571482613964425e2
+// Beyond it, atan(t) = pi/4 + atan((t - 1) / (t + 1))
+#define ATAN_REDUCTION 0.66
+
+/// @brief Weighted sum, portable version
+static void weighted_sum_scalar(double *out, const double *const *terms, const double *weights,
+                                unsigned int n_terms, size_t count)
+{
+    for (size_t k = 0; k < count; ++k) {
+        double sum = 0;
+        for (unsigned int t = 0; t < n_terms; ++t) {
+            sum += weights[t] * terms[t][k];
+        }
+        out[k] = sum;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static void weighted_sum_sse2(double *out, const double *const *terms, const double *weights,
+                              unsigned int n_terms, size_t count)
+{
+    size_t k = 0;
+    // four registers per term hide the latency of the additions
+    for (; k + 8 <= count; k += 8) {
+        __m128d a0 = _mm_setzero_pd(), a1 = _mm_setzero_pd(), a2 = _mm_setzero_pd(), a3 = _mm_setzero_pd();
+        for (unsigned int t = 0; t < n_terms; ++t) {
+            __m128d w = _mm_set1_pd(weights[t]);
+            const double *p = terms[t] + k;
+            a0 = _mm_add_pd(a0, _mm_mul_pd(w, _mm_loadu_pd(p)));
+            a1 = _mm_add_pd(a1, _mm_mul_pd(w, _mm_loadu_pd(p + 2)));
+            a2 = _mm_add_pd(a2, _mm_mul_pd(w, _mm_loadu_pd(p + 4)));
+            a3 = _mm_add_pd(a3, _mm_mul_pd(w, _mm_loadu_pd(p + 6)));
+        }
+        _mm_storeu_pd(out + k, a0);
+        _mm_storeu_pd(out + k + 2, a1);
+        _mm_storeu_pd(out + k + 4, a2);
+        _mm_storeu_pd(out + k + 6, a3);
+    }
+    for (; k + 2 <= count; k += 2) {
+        __m128d a = _mm_setzero_pd();
+        for (unsigned int t = 0; t < n_terms; ++t) {
+            a = _mm_add_pd(a, _mm_mul_pd(_mm_set1_pd(weights[t]), _mm_loadu_pd(terms[t] + k)));
+        }
+        _mm_storeu_pd(out + k, a);
+    }
+    if (k < count) {
+        double sum = 0;
+        for (unsigned int t = 0; t < n_terms; ++t) {
+            sum += weights[t] * terms[t][k];
+        }
+        out[k] = sum;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void weighted_sum_avx2(double *out, const double *const *terms, const double *weights,
+                              unsigned int n_terms, size_t count)
+{
+    size_t k = 0;
+    for (; k + 16 <= count; k += 16) {
+        __m256d a0 = _mm256_setzero_pd(), a1 = _mm256_setzero_pd();
+        __m256d a2 = _mm256_setzero_pd(), a3 = _mm256_setzero_pd();
+        for (unsigned int t = 0; t < n_terms; ++t) {
+            __m256d w = _mm256_broadcast_sd(weights + t);
+            const double *p = terms[t] + k;
+            a0 = _mm256_fmadd_pd(w, _mm256_loadu_pd(p), a0);
+            a1 = _mm256_fmadd_pd(w, _mm256_loadu_pd(p + 4), a1);
+            a2 = _mm256_fmadd_pd(w, _mm256_loadu_pd(p + 8), a2);
+            a3 = _mm256_fmadd_pd(w, _mm256_loadu_pd(p + 12), a3);
+        }
+        _mm256_storeu_pd(out + k, a0);
+        _mm256_storeu_pd(out + k + 4, a1);
+        _mm256_storeu_pd(out + k + 8, a2);
+        _mm256_storeu_pd(out + k + 12, a3);
+    }
+    for (; k + 4 <= count; k += 4) {
+        __m256d a = _mm256_setzero_pd();
+        for (unsigned int t = 0; t < n_terms; ++t) {
+            a = _mm256_fmadd_pd(_mm256_broadcast_sd(weights + t), _mm256_loadu_pd(terms[t] + k), a);
+        }
+        _mm256_storeu_pd(out + k, a);
+    }
+    for (; k < count; ++k) {
+        double sum = 0;
+        for (unsigned int t = 0; t < n_terms; ++t) {
+            sum += weights[t] * terms[t][k];
+        }
+        out[k] = sum;
+    }
+}
+
+__attribute__((target("avx512f")))
+static void weighted_sum_avx512(double *out, const double *const *terms, const double *weights,
+                                unsigned int n_terms, size_t count)
+{
+    size_t k = 0;
+    for (; k + 32 <= count; k += 32) {
+        __m512d a0 = _mm512_setzero_pd(), a1 = _mm512_setzero_pd();
+        __m512d a2 = _mm512_setzero_pd(), a3 = _mm512_setzero_pd();
+        for (unsigned int t = 0; t < n_terms; ++t) {
+            __m512d w = _mm512_set1_pd(weights[t]);
+            const double *p = terms[t] + k;
+            a0 = _mm512_fmadd_pd(w, _mm512_loadu_pd(p), a0);
+            a1 = _mm512_fmadd_pd(w, _mm512_loadu_pd(p + 8), a1);
+            a2 = _mm512_fmadd_pd(w, _mm512_loadu_pd(p + 16), a2);
+            a3 = _mm512_fmadd_pd(w, _mm512_loadu_pd(p + 24), a3);
+        }
+        _mm512_storeu_pd(out + k, a0);
+        _mm512_storeu_pd(out + k + 8, a1);
+        _mm512_storeu_pd(out + k + 16, a2);
+        _mm512_storeu_pd(out + k + 24, a3);
+    }
+    // the last values use masked loads and stores, never reading past the sequences
+    for (; k < count; k += 8) {
+        __mmask8 mask = count - k >= 8 ? 0xff : (__mmask8)((1u << (count - k)) - 1);
+        __m512d a = _mm512_setzero_pd();
+        for (unsigned int t = 0; t < n_terms; ++t) {
+            a = _mm512_fmadd_pd(_mm512_set1_pd(weights[t]), _mm512_maskz_loadu_pd(mask, terms[t] + k), a);
+        }
+        _mm512_mask_storeu_pd(out + k, mask, a);
+    }
+}
+#endif
+
+void weighted_sum(double *out, const double *const *terms, const double *weights,
+                  unsigned int n_terms, size_t count)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (cpu_has_avx512f()) {
+        weighted_sum_avx512(out, terms, weights, n_terms, count);
+    } else if (cpu_has_avx2()) {
+        weighted_sum_avx2(out, terms, weights, n_terms, count);
+    } else if (cpu_has_sse2()) {
+        weighted_sum_sse2(out, terms, weights, n_terms, count);
+    } else {
+        weighted_sum_scalar(out, terms, weights, n_terms, count);
+    }
+#else
+    weighted_sum_scalar(out, terms, weights, n_terms, count);
+#endif
+}
+
+/// @brief atan2, portable version of the vector approximation
+/// @note The ratio of the smaller to the larger coordinate, in [0, 1], gives the angle
+/// in the first octant, then mirrored into the octant of (x, y)
+static double rational_atan2(double y, double x)
+{
+    double ax = fabs(x), ay = fabs(y);
+    double t = (ax < ay ? ax : ay) / fmax(fmax(ax, ay), DBL_MIN);
+    double base = 0;
+    if (t > ATAN_REDUCTION) {
+        base = M_PI_4;
+        t = (t - 1) / (t + 1);
+    }
+    double z = t * t;
+    double p = (((ATAN_P0 * z + ATAN_P1) * z + ATAN_P2) * z + ATAN_P3) * z + ATAN_P4;
+    double q = ((((z + ATAN_Q0) * z + ATAN_Q1) * z + ATAN_Q2) * z + ATAN_Q3) * z + ATAN_Q4;
+    double a = base + t + t * z * p / q;
+    if (ay > ax) a = M_PI_2 - a;
+    if (x < 0) a = M_PI - a;
+    return copysign(a, y);
+}
+
+/// @brief Polar coordinates, portable version
+static void polar_coordinates_scalar(double *magnitude, double *angle, const double *x, const double *y, size_t count)
+{
+    for (size_t k = 0; k < count; ++k) {
+        if (magnitude) magnitude[k] = sqrt(x[k] * x[k] + y[k] * y[k]);
+        if (angle) angle[k] = rational_atan2(y[k], x[k]);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2,fma")))
+static inline __m256d atan2_avx2(__m256d y, __m256d x)
+{
+    const __m256d sign = _mm256_set1_pd(-0.0), one = _mm256_set1_pd(1);
+    __m256d ax = _mm256_andnot_pd(sign, x), ay = _mm256_andnot_pd(sign, y);
+    __m256d t = _mm256_div_pd(_mm256_min_pd(ax, ay), _mm256_max_pd(_mm256_max_pd(ax, ay), _mm256_set1_pd(DBL_MIN)));
+    __m256d reduced = _mm256_cmp_pd(t, _mm256_set1_pd(ATAN_REDUCTION), _CMP_GT_OQ);
+    t = _mm256_blendv_pd(t, _mm256_div_pd(_mm256_sub_pd(t, one), _mm256_add_pd(t, one)), reduced);
+    __m256d base = _mm256_and_pd(reduced, _mm256_set1_pd(M_PI_4));
+    __m256d z = _mm256_mul_pd(t, t);
+    __m256d p = _mm256_fmadd_pd(_mm256_set1_pd(ATAN_P0), z, _mm256_set1_pd(ATAN_P1));
+    p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(ATAN_P2));
+    p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(ATAN_P3));
+    p = _mm256_fmadd_pd(p, z, _mm256_set1_pd(ATAN_P4));
+    __m256d q = _mm256_add_pd(z, _mm256_set1_pd(ATAN_Q0));
+    q = _mm256_fmadd_pd(q, z, _mm256_set1_pd(ATAN_Q1));
+    q = _mm256_fmadd_pd(q, z, _mm256_set1_pd(ATAN_Q2));
+    q = _mm256_fmadd_pd(q, z, _mm256_set1_pd(ATAN_Q3));
+    q = _mm256_fmadd_pd(q, z, _mm256_set1_pd(ATAN_Q4));
+    __m256d a = _mm256_add_pd(base, _mm256_fmadd_pd(_mm256_mul_pd(t, z), _mm256_div_pd(p, q), t));
+    a = _mm256_blendv_pd(a, _mm256_sub_pd(_mm256_set1_pd(M_PI_2), a), _mm256_cmp_pd(ay, ax, _CMP_GT_OQ));
+    a = _mm256_blendv_pd(a, _mm256_sub_pd(_mm256_set1_pd(M_PI), a), _mm256_cmp_pd(x, _mm256_setzero_pd(), _CMP_LT_OQ));
+    return _mm256_or_pd(a, _mm256_and_pd(sign, y));
+}
+
+__attribute__((target("avx2,fma")))
+static void polar_coordinates_avx2(double *magnitude, double *angle, const double *x, const double *y, size_t count)
+{
+    size_t k = 0;
+    for (; k + 4 <= count; k += 4) {
+        __m256d vx = _mm256_loadu_pd(x + k), vy = _mm256_loadu_pd(y + k);
+        if (magnitude) {
+            _mm256_storeu_pd(magnitude + k, _mm256_sqrt_pd(_mm256_fmadd_pd(vx, vx, _mm256_mul_pd(vy, vy))));
+        }
+        if (angle) {
+            _mm256_storeu_pd(angle + k, atan2_avx2(vy, vx));
+        }
+    }
+    polar_coordinates_scalar(magnitude ? magnitude + k : NULL, angle ? angle + k : NULL, x + k, y + k, count - k);
+}
+
+__attribute__((target("avx512f")))
+static inline __m512d atan2_avx512(__m512d y, __m512d x)
+{
+    const __m512d one = _mm512_set1_pd(1);
+    __m512d ax = _mm512_abs_pd(x), ay = _mm512_abs_pd(y);
+    __m512d t = _mm512_div_pd(_mm512_min_pd(ax, ay), _mm512_max_pd(_mm512_max_pd(ax, ay), _mm512_set1_pd(DBL_MIN)));
+    __mmask8 reduced = _mm512_cmp_pd_mask(t, _mm512_set1_pd(ATAN_REDUCTION), _CMP_GT_OQ);
+    t = _mm512_mask_div_pd(t, reduced, _mm512_sub_pd(t, one), _mm512_add_pd(t, one));
+    __m512d base = _mm512_maskz_mov_pd(reduced, _mm512_set1_pd(M_PI_4));
+    __m512d z = _mm512_mul_pd(t, t);
+    __m512d p = _mm512_fmadd_pd(_mm512_set1_pd(ATAN_P0), z, _mm512_set1_pd(ATAN_P1));
+    p = _mm512_fmadd_pd(p, z, _mm512_set1_pd(ATAN_P2));
+    p = _mm512_fmadd_pd(p, z, _mm512_set1_pd(ATAN_P3));
+    p = _mm512_fmadd_pd(p, z, _mm512_set1_pd(ATAN_P4));
+    __m512d q = _mm512_add_pd(z, _mm512_set1_pd(ATAN_Q0));
+    q = _mm512_fmadd_pd(q, z, _mm512_set1_pd(ATAN_Q1));
+    q = _mm512_fmadd_pd(q, z, _mm512_set1_pd(ATAN_Q2));
+    q = _mm512_fmadd_pd(q, z, _mm512_set1_pd(ATAN_Q3));
+    q = _mm512_fmadd_pd(q, z, _mm512_set1_pd(ATAN_Q4));
+    __m512d a = _mm512_add_pd(base, _mm512_fmadd_pd(_mm512_mul_pd(t, z), _mm512_div_pd(p, q), t));
+    a = _mm512_mask_sub_pd(a, _mm512_cmp_pd_mask(ay, ax, _CMP_GT_OQ), _mm512_set1_pd(M_PI_2), a);
+    a = _mm512_mask_sub_pd(a, _mm512_cmp_pd_mask(x, _mm512_setzero_pd(), _CMP_LT_OQ), _mm512_set1_pd(M_PI), a);
+    __m512i sign = _mm512_and_si512(_mm512_castpd_si512(y), _mm512_set1_epi64(INT64_MIN));
+    return _mm512_castsi512_pd(_mm512_or_si512(_mm512_castpd_si512(a), sign));
+}
+
+__attribute__((target("avx512f")))
+static void polar_coordinates_avx512(double *magnitude, double *angle, const double *x, const double *y, size_t count)
+{
+    for (size_t k = 0; k < count; k += 8) {
+        __mmask8 mask = count - k >= 8 ? 0xff : (__mmask8)((1u << (count - k)) - 1);
+        __m512d vx = _mm512_maskz_loadu_pd(mask, x + k), vy = _mm512_maskz_loadu_pd(mask, y + k);
+        if (magnitude) {
+            _mm512_mask_storeu_pd(magnitude + k, mask, _mm512_sqrt_pd(_mm512_fmadd_pd(vx, vx, _mm512_mul_pd(vy, vy))));
+        }
+        if (angle) {
+            _mm512_mask_storeu_pd(angle + k, mask, atan2_avx512(vy, vx));
+        }
+    }
+}
+#endif
+
+void polar_coordinates(double *magnitude, double *angle, const double *x, const double *y, size_t count)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (cpu_has_avx512f()) {
+        polar_coordinates_avx512(magnitude, angle, x, y, count);
+    } else if (cpu_has_avx2()) {
+        polar_coordinates_avx2(magnitude, angle, x, y, count);
+    } else {
+        polar_coordinates_scalar(magnitude, angle, x, y, count);
+    }
+#else
+    polar_coordinates_scalar(magnitude, angle, x, y, count);
+#endif
+}